@@ -17,6 +17,7 @@
 #define kBROTLI_QUALITY_LEVEL_DEFAULT   (kBROTLI_QUALITY_LEVELS / 2)
 
 static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel level);
+static uint32_t NOZXBrotliWindowBits(void);
 
 @interface NOZXBrotliEncoderContext : NSObject <NOZEncoderContext>
 @property (nonatomic, readonly) BOOL encodedDataWasText;
@@ -28,6 +29,12 @@ static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel lev
 - (BOOL)initializeWithDictionaryData:(NSData *)dictionaryData;
 - (BOOL)encodeBytes:(const Byte*)bytes length:(size_t)length;
 - (BOOL)finalizeEncoding;
+- (BOOL)compressBytes:(const Byte *)bytes
+               length:(size_t)length
+             toBuffer:(Byte *)buffer
+             capacity:(size_t)capacity
+     compressedLength:(size_t *)compressedLength
+       dictionaryData:(NSData *)dictionaryData;
 @end
 
 @interface NOZXBrotliDecoderContext : NSObject <NOZDecoderContext>
@@ -39,6 +46,12 @@ static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel lev
 - (BOOL)initializeWithDictionaryData:(NSData *)dictionaryData;
 - (BOOL)decodeBytes:(const Byte*)bytes length:(size_t)length;
 - (BOOL)finalizeDecoding;
+- (BOOL)decompressBytes:(const Byte *)bytes
+                 length:(size_t)length
+               toBuffer:(Byte *)buffer
+               capacity:(size_t)capacity
+     decompressedLength:(size_t *)decompressedLength
+         dictionaryData:(NSData *)dictionaryData;
 @end
 
 @interface NOZXBrotliEncoder : NSObject <NOZEncoder>
@@ -120,18 +133,8 @@ static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel lev
 - (BOOL)initializeWithDictionaryData:(NSData *)dictionaryData
 {
     if (!_flags.initialized) {
-        static uint32_t lgwin = 21; // 2MB
-        static dispatch_once_t onceToken;
-        dispatch_once(&onceToken, ^{
-            unsigned long long physMemory = [NSProcessInfo processInfo].physicalMemory;
-            if (physMemory < (1024ULL * 1024ULL * 768ULL)) {
-                lgwin--; // 1MB
-            } else if (physMemory > (1024ULL * 1024ULL * 1024ULL * 3ULL / 2ULL)) {
-                lgwin++; // 4MB
-            }
-        });
         (void)BrotliEncoderSetParameter(_encoderState, BROTLI_PARAM_QUALITY, _quality);
-        (void)BrotliEncoderSetParameter(_encoderState, BROTLI_PARAM_LGWIN, lgwin);
+        (void)BrotliEncoderSetParameter(_encoderState, BROTLI_PARAM_LGWIN, NOZXBrotliWindowBits());
         if (dictionaryData.length) {
             (void)BrotliEncoderSetParameter(_encoderState, BROTLI_PARAM_LGWIN, BROTLI_DEFAULT_WINDOW);
             BrotliEncoderSetCustomDictionary(_encoderState, dictionaryData.length, dictionaryData.bytes);
@@ -216,6 +219,43 @@ static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel lev
     _encoderBufferPointer = _encoderBuffer;
 }
 
+- (BOOL)compressBytes:(const Byte *)bytes
+               length:(size_t)length
+             toBuffer:(Byte *)buffer
+             capacity:(size_t)capacity
+     compressedLength:(size_t *)compressedLength
+       dictionaryData:(NSData *)dictionaryData
+{
+    if (!_encoderState || ![self initializeWithDictionaryData:dictionaryData] || _flags.failureEncountered) {
+        return NO;
+    }
+
+    // finish the stream straight into the buffer, the encoder state is done afterwards
+    size_t availableInputByteCount = length;
+    const Byte *availableInputBytePointer = bytes;
+    size_t availableOutputByteCount = capacity;
+    Byte *availableOutputBytePointer = buffer;
+    do {
+        if (BROTLI_TRUE != BrotliEncoderCompressStream(_encoderState,
+                                                       BROTLI_OPERATION_FINISH,
+                                                       &availableInputByteCount,
+                                                       &availableInputBytePointer,
+                                                       &availableOutputByteCount,
+                                                       &availableOutputBytePointer,
+                                                       NULL /* total so far */)) {
+            _flags.failureEncountered = 1;
+            break;
+        }
+    } while (availableOutputByteCount > 0 && !BrotliEncoderIsFinished(_encoderState));
+
+    if (!BrotliEncoderIsFinished(_encoderState)) {
+        _flags.failureEncountered = 1;
+    }
+
+    *compressedLength = capacity - availableOutputByteCount;
+    return !_flags.failureEncountered;
+}
+
 @end
 
 @implementation NOZXBrotliEncoder
@@ -233,7 +273,9 @@ static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel lev
 - (instancetype)initWithDictionaryData:(NSData *)dict
 {
     if (self = [super init]) {
-        _dictionaryData = dict;
+        // Contexts share these bytes rather than copying them, they must never change.
+        // This brotli has no prepared dictionaries, each encoder state still hashes the dictionary itself.
+        _dictionaryData = [dict copy];
     }
     return self;
 }
@@ -267,6 +309,26 @@ static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel lev
     return [(NOZXBrotliEncoderContext *)context finalizeEncoding];
 }
 
+- (size_t)maximumEncodedLengthForLength:(size_t)length
+{
+    return BrotliEncoderMaxCompressedSize(length);
+}
+
+- (BOOL)encodeBytes:(const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(Byte *)buffer
+           capacity:(size_t)capacity
+      encodedLength:(size_t *)encodedLength
+            context:(id<NOZEncoderContext>)context
+{
+    return [(NOZXBrotliEncoderContext *)context compressBytes:bytes
+                                                       length:length
+                                                     toBuffer:buffer
+                                                     capacity:capacity
+                                             compressedLength:encodedLength
+                                               dictionaryData:_dictionaryData];
+}
+
 @end
 
 @implementation NOZXBrotliDecoderContext
@@ -371,6 +433,38 @@ static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel lev
     }
 }
 
+- (BOOL)decompressBytes:(const Byte *)bytes
+                 length:(size_t)length
+               toBuffer:(Byte *)buffer
+               capacity:(size_t)capacity
+     decompressedLength:(size_t *)decompressedLength
+         dictionaryData:(NSData *)dictionaryData
+{
+    if (!_decoderState || ![self initializeWithDictionaryData:dictionaryData] || _flags.failureEncountered) {
+        return NO;
+    }
+
+    // decode the whole stream straight into the buffer
+    size_t availableInputBytesCount = length;
+    const Byte *availableInputBytesPointer = bytes;
+    size_t availableOutputBytesCount = capacity;
+    Byte *availableOutputBytesPointer = buffer;
+    const BrotliDecoderResult result = BrotliDecoderDecompressStream(_decoderState,
+                                                                     &availableInputBytesCount,
+                                                                     &availableInputBytesPointer,
+                                                                     &availableOutputBytesCount,
+                                                                     &availableOutputBytesPointer,
+                                                                     NULL /* total decoded */);
+    if (BROTLI_DECODER_RESULT_SUCCESS != result) {
+        _flags.failureEncountered = 1;
+        return NO;
+    }
+
+    *decompressedLength = capacity - availableOutputBytesCount;
+    _hasFinished = YES;
+    return YES;
+}
+
 @end
 
 @implementation NOZXBrotliDecoder
@@ -378,7 +472,8 @@ static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel lev
 - (instancetype)initWithDictionaryData:(NSData *)dict
 {
     if (self = [super init]) {
-        _dictionaryData = dict;
+        // decoder states reference these bytes, they must never change
+        _dictionaryData = [dict copy];
     }
     return self;
 }
@@ -406,9 +501,39 @@ static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel lev
     return [(NOZXBrotliDecoderContext *)context finalizeDecoding];
 }
 
+- (BOOL)decodeBytes:(const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(Byte *)buffer
+           capacity:(size_t)capacity
+      decodedLength:(size_t *)decodedLength
+            context:(id<NOZDecoderContext>)context
+{
+    return [(NOZXBrotliDecoderContext *)context decompressBytes:bytes
+                                                         length:length
+                                                       toBuffer:buffer
+                                                       capacity:capacity
+                                             decompressedLength:decodedLength
+                                                 dictionaryData:_dictionaryData];
+}
+
 @end
 
 static uint32_t NOZXBrotliQualityFromNOZCompressionLevel(NOZCompressionLevel level)
 {
     return (uint32_t)NOZCompressionLevelToCustomEncoderLevel(level, BROTLI_MIN_QUALITY, BROTLI_MAX_QUALITY, kBROTLI_QUALITY_LEVEL_DEFAULT);
 }
+
+static uint32_t NOZXBrotliWindowBits(void)
+{
+    static uint32_t lgwin = 21; // 2MB
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        unsigned long long physMemory = [NSProcessInfo processInfo].physicalMemory;
+        if (physMemory < (1024ULL * 1024ULL * 768ULL)) {
+            lgwin--; // 1MB
+        } else if (physMemory > (1024ULL * 1024ULL * 1024ULL * 3ULL / 2ULL)) {
+            lgwin++; // 4MB
+        }
+    });
+    return lgwin;
+}
@@ -15,6 +15,31 @@
 
 + (nullable id<NOZEncoder>)encoder;
 + (nullable id<NOZEncoder>)encoderWithDictionaryData:(nullable NSData *)dict;
+
+/**
+ zstd encoder that compresses large entries on several threads.
+ Same as `encoderWithDictionaryData:workerCount:jobSize:overlapLog:minimumMultithreadedSize:`
+ with zstd's default job size and overlap, and a 4MB minimum entry size.
+ */
++ (nullable id<NOZEncoder>)encoderWithDictionaryData:(nullable NSData *)dict
+                                         workerCount:(NSUInteger)workerCount;
+
+/**
+ zstd encoder that compresses large entries on several threads.
+ Large entries are cut into jobs compressed in parallel, each job overlapping the end of the previous one
+ so that compression barely suffers.
+ @param dict Optional dictionary to compress with.
+ @param workerCount The number of compression threads, `0` for one per active processor.  `1` is single threaded.
+ @param jobSize The number of bytes per job, `0` to let zstd size jobs for the compression level (at least 1MB).
+ @param overlapLog How much of the window a job overlaps: `0` for none, `6` for 1/8th (zstd's default), `9` or more for all of it.
+ @param minimumSize Entries smaller than this are compressed on the calling thread.
+ They are held in memory until their size is known, so keep this modest.
+ */
++ (nullable id<NOZEncoder>)encoderWithDictionaryData:(nullable NSData *)dict
+                                         workerCount:(NSUInteger)workerCount
+                                             jobSize:(size_t)jobSize
+                                          overlapLog:(unsigned)overlapLog
+                            minimumMultithreadedSize:(size_t)minimumSize;
 + (nullable id<NOZDecoder>)decoder;
 + (nullable id<NOZDecoder>)decoderWithDictionaryData:(nullable NSData *)dict;
 
@@ -6,13 +6,19 @@
 //  Copyright © 2016 NSProgrammer. All rights reserved.
 //
 
-#define ZSTD_STATIC_LINKING_ONLY 1
+#define ZSTD_STATIC_LINKING_ONLY
 #include <zstd/zstd.h>
+#include <zstd/compress/zstdmt_compress.h>
+#define ZDICT_STATIC_LINKING_ONLY
+#include <zstd/dictBuilder/zdict.h>
 
 #import <ZipUtilities/ZipUtilities.h>
 #import "NOZXZStandardCompressionCoder.h"
 
 #define kZSTD_DEFAULT_LEVEL (7)
+#define kZSTD_DEFAULT_OVERLAP_LOG (6)
+#define kZSTD_DEFAULT_MIN_MULTITHREADED_SIZE (4 * 1024 * 1024)
+#define kZSTD_DICTIONARY_TRAINING_STEPS (8)
 
 static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
 
@@ -23,9 +29,16 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
 @property (nonatomic, readonly, copy, nonnull) NOZFlushCallback flushCallback;
 - (instancetype)initWithEncoder:(nonnull id<NOZEncoder>)encoder level:(int)level flushCallback:(NOZFlushCallback)callback;
 - (instancetype)init NS_UNAVAILABLE;
-- (BOOL)initializeWithDictionaryData:(NSData *)dictionaryData;
+- (BOOL)initializeWithDictionary:(nullable const ZSTD_CDict *)dictionary;
 - (BOOL)encodeBytes:(const Byte*)bytes length:(size_t)length;
 - (BOOL)finalizeEncoding;
+- (BOOL)prepareForReuseWithFlushCallback:(nonnull NOZFlushCallback)callback;
+- (BOOL)compressBytes:(nonnull const Byte *)bytes
+               length:(size_t)length
+             toBuffer:(nonnull Byte *)buffer
+             capacity:(size_t)capacity
+     compressedLength:(nonnull size_t *)compressedLength
+           dictionary:(nullable const ZSTD_CDict *)dictionary;
 @end
 
 @interface NOZXZStandardDecoderContext : NSObject <NOZDecoderContext>
@@ -34,21 +47,39 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
 @property (nonatomic, readonly, nonnull, unsafe_unretained) id<NOZDecoder> decoder;
 - (instancetype)initWithDecoder:(id<NOZDecoder>)decoder flushCallback:(NOZFlushCallback)callback;
 - (instancetype)init NS_UNAVAILABLE;
-- (BOOL)initializeWithDictionaryData:(NSData *)dictionaryData;
+- (BOOL)initializeWithDictionary:(nullable const ZSTD_DDict *)dictionary;
 - (BOOL)decodeBytes:(const Byte*)bytes length:(size_t)length;
 - (BOOL)finalizeDecoding;
+- (BOOL)prepareForReuseWithFlushCallback:(nonnull NOZFlushCallback)callback;
+- (BOOL)decompressBytes:(nonnull const Byte *)bytes
+                 length:(size_t)length
+               toBuffer:(nonnull Byte *)buffer
+               capacity:(size_t)capacity
+     decompressedLength:(nonnull size_t *)decompressedLength
+             dictionary:(nullable const ZSTD_DDict *)dictionary;
 @end
 
 @interface NOZXZStandardEncoder : NSObject <NOZEncoder>
 @property (nonatomic, readonly, nullable) NSData *dictionaryData;
+@property (nonatomic, readonly) unsigned workerCount;
+@property (nonatomic, readonly) size_t jobSize;
+@property (nonatomic, readonly) unsigned overlapLog;
+@property (nonatomic, readonly) size_t minimumMultithreadedSize;
 - (instancetype)initWithDictionaryData:(nullable NSData *)dict;
+- (instancetype)initWithDictionaryData:(nullable NSData *)dict
+                           workerCount:(NSUInteger)workerCount
+                               jobSize:(size_t)jobSize
+                            overlapLog:(unsigned)overlapLog
+              minimumMultithreadedSize:(size_t)minimumSize NS_DESIGNATED_INITIALIZER;
 - (instancetype)init NS_UNAVAILABLE;
+- (nullable const ZSTD_CDict *)dictionaryForLevel:(int)level;
 @end
 
 @interface NOZXZStandardDecoder : NSObject <NOZDecoder>
 @property (nonatomic, readonly, nullable) NSData *dictionaryData;
 - (instancetype)initWithDictionaryData:(nullable NSData *)dict;
 - (instancetype)init NS_UNAVAILABLE;
+- (nullable const ZSTD_DDict *)dictionary;
 @end
 
 @implementation NOZXZStandardCompressionCoder
@@ -63,6 +94,28 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
     return [[NOZXZStandardEncoder alloc] initWithDictionaryData:dict];
 }
 
++ (id<NOZEncoder>)encoderWithDictionaryData:(NSData *)dict workerCount:(NSUInteger)workerCount
+{
+    return [self encoderWithDictionaryData:dict
+                               workerCount:workerCount
+                                   jobSize:0
+                                overlapLog:kZSTD_DEFAULT_OVERLAP_LOG
+                  minimumMultithreadedSize:kZSTD_DEFAULT_MIN_MULTITHREADED_SIZE];
+}
+
++ (id<NOZEncoder>)encoderWithDictionaryData:(NSData *)dict
+                                workerCount:(NSUInteger)workerCount
+                                    jobSize:(size_t)jobSize
+                                 overlapLog:(unsigned)overlapLog
+                   minimumMultithreadedSize:(size_t)minimumSize
+{
+    return [[NOZXZStandardEncoder alloc] initWithDictionaryData:dict
+                                                    workerCount:workerCount
+                                                        jobSize:jobSize
+                                                     overlapLog:overlapLog
+                                       minimumMultithreadedSize:minimumSize];
+}
+
 + (id<NOZDecoder>)decoder
 {
     return [self decoderWithDictionaryData:nil];
@@ -78,11 +131,17 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
 @implementation NOZXZStandardEncoderContext
 {
     ZSTD_CStream *_stream;
+    ZSTDMT_CCtx *_multithreadedStream;
+    ZSTD_CCtx *_singleCallContext;
+    const ZSTD_CDict *_dictionary;
+    NSMutableData *_deferredBytes;
     ZSTD_outBuffer _outBuffer;
 
     struct {
         BOOL initialized:1;
         BOOL failureEncountered:1;
+        BOOL deferringStream:1;
+        BOOL multithreaded:1;
     } _flags;
 }
 
@@ -106,28 +165,96 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
 
 - (void)dealloc
 {
-    if (_flags.initialized) {
-        free(_outBuffer.dst);
-    }
+    free(_outBuffer.dst);
     if (_stream) {
         ZSTD_freeCStream(_stream);
     }
+    if (_multithreadedStream) {
+        ZSTDMT_freeCCtx(_multithreadedStream);
+    }
+    if (_singleCallContext) {
+        ZSTD_freeCCtx(_singleCallContext);
+    }
 }
 
-- (BOOL)initializeWithDictionaryData:(NSData *)dictionaryData
+- (BOOL)initializeWithDictionary:(const ZSTD_CDict *)dictionary
 {
-    if (!_flags.initialized) {
-        const size_t initResult = (dictionaryData.length > 0) ? ZSTD_initCStream_usingDict(_stream, dictionaryData.bytes, dictionaryData.length, _level) : ZSTD_initCStream(_stream, _level);
-        if (!ZSTD_isError(initResult)) {
-            _outBuffer.pos = 0;
+    if (!_flags.initialized && _stream) {
+        if (!_outBuffer.dst) {
             _outBuffer.size = ZSTD_CStreamOutSize();
             _outBuffer.dst = malloc(_outBuffer.size);
+        }
+        _outBuffer.pos = 0;
+        _dictionary = dictionary;
+        _flags.multithreaded = 0;
+
+        if (!_outBuffer.dst) {
+            return NO;
+        }
+
+        if ([(NOZXZStandardEncoder *)_encoder workerCount] > 1) {
+            // Only entries large enough to split into jobs go multithreaded,
+            // the stream starts once enough bytes came in or the entry ended
+            if (!_deferredBytes) {
+                _deferredBytes = [[NSMutableData alloc] init];
+            }
+            _deferredBytes.length = 0;
+            _flags.deferringStream = 1;
             _flags.initialized = 1;
+        } else {
+            _flags.initialized = [self startStreamMultithreaded:NO];
         }
     }
     return _flags.initialized;
 }
 
+- (BOOL)startStreamMultithreaded:(BOOL)multithreaded
+{
+    NOZXZStandardEncoder *encoder = (NOZXZStandardEncoder *)_encoder;
+    if (multithreaded && !_multithreadedStream) {
+        _multithreadedStream = ZSTDMT_createCCtx(encoder.workerCount);
+    }
+
+    size_t initResult;
+    if (multithreaded && _multithreadedStream) {
+        (void)ZSTDMT_setMTCtxParameter(_multithreadedStream, ZSTDMT_p_sectionSize, (unsigned)MIN(encoder.jobSize, (size_t)UINT32_MAX));
+        (void)ZSTDMT_setMTCtxParameter(_multithreadedStream, ZSTDMT_p_overlapSectionLog, encoder.overlapLog);
+        NSData *dictionaryData = encoder.dictionaryData;
+        const ZSTD_parameters params = ZSTD_getParams(_level, 0, dictionaryData.length);
+        initResult = ZSTDMT_initCStream_advanced(_multithreadedStream, dictionaryData.bytes, dictionaryData.length, params, 0);
+        _flags.multithreaded = 1;
+    } else {
+        // (re)initializing a stream reuses its workspace when the parameters fit
+        initResult = (_dictionary) ? ZSTD_initCStream_usingCDict(_stream, _dictionary) : ZSTD_initCStream(_stream, _level);
+        _flags.multithreaded = 0;
+    }
+    return !ZSTD_isError(initResult);
+}
+
+- (BOOL)startDeferredStreamMultithreaded:(BOOL)multithreaded
+{
+    _flags.deferringStream = 0;
+    if (![self startStreamMultithreaded:multithreaded]) {
+        _flags.failureEncountered = 1;
+        return NO;
+    }
+
+    const BOOL success = [self compressBytes:_deferredBytes.bytes length:_deferredBytes.length];
+    _deferredBytes.length = 0;
+    return success;
+}
+
+- (BOOL)prepareForReuseWithFlushCallback:(NOZFlushCallback)callback
+{
+    if (!_stream || _flags.failureEncountered) {
+        return NO;
+    }
+
+    _flushCallback = [callback copy];
+    _flags.initialized = 0;
+    return YES;
+}
+
 - (BOOL)encodeBytes:(const Byte*)bytes length:(size_t)length
 {
     if (!_flags.initialized || _flags.failureEncountered) {
@@ -138,12 +265,40 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
         return YES;
     }
 
+    if (_flags.deferringStream) {
+        [_deferredBytes appendBytes:bytes length:length];
+        if (_deferredBytes.length < [(NOZXZStandardEncoder *)_encoder minimumMultithreadedSize]) {
+            return YES;
+        }
+        return [self startDeferredStreamMultithreaded:YES];
+    }
+
+    return [self compressBytes:bytes length:length];
+}
+
+- (BOOL)compressBytes:(const Byte*)bytes length:(size_t)length
+{
     ZSTD_inBuffer inBuffer;
     inBuffer.src = bytes;
     inBuffer.size = length;
     inBuffer.pos = 0;
 
     while (!_flags.failureEncountered && inBuffer.pos < inBuffer.size) {
+        if (_flags.multithreaded) {
+            // flushing would cut the current job short, only hand off what was output
+            const size_t compressReturnValue = ZSTDMT_compressStream(_multithreadedStream, &_outBuffer, &inBuffer);
+            if (ZSTD_isError(compressReturnValue)) {
+                _flags.failureEncountered = 1;
+                break;
+            }
+
+            if (_outBuffer.pos > 0) {
+                _flags.failureEncountered = !_flushCallback(_encoder, self, _outBuffer.dst, _outBuffer.pos);
+                _outBuffer.pos = 0;
+            }
+            continue;
+        }
+
         const size_t compressReturnValue = ZSTD_compressStream(_stream, &_outBuffer, &inBuffer);
         if (ZSTD_isError(compressReturnValue)) {
             _flags.failureEncountered = 1;
@@ -164,6 +319,10 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
         return NO;
     }
 
+    if (_flags.deferringStream && ![self startDeferredStreamMultithreaded:NO]) {
+        return NO;
+    }
+
     [self flush:YES];
 
     return !_flags.failureEncountered;
@@ -173,7 +332,11 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
 {
     size_t remainingBytesToFlush = 0;
     do {
-        remainingBytesToFlush = (end) ? ZSTD_endStream(_stream, &_outBuffer) : ZSTD_flushStream(_stream, &_outBuffer);
+        if (_flags.multithreaded) {
+            remainingBytesToFlush = (end) ? ZSTDMT_endStream(_multithreadedStream, &_outBuffer) : ZSTDMT_flushStream(_multithreadedStream, &_outBuffer);
+        } else {
+            remainingBytesToFlush = (end) ? ZSTD_endStream(_stream, &_outBuffer) : ZSTD_flushStream(_stream, &_outBuffer);
+        }
         if (ZSTD_isError(remainingBytesToFlush)) {
             _flags.failureEncountered = 1;
         } else if (_outBuffer.pos > 0) {
@@ -183,9 +346,49 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
     } while (!_flags.failureEncountered && remainingBytesToFlush > 0);
 }
 
+- (BOOL)compressBytes:(const Byte *)bytes
+               length:(size_t)length
+             toBuffer:(Byte *)buffer
+             capacity:(size_t)capacity
+     compressedLength:(size_t *)compressedLength
+           dictionary:(const ZSTD_CDict *)dictionary
+{
+    if (_flags.initialized || _flags.failureEncountered) {
+        return NO;
+    }
+
+    // zstd 1.2 streams don't expose their compression context,
+    // so single calls keep their own alongside the stream for the life of the context
+    if (!_singleCallContext) {
+        _singleCallContext = ZSTD_createCCtx();
+        if (!_singleCallContext) {
+            return NO;
+        }
+    }
+
+    size_t result;
+    if (dictionary) {
+        result = ZSTD_compress_usingCDict(_singleCallContext, buffer, capacity, bytes, length, dictionary);
+    } else {
+        result = ZSTD_compressCCtx(_singleCallContext, buffer, capacity, bytes, length, _level);
+    }
+
+    if (ZSTD_isError(result)) {
+        _flags.failureEncountered = 1;
+        return NO;
+    }
+
+    *compressedLength = result;
+    return YES;
+}
+
 @end
 
 @implementation NOZXZStandardEncoder
+{
+    dispatch_queue_t _dictionaryQueue;
+    ZSTD_CDict **_dictionaries;
+}
 
 - (NSUInteger)numberOfCompressionLevels
 {
@@ -198,13 +401,65 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
 }
 
 - (instancetype)initWithDictionaryData:(NSData *)dict
+{
+    return [self initWithDictionaryData:dict
+                            workerCount:1
+                                jobSize:0
+                             overlapLog:kZSTD_DEFAULT_OVERLAP_LOG
+               minimumMultithreadedSize:kZSTD_DEFAULT_MIN_MULTITHREADED_SIZE];
+}
+
+- (instancetype)initWithDictionaryData:(NSData *)dict
+                           workerCount:(NSUInteger)workerCount
+                               jobSize:(size_t)jobSize
+                            overlapLog:(unsigned)overlapLog
+              minimumMultithreadedSize:(size_t)minimumSize
 {
     if (self = [super init]) {
-        _dictionaryData = dict;
+        if (!workerCount) {
+            workerCount = MAX([NSProcessInfo processInfo].activeProcessorCount, (NSUInteger)1);
+        }
+        _workerCount = (unsigned)MIN(workerCount, (NSUInteger)UINT16_MAX);
+        _jobSize = jobSize;
+        _overlapLog = overlapLog;
+        _minimumMultithreadedSize = minimumSize;
+
+        // digested dictionaries reference the bytes, they must never change
+        _dictionaryData = [dict copy];
+        _dictionaryQueue = dispatch_queue_create("com.ziputilities.zstd.encoder.dictionaries", DISPATCH_QUEUE_SERIAL);
+        _dictionaries = (ZSTD_CDict **)calloc((size_t)ZSTD_maxCLevel() + 1, sizeof(ZSTD_CDict *));
     }
     return self;
 }
 
+- (void)dealloc
+{
+    if (_dictionaries) {
+        for (int level = 0; level <= ZSTD_maxCLevel(); level++) {
+            ZSTD_freeCDict(_dictionaries[level]);
+        }
+        free(_dictionaries);
+    }
+}
+
+- (const ZSTD_CDict *)dictionaryForLevel:(int)level
+{
+    if (_dictionaryData.length == 0 || !_dictionaries || level < 0 || level > ZSTD_maxCLevel()) {
+        return NULL;
+    }
+
+    // Digesting a dictionary is about as expensive as compressing it,
+    // so it is done once per level and shared by every context
+    __block const ZSTD_CDict *dictionary = NULL;
+    dispatch_sync(_dictionaryQueue, ^{
+        if (!_dictionaries[level]) {
+            _dictionaries[level] = ZSTD_createCDict_byReference(_dictionaryData.bytes, _dictionaryData.length, level);
+        }
+        dictionary = _dictionaries[level];
+    });
+    return dictionary;
+}
+
 - (UInt16)bitFlagsForEntry:(id<NOZZipEntry>)entry
 {
     return 0;
@@ -217,9 +472,21 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
     return [[NOZXZStandardEncoderContext alloc] initWithEncoder:self level:NOZXZStandardLevelFromNOZCompressionLevel(level) flushCallback:callback];
 }
 
+- (BOOL)reuseContext:(id<NOZEncoderContext>)context
+        withBitFlags:(UInt16)bitFlags
+       flushCallback:(NOZFlushCallback)callback
+{
+    return [(NOZXZStandardEncoderContext *)context prepareForReuseWithFlushCallback:callback];
+}
+
 - (BOOL)initializeEncoderContext:(id<NOZEncoderContext>)context
 {
-    return [(NOZXZStandardEncoderContext *)context initializeWithDictionaryData:_dictionaryData];
+    NOZXZStandardEncoderContext *zstdContext = (NOZXZStandardEncoderContext *)context;
+    const ZSTD_CDict *dictionary = [self dictionaryForLevel:zstdContext.level];
+    if (!dictionary && _dictionaryData.length > 0) {
+        return NO;
+    }
+    return [zstdContext initializeWithDictionary:dictionary];
 }
 
 - (BOOL)encodeBytes:(const Byte*)bytes
@@ -234,11 +501,99 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
     return [(NOZXZStandardEncoderContext *)context finalizeEncoding];
 }
 
+- (NSData *)trainDictionaryWithSamples:(NSArray<NSData *> *)samples maximumSize:(size_t)maximumSize
+{
+    if (!samples.count || !maximumSize) {
+        return nil;
+    }
+
+    size_t samplesLength = 0;
+    for (NSData *sample in samples) {
+        samplesLength += sample.length;
+    }
+
+    NSMutableData *samplesBuffer = [NSMutableData dataWithLength:samplesLength];
+    NSMutableData *samplesSizesBuffer = [NSMutableData dataWithLength:samples.count * sizeof(size_t)];
+    NSMutableData *dictionary = [NSMutableData dataWithLength:maximumSize];
+    if (!samplesBuffer || !samplesSizesBuffer || !dictionary) {
+        return nil;
+    }
+
+    Byte *samplesBytes = (Byte *)samplesBuffer.mutableBytes;
+    size_t *samplesSizes = (size_t *)samplesSizesBuffer.mutableBytes;
+
+    unsigned sampleCount = 0;
+    size_t offset = 0;
+    for (NSData *sample in samples) {
+        memcpy(samplesBytes + offset, sample.bytes, sample.length);
+        offset += sample.length;
+        samplesSizes[sampleCount++] = sample.length;
+    }
+
+    // Let COVER search the segment and dmer sizes, spread across the processors.
+    // Fewer steps than zstd's default keep training from outlasting the compression it speeds up.
+    COVER_params_t params;
+    bzero(&params, sizeof(params));
+    params.steps = kZSTD_DICTIONARY_TRAINING_STEPS;
+    params.nbThreads = (unsigned)MAX([NSProcessInfo processInfo].activeProcessorCount, (NSUInteger)1);
+    params.compressionLevel = kZSTD_DEFAULT_LEVEL;
+
+    const size_t dictionarySize = COVER_optimizeTrainFromBuffer(dictionary.mutableBytes,
+                                                                dictionary.length,
+                                                                samplesBytes,
+                                                                samplesSizes,
+                                                                sampleCount,
+                                                                &params);
+    if (ZDICT_isError(dictionarySize) || !dictionarySize) {
+        return nil;
+    }
+
+    dictionary.length = dictionarySize;
+    return dictionary;
+}
+
+- (size_t)maximumEncodedLengthForLength:(size_t)length
+{
+    return ZSTD_compressBound(length);
+}
+
+- (BOOL)encodeBytes:(const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(Byte *)buffer
+           capacity:(size_t)capacity
+      encodedLength:(size_t *)encodedLength
+            context:(id<NOZEncoderContext>)context
+{
+    // always single threaded, single calls are only made for small sizes
+    NOZXZStandardEncoderContext *zstdContext = (NOZXZStandardEncoderContext *)context;
+    const ZSTD_CDict *dictionary = [self dictionaryForLevel:zstdContext.level];
+    if (!dictionary && _dictionaryData.length > 0) {
+        return NO;
+    }
+
+    return [zstdContext compressBytes:bytes
+                               length:length
+                             toBuffer:buffer
+                             capacity:capacity
+                     compressedLength:encodedLength
+                           dictionary:dictionary];
+}
+
+- (id<NOZEncoder>)encoderWithDictionaryData:(NSData *)dictionaryData
+{
+    return [[NOZXZStandardEncoder alloc] initWithDictionaryData:dictionaryData
+                                                    workerCount:_workerCount
+                                                        jobSize:_jobSize
+                                                     overlapLog:_overlapLog
+                                       minimumMultithreadedSize:_minimumMultithreadedSize];
+}
+
 @end
 
 @implementation NOZXZStandardDecoderContext
 {
     ZSTD_DStream *_stream;
+    ZSTD_DCtx *_singleCallContext;
     ZSTD_outBuffer _outBuffer;
 
     struct {
@@ -260,28 +615,43 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
 
 - (void)dealloc
 {
-    if (_flags.initialized) {
-        free(_outBuffer.dst);
-    }
+    free(_outBuffer.dst);
     if (_stream) {
         ZSTD_freeDStream(_stream);
     }
+    if (_singleCallContext) {
+        ZSTD_freeDCtx(_singleCallContext);
+    }
 }
 
-- (BOOL)initializeWithDictionaryData:(NSData *)dictionaryData
+- (BOOL)initializeWithDictionary:(const ZSTD_DDict *)dictionary
 {
-    if (!_flags.initialized) {
-        const size_t initResult = (dictionaryData.length > 0) ? ZSTD_initDStream_usingDict(_stream, dictionaryData.bytes, dictionaryData.length) : ZSTD_initDStream(_stream);
+    if (!_flags.initialized && _stream) {
+        const size_t initResult = (dictionary) ? ZSTD_initDStream_usingDDict(_stream, dictionary) : ZSTD_initDStream(_stream);
         if (!ZSTD_isError(initResult)) {
+            if (!_outBuffer.dst) {
+                _outBuffer.size = ZSTD_DStreamOutSize();
+                _outBuffer.dst = malloc(_outBuffer.size);
+            }
             _outBuffer.pos = 0;
-            _outBuffer.size = ZSTD_DStreamOutSize();
-            _outBuffer.dst = malloc(_outBuffer.size);
-            _flags.initialized = 1;
+            _flags.initialized = (_outBuffer.dst != NULL);
         }
     }
     return _flags.initialized;
 }
 
+- (BOOL)prepareForReuseWithFlushCallback:(NOZFlushCallback)callback
+{
+    if (!_stream || _flags.failureEncountered) {
+        return NO;
+    }
+
+    _flushCallback = [callback copy];
+    _hasFinished = NO;
+    _flags.initialized = 0;
+    return YES;
+}
+
 - (BOOL)decodeBytes:(const Byte*)bytes length:(size_t)length
 {
     if (!_flags.initialized || _flags.failureEncountered) {
@@ -325,27 +695,99 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
     return !_flags.failureEncountered;
 }
 
+- (BOOL)decompressBytes:(const Byte *)bytes
+                 length:(size_t)length
+               toBuffer:(Byte *)buffer
+               capacity:(size_t)capacity
+     decompressedLength:(size_t *)decompressedLength
+             dictionary:(const ZSTD_DDict *)dictionary
+{
+    if (_flags.initialized || _flags.failureEncountered) {
+        return NO;
+    }
+
+    if (!_singleCallContext) {
+        _singleCallContext = ZSTD_createDCtx();
+        if (!_singleCallContext) {
+            return NO;
+        }
+    }
+
+    // a buffer that's too small fails the call but leaves the context usable
+    size_t result;
+    if (dictionary) {
+        result = ZSTD_decompress_usingDDict(_singleCallContext, buffer, capacity, bytes, length, dictionary);
+    } else {
+        result = ZSTD_decompressDCtx(_singleCallContext, buffer, capacity, bytes, length);
+    }
+
+    if (ZSTD_isError(result)) {
+        return NO;
+    }
+
+    *decompressedLength = result;
+    _hasFinished = YES;
+    return YES;
+}
+
 @end
 
 @implementation NOZXZStandardDecoder
+{
+    dispatch_queue_t _dictionaryQueue;
+    ZSTD_DDict *_dictionary;
+}
 
 - (instancetype)initWithDictionaryData:(NSData *)dict
 {
     if (self = [super init]) {
-        _dictionaryData = dict;
+        _dictionaryData = [dict copy];
+        _dictionaryQueue = dispatch_queue_create("com.ziputilities.zstd.decoder.dictionary", DISPATCH_QUEUE_SERIAL);
     }
     return self;
 }
 
+- (void)dealloc
+{
+    ZSTD_freeDDict(_dictionary);
+}
+
+- (const ZSTD_DDict *)dictionary
+{
+    if (_dictionaryData.length == 0) {
+        return NULL;
+    }
+
+    __block const ZSTD_DDict *dictionary = NULL;
+    dispatch_sync(_dictionaryQueue, ^{
+        if (!_dictionary) {
+            _dictionary = ZSTD_createDDict_byReference(_dictionaryData.bytes, _dictionaryData.length);
+        }
+        dictionary = _dictionary;
+    });
+    return dictionary;
+}
+
 - (id<NOZDecoderContext>)createContextForDecodingWithBitFlags:(UInt16)flags
                                                 flushCallback:(NOZFlushCallback)callback
 {
     return [[NOZXZStandardDecoderContext alloc] initWithDecoder:self flushCallback:callback];
 }
 
+- (BOOL)reuseContext:(id<NOZDecoderContext>)context
+        withBitFlags:(UInt16)flags
+       flushCallback:(NOZFlushCallback)callback
+{
+    return [(NOZXZStandardDecoderContext *)context prepareForReuseWithFlushCallback:callback];
+}
+
 - (BOOL)initializeDecoderContext:(id<NOZDecoderContext>)context
 {
-    return [(NOZXZStandardDecoderContext *)context initializeWithDictionaryData:_dictionaryData];
+    const ZSTD_DDict *dictionary = [self dictionary];
+    if (!dictionary && _dictionaryData.length > 0) {
+        return NO;
+    }
+    return [(NOZXZStandardDecoderContext *)context initializeWithDictionary:dictionary];
 }
 
 - (BOOL)decodeBytes:(const Byte*)bytes
@@ -360,6 +802,31 @@ static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level);
     return [(NOZXZStandardDecoderContext *)context finalizeDecoding];
 }
 
+- (id<NOZDecoder>)decoderWithDictionaryData:(NSData *)dictionaryData
+{
+    return [[NOZXZStandardDecoder alloc] initWithDictionaryData:dictionaryData];
+}
+
+- (BOOL)decodeBytes:(const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(Byte *)buffer
+           capacity:(size_t)capacity
+      decodedLength:(size_t *)decodedLength
+            context:(id<NOZDecoderContext>)context
+{
+    const ZSTD_DDict *dictionary = [self dictionary];
+    if (!dictionary && _dictionaryData.length > 0) {
+        return NO;
+    }
+
+    return [(NOZXZStandardDecoderContext *)context decompressBytes:bytes
+                                                           length:length
+                                                         toBuffer:buffer
+                                                         capacity:capacity
+                                               decompressedLength:decodedLength
+                                                       dictionary:dictionary];
+}
+
 @end
 
 static int NOZXZStandardLevelFromNOZCompressionLevel(NOZCompressionLevel level)
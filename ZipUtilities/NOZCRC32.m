@@ -0,0 +1,276 @@
+//
+//  NOZCRC32.m
+//  ZipUtilities
+//
+//  The MIT License (MIT)
+//
+//  Copyright (c) 2016 Nolan O'Brien
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+#import "NOZ_Project.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+/**
+ CRC-32 as used by zip (and zlib): reflected polynomial 0xEDB88320, pre and post conditioned with ~0.
+
+ Three implementations, picked once at runtime:
+ - x86-64 with PCLMULQDQ: folds 64 bytes at a time with carry-less multiplication
+   ("Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction", Intel 2009)
+ - ARMv8 with the CRC32 extension: 8 bytes per `crc32x` instruction
+ - everything else: zlib's `crc32`
+ */
+
+#define NOZ_CRC32_POLYNOMIAL (0xEDB88320U)
+
+typedef UInt32 (*NOZCRC32Function)(UInt32 crc, const Byte *bytes, size_t length);
+
+static UInt32 noz_crc32_portable(UInt32 crc, const Byte *bytes, size_t length);
+static NOZCRC32Function noz_crc32_best_function(void);
+
+#pragma mark Portable
+
+static UInt32 noz_crc32_portable(UInt32 crc, const Byte *bytes, size_t length)
+{
+    // zlib's table driven CRC, in chunks that fit its `unsigned int` lengths
+    while (length > 0) {
+        const unsigned int chunkLength = (unsigned int)MIN(length, (size_t)UINT32_MAX);
+        crc = (UInt32)crc32(crc, bytes, chunkLength);
+        bytes += chunkLength;
+        length -= chunkLength;
+    }
+    return crc;
+}
+
+#pragma mark x86-64
+
+#if defined(__x86_64__)
+
+// Takes and returns the unconditioned CRC, _length_ must be a multiple of 16 and at least 64
+__attribute__((target("pclmul,sse2")))
+static UInt32 noz_crc32_pclmul_fold(UInt32 crc, const Byte *bytes, size_t length)
+{
+    // bit reflected x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32), x^64 mod P, then P and the Barrett constant
+    static const UInt64 k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const UInt64 k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const UInt64 k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const UInt64 poly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(bytes + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(bytes + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(bytes + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(bytes + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+    bytes += 64;
+    length -= 64;
+
+    // fold 4 x 128 bits in parallel
+    while (length >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(bytes + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(bytes + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(bytes + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(bytes + 0x30)));
+        bytes += 64;
+        length -= 64;
+    }
+
+    // fold down to 128 bits
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (length >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)bytes);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        bytes += 16;
+        length -= 16;
+    }
+
+    // 128 bits down to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i *)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (UInt32)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+static UInt32 noz_crc32_pclmul(UInt32 crc, const Byte *bytes, size_t length)
+{
+    if (length >= 64) {
+        const size_t foldedLength = length & ~(size_t)15;
+        crc = ~noz_crc32_pclmul_fold(~crc, bytes, foldedLength);
+        bytes += foldedLength;
+        length -= foldedLength;
+    }
+    return noz_crc32_portable(crc, bytes, length);
+}
+
+#endif // __x86_64__
+
+#pragma mark ARMv8
+
+#if defined(__aarch64__)
+
+__attribute__((target("crc")))
+static UInt32 noz_crc32_armv8(UInt32 crc, const Byte *bytes, size_t length)
+{
+    crc = ~crc;
+    while (length > 0 && ((uintptr_t)bytes & 7)) {
+        crc = __crc32b(crc, *bytes++);
+        length--;
+    }
+    while (length >= 8) {
+        UInt64 value;
+        memcpy(&value, bytes, sizeof(value));
+        crc = __crc32d(crc, value);
+        bytes += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = __crc32b(crc, *bytes++);
+    }
+    return ~crc;
+}
+
+#endif // __aarch64__
+
+#pragma mark Dispatch
+
+static NOZCRC32Function noz_crc32_best_function(void)
+{
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL)) {
+        return noz_crc32_pclmul;
+    }
+#elif defined(__aarch64__)
+#if defined(__ARM_FEATURE_CRC32)
+    return noz_crc32_armv8;
+#elif defined(__APPLE__)
+    int hasCRC32 = 0;
+    size_t size = sizeof(hasCRC32);
+    if (0 == sysctlbyname("hw.optional.armv8_crc32", &hasCRC32, &size, NULL, 0) && hasCRC32) {
+        return noz_crc32_armv8;
+    }
+#elif defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        return noz_crc32_armv8;
+    }
+#endif
+#endif
+    return noz_crc32_portable;
+}
+
+UInt32 noz_crc32(UInt32 crc, const Byte *bytes, size_t length)
+{
+    static NOZCRC32Function sCRC32Function = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sCRC32Function = noz_crc32_best_function();
+    });
+
+    if (!bytes || 0 == length) {
+        return crc;
+    }
+    return sCRC32Function(crc, bytes, length);
+}
+
+#pragma mark Combine
+
+// a * b modulo P, both bit reflected
+static UInt32 noz_crc32_multiply_modulo(UInt32 a, UInt32 b)
+{
+    UInt32 m = (UInt32)1 << 31;
+    UInt32 product = 0;
+    while (m) {
+        if (a & m) {
+            product ^= b;
+            if (0 == (a & (m - 1))) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ NOZ_CRC32_POLYNOMIAL : (b >> 1);
+    }
+    return product;
+}
+
+UInt32 noz_crc32_combine(UInt32 crc1, UInt32 crc2, UInt64 length2)
+{
+    // crc1 shifted over length2 zero bytes is crc1 * x^(8 * length2) modulo P,
+    // built from x^(2^k) powers squared along the way
+    UInt32 shift = (UInt32)1 << 31; // x^0
+    UInt32 power = (UInt32)1 << 23; // x^8, one byte
+    while (length2) {
+        if (length2 & 1) {
+            shift = noz_crc32_multiply_modulo(power, shift);
+        }
+        length2 >>= 1;
+        power = noz_crc32_multiply_modulo(power, power);
+    }
+    return noz_crc32_multiply_modulo(shift, crc1) ^ crc2;
+}
@@ -122,6 +122,19 @@ typedef BOOL(^NOZCompressionShouldExcludeFileBlock)(NSString* filePath);
 @property (nonatomic, readonly) SInt64 totalSizeOfUncompressedEntries;
 /** A comment embedded in the resulting zip file */
 @property (nonatomic, copy, nullable) NSString *comment;
+/**
+ The maximum number of entries to compress concurrently.
+ Entries are still written to the archive in order, so the output is identical to a serial compression.
+ Default is `1` (serial).
+ */
+@property (nonatomic) NSUInteger maxConcurrentEntryCompressions;
+/**
+ The maximum number of compressed bytes to hold in memory while waiting for earlier entries to be written.
+ Entries that would exceed the limit are buffered to a temporary file instead.
+ Only used when `maxConcurrentEntryCompressions` is greater than `1`.
+ Default is `0`, which means 32MB.
+ */
+@property (nonatomic) SInt64 maxConcurrentCompressionMemory;
 
 /** Add an object conforming to `NOZZippableEntry` */
 - (void)addEntry:(id<NOZZippableEntry>)entry;
@@ -28,8 +28,10 @@
 #import "NOZ_Project.h"
 #import "NOZCompress.h"
 #import "NOZZipper.h"
+#import "NOZZipper_Project.h"
 
 #define kWEIGHT (1000ll)
+#define kDEFAULT_MAX_CONCURRENT_COMPRESSION_MEMORY (32ll * 1024ll * 1024ll)
 
 typedef NS_ENUM(NSUInteger, NOZCompressStep)
 {
@@ -72,6 +74,8 @@ static NSArray<NOZFileZipEntry *> * __nonnull NOZEntriesFromDirectory(NSString *
 - (nullable NSError *)private_closeFile;
 
 #pragma mark Helpers
+- (nullable NSError *)private_addEntriesConcurrently:(nonnull NSArray<id<NOZZippableEntry>> *)entries;
+- (nullable NSError *)private_validateEntry:(nonnull id<NOZZippableEntry>)entry;
 - (nullable NSError *)private_addEntry:(nonnull id<NOZZippableEntry>)entry;
 - (void)private_didCompressBytes:(SInt64)byteCount;
 
@@ -266,6 +270,10 @@ static NSArray<NOZFileZipEntry *> * __nonnull NOZEntriesFromDirectory(NSString *
 {
     NSError *error = NOZErrorCreate(NOZErrorCodeCompressNoEntriesToCompress, nil);
     NSArray<id<NOZZippableEntry>> *entries = _request.entries; // deep copy
+    if (_request.maxConcurrentEntryCompressions > 1 && entries.count > 1) {
+        return [self private_addEntriesConcurrently:entries];
+    }
+
     for (id<NOZZippableEntry> entry in entries) {
         @autoreleasepool {
             if (self.isCancelled) {
@@ -297,17 +305,118 @@ static NSArray<NOZFileZipEntry *> * __nonnull NOZEntriesFromDirectory(NSString *
 
 #pragma mark Helpers
 
-- (NSError *)private_addEntry:(id<NOZZippableEntry>)entry
+- (NSError *)private_addEntriesConcurrently:(NSArray<id<NOZZippableEntry>> *)entries
+{
+    const NSUInteger maxConcurrency = _request.maxConcurrentEntryCompressions;
+    const NSUInteger maxPendingEntries = maxConcurrency * 2;
+    const SInt64 memoryLimit = (_request.maxConcurrentCompressionMemory > 0) ? _request.maxConcurrentCompressionMemory : kDEFAULT_MAX_CONCURRENT_COMPRESSION_MEMORY;
+
+    NSOperationQueue *encodeQueue = [[NSOperationQueue alloc] init];
+    encodeQueue.name = @"NOZCompressOperation.encodeQueue";
+    encodeQueue.maxConcurrentOperationCount = (NSInteger)maxConcurrency;
+    noz_defer(^{
+        [encodeQueue cancelAllOperations];
+        [encodeQueue waitUntilAllOperationsAreFinished];
+    });
+
+    // Compressed bytes held in memory are shared across all entries being encoded
+    dispatch_queue_t memoryQueue = dispatch_queue_create("NOZCompressOperation.memoryQueue", DISPATCH_QUEUE_SERIAL);
+    __block SInt64 memoryInUse = 0;
+    NOZEncodedEntryPayloadReservationBlock reservationBlock = ^BOOL(SInt64 byteCountDelta) {
+        __block BOOL reserved = YES;
+        dispatch_sync(memoryQueue, ^{
+            if (byteCountDelta > 0 && (memoryInUse + byteCountDelta) > memoryLimit) {
+                reserved = NO;
+            } else {
+                memoryInUse += byteCountDelta;
+            }
+        });
+        return reserved;
+    };
+
+    __block volatile BOOL abortAll = NO;
+    __weak typeof(self) weakSelf = self;
+    NSMutableArray<NOZEncodedEntryPayload *> *payloads = [[NSMutableArray alloc] initWithCapacity:entries.count];
+    NSMutableArray<NSOperation *> *encodeOps = [[NSMutableArray alloc] initWithCapacity:entries.count];
+    NSUInteger nextEntryToEncode = 0;
+
+    for (NSUInteger entryIndex = 0; entryIndex < entries.count; entryIndex++) {
+        @autoreleasepool {
+
+            // Keep a bounded window of entries encoding ahead of the writer
+            while (nextEntryToEncode < entries.count && nextEntryToEncode < entryIndex + maxPendingEntries) {
+                id<NOZZippableEntry> entry = entries[nextEntryToEncode];
+                NOZEncodedEntryPayload *payload = [_zipper encodedPayloadForEntry:entry reservationBlock:reservationBlock];
+                NSOperation *op = nil;
+                if (!entry.name || !entry.canBeZipped) {
+                    // validated by the writer, nothing to encode
+                    op = [[NSOperation alloc] init];
+                } else {
+                    op = [NSBlockOperation blockOperationWithBlock:^{
+                        [payload encodeWithProgressBlock:^(SInt64 totalBytes, SInt64 bytesComplete, SInt64 bytesCompletedThisPass, BOOL *abort) {
+                            if (abortAll || weakSelf.isCancelled) {
+                                *abort = YES;
+                            }
+                        }];
+                    }];
+                }
+                [payloads addObject:payload];
+                [encodeOps addObject:op];
+                [encodeQueue addOperation:op];
+                nextEntryToEncode++;
+            }
+
+            NSOperation *op = encodeOps[entryIndex];
+            [op waitUntilFinished];
+            encodeOps[entryIndex] = (id)[NSNull null];
+
+            if (self.isCancelled) {
+                abortAll = YES;
+                return kCancelledError;
+            }
+
+            id<NOZZippableEntry> entry = entries[entryIndex];
+            NSError *error = [self private_validateEntry:entry];
+            if (!error) {
+                NOZEncodedEntryPayload *payload = payloads[entryIndex];
+                [_zipper addEntry:entry encodedPayload:payload error:&error];
+                [payload discardEncodedBytes];
+                payloads[entryIndex] = (id)[NSNull null];
+                if (error) {
+                    error = NOZErrorCreate(NOZErrorCodeCompressFailedToAppendEntryToZip, @{ @"entry" : entry, NSUnderlyingErrorKey : error });
+                } else {
+                    [self private_didCompressBytes:payload.uncompressedSize];
+                }
+            }
+
+            if (error) {
+                abortAll = YES;
+                return error;
+            }
+        }
+    }
+
+    return nil;
+}
+
+- (NSError *)private_validateEntry:(id<NOZZippableEntry>)entry
 {
-    // Start
     if (!entry.name) {
         return NOZErrorCreate(NOZErrorCodeCompressMissingEntryName, @{ @"entry" : entry });
     }
     if (!entry.canBeZipped) {
         return NOZErrorCreate(NOZErrorCodeCompressEntryCannotBeZipped, @{ @"entry" : entry });
     }
+    return nil;
+}
 
-    NSError *error = nil;
+- (NSError *)private_addEntry:(id<NOZZippableEntry>)entry
+{
+    // Start
+    NSError *error = [self private_validateEntry:entry];
+    if (error) {
+        return error;
+    }
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Warc-retain-cycles"
@@ -417,6 +526,7 @@ static NSArray<NOZFileZipEntry *> * __nonnull NOZEntriesFromDirectory(NSString *
     if (self = [super init]) {
         _destinationPath = [path copy];
         _mutableEntries = [[NSMutableArray alloc] init];
+        _maxConcurrentEntryCompressions = 1;
     }
     return self;
 }
@@ -426,6 +536,8 @@ static NSArray<NOZFileZipEntry *> * __nonnull NOZEntriesFromDirectory(NSString *
     NOZCompressRequest *copy = [[[self class] allocWithZone:zone] initWithDestinationPath:self.destinationPath];
     copy.destinationPath = self.destinationPath;
     copy.comment = self.comment;
+    copy.maxConcurrentEntryCompressions = self.maxConcurrentEntryCompressions;
+    copy.maxConcurrentCompressionMemory = self.maxConcurrentCompressionMemory;
     copy->_mutableEntries = [self.entries mutableCopy];
     return copy;
 }
@@ -103,3 +103,10 @@ typedef NS_ENUM(UInt16, NOZCompressionMethod)
 
 //! Block for flushing a buffer of bytes
 typedef BOOL(^NOZFlushCallback)(id __nonnull coder, id __nonnull context, const Byte* __nonnull bufferToFlush, size_t length);
+
+/**
+ Entries and data up to this size (1MB) are encoded and decoded with a single call to coders that support it,
+ see `encodeBytes:length:toBuffer:capacity:encodedLength:context:` on `NOZEncoder`
+ and `decodeBytes:length:toBuffer:capacity:decodedLength:context:` on `NOZDecoder`.
+ */
+static const size_t NOZSingleCallCodingMaximumLength = 1024 * 1024;
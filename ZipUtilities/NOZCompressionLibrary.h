@@ -31,7 +31,9 @@
 #import "NOZCompression.h"
 
 @protocol NOZDecoder;
+@protocol NOZDecoderContext;
 @protocol NOZEncoder;
+@protocol NOZEncoderContext;
 
 /**
  Library of encoders and decoders for __ZipUtilities__
@@ -75,4 +77,50 @@
  */
 - (void)setDecoder:(nullable id<NOZDecoder>)decoder forMethod:(NOZCompressionMethod)method;
 
+#pragma mark Context Pools
+
+/**
+ Number of encoder contexts that were reused from a pool.
+ Only encoders implementing `reuseContext:withBitFlags:flushCallback:` are pooled and counted.
+ */
+@property (atomic, readonly) UInt64 encoderContextPoolHitCount;
+/** Number of encoder contexts that had to be created because none was pooled */
+@property (atomic, readonly) UInt64 encoderContextPoolMissCount;
+/**
+ Number of decoder contexts that were reused from a pool.
+ Only decoders implementing `reuseContext:withBitFlags:flushCallback:` are pooled and counted.
+ */
+@property (atomic, readonly) UInt64 decoderContextPoolHitCount;
+/** Number of decoder contexts that had to be created because none was pooled */
+@property (atomic, readonly) UInt64 decoderContextPoolMissCount;
+
+/**
+ Get a context for encoding with _encoder_, reusing a pooled one when possible.
+ Same as `[encoder createContextWithBitFlags:bitFlags compressionLevel:level flushCallback:callback]` otherwise.
+ Hand the context back with `recycleContext:forEncoder:compressionLevel:` once it was finalized successfully.
+ */
+- (nonnull id<NOZEncoderContext>)createContextForEncoder:(nonnull id<NOZEncoder>)encoder
+                                                bitFlags:(UInt16)bitFlags
+                                        compressionLevel:(NOZCompressionLevel)level
+                                           flushCallback:(nonnull NOZFlushCallback)callback;
+/**
+ Get a context for decoding with _decoder_, reusing a pooled one when possible.
+ Same as `[decoder createContextForDecodingWithBitFlags:bitFlags flushCallback:callback]` otherwise.
+ Hand the context back with `recycleContext:forDecoder:` once it was finalized successfully.
+ */
+- (nonnull id<NOZDecoderContext>)createContextForDecoder:(nonnull id<NOZDecoder>)decoder
+                                                bitFlags:(UInt16)bitFlags
+                                           flushCallback:(nonnull NOZFlushCallback)callback;
+
+/** Pool a finalized encoder context for reuse.  Does nothing if _encoder_ doesn't support reusing contexts. */
+- (void)recycleContext:(nonnull id<NOZEncoderContext>)context
+            forEncoder:(nonnull id<NOZEncoder>)encoder
+      compressionLevel:(NOZCompressionLevel)level;
+/** Pool a finalized decoder context for reuse.  Does nothing if _decoder_ doesn't support reusing contexts. */
+- (void)recycleContext:(nonnull id<NOZDecoderContext>)context
+            forDecoder:(nonnull id<NOZDecoder>)decoder;
+
+/** Release all pooled contexts, such as on a memory warning */
+- (void)purgeContextPools;
+
 @end
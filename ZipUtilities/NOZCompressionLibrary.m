@@ -32,11 +32,31 @@
 #import "NOZUtils_Project.h"
 #import "NOZZipEntry.h"
 
+// Finalized contexts kept per encoder and compression level (or per decoder)
+static const NSUInteger NOZMaxPooledContexts = 4;
+
+// The finalized contexts of one coder, which is only referenced weakly
+@interface NOZContextPool : NSObject
+@property (nonatomic, readonly, weak) id coder;
+- (instancetype)initWithCoder:(id)coder;
+- (nullable id)popContextForLevel:(NOZCompressionLevel)level;
+- (void)pushContext:(id)context forLevel:(NOZCompressionLevel)level;
+@end
+
 @implementation NOZCompressionLibrary
 {
     dispatch_queue_t _coderQueue;
     NSMutableDictionary<NSNumber *, id<NOZEncoder>> *_encoders;
     NSMutableDictionary<NSNumber *, id<NOZDecoder>> *_decoders;
+
+    // Pools are keyed by the coder's address and dropped once that coder is replaced or gone
+    dispatch_queue_t _contextPoolQueue;
+    NSMutableDictionary<NSValue *, NOZContextPool *> *_encoderContextPools;
+    NSMutableDictionary<NSValue *, NOZContextPool *> *_decoderContextPools;
+    UInt64 _encoderContextPoolHitCount;
+    UInt64 _encoderContextPoolMissCount;
+    UInt64 _decoderContextPoolHitCount;
+    UInt64 _decoderContextPoolMissCount;
 }
 
 + (instancetype)sharedInstance
@@ -67,6 +87,10 @@
 
         _decoders[@(NOZCompressionMethodDeflate)] = [[NOZDeflateDecoder alloc] init];
         _decoders[@(NOZCompressionMethodNone)] = [[NOZRawDecoder alloc] init];
+
+        _contextPoolQueue = dispatch_queue_create("com.ziputilities.context.pools", DISPATCH_QUEUE_SERIAL);
+        _encoderContextPools = [[NSMutableDictionary alloc] init];
+        _decoderContextPools = [[NSMutableDictionary alloc] init];
     }
     return self;
 }
@@ -110,23 +134,237 @@
 - (void)setEncoder:(nullable id<NOZEncoder>)encoder forMethod:(NOZCompressionMethod)method
 {
     dispatch_barrier_async(_coderQueue, ^{
+        id<NOZEncoder> replacedEncoder = _encoders[@(method)];
         if (encoder) {
             _encoders[@(method)] = encoder;
         } else {
             [_encoders removeObjectForKey:@(method)];
         }
+        if (replacedEncoder && replacedEncoder != encoder) {
+            dispatch_sync(_contextPoolQueue, ^{
+                [self private_removePoolForCoder:replacedEncoder fromPools:_encoderContextPools];
+            });
+        }
     });
 }
 
 - (void)setDecoder:(nullable id<NOZDecoder>)decoder forMethod:(NOZCompressionMethod)method
 {
     dispatch_barrier_async(_coderQueue, ^{
+        id<NOZDecoder> replacedDecoder = _decoders[@(method)];
         if (decoder) {
             _decoders[@(method)] = decoder;
         } else {
             [_decoders removeObjectForKey:@(method)];
         }
+        if (replacedDecoder && replacedDecoder != decoder) {
+            dispatch_sync(_contextPoolQueue, ^{
+                [self private_removePoolForCoder:replacedDecoder fromPools:_decoderContextPools];
+            });
+        }
+    });
+}
+
+#pragma mark Context Pools
+
+- (UInt64)encoderContextPoolHitCount
+{
+    __block UInt64 count;
+    dispatch_sync(_contextPoolQueue, ^{
+        count = _encoderContextPoolHitCount;
+    });
+    return count;
+}
+
+- (UInt64)encoderContextPoolMissCount
+{
+    __block UInt64 count;
+    dispatch_sync(_contextPoolQueue, ^{
+        count = _encoderContextPoolMissCount;
+    });
+    return count;
+}
+
+- (UInt64)decoderContextPoolHitCount
+{
+    __block UInt64 count;
+    dispatch_sync(_contextPoolQueue, ^{
+        count = _decoderContextPoolHitCount;
+    });
+    return count;
+}
+
+- (UInt64)decoderContextPoolMissCount
+{
+    __block UInt64 count;
+    dispatch_sync(_contextPoolQueue, ^{
+        count = _decoderContextPoolMissCount;
+    });
+    return count;
+}
+
+- (id<NOZEncoderContext>)createContextForEncoder:(id<NOZEncoder>)encoder
+                                        bitFlags:(UInt16)bitFlags
+                                compressionLevel:(NOZCompressionLevel)level
+                                   flushCallback:(NOZFlushCallback)callback
+{
+    __block id<NOZEncoderContext> context = nil;
+    if ([encoder respondsToSelector:@selector(reuseContext:withBitFlags:flushCallback:)]) {
+        dispatch_sync(_contextPoolQueue, ^{
+            context = [[self private_poolForCoder:encoder inPools:_encoderContextPools create:NO] popContextForLevel:level];
+            if (context) {
+                if (![encoder reuseContext:context withBitFlags:bitFlags flushCallback:callback]) {
+                    context = nil;
+                }
+            }
+            if (context) {
+                _encoderContextPoolHitCount++;
+            } else {
+                _encoderContextPoolMissCount++;
+            }
+        });
+    }
+
+    if (!context) {
+        context = [encoder createContextWithBitFlags:bitFlags compressionLevel:level flushCallback:callback];
+    }
+    return context;
+}
+
+- (id<NOZDecoderContext>)createContextForDecoder:(id<NOZDecoder>)decoder
+                                        bitFlags:(UInt16)bitFlags
+                                   flushCallback:(NOZFlushCallback)callback
+{
+    __block id<NOZDecoderContext> context = nil;
+    if ([decoder respondsToSelector:@selector(reuseContext:withBitFlags:flushCallback:)]) {
+        dispatch_sync(_contextPoolQueue, ^{
+            context = [[self private_poolForCoder:decoder inPools:_decoderContextPools create:NO] popContextForLevel:NOZCompressionLevelDefault];
+            if (context) {
+                if (![decoder reuseContext:context withBitFlags:bitFlags flushCallback:callback]) {
+                    context = nil;
+                }
+            }
+            if (context) {
+                _decoderContextPoolHitCount++;
+            } else {
+                _decoderContextPoolMissCount++;
+            }
+        });
+    }
+
+    if (!context) {
+        context = [decoder createContextForDecodingWithBitFlags:bitFlags flushCallback:callback];
+    }
+    return context;
+}
+
+- (void)recycleContext:(id<NOZEncoderContext>)context
+            forEncoder:(id<NOZEncoder>)encoder
+      compressionLevel:(NOZCompressionLevel)level
+{
+    if (!context || ![encoder respondsToSelector:@selector(reuseContext:withBitFlags:flushCallback:)]) {
+        return;
+    }
+
+    dispatch_sync(_contextPoolQueue, ^{
+        [[self private_poolForCoder:encoder inPools:_encoderContextPools create:YES] pushContext:context forLevel:level];
     });
 }
 
+- (void)recycleContext:(id<NOZDecoderContext>)context
+            forDecoder:(id<NOZDecoder>)decoder
+{
+    if (!context || ![decoder respondsToSelector:@selector(reuseContext:withBitFlags:flushCallback:)]) {
+        return;
+    }
+
+    dispatch_sync(_contextPoolQueue, ^{
+        [[self private_poolForCoder:decoder inPools:_decoderContextPools create:YES] pushContext:context forLevel:NOZCompressionLevelDefault];
+    });
+}
+
+- (void)purgeContextPools
+{
+    dispatch_sync(_contextPoolQueue, ^{
+        [_encoderContextPools removeAllObjects];
+        [_decoderContextPools removeAllObjects];
+    });
+}
+
+#pragma mark Private
+
+// Call on the context pool queue
+- (nullable NOZContextPool *)private_poolForCoder:(id)coder
+                                          inPools:(NSMutableDictionary<NSValue *, NOZContextPool *> *)pools
+                                           create:(BOOL)create
+{
+    NSValue *key = [NSValue valueWithPointer:(__bridge const void *)coder];
+    NOZContextPool *pool = pools[key];
+    if (pool && pool.coder != coder) {
+        // the pooled coder is gone and another one took its address
+        pool = nil;
+        [pools removeObjectForKey:key];
+    }
+
+    if (!pool && create) {
+        // a new coder is a good time to drop the pools of coders that were deallocated
+        for (NSValue *otherKey in pools.allKeys) {
+            if (!pools[otherKey].coder) {
+                [pools removeObjectForKey:otherKey];
+            }
+        }
+        pool = [[NOZContextPool alloc] initWithCoder:coder];
+        pools[key] = pool;
+    }
+    return pool;
+}
+
+// Call on the context pool queue
+- (void)private_removePoolForCoder:(id)coder
+                         fromPools:(NSMutableDictionary<NSValue *, NOZContextPool *> *)pools
+{
+    NSValue *key = [NSValue valueWithPointer:(__bridge const void *)coder];
+    if (pools[key].coder == coder) {
+        [pools removeObjectForKey:key];
+    }
+}
+
+@end
+
+@implementation NOZContextPool
+{
+    NSMutableDictionary<NSNumber *, NSMutableArray *> *_contextsByLevel;
+}
+
+- (instancetype)initWithCoder:(id)coder
+{
+    if (self = [super init]) {
+        _coder = coder;
+        _contextsByLevel = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (id)popContextForLevel:(NOZCompressionLevel)level
+{
+    NSMutableArray *contexts = _contextsByLevel[@(level)];
+    id context = contexts.lastObject;
+    if (context) {
+        [contexts removeLastObject];
+    }
+    return context;
+}
+
+- (void)pushContext:(id)context forLevel:(NOZCompressionLevel)level
+{
+    NSMutableArray *contexts = _contextsByLevel[@(level)];
+    if (!contexts) {
+        contexts = [[NSMutableArray alloc] initWithCapacity:NOZMaxPooledContexts];
+        _contextsByLevel[@(level)] = contexts;
+    }
+    if (contexts.count < NOZMaxPooledContexts) {
+        [contexts addObject:context];
+    }
+}
+
 @end
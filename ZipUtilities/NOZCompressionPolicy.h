@@ -0,0 +1,128 @@
+//
+//  NOZCompressionPolicy.h
+//  ZipUtilities
+//
+//  The MIT License (MIT)
+//
+//  Copyright (c) 2016 Nolan O'Brien
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "NOZCompress.h"
+#import "NOZCompression.h"
+#import "NOZZipEntry.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ What a `NOZCompressionPolicy` optimizes for when choosing between candidates
+ */
+typedef NS_ENUM(NSInteger, NOZCompressionPolicyTarget)
+{
+    /** Pick the candidate that produces the smallest output */
+    NOZCompressionPolicyTargetMaximumRatio = 0,
+    /** Pick the compressing candidate that decodes the fastest */
+    NOZCompressionPolicyTargetMinimumDecodeTime,
+    /** Pick the candidate that saves the most bytes per second spent encoding */
+    NOZCompressionPolicyTargetBytesPerCPUSecond,
+};
+
+/**
+ A compression method and level that a `NOZCompressionPolicy` can choose
+ */
+@interface NOZCompressionPolicyCandidate : NSObject
+
+/** The method to compress with */
+@property (nonatomic, readonly) NOZCompressionMethod compressionMethod;
+/** The level to compress at */
+@property (nonatomic, readonly) NOZCompressionLevel compressionLevel;
+
+/** Designated initializer */
+- (instancetype)initWithCompressionMethod:(NOZCompressionMethod)method
+                         compressionLevel:(NOZCompressionLevel)level NS_DESIGNATED_INITIALIZER;
+
+/** Unavailable */
+- (instancetype)init NS_UNAVAILABLE;
+/** Unavailable */
++ (instancetype)new NS_UNAVAILABLE;
+
+@end
+
+/**
+ `NOZCompressionPolicy` chooses the compression method and level for entries by trial.
+
+ A sample from the start of an entry is encoded and decoded with every candidate and the best
+ candidate for the `target` wins.
+ Decisions are cached per file extension (or per content class, "text" or "binary", when there is
+ no extension) so that only the first entry of each kind pays for the trial.
+ Candidates whose method has no encoder and decoder in the `NOZCompressionLibrary` are skipped.
+ If no candidate shrinks the sample, `NOZCompressionMethodNone` is chosen.
+
+ Thread safe.
+ */
+@interface NOZCompressionPolicy : NSObject
+
+/** What the policy optimizes for */
+@property (nonatomic, readonly) NOZCompressionPolicyTarget target;
+/** The candidates to trial */
+@property (nonatomic, readonly, copy) NSArray<NOZCompressionPolicyCandidate *> *candidates;
+/** Number of bytes to sample from each entry for the trial.  Default is `64KB`. */
+@property (atomic) NSUInteger sampleSize;
+
+/**
+ Designated initializer
+
+ @param target What to optimize for.
+ @param candidates The candidates to trial.  Pass `nil` for the defaults: deflate at its minimum, default and maximum levels plus every other method registered with the `NOZCompressionLibrary` at its default level.
+ */
+- (instancetype)initWithTarget:(NOZCompressionPolicyTarget)target
+                    candidates:(nullable NSArray<NOZCompressionPolicyCandidate *> *)candidates NS_DESIGNATED_INITIALIZER;
+
+/** Same as `initWithTarget:target candidates:nil` */
+- (instancetype)initWithTarget:(NOZCompressionPolicyTarget)target;
+
+/** Unavailable */
+- (instancetype)init NS_UNAVAILABLE;
+/** Unavailable */
++ (instancetype)new NS_UNAVAILABLE;
+
+/**
+ Select the compression method and level for an entry.
+ Only entries that can be read more than once (`NOZFileZipEntry` and `NOZDataZipEntry`) are sampled,
+ other entries get the cached decision for their name's extension or keep their own method and level.
+ */
+- (void)selectCompressionMethod:(out NOZCompressionMethod *)methodOut
+                          level:(out NOZCompressionLevel *)levelOut
+                       forEntry:(id<NOZZippableEntry>)entry;
+
+/** Select the compression method and level for _entry_ and assign them to it */
+- (void)applyToEntry:(NOZAbstractZipEntry<NOZZippableEntry> *)entry;
+
+/** A block for `[NOZCompressRequest addEntriesInDirectory:filterBlock:compressionSelectionBlock:]` that selects with the receiver */
+- (NOZCompressionSelectionBlock)compressionSelectionBlock;
+
+/** Forget all cached decisions */
+- (void)resetCachedDecisions;
+
+@end
+
+NS_ASSUME_NONNULL_END
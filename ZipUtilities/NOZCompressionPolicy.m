@@ -0,0 +1,277 @@
+//
+//  NOZCompressionPolicy.m
+//  ZipUtilities
+//
+//  The MIT License (MIT)
+//
+//  Copyright (c) 2016 Nolan O'Brien
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+#import "NOZ_Project.h"
+#import "NOZCompressionLibrary.h"
+#import "NOZCompressionPolicy.h"
+#import "NOZDecoder.h"
+#import "NOZEncoder.h"
+#import "NSData+NOZAdditions.h"
+
+#include <time.h>
+
+#define kDEFAULT_SAMPLE_SIZE (64u * 1024u)
+#define kTEXT_SNIFF_SIZE (4u * 1024u)
+
+static NSString * __nullable noz_extension_key_for_entry(id<NOZZippableEntry> entry);
+static double noz_thread_cpu_time(void);
+static NSString *noz_content_class_key_for_sample(NSData *sample);
+
+@implementation NOZCompressionPolicyCandidate
+
+- (instancetype)initWithCompressionMethod:(NOZCompressionMethod)method
+                         compressionLevel:(NOZCompressionLevel)level
+{
+    if (self = [super init]) {
+        _compressionMethod = method;
+        _compressionLevel = level;
+    }
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@ %p: method=%u, level=%.2f>", NSStringFromClass([self class]), self, (unsigned int)_compressionMethod, (double)_compressionLevel];
+}
+
+@end
+
+@interface NOZCompressionPolicy (Private)
+- (nullable NOZCompressionPolicyCandidate *)private_cachedDecisionForKey:(nullable NSString *)key;
+- (void)private_cacheDecision:(NOZCompressionPolicyCandidate *)decision forKey:(NSString *)key;
+- (NOZCompressionPolicyCandidate *)private_trialSample:(NSData *)sample;
+@end
+
+@implementation NOZCompressionPolicy
+{
+    dispatch_queue_t _cacheQueue;
+    NSMutableDictionary<NSString *, NOZCompressionPolicyCandidate *> *_cachedDecisions;
+}
+
+- (instancetype)initWithTarget:(NOZCompressionPolicyTarget)target
+{
+    return [self initWithTarget:target candidates:nil];
+}
+
+- (instancetype)initWithTarget:(NOZCompressionPolicyTarget)target
+                    candidates:(nullable NSArray<NOZCompressionPolicyCandidate *> *)candidates
+{
+    if (self = [super init]) {
+        _target = target;
+        if (!candidates) {
+            NSMutableArray<NOZCompressionPolicyCandidate *> *defaultCandidates = [NSMutableArray array];
+            [defaultCandidates addObject:[[NOZCompressionPolicyCandidate alloc] initWithCompressionMethod:NOZCompressionMethodDeflate compressionLevel:NOZCompressionLevelMin]];
+            [defaultCandidates addObject:[[NOZCompressionPolicyCandidate alloc] initWithCompressionMethod:NOZCompressionMethodDeflate compressionLevel:NOZCompressionLevelDefault]];
+            [defaultCandidates addObject:[[NOZCompressionPolicyCandidate alloc] initWithCompressionMethod:NOZCompressionMethodDeflate compressionLevel:NOZCompressionLevelMax]];
+            NSArray<NSNumber *> *methods = [[NOZCompressionLibrary sharedInstance].allEncoders.allKeys sortedArrayUsingSelector:@selector(compare:)];
+            for (NSNumber *method in methods) {
+                const NOZCompressionMethod compressionMethod = (NOZCompressionMethod)method.unsignedShortValue;
+                if (NOZCompressionMethodNone == compressionMethod || NOZCompressionMethodDeflate == compressionMethod) {
+                    continue;
+                }
+                [defaultCandidates addObject:[[NOZCompressionPolicyCandidate alloc] initWithCompressionMethod:compressionMethod compressionLevel:NOZCompressionLevelDefault]];
+            }
+            candidates = defaultCandidates;
+        }
+        _candidates = [candidates copy];
+        _sampleSize = kDEFAULT_SAMPLE_SIZE;
+        _cacheQueue = dispatch_queue_create("com.ziputilities.compression.policy", DISPATCH_QUEUE_SERIAL);
+        _cachedDecisions = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)selectCompressionMethod:(out NOZCompressionMethod *)methodOut
+                          level:(out NOZCompressionLevel *)levelOut
+                       forEntry:(id<NOZZippableEntry>)entry
+{
+    NSString *key = noz_extension_key_for_entry(entry);
+    NOZCompressionPolicyCandidate *decision = [self private_cachedDecisionForKey:key];
+
+    if (!decision) {
+        NSData *sample = noz_sample_for_entry(entry, self.sampleSize);
+        if (sample.length > 0) {
+            if (!key) {
+                key = noz_content_class_key_for_sample(sample);
+                decision = [self private_cachedDecisionForKey:key];
+            }
+            if (!decision) {
+                decision = [self private_trialSample:sample];
+                [self private_cacheDecision:decision forKey:key];
+            }
+        }
+    }
+
+    if (decision) {
+        *methodOut = decision.compressionMethod;
+        *levelOut = decision.compressionLevel;
+    } else {
+        *methodOut = entry.compressionMethod;
+        *levelOut = entry.compressionLevel;
+    }
+}
+
+- (void)applyToEntry:(NOZAbstractZipEntry<NOZZippableEntry> *)entry
+{
+    NOZCompressionMethod method;
+    NOZCompressionLevel level;
+    [self selectCompressionMethod:&method level:&level forEntry:entry];
+    entry.compressionMethod = method;
+    entry.compressionLevel = level;
+}
+
+- (NOZCompressionSelectionBlock)compressionSelectionBlock
+{
+    return ^(NSString *filePath, NOZCompressionMethod *compressionMethodOut, NOZCompressionLevel *compressionLevelOut) {
+        NOZFileZipEntry *entry = [[NOZFileZipEntry alloc] initWithFilePath:filePath];
+        entry.compressionMethod = *compressionMethodOut;
+        entry.compressionLevel = *compressionLevelOut;
+        [self selectCompressionMethod:compressionMethodOut level:compressionLevelOut forEntry:entry];
+    };
+}
+
+- (void)resetCachedDecisions
+{
+    dispatch_sync(_cacheQueue, ^{
+        [self->_cachedDecisions removeAllObjects];
+    });
+}
+
+@end
+
+@implementation NOZCompressionPolicy (Private)
+
+- (nullable NOZCompressionPolicyCandidate *)private_cachedDecisionForKey:(nullable NSString *)key
+{
+    if (!key) {
+        return nil;
+    }
+
+    __block NOZCompressionPolicyCandidate *decision;
+    dispatch_sync(_cacheQueue, ^{
+        decision = self->_cachedDecisions[key];
+    });
+    return decision;
+}
+
+- (void)private_cacheDecision:(NOZCompressionPolicyCandidate *)decision forKey:(NSString *)key
+{
+    dispatch_sync(_cacheQueue, ^{
+        self->_cachedDecisions[key] = decision;
+    });
+}
+
+- (NOZCompressionPolicyCandidate *)private_trialSample:(NSData *)sample
+{
+    NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+    NOZCompressionPolicyCandidate *bestCandidate = nil;
+    double bestScore = 0;
+
+    for (NOZCompressionPolicyCandidate *candidate in _candidates) {
+        if (NOZCompressionMethodNone == candidate.compressionMethod) {
+            continue;
+        }
+
+        id<NOZEncoder> encoder = [library encoderForMethod:candidate.compressionMethod];
+        id<NOZDecoder> decoder = [library decoderForMethod:candidate.compressionMethod];
+        if (!encoder || !decoder) {
+            continue;
+        }
+
+        // CPU time of this thread, so other busy threads don't make a candidate look slow
+        double startTime = noz_thread_cpu_time();
+        NSData *encoded = [sample noz_dataByCompressing:encoder compressionLevel:candidate.compressionLevel];
+        const double encodeDuration = noz_thread_cpu_time() - startTime;
+        if (!encoded || encoded.length >= sample.length) {
+            continue;
+        }
+
+        startTime = noz_thread_cpu_time();
+        NSData *decoded = [encoded noz_dataByDecompressing:decoder];
+        const double decodeDuration = noz_thread_cpu_time() - startTime;
+        if (!decoded || ![decoded isEqualToData:sample]) {
+            continue;
+        }
+
+        // higher is better
+        double score;
+        switch (_target) {
+            case NOZCompressionPolicyTargetMinimumDecodeTime:
+                score = -decodeDuration;
+                break;
+            case NOZCompressionPolicyTargetBytesPerCPUSecond:
+                score = (double)(sample.length - encoded.length) / MAX(encodeDuration, 1e-6);
+                break;
+            case NOZCompressionPolicyTargetMaximumRatio:
+            default:
+                score = -(double)encoded.length;
+                break;
+        }
+
+        if (!bestCandidate || score > bestScore) {
+            bestCandidate = candidate;
+            bestScore = score;
+        }
+    }
+
+    return bestCandidate ?: [[NOZCompressionPolicyCandidate alloc] initWithCompressionMethod:NOZCompressionMethodNone compressionLevel:NOZCompressionLevelDefault];
+}
+
+@end
+
+static double noz_thread_cpu_time(void)
+{
+    struct timespec time;
+    if (0 != clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time)) {
+        return 0;
+    }
+    return (double)time.tv_sec + ((double)time.tv_nsec / NSEC_PER_SEC);
+}
+
+static NSString * __nullable noz_extension_key_for_entry(id<NOZZippableEntry> entry)
+{
+    NSString *extension = entry.name.pathExtension.lowercaseString;
+    return (extension.length > 0) ? [@"ext:" stringByAppendingString:extension] : nil;
+}
+
+static NSString *noz_content_class_key_for_sample(NSData *sample)
+{
+    const Byte *bytes = sample.bytes;
+    const size_t length = MIN(sample.length, (NSUInteger)kTEXT_SNIFF_SIZE);
+    size_t textBytes = 0;
+    for (size_t i = 0; i < length; i++) {
+        const Byte b = bytes[i];
+        if (b == 0) {
+            return @"class:binary";
+        }
+        // printable ASCII, common whitespace and anything that could be part of a UTF-8 sequence
+        if ((b >= 0x20 && b != 0x7F) || b == '\n' || b == '\r' || b == '\t') {
+            textBytes++;
+        }
+    }
+    return (textBytes * 10 >= length * 9) ? @"class:text" : @"class:binary";
+}
@@ -84,4 +84,43 @@
  */
 - (BOOL)finalizeDecoderContext:(nonnull id<NOZDecoderContext>)context;
 
+@optional
+
+/**
+ (optional) Prepare a finalized _context_ for another decoding process, keeping its buffers and codec state,
+ as if it was just created with the given _flags_ and _callback_.
+ Implement this when creating contexts is expensive so that `NOZCompressionLibrary` pools them.
+ Return `NO` if the _context_ can't be reused, a new context is created instead.
+ */
+- (BOOL)reuseContext:(nonnull id<NOZDecoderContext>)context
+        withBitFlags:(UInt16)flags
+       flushCallback:(nonnull NOZFlushCallback)callback;
+
+/**
+ (optional) Return a decoder like this one that decompresses with the given _dictionaryData_.
+ Used by `NOZUnzipper` for archives that embed a dictionary (see `NOZEncoder`'s `encoderWithDictionaryData:`).
+ */
+- (nullable id<NOZDecoder>)decoderWithDictionaryData:(nonnull NSData *)dictionaryData;
+
+/**
+ (optional) Decode all of _bytes_ in a single call, without flush callbacks.
+ Used when the decoded size is known and small (see `NOZSingleCallCodingMaximumLength`) and the decoder implements it.
+ The _context_ is a new (or reused) context that was not initialized, it provides the bit flags and
+ its codec state is used for the call so that pooled contexts serve single calls too.
+ The _context_ is left finalized and its flush callback is never called.
+ @param bytes The bytes to decode, a complete encoded stream
+ @param length The number of _bytes_
+ @param buffer The buffer to decode into
+ @param capacity The size of _buffer_
+ @param decodedLength The number of bytes decoded into _buffer_
+ @param context The context to decode with
+ @return `YES` on success, `NO` on failure (including when _buffer_ is too small)
+ */
+- (BOOL)decodeBytes:(nonnull const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(nonnull Byte *)buffer
+           capacity:(size_t)capacity
+      decodedLength:(nonnull size_t *)decodedLength
+            context:(nonnull id<NOZDecoderContext>)context;
+
 @end
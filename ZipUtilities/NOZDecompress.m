@@ -285,7 +285,7 @@ typedef NS_ENUM(NSUInteger, NOZDecompressStep)
     [_unzipper enumerateManifestEntriesUsingBlock:^(NOZCentralDirectoryRecord * __nonnull record, NSUInteger index, BOOL * __nonnull stop) {
 
         // Skip these entries
-        if (record.isZeroLength || record.isMacOSXDSStore || record.isMacOSXAttribute) {
+        if (record.isZeroLength || record.isMacOSXDSStore || record.isMacOSXAttribute || record.isCompressionDictionary) {
             return;
         }
 
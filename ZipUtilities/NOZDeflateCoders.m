@@ -28,27 +28,35 @@
 #import "NOZ_Project.h"
 #import "NOZDecoder.h"
 #import "NOZEncoder.h"
+#import "NOZParallelDeflateEncoder.h"
 #import "NOZUtils_Project.h"
 #import "NOZZipEntry.h"
 
 #include "zlib.h"
 
 #define kDEFLATE_DEFAULT_COMPRESSION_LEVEL (6)
+#define kDEFLATE_DICTIONARY_SIZE (32 * 1024)
+#define kPARALLEL_DEFLATE_DEFAULT_BLOCK_SIZE (128 * 1024)
+#define kPARALLEL_DEFLATE_MAX_BLOCK_SIZE (64 * 1024 * 1024)
 
 #pragma mark - Deflate Encoder
 
 static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level);
+static UInt16 NOZDeflateBitFlagsForEntry(id<NOZEncoder> encoder, id<NOZZipEntry> entry);
 
 @interface NOZDeflateEncoderContext : NSObject <NOZEncoderContext>
 @property (nonatomic, copy, nullable) NOZFlushCallback flushCallback;
 @property (nonatomic) int compressionLevel;
 @property (nonatomic) BOOL zStreamOpen;
+@property (nonatomic) BOOL zStreamAllocated;
 
 @property (nonatomic, readonly) z_stream *zStream;
 @property (nonatomic, readonly) Byte *compressedDataBuffer;
 @property (nonatomic, readonly) size_t compressedDataBufferSize;
 @property (nonatomic) size_t compressedDataPosition;
 @property (nonatomic) BOOL encodedDataWasText;
+
+- (void)prepareForReuse;
 @end
 
 @implementation NOZDeflateEncoderContext
@@ -86,11 +94,20 @@ static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level);
 - (void)dealloc
 {
     free(_compressedDataBuffer);
-    if (_zStreamOpen) {
+    if (_zStreamAllocated) {
         deflateEnd(&_zStream);
     }
 }
 
+- (void)prepareForReuse
+{
+    _zStream.avail_in = 0;
+    _zStream.avail_out = (UInt32)_compressedDataBufferSize;
+    _zStream.next_out = _compressedDataBuffer;
+    _compressedDataPosition = 0;
+    _encodedDataWasText = NO;
+}
+
 @end
 
 @implementation NOZDeflateEncoder
@@ -107,18 +124,7 @@ static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level);
 
 - (UInt16)bitFlagsForEntry:(id<NOZZipEntry>)entry
 {
-    const NSUInteger level = NOZCompressionLevelToEncoderSpecificLevel(self, entry.compressionLevel);
-    switch (level) {
-        case Z_BEST_COMPRESSION:
-        case Z_BEST_COMPRESSION - 1:
-            return NOZFlagBitsMaxDeflate;
-        case Z_BEST_SPEED + 1:
-            return NOZFlagBitsFastDeflate;
-        case Z_BEST_SPEED:
-            return NOZFlagBitsSuperFastDeflate;
-        default:
-            return NOZFlagBitsNormalDeflate;
-    }
+    return NOZDeflateBitFlagsForEntry(self, entry);
 }
 
 - (NOZDeflateEncoderContext *)createContextWithBitFlags:(UInt16)bitFlags
@@ -131,17 +137,38 @@ static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level);
     return context;
 }
 
-- (BOOL)initializeEncoderContext:(NOZDeflateEncoderContext *)context
+- (BOOL)reuseContext:(NOZDeflateEncoderContext *)context
+        withBitFlags:(UInt16)bitFlags
+       flushCallback:(NOZFlushCallback)callback
 {
-    if (Z_OK != deflateInit2(context.zStream,
-                             context.compressionLevel,
-                             Z_DEFLATED,
-                             -MAX_WBITS,
-                             8 /* default memory level */,
-                             Z_DEFAULT_STRATEGY)) {
+    if (context.zStreamOpen || !context.compressedDataBuffer) {
         return NO;
     }
 
+    [context prepareForReuse];
+    context.flushCallback = callback;
+    return YES;
+}
+
+- (BOOL)initializeEncoderContext:(NOZDeflateEncoderContext *)context
+{
+    if (context.zStreamAllocated) {
+        // reused, the deflate state only needs a reset (keeping the same level)
+        if (Z_OK != deflateReset(context.zStream)) {
+            return NO;
+        }
+    } else {
+        if (Z_OK != deflateInit2(context.zStream,
+                                 context.compressionLevel,
+                                 Z_DEFLATED,
+                                 -MAX_WBITS,
+                                 8 /* default memory level */,
+                                 Z_DEFAULT_STRATEGY)) {
+            return NO;
+        }
+        context.zStreamAllocated = YES;
+    }
+
     context.zStreamOpen = YES;
     return YES;
 }
@@ -231,16 +258,367 @@ static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level);
 
     context.encodedDataWasText = (zStream->data_type == Z_ASCII);
 
-    do {
-        int err = deflateEnd(zStream);
-        if (success) {
-            success = (err == Z_OK);
+    // the deflate state is kept until dealloc, in case the context gets reused
+    context.zStreamOpen = NO;
+    context.flushCallback = NULL;
+
+    return success;
+}
+
+- (size_t)maximumEncodedLengthForLength:(size_t)length
+{
+    // zlib's bound covers its 6 byte wrapper, which raw deflate doesn't have
+    return (size_t)compressBound((uLong)length);
+}
+
+- (BOOL)encodeBytes:(const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(Byte *)buffer
+           capacity:(size_t)capacity
+      encodedLength:(size_t *)encodedLength
+            context:(NOZDeflateEncoderContext *)context
+{
+    if (length > UINT32_MAX || capacity > UINT32_MAX) {
+        return NO;
+    }
+
+    // same deflate state as streaming, so a pooled context only needs a reset
+    if (![self initializeEncoderContext:context]) {
+        return NO;
+    }
+
+    z_stream *zStream = context.zStream;
+    zStream->next_in = (Byte *)bytes;
+    zStream->avail_in = (uInt)length;
+    zStream->next_out = buffer;
+    zStream->avail_out = (uInt)capacity;
+
+    const BOOL success = (Z_STREAM_END == deflate(zStream, Z_FINISH));
+    *encodedLength = (size_t)zStream->total_out;
+
+    // don't keep pointers into the caller's memory
+    zStream->next_in = NULL;
+    [context prepareForReuse];
+    context.encodedDataWasText = (zStream->data_type == Z_ASCII);
+    context.zStreamOpen = NO;
+    context.flushCallback = NULL;
+
+    return success;
+}
+
+@end
+
+#pragma mark - Parallel Deflate Encoder
+
+@interface NOZParallelDeflateBlock : NSObject
+@property (nonatomic, readonly, nonnull) NSData *uncompressedData;
+@property (nonatomic, readonly, nullable) NSData *dictionaryData;
+@property (nonatomic, readonly) BOOL isLastBlock;
+@property (nonatomic, readonly) int compressionLevel;
+
+@property (nonatomic, readonly, nullable) NSMutableData *compressedData;
+@property (nonatomic, readonly) UInt32 crc32;
+@property (nonatomic, readonly) BOOL success;
+@property (nonatomic, readonly) BOOL wasText;
+@property (nonatomic, nullable) NSOperation *operation;
+
+- (nonnull instancetype)initWithUncompressedData:(nonnull NSData *)uncompressedData
+                                  dictionaryData:(nullable NSData *)dictionaryData
+                                compressionLevel:(int)level
+                                     isLastBlock:(BOOL)isLastBlock;
+- (void)compress;
+@end
+
+@interface NOZParallelDeflateEncoderContext : NSObject <NOZEncoderContext>
+@property (nonatomic, copy, nullable) NOZFlushCallback flushCallback;
+@property (nonatomic) int compressionLevel;
+@property (nonatomic) BOOL encodedDataWasText;
+@property (nonatomic) UInt32 uncompressedCRC32;
+@property (nonatomic) BOOL hasEncodedBytes;
+@property (nonatomic) BOOL failureEncountered;
+
+@property (nonatomic, nullable) NSOperationQueue *blockQueue;
+@property (nonatomic, readonly, nonnull) NSMutableArray<NOZParallelDeflateBlock *> *pendingBlocks;
+@property (nonatomic, nullable) NSMutableData *currentBlockData;
+@property (nonatomic, nullable) NSData *previousBlockData;
+@end
+
+@implementation NOZParallelDeflateBlock
+
+- (instancetype)initWithUncompressedData:(NSData *)uncompressedData
+                          dictionaryData:(NSData *)dictionaryData
+                        compressionLevel:(int)level
+                             isLastBlock:(BOOL)isLastBlock
+{
+    if (self = [super init]) {
+        _uncompressedData = uncompressedData;
+        _dictionaryData = dictionaryData;
+        _compressionLevel = level;
+        _isLastBlock = isLastBlock;
+    }
+    return self;
+}
+
+- (void)compress
+{
+    z_stream zStream;
+    zStream.zalloc = NULL;
+    zStream.zfree = NULL;
+    zStream.opaque = NULL;
+    zStream.data_type = Z_BINARY;
+
+    if (Z_OK != deflateInit2(&zStream,
+                             _compressionLevel,
+                             Z_DEFLATED,
+                             -MAX_WBITS,
+                             8 /* default memory level */,
+                             Z_DEFAULT_STRATEGY)) {
+        return;
+    }
+
+    BOOL success = YES;
+    if (_dictionaryData.length > 0) {
+        success = (Z_OK == deflateSetDictionary(&zStream, _dictionaryData.bytes, (uInt)_dictionaryData.length));
+    }
+
+    if (success) {
+        // a sync flush appends an empty stored block, leave room for it beyond the bound
+        const uLong bound = deflateBound(&zStream, (uLong)_uncompressedData.length) + 16;
+        _compressedData = [[NSMutableData alloc] initWithLength:(NSUInteger)bound];
+
+        zStream.next_in = (Byte *)_uncompressedData.bytes;
+        zStream.avail_in = (uInt)_uncompressedData.length;
+        zStream.next_out = _compressedData.mutableBytes;
+        zStream.avail_out = (uInt)bound;
+
+        // Non-final blocks end byte aligned (and not marked as last) so that they can be concatenated
+        const int err = deflate(&zStream, (_isLastBlock) ? Z_FINISH : Z_SYNC_FLUSH);
+        if (_isLastBlock) {
+            success = (err == Z_STREAM_END);
+        } else {
+            success = (err == Z_OK && zStream.avail_in == 0 && zStream.avail_out > 0);
+        }
+
+        _compressedData.length = (NSUInteger)zStream.total_out;
+        _wasText = (zStream.data_type == Z_ASCII);
+    }
+
+    deflateEnd(&zStream);
+
+    if (success) {
+        _crc32 = noz_crc32(0, _uncompressedData.bytes, _uncompressedData.length);
+    } else {
+        _compressedData = nil;
+    }
+    _success = success;
+}
+
+@end
+
+@implementation NOZParallelDeflateEncoderContext
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _pendingBlocks = [[NSMutableArray alloc] init];
+        _compressionLevel = kDEFLATE_DEFAULT_COMPRESSION_LEVEL;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_blockQueue cancelAllOperations];
+    [_blockQueue waitUntilAllOperationsAreFinished];
+}
+
+@end
+
+@interface NOZParallelDeflateEncoder (Private)
+- (void)private_enqueueCurrentBlockForContext:(nonnull NOZParallelDeflateEncoderContext *)context isLastBlock:(BOOL)isLastBlock;
+- (BOOL)private_flushFinishedBlocksForContext:(nonnull NOZParallelDeflateEncoderContext *)context waitForAll:(BOOL)waitForAll;
+@end
+
+@implementation NOZParallelDeflateEncoder
+
+- (instancetype)init
+{
+    return [self initWithMaxConcurrentBlocks:0 blockSize:0];
+}
+
+- (instancetype)initWithMaxConcurrentBlocks:(NSUInteger)maxConcurrentBlocks blockSize:(size_t)blockSize
+{
+    if (self = [super init]) {
+        if (!maxConcurrentBlocks) {
+            maxConcurrentBlocks = MAX([NSProcessInfo processInfo].activeProcessorCount, (NSUInteger)1);
         }
-        context.zStreamOpen = NO;
+        if (!blockSize) {
+            blockSize = kPARALLEL_DEFLATE_DEFAULT_BLOCK_SIZE;
+        } else if (blockSize < kDEFLATE_DICTIONARY_SIZE) {
+            blockSize = kDEFLATE_DICTIONARY_SIZE;
+        } else if (blockSize > kPARALLEL_DEFLATE_MAX_BLOCK_SIZE) {
+            blockSize = kPARALLEL_DEFLATE_MAX_BLOCK_SIZE;
+        }
+        _maxConcurrentBlocks = maxConcurrentBlocks;
+        _blockSize = blockSize;
+    }
+    return self;
+}
+
+- (NSUInteger)numberOfCompressionLevels
+{
+    return 1 + Z_BEST_COMPRESSION - Z_BEST_SPEED;
+}
+
+- (NSUInteger)defaultCompressionLevel
+{
+    return kDEFLATE_DEFAULT_COMPRESSION_LEVEL;
+}
+
+- (UInt16)bitFlagsForEntry:(id<NOZZipEntry>)entry
+{
+    return NOZDeflateBitFlagsForEntry(self, entry);
+}
+
+- (NOZParallelDeflateEncoderContext *)createContextWithBitFlags:(UInt16)bitFlags
+                                               compressionLevel:(NOZCompressionLevel)level
+                                                  flushCallback:(NOZFlushCallback)callback
+{
+    NOZParallelDeflateEncoderContext *context = [[NOZParallelDeflateEncoderContext alloc] init];
+    context.flushCallback = callback;
+    context.compressionLevel = NOZCompressionLevelToDeflateLevel(level);
+    return context;
+}
+
+- (BOOL)initializeEncoderContext:(NOZParallelDeflateEncoderContext *)context
+{
+    if (context.blockQueue) {
+        return NO;
+    }
+
+    NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+    queue.name = @"NOZParallelDeflateEncoder.blockQueue";
+    queue.maxConcurrentOperationCount = (NSInteger)_maxConcurrentBlocks;
+    context.blockQueue = queue;
+    context.currentBlockData = [[NSMutableData alloc] initWithCapacity:_blockSize];
+    return YES;
+}
+
+- (BOOL)encodeBytes:(const Byte*)bytes
+             length:(size_t)length
+            context:(NOZParallelDeflateEncoderContext *)context
+{
+    if (!context.blockQueue || context.failureEncountered) {
+        return NO;
+    }
+
+    while (length > 0) {
+        NSMutableData *blockData = context.currentBlockData;
+        const size_t bytesToCopy = MIN(length, _blockSize - blockData.length);
+        [blockData appendBytes:bytes length:bytesToCopy];
+        bytes += bytesToCopy;
+        length -= bytesToCopy;
+
+        if (blockData.length == _blockSize) {
+            [self private_enqueueCurrentBlockForContext:context isLastBlock:NO];
+            if (![self private_flushFinishedBlocksForContext:context waitForAll:NO]) {
+                return NO;
+            }
+        }
+    }
+
+    return YES;
+}
+
+- (BOOL)finalizeEncoderContext:(NOZParallelDeflateEncoderContext *)context
+{
+    if (!context.blockQueue) {
+        return NO;
+    }
+
+    noz_defer(^{
+        context.blockQueue = nil;
+        context.currentBlockData = nil;
+        context.previousBlockData = nil;
         context.flushCallback = NULL;
-    } while (0);
+    });
 
-    return success;
+    if (context.failureEncountered) {
+        [context.blockQueue cancelAllOperations];
+        [context.blockQueue waitUntilAllOperationsAreFinished];
+        return NO;
+    }
+
+    // Always enqueue a last block (even if empty) so the stream is terminated
+    [self private_enqueueCurrentBlockForContext:context isLastBlock:YES];
+    return [self private_flushFinishedBlocksForContext:context waitForAll:YES];
+}
+
+@end
+
+@implementation NOZParallelDeflateEncoder (Private)
+
+- (void)private_enqueueCurrentBlockForContext:(NOZParallelDeflateEncoderContext *)context isLastBlock:(BOOL)isLastBlock
+{
+    NSData *blockData = context.currentBlockData;
+    NSData *previousData = context.previousBlockData;
+    NSData *dictionaryData = nil;
+    if (previousData.length > 0) {
+        const NSUInteger dictionarySize = MIN(previousData.length, (NSUInteger)kDEFLATE_DICTIONARY_SIZE);
+        dictionaryData = [previousData subdataWithRange:NSMakeRange(previousData.length - dictionarySize, dictionarySize)];
+    }
+
+    NOZParallelDeflateBlock *block = [[NOZParallelDeflateBlock alloc] initWithUncompressedData:blockData
+                                                                               dictionaryData:dictionaryData
+                                                                             compressionLevel:context.compressionLevel
+                                                                                  isLastBlock:isLastBlock];
+    __unsafe_unretained NOZParallelDeflateBlock *rawBlock = block;
+    block.operation = [NSBlockOperation blockOperationWithBlock:^{
+        [rawBlock compress];
+    }];
+
+    [context.pendingBlocks addObject:block];
+    [context.blockQueue addOperation:block.operation];
+
+    context.previousBlockData = blockData;
+    context.currentBlockData = (isLastBlock) ? nil : [[NSMutableData alloc] initWithCapacity:_blockSize];
+}
+
+- (BOOL)private_flushFinishedBlocksForContext:(NOZParallelDeflateEncoderContext *)context waitForAll:(BOOL)waitForAll
+{
+    NSMutableArray<NOZParallelDeflateBlock *> *pendingBlocks = context.pendingBlocks;
+    // Keep enough blocks in flight to saturate the workers without buffering the whole source
+    const NSUInteger maxPendingBlocks = _maxConcurrentBlocks * 2;
+
+    while (pendingBlocks.count > 0) {
+        NOZParallelDeflateBlock *block = pendingBlocks.firstObject;
+        if (!block.operation.isFinished) {
+            if (!waitForAll && pendingBlocks.count < maxPendingBlocks) {
+                break;
+            }
+            [block.operation waitUntilFinished];
+        }
+        [pendingBlocks removeObjectAtIndex:0];
+
+        if (!block.success) {
+            context.failureEncountered = YES;
+            return NO;
+        }
+
+        NSData *compressedData = block.compressedData;
+        if (compressedData.length > 0 && !context.flushCallback(self, context, compressedData.bytes, compressedData.length)) {
+            context.failureEncountered = YES;
+            return NO;
+        }
+
+        context.uncompressedCRC32 = noz_crc32_combine(context.uncompressedCRC32, block.crc32, (UInt64)block.uncompressedData.length);
+        if (block.uncompressedData.length > 0) {
+            context.encodedDataWasText = (context.hasEncodedBytes) ? (context.encodedDataWasText && block.wasText) : block.wasText;
+            context.hasEncodedBytes = YES;
+        }
+    }
+
+    return YES;
 }
 
 @end
@@ -250,6 +628,7 @@ static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level);
 @interface NOZDeflateDecoderContext : NSObject <NOZDecoderContext>
 @property (nonatomic, copy, nullable) NOZFlushCallback flushCallback;
 @property (nonatomic) BOOL zStreamOpen;
+@property (nonatomic) BOOL zStreamAllocated;
 @property (nonatomic) BOOL hasFinished;
 
 @property (nonatomic, readonly) z_stream *zStream;
@@ -284,7 +663,7 @@ static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level);
 - (void)dealloc
 {
     free(_decompressedDataBuffer);
-    if (_zStreamOpen) {
+    if (_zStreamAllocated) {
         inflateEnd(&_zStream);
     }
 }
@@ -326,11 +705,34 @@ static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level);
     return context;
 }
 
-- (BOOL)initializeDecoderContext:(NOZDeflateDecoderContext *)context
+- (BOOL)reuseContext:(NOZDeflateDecoderContext *)context
+        withBitFlags:(UInt16)flags
+       flushCallback:(NOZFlushCallback)callback
 {
-    if (Z_OK != inflateInit2(context.zStream, -MAX_WBITS)) {
+    // the decompression buffer is dropped when it can't grow any further
+    if (context.zStreamOpen || !context.decompressedDataBuffer) {
         return NO;
     }
+
+    context.zStream->next_in = NULL;
+    context.zStream->avail_in = 0;
+    context.hasFinished = NO;
+    context.flushCallback = callback;
+    return YES;
+}
+
+- (BOOL)initializeDecoderContext:(NOZDeflateDecoderContext *)context
+{
+    if (context.zStreamAllocated) {
+        if (Z_OK != inflateReset(context.zStream)) {
+            return NO;
+        }
+    } else {
+        if (Z_OK != inflateInit2(context.zStream, -MAX_WBITS)) {
+            return NO;
+        }
+        context.zStreamAllocated = YES;
+    }
     context.zStreamOpen = YES;
     return YES;
 }
@@ -410,16 +812,66 @@ static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level);
 
 - (BOOL)finalizeDecoderContext:(NOZDeflateDecoderContext *)context
 {
-    if (context.zStreamOpen) {
-        inflateEnd(context.zStream);
-        context.zStreamOpen = NO;
-    }
+    // the inflate state is kept until dealloc, in case the context gets reused
+    context.zStreamOpen = NO;
+    context.flushCallback = NULL;
     return YES;
 }
 
+- (BOOL)decodeBytes:(const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(Byte *)buffer
+           capacity:(size_t)capacity
+      decodedLength:(size_t *)decodedLength
+            context:(NOZDeflateDecoderContext *)context
+{
+    if (length > UINT32_MAX || capacity > UINT32_MAX) {
+        return NO;
+    }
+
+    if (![self initializeDecoderContext:context]) {
+        return NO;
+    }
+
+    z_stream *zStream = context.zStream;
+    zStream->next_in = (Byte *)bytes;
+    zStream->avail_in = (uInt)length;
+    zStream->next_out = buffer;
+    zStream->avail_out = (uInt)capacity;
+
+    // anything short of the end of the stream means the buffer was too small or the data is corrupt
+    const BOOL success = (Z_STREAM_END == inflate(zStream, Z_FINISH));
+    *decodedLength = (size_t)zStream->total_out;
+
+    // don't keep pointers into the caller's memory
+    zStream->next_in = NULL;
+    zStream->avail_in = 0;
+    zStream->next_out = NULL;
+    zStream->avail_out = 0;
+    context.hasFinished = YES;
+
+    return [self finalizeDecoderContext:context] && success;
+}
+
 @end
 
 static UInt16 NOZCompressionLevelToDeflateLevel(NOZCompressionLevel level)
 {
     return (UInt16)NOZCompressionLevelToCustomEncoderLevel(level, Z_BEST_SPEED, Z_BEST_COMPRESSION, kDEFLATE_DEFAULT_COMPRESSION_LEVEL);
 }
+
+static UInt16 NOZDeflateBitFlagsForEntry(id<NOZEncoder> encoder, id<NOZZipEntry> entry)
+{
+    const NSUInteger level = NOZCompressionLevelToEncoderSpecificLevel(encoder, entry.compressionLevel);
+    switch (level) {
+        case Z_BEST_COMPRESSION:
+        case Z_BEST_COMPRESSION - 1:
+            return NOZFlagBitsMaxDeflate;
+        case Z_BEST_SPEED + 1:
+            return NOZFlagBitsFastDeflate;
+        case Z_BEST_SPEED:
+            return NOZFlagBitsSuperFastDeflate;
+        default:
+            return NOZFlagBitsNormalDeflate;
+    }
+}
@@ -37,6 +37,16 @@
 @protocol NOZEncoderContext <NSObject>
 /** return `YES` if the encoded data was known to be text.  `NO` otherwise. */
 - (BOOL)encodedDataWasText;
+
+@optional
+
+/**
+ (optional) The CRC-32 of all the bytes that were encoded.
+ Implement this if the encoder already checksums its input (e.g. in parallel while encoding)
+ so that callers can skip computing it themselves.  Only valid after finalizing the context.
+ */
+- (UInt32)uncompressedCRC32;
+
 @end
 
 
@@ -97,4 +107,60 @@
  */
 - (NSUInteger)defaultCompressionLevel;
 
+/**
+ (optional) Prepare a finalized _context_ for another encoding process, keeping its buffers and codec state,
+ as if it was just created with the same compression level and the given _bitFlags_ and _callback_.
+ Implement this when creating contexts is expensive so that `NOZCompressionLibrary` pools them.
+ Return `NO` if the _context_ can't be reused, a new context is created instead.
+ */
+- (BOOL)reuseContext:(nonnull id<NOZEncoderContext>)context
+        withBitFlags:(UInt16)bitFlags
+       flushCallback:(nonnull NOZFlushCallback)callback;
+
+/**
+ (optional) Train a dictionary for compressing content like the given _samples_.
+ Implement this (along with `encoderWithDictionaryData:`) if the encoder supports dictionaries
+ so that `NOZZipper` can train one from the entries it is zipping.
+ @param samples The samples of content to train with
+ @param maximumSize The maximum size in bytes for the dictionary
+ @return the trained dictionary or `nil` if one could not be trained (such as with too few samples)
+ */
+- (nullable NSData *)trainDictionaryWithSamples:(nonnull NSArray<NSData *> *)samples
+                                    maximumSize:(size_t)maximumSize;
+
+/**
+ (optional) Return an encoder like this one that compresses with the given _dictionaryData_.
+ The decoder for the same compression method must implement `decoderWithDictionaryData:`.
+ */
+- (nullable id<NOZEncoder>)encoderWithDictionaryData:(nonnull NSData *)dictionaryData;
+
+/**
+ (optional) The most bytes encoding _length_ bytes in a single call can produce
+ (e.g. `compressBound` for DEFLATE or `ZSTD_compressBound` for zstd).
+ Implement this along with `encodeBytes:length:toBuffer:capacity:encodedLength:context:`.
+ */
+- (size_t)maximumEncodedLengthForLength:(size_t)length;
+
+/**
+ (optional) Encode all of _bytes_ in a single call, without flush callbacks.
+ Used for small entries and data (see `NOZSingleCallCodingMaximumLength`) when the encoder implements it,
+ the output must be the same format as encoding the bytes with `encodeBytes:length:context:`.
+ The _context_ is a new (or reused) context that was not initialized, it provides the bit flags and
+ compression level and its codec state is used for the call so that pooled contexts serve single calls too.
+ The _context_ is left finalized, with `encodedDataWasText` set, and its flush callback is never called.
+ @param bytes The bytes to encode
+ @param length The number of _bytes_
+ @param buffer The buffer to encode into
+ @param capacity The size of _buffer_, at least `maximumEncodedLengthForLength:` of _length_
+ @param encodedLength The number of bytes encoded into _buffer_
+ @param context The context to encode with
+ @return `YES` on success, `NO` on failure
+ */
+- (BOOL)encodeBytes:(nonnull const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(nonnull Byte *)buffer
+           capacity:(size_t)capacity
+      encodedLength:(nonnull size_t *)encodedLength
+            context:(nonnull id<NOZEncoderContext>)context;
+
 @end
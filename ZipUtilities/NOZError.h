@@ -116,7 +116,7 @@ typedef NS_ENUM(NSInteger, NOZErrorCode)
     NOZErrorCodeZipFailedToWriteZip,
     /** Zipper couldn't open a new entry */
     NOZErrorCodeZipCannotOpenNewEntry,
-    /** Zipper doesn't support 64-bit file sizes */
+    /** Zipper entry outgrew 32-bit sizes without having been prepared for Zip64 (`sizeInBytes` was inaccurate) */
     NOZErrorCodeZipDoesNotSupportZip64,
     /** Zipper doesn't support a particular compression method */
     NOZErrorCodeZipDoesNotSupportCompressionMethod,
@@ -124,6 +124,8 @@ typedef NS_ENUM(NSInteger, NOZErrorCode)
     NOZErrorCodeZipFailedToWriteEntry,
     /** An entry failed to be compressed */
     NOZErrorCodeZipFailedToCompressEntry,
+    /** Zipper couldn't train a compression dictionary (too few samples, or entries were already added) */
+    NOZErrorCodeZipCannotTrainDictionary,
 
     /** Unknown unzip error */
     NOZErrorCodeUnzipUnknown = NOZErrorPageUnzip * NOZErrorPageSize,
@@ -65,6 +65,7 @@ NSString *NOZErrorCodeToString(NOZErrorCode code)
             SWITCH_CASE(NOZErrorCodeZipDoesNotSupportCompressionMethod);
             SWITCH_CASE(NOZErrorCodeZipFailedToWriteEntry);
             SWITCH_CASE(NOZErrorCodeZipFailedToCompressEntry);
+            SWITCH_CASE(NOZErrorCodeZipCannotTrainDictionary);
 
             SWITCH_CASE(NOZErrorCodeUnzipUnknown);
             SWITCH_CASE(NOZErrorCodeUnzipCannotOpenZip);
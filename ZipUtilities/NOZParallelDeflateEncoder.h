@@ -0,0 +1,68 @@
+//
+//  NOZParallelDeflateEncoder.h
+//  ZipUtilities
+//
+//  The MIT License (MIT)
+//
+//  Copyright (c) 2016 Nolan O'Brien
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "NOZEncoder.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ `NOZParallelDeflateEncoder` is a DEFLATE encoder that compresses large sources across multiple threads.
+
+ The input is split into blocks which are compressed concurrently, each block primed with the
+ last 32KB of the block before it.  The blocks are emitted in order as a single raw DEFLATE stream
+ that any inflater can read.  The CRC-32 is computed per block and combined, so callers such as
+ `NOZZipper` don't need to checksum the source themselves.
+
+ The output is not byte for byte identical to `NOZCompressionMethodDeflate`'s default encoder.
+
+ ### Example
+
+    id<NOZEncoder> encoder = [[NOZParallelDeflateEncoder alloc] init];
+    [[NOZCompressionLibrary sharedInstance] setEncoder:encoder forMethod:NOZCompressionMethodDeflate];
+ */
+@interface NOZParallelDeflateEncoder : NSObject <NOZEncoder>
+
+/** The maximum number of blocks compressed at once.  Defaults to the number of active processors. */
+@property (nonatomic, readonly) NSUInteger maxConcurrentBlocks;
+/** The number of uncompressed bytes per block.  Defaults to 128KB. */
+@property (nonatomic, readonly) size_t blockSize;
+
+/**
+ Designated initializer
+ @param maxConcurrentBlocks The maximum number of blocks to compress at once.  `0` uses the default.
+ @param blockSize The number of uncompressed bytes per block.  `0` uses the default.  Must be at least 32KB.
+ */
+- (instancetype)initWithMaxConcurrentBlocks:(NSUInteger)maxConcurrentBlocks blockSize:(size_t)blockSize NS_DESIGNATED_INITIALIZER;
+
+/** Initialize with the defaults */
+- (instancetype)init;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -80,6 +80,27 @@
     return YES;
 }
 
+- (size_t)maximumEncodedLengthForLength:(size_t)length
+{
+    return length;
+}
+
+- (BOOL)encodeBytes:(const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(Byte *)buffer
+           capacity:(size_t)capacity
+      encodedLength:(size_t *)encodedLength
+            context:(NOZRawEncoderContext *)context
+{
+    if (capacity < length) {
+        return NO;
+    }
+
+    memcpy(buffer, bytes, length);
+    *encodedLength = length;
+    return YES;
+}
+
 @end
 
 #pragma mark - Raw Decoder
@@ -133,4 +154,21 @@
     return YES;
 }
 
+- (BOOL)decodeBytes:(const Byte *)bytes
+             length:(size_t)length
+           toBuffer:(Byte *)buffer
+           capacity:(size_t)capacity
+      decodedLength:(size_t *)decodedLength
+            context:(NOZRawDecoderContext *)context
+{
+    if (capacity < length) {
+        return NO;
+    }
+
+    memcpy(buffer, bytes, length);
+    *decodedLength = length;
+    context.hasFinished = YES;
+    return YES;
+}
+
 @end
@@ -175,6 +175,25 @@ typedef NS_OPTIONS(NSInteger, NOZUnzipperSaveRecordOptions)
 /** The central directory object.  `nil` if it hasn't been parsed (or failed to be read). */
 @property (nonatomic, readonly, nullable) NOZCentralDirectory *centralDirectory;
 
+/**
+ Whether the archive is memory mapped when opened.
+ The central directory is then parsed straight from the mapping and decoders read compressed bytes from it.
+ Stored records (`NOZCompressionMethodNone`) are handed to the `enumerateByteRangesOfRecord:progressBlock:usingBlock:error:`
+ block as pointers into the mapping, without being copied, and are only valid for the duration of the block.
+ Falls back to reading the archive with file I/O if it cannot be mapped.
+ The archive must not be truncated while it is mapped.
+ Must be set _before_ opening the Unzipper.  Default is `NO`.
+ */
+@property (nonatomic) BOOL memoryMapsArchive;
+
+/**
+ Whether the name indexes (the hash index for looking up records by name and the sorted index for
+ prefix, directory and glob queries) are built while reading the central directory.
+ When `NO`, each index is built by the first query that needs it instead.
+ Must be set _before_ reading the central directory.  Default is `NO`.
+ */
+@property (nonatomic) BOOL indexesRecordNamesEagerly;
+
 /** Designated initializer */
 - (nonnull instancetype)initWithZipFile:(nonnull NSString *)zipFilePath;
 
@@ -211,14 +230,50 @@ typedef NS_OPTIONS(NSInteger, NOZUnzipperSaveRecordOptions)
 
 /**
  Find the index for a record matching the _name_ provided.  `NSNotFound` if no match was found.
+ Lookups are by hash, see `indexesRecordNamesEagerly`.
  */
 - (NSUInteger)indexForRecordWithName:(nonnull NSString *)name;
 
+/**
+ Find the index for a record whose name is the _length_ UTF-8 bytes at _nameBytes_.  `NSNotFound` if no match was found.
+ Doesn't create any objects, the bytes don't need to be NUL terminated.
+ */
+- (NSUInteger)indexForRecordWithNameBytes:(nonnull const void *)nameBytes length:(size_t)length;
+
+/**
+ Find the index for a record whose name is the NUL terminated UTF-8 _name_.  `NSNotFound` if no match was found.
+ Doesn't create any objects.
+ */
+- (NSUInteger)indexForRecordWithUTF8Name:(nonnull const char *)name;
+
 /**
  Enumerate all the records.
  */
 - (void)enumerateManifestEntriesUsingBlock:(__attribute__((noescape)) NOZUnzipRecordEnumerationBlock __nonnull)block;
 
+/**
+ Enumerate the records whose names start with _prefix_, in order of their names' UTF-8 bytes.
+ Found by binary search over a sorted index of names, so only the matching records are visited.
+ */
+- (void)enumerateRecordsWithNamePrefix:(nonnull NSString *)prefix
+                            usingBlock:(__attribute__((noescape)) NOZUnzipRecordEnumerationBlock __nonnull)block;
+
+/**
+ Enumerate the records whose names match the glob _pattern_, in order of their names' UTF-8 bytes.
+ `*` matches within a path component, `**` matches across components (`**` followed by `/` also matches no directories),
+ `?` matches one character, `[...]` and `[!...]` match a set of ASCII characters or ranges and `\` escapes the next character.
+ Only the records sharing the pattern's literal prefix (up to the first special character) are tested.
+ */
+- (void)enumerateRecordsMatchingGlob:(nonnull NSString *)pattern
+                          usingBlock:(__attribute__((noescape)) NOZUnzipRecordEnumerationBlock __nonnull)block;
+
+/**
+ The full names of the immediate children of _directory_ (`@""` for the root of the archive), in order of their UTF-8 bytes.
+ Subdirectories end in `/`, including those that are only implied by the names of records within them.
+ Each subdirectory is skipped over by binary search, so large subtrees aren't walked.
+ */
+- (nonnull NSArray<NSString *> *)namesOfItemsInDirectory:(nonnull NSString *)directory;
+
 
 /**
  Read a record as NSData.
@@ -266,6 +321,7 @@ typedef NS_OPTIONS(NSInteger, NOZUnzipperSaveRecordOptions)
 
 /**
  A central directory record is a zip entry populated with all the pertinent central directory info.
+ Records are equal (and hash the same) when they are the same record of the same central directory.
  */
 @interface NOZCentralDirectoryRecord : NSObject <NOZZipEntry>
 /** name of record */
@@ -297,6 +353,8 @@ typedef NS_OPTIONS(NSInteger, NOZUnzipperSaveRecordOptions)
 - (BOOL)isMacOSXAttribute;
 /** Record is a `".DS_Store"` file for Mac OS X. */
 - (BOOL)isMacOSXDSStore;
+/** Record is a compression dictionary embedded by `NOZZipper` (see `addDictionaryTrainedFromEntries:compressionMethod:maximumSize:error:`). */
+- (BOOL)isCompressionDictionary;
 @end
 
 /**
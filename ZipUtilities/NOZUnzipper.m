@@ -29,15 +29,58 @@
 #import "NOZCompressionLibrary.h"
 #import "NOZError.h"
 #import "NOZUnzipper.h"
+#import "NOZUnzipper_Project.h"
 #import "NOZUtils_Project.h"
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+// Mapped bytes are handed to blocks and decoders in ranges of this size
+#define kMAPPED_RANGE_SIZE (1024u * 1024u)
+// Central directory file record up to the variable length name, extra field and comment
+#define kCENTRAL_DIRECTORY_RECORD_FIXED_SIZE (46u)
+
+/**
+ Compact, fixed width form of a central directory file record.
+ The variable length name, extra field and comment follow each other in the central directory's arena, starting at `arenaOffset`.
+ */
+typedef struct _NOZCentralDirectoryEntryT
+{
+    UInt64 compressedSize;
+    UInt64 uncompressedSize;
+    UInt64 localFileHeaderOffset;
+    UInt64 arenaOffset;
+    UInt32 crc32;
+    UInt32 externalFileAttributes;
+    UInt16 versionMadeBy;
+    UInt16 versionForExtraction;
+    UInt16 bitFlag;
+    UInt16 compressionMethod;
+    UInt16 dosTime;
+    UInt16 dosDate;
+    UInt16 nameSize;
+    UInt16 extraFieldSize;
+    UInt16 commentSize;
+    UInt16 fileStartDiskNumber;
+    UInt16 internalFileAttributes;
+} NOZCentralDirectoryEntryT;
+
+static BOOL noz_read_zip64_extra_field(const Byte *extraField,
+                                       UInt16 extraFieldSize,
+                                       UInt64 * __nullable uncompressedSize,
+                                       UInt64 * __nullable compressedSize,
+                                       UInt64 * __nullable localFileHeaderOffset);
+
 static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 
+static size_t noz_glob_literal_prefix_length(const Byte *pattern, size_t length);
+static BOOL noz_glob_match(const Byte *pattern, const Byte *patternEnd, const Byte *name, const Byte *nameEnd);
+
 #define PRIVATE_READ(file, value) noz_fread_value(file, (Byte *)&value, sizeof(value))
 
 @interface NOZCentralDirectoryRecord ()
-- (instancetype)initWithOwner:(NOZCentralDirectory *)cd;
-- (NOZFileEntryT *)internalEntry;
+- (instancetype)initWithOwner:(NOZCentralDirectory *)cd index:(NSUInteger)index;
 - (NOZErrorCode)validate;
 - (BOOL)isOwnedByCentralDirectory:(NOZCentralDirectory *)cd;
 - (NSString *)nameNoCopy;
@@ -48,22 +91,45 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 @end
 
 @interface NOZCentralDirectory (Protected)
-- (NSArray<NOZCentralDirectoryRecord *> *)internalRecords;
 - (BOOL)readEndOfCentralDirectoryRecordAtPosition:(off_t)eocdPos inFile:(FILE*)file;
+- (BOOL)readZip64EndOfCentralDirectoryRecordPrecedingPosition:(off_t)eocdPos inFile:(FILE*)file;
+- (BOOL)getCentralDirectoryLength:(out size_t*)length;
 - (BOOL)readCentralDirectoryEntriesWithFile:(FILE*)file;
-- (NOZCentralDirectoryRecord *)readCentralDirectoryEntryAtCurrentPositionWithFile:(FILE*)file;
+- (BOOL)readCentralDirectoryEntriesFromMappedBytes:(const Byte*)mappedBytes length:(size_t)mappedLength;
+- (BOOL)readCentralDirectoryEntriesFromBytes:(const Byte*)bytes length:(size_t)length;
+- (BOOL)readCentralDirectoryEntry:(NOZCentralDirectoryEntryT*)entry withReader:(NOZByteReaderT*)reader;
 - (BOOL)validateCentralDirectoryAndReturnError:(NSError **)error;
 - (NOZCentralDirectoryRecord *)recordAtIndex:(NSUInteger)index;
 - (NSUInteger)indexForRecordWithName:(NSString *)name;
+- (NSUInteger)indexForRecordWithNameBytes:(const Byte *)nameBytes length:(size_t)length;
+- (void)buildNameIndexIfNeeded;
+- (BOOL)hasSharedLocalFileHeaderOffset:(UInt64)localFileHeaderOffset;
+- (void)buildSortedNameIndexIfNeeded;
+- (void)enumerateIndexesOfRecordsWithNamePrefix:(const Byte *)prefix
+                                         length:(size_t)length
+                                     usingBlock:(__attribute__((noescape)) void (^)(NSUInteger index, BOOL *stop))block;
+- (void)enumerateIndexesOfRecordsMatchingGlob:(const Byte *)pattern
+                                       length:(size_t)length
+                                   usingBlock:(__attribute__((noescape)) void (^)(NSUInteger index, BOOL *stop))block;
+- (NSArray<NSString *> *)namesOfItemsInDirectory:(NSString *)directory;
 @end
 
 @interface NOZUnzipper (Private)
 - (SInt64)private_locateSignature:(UInt32)signature;
 - (BOOL)private_locateCompressedDataOfRecord:(NOZCentralDirectoryRecord *)record;
+- (nullable const Byte *)private_locateMappedCompressedDataOfRecord:(NOZCentralDirectoryRecord *)record;
+- (BOOL)private_enumerateMappedStoredBytesWithProgressBlock:(nullable NOZProgressBlock)progressBlock
+                                                 usingBlock:(nonnull NOZUnzipByteRangeEnumerationBlock)block
+                                                      error:(out NSError *__autoreleasing  __nullable * __nullable)error;
 - (BOOL)private_deflateWithProgressBlock:(nullable NOZProgressBlock)progressBlock
                               usingBlock:(nonnull NOZUnzipByteRangeEnumerationBlock)block
                                    error:(out NSError *__autoreleasing  __nullable * __nullable)error;
+- (BOOL)private_decodeInSingleCallWithDecoder:(nonnull id<NOZDecoder>)decoder
+                                progressBlock:(nullable NOZProgressBlock)progressBlock
+                                   usingBlock:(nonnull NOZUnzipByteRangeEnumerationBlock)block
+                                        error:(out NSError *__autoreleasing  __nullable * __nullable)error;
 - (BOOL)private_flushDecompressedBytes:(const Byte*)buffer length:(size_t)length block:(nonnull NOZUnzipByteRangeEnumerationBlock)block;
+- (nullable id<NOZDecoder>)private_decoderForRecord:(nonnull NOZCentralDirectoryRecord *)record;
 @end
 
 @implementation NOZUnzipper
@@ -71,9 +137,12 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
     NSString *_standardizedFilePath;
     id<NOZDecoder> _currentDecoder;
     id<NOZDecoderContext> _currentDecoderContext;
+    NSMutableDictionary<NSNumber *, id> *_dictionaryDecoders; // compression methods and dictionary IDs to decoders with the archive's dictionary (or NSNull)
 
     struct {
         FILE* file;
+        const Byte* mappedBytes; // the whole archive when memory mapped
+        size_t mappedLength;
 
         off_t endOfCentralDirectorySignaturePosition;
         off_t endOfFilePosition;
@@ -85,6 +154,7 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
         size_t bytesDecompressed;
 
         NOZFileEntryT *entry;
+        const Byte *mappedCompressedBytes; // NULL unless the archive is memory mapped
 
         BOOL isUnzipping:YES;
     } _currentUnzipping;
@@ -121,6 +191,14 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
             } else {
                 _internal.endOfFilePosition = (off_t)[[[NSFileManager defaultManager] attributesOfItemAtPath:_standardizedFilePath error:nil] fileSize];
             }
+            if (_memoryMapsArchive && _internal.endOfFilePosition > 0 && (UInt64)_internal.endOfFilePosition <= (UInt64)SIZE_MAX) {
+                // without a mapping, everything is read with file I/O instead
+                void *mappedBytes = mmap(NULL, (size_t)_internal.endOfFilePosition, PROT_READ, MAP_PRIVATE, fileno(_internal.file), 0);
+                if (MAP_FAILED != mappedBytes) {
+                    _internal.mappedBytes = mappedBytes;
+                    _internal.mappedLength = (size_t)_internal.endOfFilePosition;
+                }
+            }
             _internal.endOfCentralDirectorySignaturePosition = [self private_locateSignature:NOZMagicNumberEndOfCentralDirectoryRecord];
             if (_internal.endOfCentralDirectorySignaturePosition) {
                 return YES;
@@ -140,6 +218,12 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 - (BOOL)closeAndReturnError:(out NSError **)error
 {
     _centralDirectory = nil;
+    _dictionaryDecoders = nil;
+    if (_internal.mappedBytes) {
+        munmap((void *)_internal.mappedBytes, _internal.mappedLength);
+        _internal.mappedBytes = NULL;
+        _internal.mappedLength = 0;
+    }
     if (_internal.file) {
         fclose(_internal.file);
         _internal.file = NULL;
@@ -169,7 +253,10 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
             return nil;
         }
 
-        if (![cd readCentralDirectoryEntriesWithFile:_internal.file]) {
+        const BOOL readEntries = (_internal.mappedBytes) ?
+                                    [cd readCentralDirectoryEntriesFromMappedBytes:_internal.mappedBytes length:_internal.mappedLength] :
+                                    [cd readCentralDirectoryEntriesWithFile:_internal.file];
+        if (!readEntries) {
             stackError = NOZErrorCreate(NOZErrorCodeUnzipCannotReadCentralDirectory, nil);
             return nil;
         }
@@ -177,9 +264,15 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
         if (![cd validateCentralDirectoryAndReturnError:&stackError]) {
             return nil;
         }
+
+        if (_indexesRecordNamesEagerly) {
+            [cd buildNameIndexIfNeeded];
+            [cd buildSortedNameIndexIfNeeded];
+        }
     }
 
     _centralDirectory = cd;
+    _dictionaryDecoders = nil;
     return cd;
 }
 
@@ -199,9 +292,65 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
     return (_centralDirectory) ? [_centralDirectory indexForRecordWithName:name] : NSNotFound;
 }
 
+- (NSUInteger)indexForRecordWithNameBytes:(const void *)nameBytes length:(size_t)length
+{
+    return (_centralDirectory) ? [_centralDirectory indexForRecordWithNameBytes:nameBytes length:length] : NSNotFound;
+}
+
+- (NSUInteger)indexForRecordWithUTF8Name:(const char *)name
+{
+    return [self indexForRecordWithNameBytes:name length:strlen(name)];
+}
+
+- (void)enumerateRecordsWithNamePrefix:(NSString *)prefix usingBlock:(NOZUnzipRecordEnumerationBlock)block
+{
+    NOZCentralDirectory *centralDirectory = _centralDirectory;
+    const char *prefixBytes = prefix.UTF8String;
+    if (!centralDirectory || !prefixBytes) {
+        return;
+    }
+
+    [centralDirectory enumerateIndexesOfRecordsWithNamePrefix:(const Byte *)prefixBytes
+                                                       length:strlen(prefixBytes)
+                                                   usingBlock:^(NSUInteger index, BOOL *stop) {
+                                                       @autoreleasepool {
+                                                           block([centralDirectory recordAtIndex:index], index, stop);
+                                                       }
+                                                   }];
+}
+
+- (void)enumerateRecordsMatchingGlob:(NSString *)pattern usingBlock:(NOZUnzipRecordEnumerationBlock)block
+{
+    NOZCentralDirectory *centralDirectory = _centralDirectory;
+    const char *patternBytes = pattern.UTF8String;
+    if (!centralDirectory || !patternBytes) {
+        return;
+    }
+
+    [centralDirectory enumerateIndexesOfRecordsMatchingGlob:(const Byte *)patternBytes
+                                                     length:strlen(patternBytes)
+                                                 usingBlock:^(NSUInteger index, BOOL *stop) {
+                                                     @autoreleasepool {
+                                                         block([centralDirectory recordAtIndex:index], index, stop);
+                                                     }
+                                                 }];
+}
+
+- (NSArray<NSString *> *)namesOfItemsInDirectory:(NSString *)directory
+{
+    return [_centralDirectory namesOfItemsInDirectory:directory] ?: @[];
+}
+
 - (void)enumerateManifestEntriesUsingBlock:(NOZUnzipRecordEnumerationBlock)block
 {
-    [_centralDirectory.internalRecords enumerateObjectsUsingBlock:block];
+    NOZCentralDirectory *centralDirectory = _centralDirectory;
+    const NSUInteger recordCount = centralDirectory.recordCount;
+    BOOL stop = NO;
+    for (NSUInteger index = 0; index < recordCount && !stop; index++) {
+        @autoreleasepool {
+            block([centralDirectory recordAtIndex:index], index, &stop);
+        }
+    }
 }
 
 - (BOOL)enumerateByteRangesOfRecord:(NOZCentralDirectoryRecord *)record
@@ -227,7 +376,17 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
             return NO;
         }
 
-        if (![self private_locateCompressedDataOfRecord:record]) {
+        // resolved first, finding the archive's dictionary can mean reading another record
+        id<NOZDecoder> decoder = [self private_decoderForRecord:record];
+
+        const Byte *mappedCompressedBytes = NULL;
+        if (_internal.mappedBytes) {
+            mappedCompressedBytes = [self private_locateMappedCompressedDataOfRecord:record];
+            if (!mappedCompressedBytes) {
+                stackError = NOZErrorCreate(NOZErrorCodeUnzipCannotReadFileEntry, nil);
+                return NO;
+            }
+        } else if (![self private_locateCompressedDataOfRecord:record]) {
             stackError = NOZErrorCreate(NOZErrorCodeUnzipCannotReadFileEntry, nil);
             return NO;
         }
@@ -243,24 +402,48 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
         _currentUnzipping.isUnzipping = YES;
         noz_defer(^{ _currentUnzipping.isUnzipping = NO; });
 
-        _currentUnzipping.offsetToFirstByte = ftello(_internal.file);
+        _currentUnzipping.offsetToFirstByte = (mappedCompressedBytes) ? (off_t)(mappedCompressedBytes - _internal.mappedBytes) : ftello(_internal.file);
         if (_currentUnzipping.offsetToFirstByte == -1) {
             stackError = NOZErrorCreate(NOZErrorCodeUnzipCannotReadFileEntry, nil);
             return NO;
         }
 
         _currentUnzipping.crc32 = 0;
+        _currentUnzipping.bytesDecompressed = 0;
+        _currentUnzipping.mappedCompressedBytes = mappedCompressedBytes;
+        noz_defer(^{ _currentUnzipping.mappedCompressedBytes = NULL; });
+
+        // Mapped stored records are handed out right from the mapping
+        const NOZFileEntryT *entry = record.internalEntry;
+        if (mappedCompressedBytes && NOZCompressionMethodNone == entry->fileHeader.compressionMethod) {
+            _currentUnzipping.entry = record.internalEntry;
+            noz_defer(^{ _currentUnzipping.entry = NULL; });
+            return [self private_enumerateMappedStoredBytesWithProgressBlock:progressBlock usingBlock:block error:&stackError];
+        }
 
-        __unsafe_unretained typeof(self) rawSelf = self;
-        _currentDecoder = [[NOZCompressionLibrary sharedInstance] decoderForMethod:record.internalEntry->fileHeader.compressionMethod];
-        _currentDecoderContext = [_currentDecoder createContextForDecodingWithBitFlags:record.internalEntry->fileHeader.bitFlag
-                                                                         flushCallback:^BOOL(id coder, id context, const Byte* bufferToFlush, size_t length) {
-                                                                             if (rawSelf->_currentDecoder != coder) {
-                                                                                 return NO;
-                                                                             }
+        // Small records are read whole and decoded in a single call, their sizes are known from the central directory.
+        // Stored records already stream without copying, so they are left alone.
+        if (NOZCompressionMethodNone != entry->fileHeader.compressionMethod &&
+            entry->fileDescriptor.compressedSize <= NOZSingleCallCodingMaximumLength &&
+            entry->fileDescriptor.uncompressedSize <= NOZSingleCallCodingMaximumLength &&
+            [decoder respondsToSelector:@selector(decodeBytes:length:toBuffer:capacity:decodedLength:context:)]) {
+            _currentUnzipping.entry = record.internalEntry;
+            noz_defer(^{ _currentUnzipping.entry = NULL; });
+            return [self private_decodeInSingleCallWithDecoder:decoder progressBlock:progressBlock usingBlock:block error:&stackError];
+        }
 
-                                                                             return [rawSelf private_flushDecompressedBytes:bufferToFlush length:length block:block];
-                                                                         }];
+        __unsafe_unretained typeof(self) rawSelf = self;
+        NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+        _currentDecoder = decoder;
+        _currentDecoderContext = (!_currentDecoder) ? nil : [library createContextForDecoder:_currentDecoder
+                                                                                    bitFlags:record.internalEntry->fileHeader.bitFlag
+                                                                               flushCallback:^BOOL(id coder, id context, const Byte* bufferToFlush, size_t length) {
+                                                                                   if (rawSelf->_currentDecoder != coder) {
+                                                                                       return NO;
+                                                                                   }
+
+                                                                                   return [rawSelf private_flushDecompressedBytes:bufferToFlush length:length block:block];
+                                                                               }];
 
         noz_defer(^{
             _currentDecoder = nil;
@@ -288,6 +471,7 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
             stackError = NOZErrorCreate(NOZErrorCodeUnzipFailedToDecompressEntry, nil);
             return NO;
         }
+        [library recycleContext:_currentDecoderContext forDecoder:_currentDecoder];
     }
 
     return YES;
@@ -413,11 +597,48 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 
 @end
 
+@implementation NOZUnzipper (Project)
+
+- (BOOL)locateCompressedDataOfRecord:(NOZCentralDirectoryRecord *)record
+                      fileDescriptor:(out int *)fileDescriptor
+                              offset:(out SInt64 *)offset
+                               error:(out NSError **)error
+{
+    NOZErrorCode code = 0;
+    if (!_internal.file) {
+        code = NOZErrorCodeUnzipMustOpenUnzipperBeforeManipulating;
+    } else if (![record isOwnedByCentralDirectory:_centralDirectory]) {
+        code = NOZErrorCodeUnzipCannotReadFileEntry;
+    } else if (![self private_locateCompressedDataOfRecord:record]) {
+        code = NOZErrorCodeUnzipCannotReadFileEntry;
+    } else {
+        code = [record validate];
+    }
+
+    const off_t position = (0 == code) ? ftello(_internal.file) : -1;
+    if (0 == code && position < 0) {
+        code = NOZErrorCodeUnzipCannotReadFileEntry;
+    }
+
+    if (code) {
+        if (error) {
+            *error = NOZErrorCreate(code, nil);
+        }
+        return NO;
+    }
+
+    *fileDescriptor = fileno(_internal.file);
+    *offset = (SInt64)position;
+    return YES;
+}
+
+@end
+
 @implementation NOZUnzipper (Private)
 
 - (BOOL)private_flushDecompressedBytes:(const Byte *)buffer length:(size_t)length block:(NOZUnzipByteRangeEnumerationBlock)block
 {
-    _currentUnzipping.crc32 = (UInt32)crc32(_currentUnzipping.crc32, buffer, (UInt32)length);
+    _currentUnzipping.crc32 = noz_crc32(_currentUnzipping.crc32, buffer, length);
     _currentUnzipping.bytesDecompressed += length;
 
     BOOL abort = NO;
@@ -426,6 +647,50 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
     return !abort;
 }
 
+- (id<NOZDecoder>)private_decoderForRecord:(NOZCentralDirectoryRecord *)record
+{
+    const NOZFileEntryT *entry = record.internalEntry;
+    const NOZCompressionMethod method = entry->fileHeader.compressionMethod;
+    id<NOZDecoder> decoder = [[NOZCompressionLibrary sharedInstance] decoderForMethod:method];
+    if (!decoder || NOZCompressionMethodNone == method || ![decoder respondsToSelector:@selector(decoderWithDictionaryData:)]) {
+        return decoder;
+    }
+
+    // only entries marked as compressed with a dictionary need one
+    UInt32 dictionaryID = 0;
+    if (!noz_read_dictionary_extra_field(entry->extraField, entry->fileHeader.extraFieldSize, NOZExtraFieldIdentifierDictionaryCompressed, &dictionaryID)) {
+        return decoder;
+    }
+
+    NSNumber *key = @(((UInt64)method << 32) | dictionaryID);
+    id dictionaryDecoder = _dictionaryDecoders[key];
+    if (!dictionaryDecoder) {
+        dictionaryDecoder = [NSNull null];
+
+        // a missing or mismatched dictionary only fails the entries that need it, when they fail to decode
+        const NSUInteger index = [_centralDirectory indexForRecordWithName:noz_dictionary_entry_name(method)];
+        NOZCentralDirectoryRecord *dictionaryRecord = (NSNotFound != index) ? [_centralDirectory recordAtIndex:index] : nil;
+        UInt32 recordDictionaryID = 0;
+        if (dictionaryRecord &&
+            NOZCompressionMethodNone == dictionaryRecord.compressionMethod &&
+            noz_read_dictionary_extra_field(dictionaryRecord.internalEntry->extraField, dictionaryRecord.internalEntry->fileHeader.extraFieldSize, NOZExtraFieldIdentifierCompressionDictionary, &recordDictionaryID) &&
+            recordDictionaryID == dictionaryID) {
+            // dictionaries are always stored, so reading one never needs a dictionary
+            NSData *dictionaryData = [self readDataFromRecord:dictionaryRecord progressBlock:NULL error:NULL];
+            if (dictionaryData.length > 0) {
+                dictionaryDecoder = [decoder decoderWithDictionaryData:dictionaryData] ?: [NSNull null];
+            }
+        }
+
+        if (!_dictionaryDecoders) {
+            _dictionaryDecoders = [[NSMutableDictionary alloc] init];
+        }
+        _dictionaryDecoders[key] = dictionaryDecoder;
+    }
+
+    return (dictionaryDecoder != [NSNull null]) ? dictionaryDecoder : decoder;
+}
+
 - (off_t)private_locateSignature:(UInt32)signature
 {
     Byte sig[4];
@@ -442,10 +707,30 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
     sig[3] = ((Byte*)(&signature))[3];
 #endif
 
+    size_t maxBytes = UINT16_MAX /* max global comment size */ + 22 /* End of Central Directory Record size */;
+
+    if (_internal.mappedBytes) {
+        if (maxBytes > _internal.mappedLength) {
+            maxBytes = _internal.mappedLength;
+        }
+        if (maxBytes < 4) {
+            return 0;
+        }
+        const Byte *lowest = _internal.mappedBytes + _internal.mappedLength - maxBytes;
+        for (const Byte *candidate = _internal.mappedBytes + _internal.mappedLength - 4; candidate >= lowest; candidate--) {
+            if (candidate[3] == sig[3] && candidate[2] == sig[2] && candidate[1] == sig[1] && candidate[0] == sig[0]) {
+                return (off_t)(candidate - _internal.mappedBytes);
+            }
+            if (candidate == lowest) {
+                break;
+            }
+        }
+        return 0;
+    }
+
     const size_t pageSize = NOZBufferSize();
     Byte buffer[pageSize];
     size_t bytesRead = 0;
-    size_t maxBytes = UINT16_MAX /* max global comment size */ + 22 /* End of Central Directory Record size */;
 
     if (0 != fseeko(_internal.file, 0, SEEK_END)) {
         return 0;
@@ -500,7 +785,7 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
         return NO;
     }
 
-    if (0 != fseeko(_internal.file, entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk, SEEK_SET)) {
+    if (0 != fseeko(_internal.file, (off_t)entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk, SEEK_SET)) {
         return NO;
     }
 
@@ -531,7 +816,10 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
     }
 
     if (entry->fileHeader.nameSize != nameSize) {
-        return NO;
+        // only records sharing data (see NOZZipperDeduplicationModeShareCompressedData) may differ from their local name
+        if (![_centralDirectory hasSharedLocalFileHeaderOffset:entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk]) {
+            return NO;
+        }
     }
 
     seek = extraFieldSize + nameSize;
@@ -542,6 +830,177 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
     return YES;
 }
 
+- (const Byte *)private_locateMappedCompressedDataOfRecord:(NOZCentralDirectoryRecord *)record
+{
+    NOZFileEntryT *entry = record.internalEntry;
+    if (!entry || entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk > (UInt64)_internal.mappedLength) {
+        return NULL;
+    }
+
+    NOZByteReaderT reader;
+    const size_t localFileHeaderOffset = (size_t)entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk;
+    NOZByteReaderInit(&reader, _internal.mappedBytes + localFileHeaderOffset, _internal.mappedLength - localFileHeaderOffset);
+
+    UInt32 signature = 0;
+    if (!NOZByteReaderReadUInt32(&reader, &signature) || signature != NOZMagicNumberLocalFileHeader) {
+        return NULL;
+    }
+
+    const size_t skip = 2 + // versionForExtraction
+                        2 + // bitFlag
+                        2 + // compressionMethod
+                        2 + // dosTime
+                        2 + // dosDate
+                        4 + // crc32
+                        4 + // compressed size
+                        4 + // decompressed size
+                        0;
+
+    UInt16 nameSize, extraFieldSize;
+    if (!NOZByteReaderReadBytes(&reader, skip) ||
+        !NOZByteReaderReadUInt16(&reader, &nameSize) ||
+        !NOZByteReaderReadUInt16(&reader, &extraFieldSize) ||
+        !NOZByteReaderReadBytes(&reader, (size_t)nameSize + (size_t)extraFieldSize)) {
+        return NULL;
+    }
+
+    if (entry->fileHeader.nameSize != nameSize && ![_centralDirectory hasSharedLocalFileHeaderOffset:entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk]) {
+        return NULL;
+    }
+
+    // the whole record has to be in the mapping
+    if (entry->fileDescriptor.compressedSize > (UInt64)NOZByteReaderRemainingLength(&reader)) {
+        return NULL;
+    }
+
+    return reader.bytes + reader.offset;
+}
+
+- (BOOL)private_enumerateMappedStoredBytesWithProgressBlock:(NOZProgressBlock)progressBlock
+                                                 usingBlock:(NOZUnzipByteRangeEnumerationBlock)block
+                                                      error:(out NSError **)error
+{
+    const Byte *bytes = _currentUnzipping.mappedCompressedBytes;
+    const size_t length = (size_t)_currentUnzipping.entry->fileDescriptor.compressedSize;
+    if (length != _currentUnzipping.entry->fileDescriptor.uncompressedSize) {
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeUnzipFailedToDecompressEntry, nil);
+        }
+        return NO;
+    }
+
+    size_t offset = 0;
+    while (offset < length) {
+        const size_t rangeLength = MIN(length - offset, (size_t)kMAPPED_RANGE_SIZE);
+        if (![self private_flushDecompressedBytes:bytes + offset length:rangeLength block:block]) {
+            if (error) {
+                *error = NOZErrorCreate(NOZErrorCodeUnzipCannotDecompressFileEntry, nil);
+            }
+            return NO;
+        }
+        offset += rangeLength;
+
+        if (progressBlock) {
+            BOOL progressStop = NO;
+            progressBlock((SInt64)length, (SInt64)offset, (SInt64)rangeLength, &progressStop);
+            if (progressStop) {
+                if (error) {
+                    *error = NOZErrorCreate(NOZErrorCodeUnzipCannotDecompressFileEntry, nil);
+                }
+                return NO;
+            }
+        }
+    }
+
+    if (_currentUnzipping.crc32 != _currentUnzipping.entry->fileDescriptor.crc32) {
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeUnzipChecksumMissmatch, nil);
+        }
+        return NO;
+    }
+
+    return YES;
+}
+
+- (BOOL)private_decodeInSingleCallWithDecoder:(id<NOZDecoder>)decoder
+                                progressBlock:(NOZProgressBlock)progressBlock
+                                   usingBlock:(NOZUnzipByteRangeEnumerationBlock)block
+                                        error:(out NSError **)error
+{
+    __block BOOL success = YES;
+    noz_defer(^{
+        if (!success && error && !*error) {
+            *error = NOZErrorCreate(NOZErrorCodeUnzipCannotDecompressFileEntry, nil);
+        }
+    });
+
+    const size_t compressedLength = (size_t)_currentUnzipping.entry->fileDescriptor.compressedSize;
+    const size_t uncompressedLength = (size_t)_currentUnzipping.entry->fileDescriptor.uncompressedSize;
+    Byte *readBuffer = (_currentUnzipping.mappedCompressedBytes) ? NULL : malloc(MAX(compressedLength, (size_t)1));
+    Byte *uncompressedBuffer = malloc(MAX(uncompressedLength, (size_t)1));
+    noz_defer(^{
+        free(readBuffer);
+        free(uncompressedBuffer);
+    });
+
+    const Byte *compressedBuffer = _currentUnzipping.mappedCompressedBytes ?: readBuffer;
+    if (!compressedBuffer || !uncompressedBuffer) {
+        success = NO;
+        return NO;
+    }
+
+    if (readBuffer && compressedLength != fread(readBuffer, 1, compressedLength, _internal.file)) {
+        success = NO;
+        return NO;
+    }
+
+    if (progressBlock) {
+        BOOL progressStop = NO;
+        progressBlock((SInt64)compressedLength, (SInt64)compressedLength, (SInt64)compressedLength, &progressStop);
+        if (progressStop) {
+            success = NO;
+            return NO;
+        }
+    }
+
+    // the context only holds the codec state, nothing is flushed through it
+    NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+    id<NOZDecoderContext> context = [library createContextForDecoder:decoder
+                                                             bitFlags:_currentUnzipping.entry->fileHeader.bitFlag
+                                                        flushCallback:^BOOL(id coder, id callbackContext, const Byte *bufferToFlush, size_t length) {
+                                                            return NO;
+                                                        }];
+    size_t decodedLength = 0;
+    if (![decoder decodeBytes:compressedBuffer
+                       length:compressedLength
+                     toBuffer:uncompressedBuffer
+                     capacity:MAX(uncompressedLength, (size_t)1)
+                decodedLength:&decodedLength
+                      context:context] || decodedLength != uncompressedLength) {
+        success = NO;
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeUnzipFailedToDecompressEntry, nil);
+        }
+        return NO;
+    }
+    [library recycleContext:context forDecoder:decoder];
+
+    if (decodedLength > 0 && ![self private_flushDecompressedBytes:uncompressedBuffer length:decodedLength block:block]) {
+        success = NO;
+        return NO;
+    }
+
+    if (_currentUnzipping.crc32 != _currentUnzipping.entry->fileDescriptor.crc32) {
+        success = NO;
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeUnzipChecksumMissmatch, nil);
+        }
+        return NO;
+    }
+
+    return YES;
+}
+
 - (BOOL)private_deflateWithProgressBlock:(NOZProgressBlock)progressBlock
                               usingBlock:(NOZUnzipByteRangeEnumerationBlock)block
                                    error:(out NSError **)error
@@ -563,17 +1022,24 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 
     while (!stop && !_currentDecoderContext.hasFinished) {
 
+        const Byte *compressedBytes = compressedBuffer;
+        if (_currentUnzipping.mappedCompressedBytes) {
+            // decode straight from the mapping
+            compressedBytes = _currentUnzipping.mappedCompressedBytes + (compressedBytesTotal - compressedBytesLeft);
+            compressedBufferSize = kMAPPED_RANGE_SIZE;
+        }
+
         if ((size_t)compressedBytesLeft < compressedBufferSize) {
             compressedBufferSize = (size_t)compressedBytesLeft;
         }
 
-        if (compressedBufferSize != fread(compressedBuffer, 1, compressedBufferSize, _internal.file)) {
+        if (!_currentUnzipping.mappedCompressedBytes && compressedBufferSize != fread(compressedBuffer, 1, compressedBufferSize, _internal.file)) {
             success = NO;
             return NO;
         }
         compressedBytesLeft -= compressedBufferSize;
 
-        if (![_currentDecoder decodeBytes:compressedBuffer length:compressedBufferSize context:_currentDecoderContext]) {
+        if (![_currentDecoder decodeBytes:compressedBytes length:compressedBufferSize context:_currentDecoderContext]) {
             success = NO;
             return NO;
         }
@@ -610,14 +1076,36 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 @implementation NOZCentralDirectory
 {
     off_t _endOfCentralDirectoryRecordPosition;
+    off_t _centralDirectoryEndPosition; // the Zip64 record when present, otherwise the EOCD record
     NOZEndOfCentralDirectoryRecordT _endOfCentralDirectoryRecord;
 
-    NSArray<NOZCentralDirectoryRecord *> *_records;
+    NOZCentralDirectoryEntryT *_entries;
+    NSUInteger _entryCount;
+    Byte *_arena; // the names, extra fields and comments of all entries
+    size_t _arenaLength;
     off_t _lastCentralDirectoryRecordEndPosition; // exclusive
+
+    // the name indexes are built on first use, by whichever thread gets there first.
+    // once a built flag is set (with release) its index is never written again, so lookups skip the mutex
+    pthread_mutex_t _nameIndexMutex; // guards building both indexes
+    atomic_bool _nameIndexBuilt;
+    atomic_bool _sortedNameIndexBuilt;
+
+    // open addressing hash table of entry indexes (plus one, zero is empty) keyed by name
+    UInt32 *_nameIndexSlots;
+    size_t _nameIndexMask;
+
+    // entry indexes ordered by name bytes
+    UInt32 *_sortedNameIndexes;
 }
 
 - (void)dealloc
 {
+    free(_entries);
+    free(_arena);
+    free(_nameIndexSlots);
+    free(_sortedNameIndexes);
+    pthread_mutex_destroy(&_nameIndexMutex);
 }
 
 - (instancetype)init
@@ -630,13 +1118,14 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 {
     if (self = [super init]) {
         _totalCompressedSize = fileSize;
+        pthread_mutex_init(&_nameIndexMutex, NULL);
     }
     return self;
 }
 
 - (NSUInteger)recordCount
 {
-    return _records.count;
+    return _entryCount;
 }
 
 @end
@@ -658,16 +1147,25 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
         return NO;
     }
 
-    if (!PRIVATE_READ(file, _endOfCentralDirectoryRecord.diskNumber) ||
-        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.startDiskNumber) ||
-        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.recordCountForDisk) ||
-        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.totalRecordCount) ||
-        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.centralDirectorySize) ||
-        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset) ||
+    UInt16 diskNumber, startDiskNumber, recordCountForDisk, totalRecordCount;
+    UInt32 centralDirectorySize, archiveStartToCentralDirectoryStartOffset;
+    if (!PRIVATE_READ(file, diskNumber) ||
+        !PRIVATE_READ(file, startDiskNumber) ||
+        !PRIVATE_READ(file, recordCountForDisk) ||
+        !PRIVATE_READ(file, totalRecordCount) ||
+        !PRIVATE_READ(file, centralDirectorySize) ||
+        !PRIVATE_READ(file, archiveStartToCentralDirectoryStartOffset) ||
         !PRIVATE_READ(file, _endOfCentralDirectoryRecord.commentSize)) {
         return NO;
     }
 
+    _endOfCentralDirectoryRecord.diskNumber = diskNumber;
+    _endOfCentralDirectoryRecord.startDiskNumber = startDiskNumber;
+    _endOfCentralDirectoryRecord.recordCountForDisk = recordCountForDisk;
+    _endOfCentralDirectoryRecord.totalRecordCount = totalRecordCount;
+    _endOfCentralDirectoryRecord.centralDirectorySize = centralDirectorySize;
+    _endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset = archiveStartToCentralDirectoryStartOffset;
+
     if (_endOfCentralDirectoryRecord.commentSize) {
         unsigned char* commentBuffer = malloc(_endOfCentralDirectoryRecord.commentSize + 1);
         if (_endOfCentralDirectoryRecord.commentSize == fread(commentBuffer, 1, _endOfCentralDirectoryRecord.commentSize, file)) {
@@ -678,110 +1176,523 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
     }
 
     _endOfCentralDirectoryRecordPosition = eocdPos;
+    _centralDirectoryEndPosition = eocdPos;
+
+    // Saturated values mean the real ones are in the Zip64 record
+    if (recordCountForDisk == NOZZip64MaxUInt16 ||
+        totalRecordCount == NOZZip64MaxUInt16 ||
+        centralDirectorySize == NOZZip64MaxUInt32 ||
+        archiveStartToCentralDirectoryStartOffset == NOZZip64MaxUInt32) {
+        if (![self readZip64EndOfCentralDirectoryRecordPrecedingPosition:eocdPos inFile:file]) {
+            return NO;
+        }
+    }
+
+    return YES;
+}
+
+- (BOOL)readZip64EndOfCentralDirectoryRecordPrecedingPosition:(off_t)eocdPos inFile:(FILE*)file
+{
+    const off_t locatorPos = eocdPos - 20;
+    if (locatorPos < 0 || 0 != fseeko(file, locatorPos, SEEK_SET)) {
+        return NO;
+    }
+
+    UInt32 signature = 0;
+    UInt32 zip64RecordDiskNumber = 0;
+    UInt64 zip64RecordOffset = 0;
+    if (!PRIVATE_READ(file, signature) || NOZMagicNumberZip64EndOfCentralDirectoryLocator != signature) {
+        return NO;
+    }
+    if (!PRIVATE_READ(file, zip64RecordDiskNumber) || !PRIVATE_READ(file, zip64RecordOffset)) {
+        return NO;
+    }
+
+    if (zip64RecordOffset > (UInt64)locatorPos || 0 != fseeko(file, (off_t)zip64RecordOffset, SEEK_SET)) {
+        return NO;
+    }
+
+    UInt64 remainingRecordSize = 0;
+    UInt16 versionMadeBy, versionForExtraction;
+    if (!PRIVATE_READ(file, signature) || NOZMagicNumberZip64EndOfCentralDirectoryRecord != signature) {
+        return NO;
+    }
+    if (!PRIVATE_READ(file, remainingRecordSize) ||
+        !PRIVATE_READ(file, versionMadeBy) ||
+        !PRIVATE_READ(file, versionForExtraction) ||
+        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.diskNumber) ||
+        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.startDiskNumber) ||
+        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.recordCountForDisk) ||
+        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.totalRecordCount) ||
+        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.centralDirectorySize) ||
+        !PRIVATE_READ(file, _endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset)) {
+        return NO;
+    }
+
+    _centralDirectoryEndPosition = (off_t)zip64RecordOffset;
+    return YES;
+}
+
+- (BOOL)getCentralDirectoryLength:(out size_t *)length
+{
+    const UInt64 startPosition = _endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset;
+    if (!_endOfCentralDirectoryRecordPosition || _centralDirectoryEndPosition < 0 || startPosition > (UInt64)_centralDirectoryEndPosition) {
+        return NO;
+    }
+
+    const UInt64 centralDirectoryLength = (UInt64)_centralDirectoryEndPosition - startPosition;
+    if (centralDirectoryLength > (UInt64)SIZE_MAX) {
+        return NO;
+    }
+
+    *length = (size_t)centralDirectoryLength;
     return YES;
 }
 
 - (BOOL)readCentralDirectoryEntriesWithFile:(FILE *)file
 {
-    if (!file || !_endOfCentralDirectoryRecordPosition) {
+    size_t length = 0;
+    if (!file || ![self getCentralDirectoryLength:&length]) {
         return NO;
     }
 
-    if (0 != fseeko(file, _endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset, SEEK_SET)) {
+    // the whole central directory is read at once and parsed in memory
+    Byte *buffer = malloc(MAX(length, (size_t)1));
+    if (!buffer) {
         return NO;
     }
+    noz_defer(^{ free(buffer); });
 
-    NSMutableArray<NOZCentralDirectoryRecord *> *records = [NSMutableArray arrayWithCapacity:_endOfCentralDirectoryRecord.totalRecordCount];
-    while (_endOfCentralDirectoryRecordPosition > ftello(file)) {
-        NOZCentralDirectoryRecord *record = [self readCentralDirectoryEntryAtCurrentPositionWithFile:file];
-        if (record) {
-            [records addObject:record];
-        } else {
-            break;
+    const int fd = fileno(file);
+    const off_t startPosition = (off_t)_endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset;
+    size_t bytesRead = 0;
+    while (bytesRead < length) {
+        const ssize_t result = pread(fd, buffer + bytesRead, length - bytesRead, startPosition + (off_t)bytesRead);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return NO;
         }
+        bytesRead += (size_t)result;
     }
 
-    _records = [records copy];
-    return YES;
+    return [self readCentralDirectoryEntriesFromBytes:buffer length:length];
 }
 
-- (NOZCentralDirectoryRecord *)readCentralDirectoryEntryAtCurrentPositionWithFile:(FILE *)file
+- (BOOL)readCentralDirectoryEntriesFromMappedBytes:(const Byte *)mappedBytes length:(size_t)mappedLength
 {
-    UInt32 signature = 0;
-    if (!PRIVATE_READ(file, signature) || signature != NOZMagicNumberCentralDirectoryFileRecord) {
-        return nil;
+    size_t length = 0;
+    if (!mappedBytes || ![self getCentralDirectoryLength:&length] || (UInt64)_centralDirectoryEndPosition > (UInt64)mappedLength) {
+        return NO;
     }
 
-    NOZCentralDirectoryRecord *record = [[NOZCentralDirectoryRecord alloc] initWithOwner:self];
-    NOZFileEntryT* entry = record.internalEntry;
-
-    if (!PRIVATE_READ(file, entry->centralDirectoryRecord.versionMadeBy) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->versionForExtraction) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->bitFlag) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->compressionMethod) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->dosTime) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->dosDate) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->fileDescriptor->crc32) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->fileDescriptor->compressedSize) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->fileDescriptor->uncompressedSize) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->nameSize) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileHeader->extraFieldSize) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.commentSize) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.fileStartDiskNumber) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.internalFileAttributes) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.externalFileAttributes) ||
-        !PRIVATE_READ(file, entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk) ||
-        entry->centralDirectoryRecord.fileHeader->nameSize == 0) {
-        return nil;
+    return [self readCentralDirectoryEntriesFromBytes:mappedBytes + _endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset length:length];
+}
+
+- (BOOL)readCentralDirectoryEntriesFromBytes:(const Byte *)bytes length:(size_t)length
+{
+    free(_entries);
+    free(_arena);
+    _entries = NULL;
+    _entryCount = 0;
+    _arena = NULL;
+    _arenaLength = 0;
+
+    // Every entry takes at least the fixed size part of a record, which bounds a bogus record count.
+    // The variable length parts can't take more than the central directory itself, they are packed down after parsing.
+    NSUInteger capacity = (NSUInteger)MIN(_endOfCentralDirectoryRecord.totalRecordCount, (UInt64)(length / kCENTRAL_DIRECTORY_RECORD_FIXED_SIZE));
+    capacity = MAX(capacity, (NSUInteger)1);
+    _entries = malloc(capacity * sizeof(NOZCentralDirectoryEntryT));
+    _arena = malloc(MAX(length, (size_t)1));
+    if (!_entries || !_arena) {
+        return NO;
     }
 
-    entry->name = malloc(entry->centralDirectoryRecord.fileHeader->nameSize + 1);
-    ((Byte*)entry->name)[entry->centralDirectoryRecord.fileHeader->nameSize] = '\0';
-    entry->ownsName = YES;
-    if (entry->centralDirectoryRecord.fileHeader->nameSize != fread((Byte*)entry->name, 1, entry->centralDirectoryRecord.fileHeader->nameSize, file)) {
-        return nil;
+    NOZByteReaderT reader;
+    NOZByteReaderInit(&reader, bytes, length);
+
+    while (NOZByteReaderRemainingLength(&reader) > 0) {
+        if (_entryCount == capacity) {
+            NOZCentralDirectoryEntryT *entries = realloc(_entries, capacity * 2 * sizeof(NOZCentralDirectoryEntryT));
+            if (!entries) {
+                return NO;
+            }
+            _entries = entries;
+            capacity *= 2;
+        }
+
+        if (![self readCentralDirectoryEntry:&_entries[_entryCount] withReader:&reader]) {
+            break;
+        }
+        _totalUncompressedSize += (SInt64)_entries[_entryCount].uncompressedSize;
+        _entryCount++;
     }
 
-    if (entry->centralDirectoryRecord.fileHeader->extraFieldSize > 0) {
-        if (0 != fseeko(file, entry->centralDirectoryRecord.fileHeader->extraFieldSize, SEEK_CUR)) {
-            return nil;
+    if (_arenaLength > 0 && _arenaLength < length) {
+        Byte *arena = realloc(_arena, _arenaLength);
+        if (arena) {
+            _arena = arena;
+        }
+    }
+    if (_entryCount > 0 && _entryCount < capacity) {
+        NOZCentralDirectoryEntryT *entries = realloc(_entries, _entryCount * sizeof(NOZCentralDirectoryEntryT));
+        if (entries) {
+            _entries = entries;
         }
     }
 
-    if (entry->centralDirectoryRecord.commentSize > 0) {
-        entry->comment = malloc(entry->centralDirectoryRecord.commentSize + 1);
-        ((Byte*)entry->comment)[entry->centralDirectoryRecord.commentSize] = '\0';
-        entry->ownsComment = YES;
-        if (entry->centralDirectoryRecord.commentSize != fread((Byte*)entry->comment, 1, entry->centralDirectoryRecord.commentSize, file)) {
-            return nil;
+    return YES;
+}
+
+- (BOOL)readCentralDirectoryEntry:(NOZCentralDirectoryEntryT *)entry withReader:(NOZByteReaderT *)reader
+{
+    // the fixed size part of the record is bounds checked once
+    const Byte *header = NOZByteReaderReadBytes(reader, kCENTRAL_DIRECTORY_RECORD_FIXED_SIZE);
+    if (!header || NOZReadLittleEndianUInt32(header) != NOZMagicNumberCentralDirectoryFileRecord) {
+        return NO;
+    }
+
+    entry->versionMadeBy = NOZReadLittleEndianUInt16(header + 4);
+    entry->versionForExtraction = NOZReadLittleEndianUInt16(header + 6);
+    entry->bitFlag = NOZReadLittleEndianUInt16(header + 8);
+    entry->compressionMethod = NOZReadLittleEndianUInt16(header + 10);
+    entry->dosTime = NOZReadLittleEndianUInt16(header + 12);
+    entry->dosDate = NOZReadLittleEndianUInt16(header + 14);
+    entry->crc32 = NOZReadLittleEndianUInt32(header + 16);
+    entry->compressedSize = NOZReadLittleEndianUInt32(header + 20);
+    entry->uncompressedSize = NOZReadLittleEndianUInt32(header + 24);
+    entry->nameSize = NOZReadLittleEndianUInt16(header + 28);
+    entry->extraFieldSize = NOZReadLittleEndianUInt16(header + 30);
+    entry->commentSize = NOZReadLittleEndianUInt16(header + 32);
+    entry->fileStartDiskNumber = NOZReadLittleEndianUInt16(header + 34);
+    entry->internalFileAttributes = NOZReadLittleEndianUInt16(header + 36);
+    entry->externalFileAttributes = NOZReadLittleEndianUInt32(header + 38);
+    entry->localFileHeaderOffset = NOZReadLittleEndianUInt32(header + 42);
+    if (entry->nameSize == 0) {
+        return NO;
+    }
+
+    // the name, extra field and comment are contiguous, so they go into the arena together
+    const size_t variableLength = (size_t)entry->nameSize + (size_t)entry->extraFieldSize + (size_t)entry->commentSize;
+    const Byte *variableBytes = NOZByteReaderReadBytes(reader, variableLength);
+    if (!variableBytes) {
+        return NO;
+    }
+    entry->arenaOffset = _arenaLength;
+    memcpy(_arena + _arenaLength, variableBytes, variableLength);
+    _arenaLength += variableLength;
+
+    const BOOL compressedSizeIsZip64 = (entry->compressedSize == NOZZip64MaxUInt32);
+    const BOOL uncompressedSizeIsZip64 = (entry->uncompressedSize == NOZZip64MaxUInt32);
+    const BOOL offsetIsZip64 = (entry->localFileHeaderOffset == NOZZip64MaxUInt32);
+    if (compressedSizeIsZip64 || uncompressedSizeIsZip64 || offsetIsZip64) {
+        if (!noz_read_zip64_extra_field(_arena + entry->arenaOffset + entry->nameSize,
+                                        entry->extraFieldSize,
+                                        (uncompressedSizeIsZip64) ? &entry->uncompressedSize : NULL,
+                                        (compressedSizeIsZip64) ? &entry->compressedSize : NULL,
+                                        (offsetIsZip64) ? &entry->localFileHeaderOffset : NULL)) {
+            return NO;
         }
     }
 
-    _totalUncompressedSize += record.uncompressedSize;
-    _lastCentralDirectoryRecordEndPosition = ftello(file);
-    return record;
+    _lastCentralDirectoryRecordEndPosition = (off_t)(_endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset + reader->offset);
+    return YES;
 }
 
 - (NOZCentralDirectoryRecord *)recordAtIndex:(NSUInteger)index
 {
-    return [_records objectAtIndex:index];
+    if (index >= _entryCount) {
+        @throw [NSException exceptionWithName:NSRangeException
+                                       reason:[NSString stringWithFormat:@"index %tu beyond bounds [0 .. %tu]", index, _entryCount]
+                                     userInfo:nil];
+    }
+    return [[NOZCentralDirectoryRecord alloc] initWithOwner:self index:index];
+}
+
+- (BOOL)hasSharedLocalFileHeaderOffset:(UInt64)localFileHeaderOffset
+{
+    NSUInteger recordsAtOffset = 0;
+    for (NSUInteger index = 0; index < _entryCount && recordsAtOffset < 2; index++) {
+        if (_entries[index].localFileHeaderOffset == localFileHeaderOffset) {
+            recordsAtOffset++;
+        }
+    }
+    return recordsAtOffset > 1;
 }
 
 - (NSUInteger)indexForRecordWithName:(NSString *)name
 {
-    __block NSUInteger index = NSNotFound;
-    [_records enumerateObjectsUsingBlock:^(NOZCentralDirectoryRecord *record, NSUInteger idx, BOOL *stop) {
-        if ([name isEqualToString:record.nameNoCopy]) {
-            index = idx;
-            *stop = YES;
+    const char *nameBytes = name.UTF8String;
+    if (!nameBytes) {
+        return NSNotFound;
+    }
+
+    return [self indexForRecordWithNameBytes:(const Byte *)nameBytes length:strlen(nameBytes)];
+}
+
+- (NSUInteger)indexForRecordWithNameBytes:(const Byte *)nameBytes length:(size_t)length
+{
+    if (length == 0 || length > UINT16_MAX) {
+        return NSNotFound;
+    }
+
+    [self buildNameIndexIfNeeded];
+
+    if (!_nameIndexSlots) {
+        // too many entries to index (or no memory to), look at each of them instead
+        for (NSUInteger index = 0; index < _entryCount; index++) {
+            const NOZCentralDirectoryEntryT *entry = &_entries[index];
+            if (entry->nameSize == length && 0 == memcmp(_arena + entry->arenaOffset, nameBytes, length)) {
+                return index;
+            }
         }
-    }];
-    return index;
+        return NSNotFound;
+    }
+
+    // entries went in by index, so the first of any duplicate names is found first
+    for (size_t slot = (size_t)noz_crc32(0, nameBytes, length) & _nameIndexMask; _nameIndexSlots[slot] != 0; slot = (slot + 1) & _nameIndexMask) {
+        const NSUInteger index = _nameIndexSlots[slot] - 1;
+        const NOZCentralDirectoryEntryT *entry = &_entries[index];
+        if (entry->nameSize == length && 0 == memcmp(_arena + entry->arenaOffset, nameBytes, length)) {
+            return index;
+        }
+    }
+    return NSNotFound;
 }
 
-- (NSArray<NOZCentralDirectoryRecord *> *)internalRecords
+- (void)buildNameIndexIfNeeded
 {
-    return _records;
+    if (atomic_load_explicit(&_nameIndexBuilt, memory_order_acquire)) {
+        return;
+    }
+
+    pthread_mutex_lock(&_nameIndexMutex);
+    noz_defer(^{ pthread_mutex_unlock(&self->_nameIndexMutex); });
+
+    if (atomic_load_explicit(&_nameIndexBuilt, memory_order_relaxed)) {
+        return;
+    }
+    // a failed build isn't retried, lookups fall back to looking at each entry
+    noz_defer(^{ atomic_store_explicit(&self->_nameIndexBuilt, true, memory_order_release); });
+
+    if (_entryCount == 0 || _entryCount >= (UINT32_MAX / 2)) {
+        return;
+    }
+
+    // at most half full
+    size_t slotCount = 16;
+    while (slotCount < _entryCount * 2) {
+        slotCount <<= 1;
+    }
+
+    UInt32 *slots = calloc(slotCount, sizeof(UInt32));
+    if (!slots) {
+        return;
+    }
+
+    const size_t mask = slotCount - 1;
+    for (NSUInteger index = 0; index < _entryCount; index++) {
+        const NOZCentralDirectoryEntryT *entry = &_entries[index];
+        size_t slot = (size_t)noz_crc32(0, _arena + entry->arenaOffset, entry->nameSize) & mask;
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = (UInt32)(index + 1);
+    }
+
+    _nameIndexMask = mask;
+    _nameIndexSlots = slots;
+}
+
+- (void)buildSortedNameIndexIfNeeded
+{
+    if (atomic_load_explicit(&_sortedNameIndexBuilt, memory_order_acquire)) {
+        return;
+    }
+
+    pthread_mutex_lock(&_nameIndexMutex);
+    noz_defer(^{ pthread_mutex_unlock(&self->_nameIndexMutex); });
+
+    if (atomic_load_explicit(&_sortedNameIndexBuilt, memory_order_relaxed)) {
+        return;
+    }
+    noz_defer(^{ atomic_store_explicit(&self->_sortedNameIndexBuilt, true, memory_order_release); });
+
+    if (_entryCount == 0 || _entryCount >= UINT32_MAX) {
+        return;
+    }
+
+    UInt32 *sortedIndexes = malloc(_entryCount * sizeof(UInt32));
+    if (!sortedIndexes) {
+        return;
+    }
+
+    for (NSUInteger index = 0; index < _entryCount; index++) {
+        sortedIndexes[index] = (UInt32)index;
+    }
+
+    const NOZCentralDirectoryEntryT *entries = _entries;
+    const Byte *arena = _arena;
+    qsort_b(sortedIndexes, _entryCount, sizeof(UInt32), ^int(const void *lhs, const void *rhs) {
+        const UInt32 lhsIndex = *(const UInt32 *)lhs;
+        const UInt32 rhsIndex = *(const UInt32 *)rhs;
+        const NOZCentralDirectoryEntryT *lhsEntry = &entries[lhsIndex];
+        const NOZCentralDirectoryEntryT *rhsEntry = &entries[rhsIndex];
+        const int result = memcmp(arena + lhsEntry->arenaOffset, arena + rhsEntry->arenaOffset, MIN(lhsEntry->nameSize, rhsEntry->nameSize));
+        if (result != 0) {
+            return result;
+        } else if (lhsEntry->nameSize != rhsEntry->nameSize) {
+            return (lhsEntry->nameSize < rhsEntry->nameSize) ? -1 : 1;
+        }
+        // duplicate names stay in archive order, and an element compared with itself is equal
+        return (lhsIndex > rhsIndex) - (lhsIndex < rhsIndex);
+    });
+
+    _sortedNameIndexes = sortedIndexes;
+}
+
+/** Compares the name at _position_ in the sorted index, cut to the length of _prefix_, with _prefix_ */
+- (int)compareNameAtSortedPosition:(NSUInteger)position withPrefix:(const Byte *)prefix length:(size_t)length
+{
+    const NOZCentralDirectoryEntryT *entry = &_entries[_sortedNameIndexes[position]];
+    const int result = memcmp(_arena + entry->arenaOffset, prefix, MIN((size_t)entry->nameSize, length));
+    if (result == 0 && entry->nameSize < length) {
+        return -1;
+    }
+    return result;
+}
+
+/** The positions in the sorted index of every name starting with _prefix_, found by binary search */
+- (NSRange)sortedRangeOfNamesWithPrefix:(const Byte *)prefix length:(size_t)length
+{
+    NSUInteger low = 0;
+    NSUInteger high = _entryCount;
+    while (low < high) {
+        const NSUInteger middle = low + ((high - low) / 2);
+        if ([self compareNameAtSortedPosition:middle withPrefix:prefix length:length] < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    const NSUInteger start = low;
+    high = _entryCount;
+    while (low < high) {
+        const NSUInteger middle = low + ((high - low) / 2);
+        if ([self compareNameAtSortedPosition:middle withPrefix:prefix length:length] <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return NSMakeRange(start, low - start);
+}
+
+- (void)enumerateIndexesOfRecordsWithNamePrefix:(const Byte *)prefix
+                                         length:(size_t)length
+                                     usingBlock:(__attribute__((noescape)) void (^)(NSUInteger index, BOOL *stop))block
+{
+    [self buildSortedNameIndexIfNeeded];
+
+    BOOL stop = NO;
+    if (!_sortedNameIndexes) {
+        // too many entries to sort (or no memory to), look at each of them instead
+        for (NSUInteger index = 0; index < _entryCount && !stop; index++) {
+            const NOZCentralDirectoryEntryT *entry = &_entries[index];
+            if (entry->nameSize >= length && 0 == memcmp(_arena + entry->arenaOffset, prefix, length)) {
+                block(index, &stop);
+            }
+        }
+        return;
+    }
+
+    const NSRange range = [self sortedRangeOfNamesWithPrefix:prefix length:length];
+    for (NSUInteger position = range.location; position < NSMaxRange(range) && !stop; position++) {
+        block(_sortedNameIndexes[position], &stop);
+    }
+}
+
+- (void)enumerateIndexesOfRecordsMatchingGlob:(const Byte *)pattern
+                                       length:(size_t)length
+                                   usingBlock:(__attribute__((noescape)) void (^)(NSUInteger index, BOOL *stop))block
+{
+    // only names sharing the pattern's literal prefix can match, so only those are tested
+    const size_t prefixLength = noz_glob_literal_prefix_length(pattern, length);
+    [self enumerateIndexesOfRecordsWithNamePrefix:pattern
+                                           length:prefixLength
+                                       usingBlock:^(NSUInteger index, BOOL *stop) {
+                                           const NOZCentralDirectoryEntryT *entry = &self->_entries[index];
+                                           const Byte *name = self->_arena + entry->arenaOffset;
+                                           if (noz_glob_match(pattern + prefixLength, pattern + length, name + prefixLength, name + entry->nameSize)) {
+                                               block(index, stop);
+                                           }
+                                       }];
+}
+
+- (NSArray<NSString *> *)namesOfItemsInDirectory:(NSString *)directory
+{
+    NSString *prefix = directory;
+    if (prefix.length > 0 && ![prefix hasSuffix:@"/"]) {
+        prefix = [prefix stringByAppendingString:@"/"];
+    }
+    const char *prefixBytes = prefix.UTF8String;
+    if (!prefixBytes) {
+        return nil;
+    }
+    const size_t prefixLength = strlen(prefixBytes);
+
+    [self buildSortedNameIndexIfNeeded];
+
+    // subdirectories are listed with their trailing separator, whether they have a record of their own or not
+    NSMutableOrderedSet<NSString *> *names = [[NSMutableOrderedSet alloc] init];
+    size_t (^addChildOfName)(const Byte *, size_t) = ^size_t(const Byte *name, size_t nameSize) {
+        const Byte *separator = memchr(name + prefixLength, '/', nameSize - prefixLength);
+        const size_t childLength = (separator) ? (size_t)(separator - name) + 1 : nameSize;
+        NSString *childName = [[NSString alloc] initWithBytes:name length:childLength encoding:NSUTF8StringEncoding];
+        if (childName) {
+            [names addObject:childName];
+        }
+        return (separator) ? childLength : 0;
+    };
+
+    if (!_sortedNameIndexes) {
+        for (NSUInteger index = 0; index < _entryCount; index++) {
+            const NOZCentralDirectoryEntryT *entry = &_entries[index];
+            const Byte *name = _arena + entry->arenaOffset;
+            if (entry->nameSize > prefixLength && 0 == memcmp(name, prefixBytes, prefixLength)) {
+                addChildOfName(name, entry->nameSize);
+            }
+        }
+        [names sortUsingComparator:^NSComparisonResult(NSString *lhs, NSString *rhs) {
+            return [lhs compare:rhs options:NSLiteralSearch];
+        }];
+        return names.array;
+    }
+
+    const NSRange range = [self sortedRangeOfNamesWithPrefix:(const Byte *)prefixBytes length:prefixLength];
+    NSUInteger position = range.location;
+    while (position < NSMaxRange(range)) {
+        const NOZCentralDirectoryEntryT *entry = &_entries[_sortedNameIndexes[position]];
+        if (entry->nameSize == prefixLength) {
+            // the directory's own record
+            position++;
+            continue;
+        }
+
+        const Byte *name = _arena + entry->arenaOffset;
+        const size_t subdirectoryLength = addChildOfName(name, entry->nameSize);
+        if (subdirectoryLength > 0) {
+            // skip the rest of the subdirectory's contents in one go
+            position = NSMaxRange([self sortedRangeOfNamesWithPrefix:name length:subdirectoryLength]);
+        } else {
+            position++;
+        }
+    }
+
+    return names.array;
 }
 
 - (BOOL)validateCentralDirectoryAndReturnError:(NSError **)error
@@ -799,18 +1710,18 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
         return NO;
     }
 
-    if (0 == _records.count) {
+    if (0 == _entryCount) {
         code = NOZErrorCodeUnzipCouldNotReadCentralDirectoryRecord;
         return NO;
     }
 
-    if (_records.count != _endOfCentralDirectoryRecord.totalRecordCount) {
+    if ((UInt64)_entryCount != _endOfCentralDirectoryRecord.totalRecordCount) {
         code = NOZErrorCodeUnzipCentralDirectoryRecordCountsDoNotAlign;
-        userInfo = @{ @"expectedCount" : @(_endOfCentralDirectoryRecord.totalRecordCount), @"actualCount" : @(_records.count) };
+        userInfo = @{ @"expectedCount" : @(_endOfCentralDirectoryRecord.totalRecordCount), @"actualCount" : @(_entryCount) };
         return NO;
     }
 
-    if (_endOfCentralDirectoryRecordPosition != _lastCentralDirectoryRecordEndPosition) {
+    if (_centralDirectoryEndPosition != _lastCentralDirectoryRecordEndPosition) {
         code = NOZErrorCodeUnzipCentralDirectoryRecordsDoNotCompleteWithEOCDRecord;
         return NO;
     }
@@ -823,19 +1734,16 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 @implementation NOZCentralDirectoryRecord
 {
     NOZFileEntryT _entry;
-    __unsafe_unretained NOZCentralDirectory *_owner;
+    NOZCentralDirectory *_owner; // the entry's name, extra field and comment live in the owner's arena
+    NSUInteger _index;
 }
 
-- (void)dealloc
-{
-    NOZFileEntryClean(&_entry);
-}
-
-- (instancetype)initWithOwner:(NOZCentralDirectory *)cd
+- (instancetype)initWithOwner:(NOZCentralDirectory *)cd index:(NSUInteger)index
 {
     if (self = [super init]) {
-        NOZFileEntryInit(&_entry);
         _owner = cd;
+        _index = index;
+        [cd getInternalEntry:&_entry atIndex:index];
     }
     return self;
 }
@@ -884,40 +1792,36 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 
 - (SInt64)compressedSize
 {
-    return _entry.fileDescriptor.compressedSize;
+    return (SInt64)_entry.fileDescriptor.compressedSize;
 }
 
 - (SInt64)uncompressedSize
 {
-    return _entry.fileDescriptor.uncompressedSize;
+    return (SInt64)_entry.fileDescriptor.uncompressedSize;
 }
 
 - (id)copyWithZone:(NSZone *)zone
 {
-    NOZCentralDirectoryRecord *record = [[[self class] allocWithZone:zone] init];
-    record->_entry.fileDescriptor = _entry.fileDescriptor;
-    record->_entry.fileHeader = _entry.fileHeader;
-    record->_entry.centralDirectoryRecord = _entry.centralDirectoryRecord;
-
-    if (_entry.name) {
-        record->_entry.name = malloc(_entry.fileHeader.nameSize + 1);
-        memcpy((Byte *)record->_entry.name, _entry.name, _entry.fileHeader.nameSize + 1);
-        record->_entry.ownsName = YES;
-    }
+    // immutable
+    return self;
+}
 
-    if (_entry.extraField) {
-        record->_entry.extraField = malloc(_entry.fileHeader.extraFieldSize + 1);
-        memcpy((Byte *)record->_entry.extraField, _entry.extraField, _entry.fileHeader.extraFieldSize + 1);
-        record->_entry.ownsExtraField = YES;
+// records are created on demand, so two fetches of the same record are equal rather than identical
+- (BOOL)isEqual:(id)object
+{
+    if (self == object) {
+        return YES;
     }
-
-    if (_entry.comment) {
-        record->_entry.comment = malloc(_entry.centralDirectoryRecord.commentSize + 1);
-        memcpy((Byte *)record->_entry.comment, _entry.comment, _entry.centralDirectoryRecord.commentSize + 1);
-        record->_entry.ownsComment = YES;
+    if (![object isKindOfClass:[NOZCentralDirectoryRecord class]]) {
+        return NO;
     }
+    NOZCentralDirectoryRecord *other = object;
+    return (other->_owner == _owner) && (other->_index == _index);
+}
 
-    return record;
+- (NSUInteger)hash
+{
+    return _index ^ (NSUInteger)(__bridge void *)_owner;
 }
 
 #pragma mark Internal
@@ -927,11 +1831,6 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
     return (cd != nil) && (cd == _owner);
 }
 
-- (NOZFileEntryT *)internalEntry
-{
-    return &_entry;
-}
-
 - (BOOL)isZeroLength
 {
     return (_entry.centralDirectoryRecord.fileHeader->fileDescriptor->compressedSize == 0);
@@ -954,13 +1853,28 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
     return NO;
 }
 
+- (BOOL)isCompressionDictionary
+{
+    // entries a user named like a dictionary don't have the extra field
+    UInt32 dictionaryID = 0;
+    if (!noz_read_dictionary_extra_field(_entry.extraField, _entry.fileHeader.extraFieldSize, NOZExtraFieldIdentifierCompressionDictionary, &dictionaryID)) {
+        return NO;
+    }
+
+    NSArray<NSString *> *components = [self.nameNoCopy pathComponents];
+    if (components.count == 2 && [components.firstObject isEqualToString:NOZDictionaryEntryDirectory]) {
+        return YES;
+    }
+    return NO;
+}
+
 - (NOZErrorCode)validate
 {
     if (self.isZeroLength || self.isMacOSXAttribute || self.isMacOSXDSStore) {
         return 0;
     }
 
-    if ((_entry.centralDirectoryRecord.fileHeader->versionForExtraction & 0x00ff) > (NOZVersionForExtraction & 0x00ff)) {
+    if ((_entry.centralDirectoryRecord.fileHeader->versionForExtraction & 0x00ff) > (NOZVersionForZip64 & 0x00ff)) {
         return NOZErrorCodeUnzipUnsupportedRecordVersion;
     }
     if ((_entry.centralDirectoryRecord.fileHeader->bitFlag & 0b01)) {
@@ -972,6 +1886,51 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount);
 
 @end
 
+@implementation NOZCentralDirectory (Project)
+
+- (void)getInternalEntry:(NOZFileEntryT *)entry atIndex:(NSUInteger)index
+{
+    const NOZCentralDirectoryEntryT *compactEntry = &_entries[index];
+    const Byte *variableBytes = _arena + compactEntry->arenaOffset;
+
+    NOZFileEntryInit(entry);
+    entry->fileDescriptor.crc32 = compactEntry->crc32;
+    entry->fileDescriptor.compressedSize = compactEntry->compressedSize;
+    entry->fileDescriptor.uncompressedSize = compactEntry->uncompressedSize;
+    entry->fileHeader.versionForExtraction = compactEntry->versionForExtraction;
+    entry->fileHeader.bitFlag = compactEntry->bitFlag;
+    entry->fileHeader.compressionMethod = compactEntry->compressionMethod;
+    entry->fileHeader.dosTime = compactEntry->dosTime;
+    entry->fileHeader.dosDate = compactEntry->dosDate;
+    entry->fileHeader.nameSize = compactEntry->nameSize;
+    entry->fileHeader.extraFieldSize = compactEntry->extraFieldSize;
+    entry->centralDirectoryRecord.versionMadeBy = compactEntry->versionMadeBy;
+    entry->centralDirectoryRecord.commentSize = compactEntry->commentSize;
+    entry->centralDirectoryRecord.fileStartDiskNumber = compactEntry->fileStartDiskNumber;
+    entry->centralDirectoryRecord.internalFileAttributes = compactEntry->internalFileAttributes;
+    entry->centralDirectoryRecord.externalFileAttributes = compactEntry->externalFileAttributes;
+    entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk = compactEntry->localFileHeaderOffset;
+    entry->name = variableBytes;
+    entry->extraField = (compactEntry->extraFieldSize > 0) ? variableBytes + compactEntry->nameSize : NULL;
+    entry->comment = (compactEntry->commentSize > 0) ? variableBytes + compactEntry->nameSize + compactEntry->extraFieldSize : NULL;
+}
+
+- (UInt64)centralDirectoryStartOffset
+{
+    return _endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset;
+}
+
+@end
+
+@implementation NOZCentralDirectoryRecord (Project)
+
+- (NOZFileEntryT *)internalEntry
+{
+    return &_entry;
+}
+
+@end
+
 static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount)
 {
     for (size_t i = 0; i < byteCount; i++) {
@@ -987,3 +1946,155 @@ static BOOL noz_fread_value(FILE *file, Byte* value, const UInt8 byteCount)
     }
     return YES;
 }
+
+static BOOL noz_read_zip64_extra_field(const Byte *extraField,
+                                       UInt16 extraFieldSize,
+                                       UInt64 *uncompressedSize,
+                                       UInt64 *compressedSize,
+                                       UInt64 *localFileHeaderOffset)
+{
+    const Byte *data = NULL;
+    UInt16 dataSize = 0;
+    if (!noz_find_extra_field_block(extraField, extraFieldSize, NOZExtraFieldIdentifierZip64, &data, &dataSize)) {
+        return NO;
+    }
+
+    // only the saturated values are present, always in this order
+    UInt64 *values[3];
+    UInt8 valueCount = 0;
+    if (uncompressedSize) {
+        values[valueCount++] = uncompressedSize;
+    }
+    if (compressedSize) {
+        values[valueCount++] = compressedSize;
+    }
+    if (localFileHeaderOffset) {
+        values[valueCount++] = localFileHeaderOffset;
+    }
+
+    if (dataSize < (valueCount * 8)) {
+        return NO;
+    }
+
+    for (UInt8 i = 0; i < valueCount; i++) {
+        *values[i] = NOZReadLittleEndianUInt64(data + (i * 8));
+    }
+
+    return YES;
+}
+
+static size_t noz_glob_literal_prefix_length(const Byte *pattern, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        switch (pattern[i]) {
+            case '*':
+            case '?':
+            case '[':
+            case '\\':
+                return i;
+            default:
+                break;
+        }
+    }
+    return length;
+}
+
+static BOOL noz_glob_match(const Byte *pattern, const Byte *patternEnd, const Byte *name, const Byte *nameEnd)
+{
+    while (pattern < patternEnd) {
+        switch (*pattern) {
+            case '*': {
+                // "*" stays within a path component, "**" crosses them
+                const BOOL crossesComponents = (pattern + 1 < patternEnd && pattern[1] == '*');
+                pattern += (crossesComponents) ? 2 : 1;
+                if (crossesComponents && pattern < patternEnd && *pattern == '/' && noz_glob_match(pattern + 1, patternEnd, name, nameEnd)) {
+                    // "**/" can also match no directories at all
+                    return YES;
+                }
+                for (const Byte *candidate = name; ; candidate++) {
+                    if (noz_glob_match(pattern, patternEnd, candidate, nameEnd)) {
+                        return YES;
+                    }
+                    if (candidate == nameEnd || (!crossesComponents && *candidate == '/')) {
+                        return NO;
+                    }
+                }
+            }
+            case '?': {
+                if (name == nameEnd || *name == '/') {
+                    return NO;
+                }
+                // one character, however many UTF-8 bytes it takes
+                name++;
+                while (name < nameEnd && (*name & 0xC0) == 0x80) {
+                    name++;
+                }
+                pattern++;
+                break;
+            }
+            case '[': {
+                const Byte *set = pattern + 1;
+                const BOOL negated = (set < patternEnd && (*set == '!' || *set == '^'));
+                if (negated) {
+                    set++;
+                }
+                // a leading ']' is a member, not the end of the set
+                const Byte *setEnd = (set < patternEnd && *set == ']') ? set + 1 : set;
+                while (setEnd < patternEnd && *setEnd != ']') {
+                    setEnd++;
+                }
+
+                if (setEnd == patternEnd) {
+                    // never closed, so it's a literal '['
+                    if (name == nameEnd || *name != '[') {
+                        return NO;
+                    }
+                    name++;
+                    pattern++;
+                    break;
+                }
+
+                if (name == nameEnd || *name == '/') {
+                    return NO;
+                }
+
+                BOOL matched = NO;
+                for (const Byte *member = set; member < setEnd; member++) {
+                    if ((member + 2) < setEnd && member[1] == '-') {
+                        matched = matched || (*name >= member[0] && *name <= member[2]);
+                        member += 2;
+                    } else {
+                        matched = matched || (*name == *member);
+                    }
+                }
+                if (matched == negated) {
+                    return NO;
+                }
+                name++;
+                pattern = setEnd + 1;
+                break;
+            }
+            case '\\': {
+                if (pattern + 1 < patternEnd) {
+                    pattern++;
+                }
+                if (name == nameEnd || *name != *pattern) {
+                    return NO;
+                }
+                name++;
+                pattern++;
+                break;
+            }
+            default: {
+                if (name == nameEnd || *name != *pattern) {
+                    return NO;
+                }
+                name++;
+                pattern++;
+                break;
+            }
+        }
+    }
+
+    return name == nameEnd;
+}
@@ -0,0 +1,76 @@
+//
+//  NOZUnzipper_Project.h
+//  ZipUtilities
+//
+//  The MIT License (MIT)
+//
+//  Copyright (c) 2016 Nolan O'Brien
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+#import "NOZUnzipper.h"
+#import "NOZUtils_Project.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Project level methods for `NOZCentralDirectoryRecord`
+ */
+@interface NOZCentralDirectoryRecord (Project)
+
+/** The record's backing entry, owned by the record.  Its name, extra field and comment live in the record's central directory. */
+- (NOZFileEntryT *)internalEntry;
+
+@end
+
+/**
+ Project level methods for `NOZCentralDirectory`
+ */
+@interface NOZCentralDirectory (Project)
+
+/**
+ Fill _entry_ with the record at _index_, without creating a `NOZCentralDirectoryRecord`.
+ The entry's name, extra field and comment point into the receiver's storage and are not owned by the entry.
+ */
+- (void)getInternalEntry:(NOZFileEntryT *)entry atIndex:(NSUInteger)index;
+
+/** Offset from the start of the archive to the first central directory record */
+- (UInt64)centralDirectoryStartOffset;
+
+@end
+
+/**
+ Project level methods for `NOZUnzipper`
+ */
+@interface NOZUnzipper (Project)
+
+/**
+ Locate the compressed bytes of _record_ in the archive, for copying them without decoding.
+ The returned _fileDescriptor_ belongs to the unzipper and is only valid until it is closed.
+ Read from it with positioned reads (like `pread`) to leave the unzipper's position alone.
+ */
+- (BOOL)locateCompressedDataOfRecord:(NOZCentralDirectoryRecord *)record
+                      fileDescriptor:(out int *)fileDescriptor
+                              offset:(out SInt64 *)offset
+                               error:(out NSError * __nullable * __nullable)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -25,9 +25,16 @@
 //  SOFTWARE.
 //
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // copy_file_range
+#endif
+
 #import "NOZ_Project.h"
 #import "NOZUtils_Project.h"
 #include "zlib.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 void NOZFileEntryInit(NOZFileEntryT* entry)
 {
@@ -85,6 +92,547 @@ void NOZFileEntryCleanFree(NOZFileEntryT* entry)
     }
 }
 
+static BOOL _NOZWriteVectors(NOZBufferedWriterT *writer, struct iovec *vectors, int vectorCount)
+{
+    if (writer->outputFunction) {
+        for (int i = 0; i < vectorCount; i++) {
+            if (!writer->outputFunction(writer->outputContext, (const Byte *)vectors[i].iov_base, vectors[i].iov_len)) {
+                return NO;
+            }
+        }
+        return YES;
+    }
+
+    const int fd = writer->fd;
+    while (vectorCount > 0) {
+        const ssize_t bytesWritten = writev(fd, vectors, vectorCount);
+        if (bytesWritten < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return NO;
+        } else if (0 == bytesWritten) {
+            return NO;
+        }
+
+        // handle partial writes
+        size_t remaining = (size_t)bytesWritten;
+        while (vectorCount > 0 && remaining >= vectors->iov_len) {
+            remaining -= vectors->iov_len;
+            vectors++;
+            vectorCount--;
+        }
+        if (vectorCount > 0) {
+            vectors->iov_base = (Byte *)vectors->iov_base + remaining;
+            vectors->iov_len -= remaining;
+        }
+    }
+    return YES;
+}
+
+BOOL NOZBufferedWriterInit(NOZBufferedWriterT* writer, int fd, SInt64 position, size_t capacity)
+{
+    bzero(writer, sizeof(NOZBufferedWriterT));
+    writer->fd = fd;
+    writer->flushedPosition = position;
+    writer->seekable = (lseek(fd, 0, SEEK_CUR) >= 0);
+    writer->readable = ((fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR);
+    writer->buffer = (Byte *)malloc(capacity);
+    if (!writer->buffer) {
+        writer->fd = -1;
+        return NO;
+    }
+    writer->bufferCapacity = capacity;
+    return YES;
+}
+
+BOOL NOZBufferedWriterInitWithOutputFunction(NOZBufferedWriterT* writer, NOZBufferedWriterOutputFunction outputFunction, void *outputContext, size_t capacity)
+{
+    bzero(writer, sizeof(NOZBufferedWriterT));
+    writer->fd = -1;
+    writer->outputFunction = outputFunction;
+    writer->outputContext = outputContext;
+    writer->buffer = (Byte *)malloc(capacity);
+    if (!writer->buffer) {
+        writer->outputFunction = NULL;
+        return NO;
+    }
+    writer->bufferCapacity = capacity;
+    return YES;
+}
+
+BOOL NOZBufferedWriterInitInMemory(NOZBufferedWriterT* writer, size_t capacity)
+{
+    bzero(writer, sizeof(NOZBufferedWriterT));
+    writer->fd = -1;
+    writer->seekable = YES;
+    writer->readable = YES;
+    writer->inMemory = YES;
+    writer->buffer = (Byte *)malloc(capacity);
+    if (!writer->buffer) {
+        return NO;
+    }
+    writer->bufferCapacity = capacity;
+    return YES;
+}
+
+BOOL NOZBufferedWriterReserveCapacity(NOZBufferedWriterT* writer, size_t capacity)
+{
+    if (!writer->inMemory) {
+        return NO;
+    }
+
+    if (capacity <= writer->bufferCapacity) {
+        return YES;
+    }
+
+    Byte *buffer = (Byte *)realloc(writer->buffer, capacity);
+    if (!buffer) {
+        return NO;
+    }
+    writer->buffer = buffer;
+    writer->bufferCapacity = capacity;
+    return YES;
+}
+
+Byte *NOZBufferedWriterDetachBuffer(NOZBufferedWriterT* writer, size_t *length)
+{
+    if (!writer->inMemory) {
+        return NULL;
+    }
+
+    Byte *buffer = writer->buffer;
+    *length = writer->bufferLength;
+    if (writer->bufferLength > 0 && writer->bufferLength < writer->bufferCapacity) {
+        // give back the slack, it's fine to keep the bigger buffer if that fails
+        Byte *shrunkBuffer = (Byte *)realloc(buffer, writer->bufferLength);
+        if (shrunkBuffer) {
+            buffer = shrunkBuffer;
+        }
+    }
+    writer->buffer = NULL;
+    writer->bufferCapacity = writer->bufferLength = 0;
+    return buffer;
+}
+
+#pragma mark Background Flushing
+
+typedef struct _NOZBufferedWriterBackgroundT
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+
+    Byte **buffers;         // every buffer, to free them
+    Byte **freeBuffers;     // stack of buffers ready to be filled
+    size_t freeCount;
+    Byte **queuedBuffers;   // ring of full buffers waiting to be written
+    size_t *queuedLengths;
+    size_t queueStart;
+    size_t queuedCount;
+    size_t bufferCount;
+
+    BOOL failed;
+    BOOL stopping;
+} NOZBufferedWriterBackgroundT;
+
+static BOOL _NOZBufferedWriterQueueBuffer(NOZBufferedWriterT *writer);
+static BOOL _NOZBufferedWriterDrain(NOZBufferedWriterT *writer);
+
+static void *_NOZBufferedWriterBackgroundMain(void *context)
+{
+    NOZBufferedWriterT *writer = (NOZBufferedWriterT *)context;
+    NOZBufferedWriterBackgroundT *background = writer->background;
+
+    pthread_mutex_lock(&background->mutex);
+    while (YES) {
+        while (0 == background->queuedCount && !background->stopping) {
+            pthread_cond_wait(&background->condition, &background->mutex);
+        }
+        if (0 == background->queuedCount) {
+            break;
+        }
+
+        Byte *buffer = background->queuedBuffers[background->queueStart];
+        const size_t length = background->queuedLengths[background->queueStart];
+        const BOOL skip = background->failed;
+        pthread_mutex_unlock(&background->mutex);
+
+        BOOL success = YES;
+        if (!skip) {
+            @autoreleasepool {
+                struct iovec vector = { buffer, length };
+                success = _NOZWriteVectors(writer, &vector, 1);
+            }
+        }
+
+        pthread_mutex_lock(&background->mutex);
+        background->queueStart = (background->queueStart + 1) % background->bufferCount;
+        background->queuedCount--;
+        background->freeBuffers[background->freeCount++] = buffer;
+        if (!success) {
+            background->failed = YES;
+        }
+        pthread_cond_broadcast(&background->condition);
+    }
+    pthread_mutex_unlock(&background->mutex);
+
+    return NULL;
+}
+
+BOOL NOZBufferedWriterEnableBackgroundFlushing(NOZBufferedWriterT* writer, size_t bufferCount)
+{
+    if (writer->background || writer->inMemory || !writer->buffer || bufferCount < 2) {
+        return NO;
+    }
+
+    NOZBufferedWriterBackgroundT *background = (NOZBufferedWriterBackgroundT *)calloc(1, sizeof(NOZBufferedWriterBackgroundT));
+    if (!background) {
+        return NO;
+    }
+    background->bufferCount = bufferCount;
+    background->buffers = (Byte **)calloc(bufferCount, sizeof(Byte *));
+    background->freeBuffers = (Byte **)calloc(bufferCount, sizeof(Byte *));
+    background->queuedBuffers = (Byte **)calloc(bufferCount, sizeof(Byte *));
+    background->queuedLengths = (size_t *)calloc(bufferCount, sizeof(size_t));
+
+    BOOL success = background->buffers && background->freeBuffers && background->queuedBuffers && background->queuedLengths;
+    if (success) {
+        // the buffer being filled is one of them
+        background->buffers[0] = writer->buffer;
+        for (size_t i = 1; success && i < bufferCount; i++) {
+            background->buffers[i] = (Byte *)malloc(writer->bufferCapacity);
+            if (background->buffers[i]) {
+                background->freeBuffers[background->freeCount++] = background->buffers[i];
+            } else {
+                success = NO;
+            }
+        }
+    }
+
+    if (success) {
+        pthread_mutex_init(&background->mutex, NULL);
+        pthread_cond_init(&background->condition, NULL);
+        writer->background = background;
+        if (0 != pthread_create(&background->thread, NULL, _NOZBufferedWriterBackgroundMain, writer)) {
+            pthread_cond_destroy(&background->condition);
+            pthread_mutex_destroy(&background->mutex);
+            writer->background = NULL;
+            success = NO;
+        }
+    }
+
+    if (!success) {
+        if (background->buffers) {
+            for (size_t i = 1; i < bufferCount; i++) {
+                free(background->buffers[i]);
+            }
+        }
+        free(background->buffers);
+        free(background->freeBuffers);
+        free(background->queuedBuffers);
+        free(background->queuedLengths);
+        free(background);
+    }
+
+    return success;
+}
+
+static BOOL _NOZBufferedWriterQueueBuffer(NOZBufferedWriterT *writer)
+{
+    NOZBufferedWriterBackgroundT *background = writer->background;
+    if (0 == writer->bufferLength) {
+        return YES;
+    }
+
+    pthread_mutex_lock(&background->mutex);
+    while (0 == background->freeCount && !background->failed) {
+        pthread_cond_wait(&background->condition, &background->mutex);
+    }
+    const BOOL failed = background->failed;
+    if (!failed) {
+        const size_t queueEnd = (background->queueStart + background->queuedCount) % background->bufferCount;
+        background->queuedBuffers[queueEnd] = writer->buffer;
+        background->queuedLengths[queueEnd] = writer->bufferLength;
+        background->queuedCount++;
+        writer->buffer = background->freeBuffers[--background->freeCount];
+        pthread_cond_broadcast(&background->condition);
+    }
+    pthread_mutex_unlock(&background->mutex);
+
+    if (failed) {
+        return NO;
+    }
+
+    writer->flushedPosition += (SInt64)writer->bufferLength;
+    writer->bufferLength = 0;
+    return YES;
+}
+
+static BOOL _NOZBufferedWriterDrain(NOZBufferedWriterT *writer)
+{
+    NOZBufferedWriterBackgroundT *background = writer->background;
+    if (!background) {
+        return YES;
+    }
+
+    pthread_mutex_lock(&background->mutex);
+    while (background->queuedCount > 0) {
+        pthread_cond_wait(&background->condition, &background->mutex);
+    }
+    const BOOL failed = background->failed;
+    pthread_mutex_unlock(&background->mutex);
+    return !failed;
+}
+
+static void _NOZBufferedWriterStopBackgroundFlushing(NOZBufferedWriterT *writer)
+{
+    NOZBufferedWriterBackgroundT *background = writer->background;
+    if (!background) {
+        return;
+    }
+
+    pthread_mutex_lock(&background->mutex);
+    background->stopping = YES;
+    pthread_cond_broadcast(&background->condition);
+    pthread_mutex_unlock(&background->mutex);
+    pthread_join(background->thread, NULL);
+
+    pthread_cond_destroy(&background->condition);
+    pthread_mutex_destroy(&background->mutex);
+    for (size_t i = 0; i < background->bufferCount; i++) {
+        if (background->buffers[i] != writer->buffer) {
+            free(background->buffers[i]);
+        }
+    }
+    free(background->buffers);
+    free(background->freeBuffers);
+    free(background->queuedBuffers);
+    free(background->queuedLengths);
+    free(background);
+    writer->background = NULL;
+}
+
+#pragma mark Buffered Writer
+
+BOOL NOZBufferedWriterFlush(NOZBufferedWriterT* writer)
+{
+    if (writer->background) {
+        return _NOZBufferedWriterQueueBuffer(writer) && _NOZBufferedWriterDrain(writer);
+    }
+
+    if (0 == writer->bufferLength || writer->inMemory) {
+        return YES;
+    }
+
+    struct iovec vector = { writer->buffer, writer->bufferLength };
+    if (!_NOZWriteVectors(writer, &vector, 1)) {
+        return NO;
+    }
+
+    writer->flushedPosition += (SInt64)writer->bufferLength;
+    writer->bufferLength = 0;
+    return YES;
+}
+
+void NOZBufferedWriterClean(NOZBufferedWriterT* writer)
+{
+    _NOZBufferedWriterStopBackgroundFlushing(writer);
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->bufferCapacity = writer->bufferLength = 0;
+}
+
+BOOL NOZBufferedWriterWrite(NOZBufferedWriterT* writer, const Byte* bytes, size_t length)
+{
+    if (0 == length) {
+        return YES;
+    }
+
+    if (length <= writer->bufferCapacity - writer->bufferLength) {
+        memcpy(writer->buffer + writer->bufferLength, bytes, length);
+        writer->bufferLength += length;
+        return YES;
+    }
+
+    if (writer->background) {
+        // fill whole buffers, the background thread writes them while the next one fills
+        while (length > 0) {
+            const size_t copyLength = MIN(length, writer->bufferCapacity - writer->bufferLength);
+            memcpy(writer->buffer + writer->bufferLength, bytes, copyLength);
+            writer->bufferLength += copyLength;
+            bytes += copyLength;
+            length -= copyLength;
+            if (writer->bufferLength == writer->bufferCapacity && !_NOZBufferedWriterQueueBuffer(writer)) {
+                return NO;
+            }
+        }
+        return YES;
+    }
+
+    if (writer->inMemory) {
+        // grow geometrically so many small writes don't each reallocate
+        if (!NOZBufferedWriterReserveCapacity(writer, MAX(writer->bufferCapacity * 2, writer->bufferLength + length))) {
+            return NO;
+        }
+        memcpy(writer->buffer + writer->bufferLength, bytes, length);
+        writer->bufferLength += length;
+        return YES;
+    }
+
+    if (length < writer->bufferCapacity) {
+        if (!NOZBufferedWriterFlush(writer)) {
+            return NO;
+        }
+        memcpy(writer->buffer, bytes, length);
+        writer->bufferLength = length;
+        return YES;
+    }
+
+    // Too big to buffer, send it out along with what's already buffered
+    struct iovec vectors[2];
+    int vectorCount = 0;
+    if (writer->bufferLength > 0) {
+        vectors[vectorCount++] = (struct iovec){ writer->buffer, writer->bufferLength };
+    }
+    vectors[vectorCount++] = (struct iovec){ (void *)bytes, length };
+    if (!_NOZWriteVectors(writer, vectors, vectorCount)) {
+        return NO;
+    }
+
+    writer->flushedPosition += (SInt64)(writer->bufferLength + length);
+    writer->bufferLength = 0;
+    return YES;
+}
+
+BOOL NOZBufferedWriterPatch(NOZBufferedWriterT* writer, const Byte* bytes, size_t length, SInt64 position)
+{
+    if (position < 0 || position + (SInt64)length > NOZBufferedWriterPosition(writer)) {
+        return NO;
+    }
+
+    if (position < writer->flushedPosition && !writer->seekable) {
+        return NO;
+    }
+
+    // queued buffers have to reach the output before it can be patched
+    if (position < writer->flushedPosition && !_NOZBufferedWriterDrain(writer)) {
+        return NO;
+    }
+
+    // the part that already went out to the file
+    while (length > 0 && position < writer->flushedPosition) {
+        const size_t flushedLength = (size_t)MIN((SInt64)length, writer->flushedPosition - position);
+        const ssize_t bytesWritten = pwrite(writer->fd, bytes, flushedLength, (off_t)position);
+        if (bytesWritten < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return NO;
+        } else if (0 == bytesWritten) {
+            return NO;
+        }
+        bytes += bytesWritten;
+        length -= (size_t)bytesWritten;
+        position += bytesWritten;
+    }
+
+    // the part that is still buffered
+    if (length > 0) {
+        memcpy(writer->buffer + (position - writer->flushedPosition), bytes, length);
+    }
+
+    return YES;
+}
+
+BOOL NOZBufferedWriterTruncate(NOZBufferedWriterT* writer, SInt64 position)
+{
+    if (position < 0 || position > NOZBufferedWriterPosition(writer)) {
+        return NO;
+    }
+
+    if (position >= writer->flushedPosition) {
+        writer->bufferLength = (size_t)(position - writer->flushedPosition);
+        return YES;
+    }
+
+    if (!writer->seekable || !_NOZBufferedWriterDrain(writer) || 0 != ftruncate(writer->fd, (off_t)position) || lseek(writer->fd, (off_t)position, SEEK_SET) < 0) {
+        return NO;
+    }
+
+    writer->flushedPosition = position;
+    writer->bufferLength = 0;
+    return YES;
+}
+
+BOOL NOZBufferedWriterCopyFromFile(NOZBufferedWriterT* writer, int fd, SInt64 offset, SInt64 length)
+{
+#if defined(__linux__)
+    // Copy in kernel, anything buffered has to go out first to keep the order
+    if (length > 0 && writer->fd >= 0 && writer->seekable && NOZBufferedWriterFlush(writer)) {
+        off_t sourceOffset = (off_t)offset;
+        while (length > 0) {
+            const ssize_t bytesCopied = copy_file_range(fd, &sourceOffset, writer->fd, NULL, (size_t)MIN(length, (SInt64)SSIZE_MAX), 0);
+            if (bytesCopied <= 0) {
+                if (bytesCopied < 0 && EINTR == errno) {
+                    continue;
+                }
+                // not supported for these files (or end of file), finish with reads and writes
+                break;
+            }
+            writer->flushedPosition += bytesCopied;
+            offset += bytesCopied;
+            length -= bytesCopied;
+        }
+    }
+#endif
+
+    const size_t bufferSize = NOZBufferSize();
+    Byte buffer[bufferSize];
+    while (length > 0) {
+        const ssize_t bytesRead = pread(fd, buffer, (size_t)MIN(length, (SInt64)bufferSize), (off_t)offset);
+        if (bytesRead < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return NO;
+        } else if (0 == bytesRead) {
+            return NO;
+        }
+        if (!NOZBufferedWriterWrite(writer, buffer, (size_t)bytesRead)) {
+            return NO;
+        }
+        offset += bytesRead;
+        length -= bytesRead;
+    }
+
+    return YES;
+}
+
+BOOL NOZBufferedWriterCopyWrittenBytes(NOZBufferedWriterT* writer, SInt64 position, SInt64 length)
+{
+    if (position < 0 || length < 0 || position + length > NOZBufferedWriterPosition(writer)) {
+        return NO;
+    }
+
+    if (writer->inMemory) {
+        // reserve first, growing the buffer moves the bytes being copied
+        if (!NOZBufferedWriterReserveCapacity(writer, writer->bufferLength + (size_t)length)) {
+            return NO;
+        }
+        memcpy(writer->buffer + writer->bufferLength, writer->buffer + position, (size_t)length);
+        writer->bufferLength += (size_t)length;
+        return YES;
+    }
+
+    if (writer->fd < 0 || !writer->seekable || !writer->readable) {
+        return NO;
+    }
+
+    // the bytes are read back from the file, so they can't still be sitting in the buffer
+    return NOZBufferedWriterFlush(writer) && NOZBufferedWriterCopyFromFile(writer, writer->fd, position, length);
+}
+
 static BOOL _NOZOpenInputOutputFiles(NSString * __nonnull sourceFilePath, FILE * __nullable * __nonnull sourceFile, NSString * __nonnull destinationFilePath, FILE * __nonnull * __nullable destinationFile, NSError * __nullable * __nullable error);
 static BOOL _NOZOpenInputOutputFiles(NSString *sourceFilePath, FILE **sourceFile, NSString *destinationFilePath, FILE **destinationFile, NSError **error)
 {
@@ -37,9 +37,21 @@ static const UInt32 NOZMagicNumberLocalFileHeader               = 0x04034b50;
 static const UInt32 NOZMagicNumberDataDescriptor                = 0x08074b50;
 static const UInt32 NOZMagicNumberCentralDirectoryFileRecord    = 0x02014b50;
 static const UInt32 NOZMagicNumberEndOfCentralDirectoryRecord   = 0x06054b50;
+static const UInt32 NOZMagicNumberZip64EndOfCentralDirectoryRecord  = 0x06064b50;
+static const UInt32 NOZMagicNumberZip64EndOfCentralDirectoryLocator = 0x07064b50;
+
+static const UInt16 NOZExtraFieldIdentifierZip64 = 0x0001;
+static const UInt16 NOZExtraFieldIdentifierCompressionDictionary = 0x4E44; // "DN", the reserved entry holding a dictionary
+static const UInt16 NOZExtraFieldIdentifierDictionaryCompressed  = 0x4E45; // "EN", an entry compressed with a dictionary
 
 static const UInt32 NOZVersionForCreation   = 20; // Zip 2.0
 static const UInt32 NOZVersionForExtraction = 20; // Zip 2.0
+static const UInt32 NOZVersionForZip64      = 45; // Zip 4.5
+
+static const UInt16 NOZZip64MaxUInt16 = UINT16_MAX;
+static const UInt32 NOZZip64MaxUInt32 = UINT32_MAX;
+// Entries this large might not compress below 4GB, so they get Zip64 records up front
+static const SInt64 NOZZip64EntrySizeThreshold = (SInt64)UINT32_MAX - ((SInt64)UINT32_MAX / 20);
 
 static const UInt16 NOZFlagBitsNormalDeflate    = 0b000000;
 static const UInt16 NOZFlagBitsMaxDeflate       = 0b000010;
@@ -52,8 +64,8 @@ typedef struct _NOZLocalFileDescriptorT
     // Optionally starts with NOZMagicNumberDataDescriptor
 
     UInt32 crc32;
-    UInt32 compressedSize;
-    UInt32 uncompressedSize;
+    UInt64 compressedSize; // 4 bytes, or 8 bytes in a Zip64 descriptor
+    UInt64 uncompressedSize; // 4 bytes, or 8 bytes in a Zip64 descriptor
 } NOZLocalFileDescriptorT;
 
 typedef struct _NOZLocalFileHeaderT
@@ -84,7 +96,7 @@ typedef struct _NOZCentralDirectoryFileRecordT
     UInt16 fileStartDiskNumber;
     UInt16 internalFileAttributes;
     UInt32 externalFileAttributes;
-    UInt32 localFileHeaderOffsetFromStartOfDisk;
+    UInt64 localFileHeaderOffsetFromStartOfDisk; // 4 bytes, 8 bytes in the Zip64 extra field
 
     // ends with:
     // const Byte* name;
@@ -96,12 +108,14 @@ typedef struct _NOZEndOfCentralDirectoryRecordT
 {
     // starts with NOZMagicNumberEndOfCentralDirectoryRecord
 
-    UInt16 diskNumber;
-    UInt16 startDiskNumber;
-    UInt16 recordCountForDisk;
-    UInt16 totalRecordCount;
-    UInt32 centralDirectorySize;
-    UInt32 archiveStartToCentralDirectoryStartOffset;
+    // The in memory sizes match the Zip64 record, the classic record truncates them
+
+    UInt32 diskNumber; // 2 bytes, or 4 bytes in the Zip64 record
+    UInt32 startDiskNumber; // 2 bytes, or 4 bytes in the Zip64 record
+    UInt64 recordCountForDisk; // 2 bytes, or 8 bytes in the Zip64 record
+    UInt64 totalRecordCount; // 2 bytes, or 8 bytes in the Zip64 record
+    UInt64 centralDirectorySize; // 4 bytes, or 8 bytes in the Zip64 record
+    UInt64 archiveStartToCentralDirectoryStartOffset; // 4 bytes, or 8 bytes in the Zip64 record
     UInt16 commentSize;
 
     // ends with:
@@ -122,6 +136,7 @@ typedef struct _NOZFileEntryT
     BOOL ownsName:1;
     BOOL ownsExtraField:1;
     BOOL ownsComment:1;
+    BOOL usesZip64:1;
 } NOZFileEntryT;
 
 FOUNDATION_EXTERN NOZFileEntryT* NOZFileEntryAllocInit(void);
@@ -130,6 +145,147 @@ FOUNDATION_EXTERN void NOZFileEntryInit(NOZFileEntryT* entry);
 FOUNDATION_EXTERN void NOZFileEntryCleanFree(NOZFileEntryT* entry);
 FOUNDATION_EXTERN void NOZFileEntryClean(NOZFileEntryT* entry);
 
+//! Sends bytes to an output other than a file descriptor, returns `NO` unless all of them were sent
+typedef BOOL (*NOZBufferedWriterOutputFunction)(void *context, const Byte* bytes, size_t length);
+
+/**
+ Buffered writer for zip output.
+ Records and encoded bytes accumulate in `buffer` and go out to `fd` (or `outputFunction`) in large batches,
+ anything that doesn't fit is written alongside the buffered bytes with a single `writev`.
+ When the output isn't `seekable`, bytes can only be patched or truncated while they are still buffered.
+ Written bytes can only be read back from a `readable` output.
+ An `inMemory` writer has no output, its buffer grows to hold everything written.
+ With background flushing, full buffers are queued to a writer thread and filling continues in a spare buffer.
+ */
+typedef struct _NOZBufferedWriterT
+{
+    int fd;
+    NOZBufferedWriterOutputFunction outputFunction;
+    void *outputContext;
+    Byte *buffer;
+    size_t bufferCapacity;
+    size_t bufferLength;
+    SInt64 flushedPosition; // output position of buffer[0]
+    BOOL seekable;
+    BOOL readable;
+    BOOL inMemory;
+    struct _NOZBufferedWriterBackgroundT *background; // NULL unless background flushing is enabled
+} NOZBufferedWriterT;
+
+FOUNDATION_EXTERN BOOL NOZBufferedWriterInit(NOZBufferedWriterT* writer, int fd, SInt64 position, size_t capacity);
+//! Writer for an output that isn't a file descriptor, positions start at `0`
+FOUNDATION_EXTERN BOOL NOZBufferedWriterInitWithOutputFunction(NOZBufferedWriterT* writer, NOZBufferedWriterOutputFunction outputFunction, void *outputContext, size_t capacity);
+//! Writer that keeps everything in memory, _capacity_ is only the initial capacity
+FOUNDATION_EXTERN BOOL NOZBufferedWriterInitInMemory(NOZBufferedWriterT* writer, size_t capacity);
+//! Write full buffers on a background thread, with up to _bufferCount_ buffers (including the one being filled) in flight
+FOUNDATION_EXTERN BOOL NOZBufferedWriterEnableBackgroundFlushing(NOZBufferedWriterT* writer, size_t bufferCount);
+//! Write out everything buffered (waiting for the background thread, if any)
+FOUNDATION_EXTERN BOOL NOZBufferedWriterFlush(NOZBufferedWriterT* writer);
+FOUNDATION_EXTERN void NOZBufferedWriterClean(NOZBufferedWriterT* writer);
+
+FOUNDATION_EXTERN BOOL NOZBufferedWriterWrite(NOZBufferedWriterT* writer, const Byte* bytes, size_t length);
+//! Overwrite bytes that were already written, whether they are still buffered or not
+FOUNDATION_EXTERN BOOL NOZBufferedWriterPatch(NOZBufferedWriterT* writer, const Byte* bytes, size_t length, SInt64 position);
+//! Drop everything written from _position_ on, subsequent writes continue from _position_
+FOUNDATION_EXTERN BOOL NOZBufferedWriterTruncate(NOZBufferedWriterT* writer, SInt64 position);
+//! Append _length_ bytes read from _fd_ at _offset_, in kernel when the platform supports it (`copy_file_range`)
+FOUNDATION_EXTERN BOOL NOZBufferedWriterCopyFromFile(NOZBufferedWriterT* writer, int fd, SInt64 offset, SInt64 length);
+//! Append _length_ bytes that were already written at _position_, needs a `seekable` and `readable` output
+FOUNDATION_EXTERN BOOL NOZBufferedWriterCopyWrittenBytes(NOZBufferedWriterT* writer, SInt64 position, SInt64 length);
+//! Grow an `inMemory` writer's buffer to at least _capacity_ bytes up front
+FOUNDATION_EXTERN BOOL NOZBufferedWriterReserveCapacity(NOZBufferedWriterT* writer, size_t capacity);
+//! Take ownership of an `inMemory` writer's bytes (to be freed with `free`), the writer is left without a buffer
+FOUNDATION_EXTERN Byte *NOZBufferedWriterDetachBuffer(NOZBufferedWriterT* writer, size_t *length);
+
+NS_INLINE SInt64 NOZBufferedWriterPosition(const NOZBufferedWriterT* writer)
+{
+    return writer->flushedPosition + (SInt64)writer->bufferLength;
+}
+
+NS_INLINE BOOL NOZBufferedWriterIsOpen(const NOZBufferedWriterT* writer)
+{
+    return NULL != writer->buffer;
+}
+
+NS_INLINE UInt16 NOZReadLittleEndianUInt16(const Byte* bytes)
+{
+    return (UInt16)(bytes[0] | (bytes[1] << 8));
+}
+
+NS_INLINE UInt32 NOZReadLittleEndianUInt32(const Byte* bytes)
+{
+    return (UInt32)bytes[0] | ((UInt32)bytes[1] << 8) | ((UInt32)bytes[2] << 16) | ((UInt32)bytes[3] << 24);
+}
+
+NS_INLINE UInt64 NOZReadLittleEndianUInt64(const Byte* bytes)
+{
+    return (UInt64)NOZReadLittleEndianUInt32(bytes) | ((UInt64)NOZReadLittleEndianUInt32(bytes + 4) << 32);
+}
+
+/**
+ Bounds checked cursor for reading little endian zip records out of bytes in memory.
+ Reads that would go past `length` fail and leave the cursor where it was.
+ */
+typedef struct _NOZByteReaderT
+{
+    const Byte *bytes;
+    size_t length;
+    size_t offset;
+} NOZByteReaderT;
+
+NS_INLINE void NOZByteReaderInit(NOZByteReaderT* reader, const Byte* bytes, size_t length)
+{
+    reader->bytes = bytes;
+    reader->length = length;
+    reader->offset = 0;
+}
+
+NS_INLINE size_t NOZByteReaderRemainingLength(const NOZByteReaderT* reader)
+{
+    return reader->length - reader->offset;
+}
+
+//! Consume _length_ bytes, returning where they start or `NULL` if there aren't enough left
+NS_INLINE const Byte *NOZByteReaderReadBytes(NOZByteReaderT* reader, size_t length)
+{
+    if (length > (reader->length - reader->offset)) {
+        return NULL;
+    }
+    const Byte *bytes = reader->bytes + reader->offset;
+    reader->offset += length;
+    return bytes;
+}
+
+NS_INLINE BOOL NOZByteReaderReadUInt16(NOZByteReaderT* reader, UInt16* value)
+{
+    const Byte *bytes = NOZByteReaderReadBytes(reader, 2);
+    if (!bytes) {
+        return NO;
+    }
+    *value = NOZReadLittleEndianUInt16(bytes);
+    return YES;
+}
+
+NS_INLINE BOOL NOZByteReaderReadUInt32(NOZByteReaderT* reader, UInt32* value)
+{
+    const Byte *bytes = NOZByteReaderReadBytes(reader, 4);
+    if (!bytes) {
+        return NO;
+    }
+    *value = NOZReadLittleEndianUInt32(bytes);
+    return YES;
+}
+
+NS_INLINE BOOL NOZByteReaderReadUInt64(NOZByteReaderT* reader, UInt64* value)
+{
+    const Byte *bytes = NOZByteReaderReadBytes(reader, 8);
+    if (!bytes) {
+        return NO;
+    }
+    *value = NOZReadLittleEndianUInt64(bytes);
+    return YES;
+}
+
 #import "NOZDecoder.h"
 #import "NOZEncoder.h"
 
@@ -63,6 +63,15 @@ NS_ASSUME_NONNULL_BEGIN
 /** Input Stream for reading the entry into the zip file.  Return `nil` if no input stream is available. */
 - (nullable NSInputStream *)inputStream;
 
+@optional
+
+/**
+ The entry's bytes as one contiguous region, such as a memory-mapped file.
+ When available, the zipper compresses straight from it instead of copying the bytes out of `inputStream`.
+ Return `nil` to fall back to `inputStream`.
+ */
+- (nullable NSData *)contiguousData;
+
 @end
 
 /**
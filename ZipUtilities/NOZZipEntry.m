@@ -25,8 +25,11 @@
 //  SOFTWARE.
 //
 
+#import "NOZ_Project.h"
 #import "NOZZipEntry.h"
 
+#include <sys/mman.h>
+
 @interface NOZAbstractZipEntry ()
 - (instancetype)initWithEntry:(nonnull NOZAbstractZipEntry *)entry;
 @end
@@ -121,6 +124,11 @@
     return [NSInputStream inputStreamWithData:_data];
 }
 
+- (NSData *)contiguousData
+{
+    return _data;
+}
+
 @end
 
 @implementation NOZFileZipEntry
@@ -190,4 +198,72 @@
     return [NSInputStream inputStreamWithFileAtPath:_filePath];
 }
 
+- (NSData *)contiguousData
+{
+    if (!_filePath) {
+        return nil;
+    }
+
+    // empty files can't be mapped, they fall back to the input stream
+    NSData *data = [NSData dataWithContentsOfFile:_filePath options:NSDataReadingMappedAlways error:NULL];
+    if (data.length > 0) {
+        // read front to back exactly once, let the kernel read ahead and drop pages behind
+        (void)madvise((void *)data.bytes, data.length, MADV_SEQUENTIAL);
+    }
+    return data;
+}
+
 @end
+
+BOOL noz_entry_can_restart(id<NOZZippableEntry> entry)
+{
+    // these entries provide a new input stream from the start every time
+    return [entry isKindOfClass:[NOZFileZipEntry class]] || [entry isKindOfClass:[NOZDataZipEntry class]];
+}
+
+NSInteger noz_read_input_stream_fully(NSInputStream *inputStream, Byte *buffer, size_t length)
+{
+    // streams may return short reads, only a read of 0 is the end of the content
+    size_t totalBytesRead = 0;
+    while (totalBytesRead < length) {
+        const NSInteger bytesRead = [inputStream read:buffer + totalBytesRead maxLength:length - totalBytesRead];
+        if (bytesRead < 0) {
+            return -1;
+        } else if (bytesRead == 0) {
+            break;
+        }
+        totalBytesRead += (size_t)bytesRead;
+    }
+    return (NSInteger)totalBytesRead;
+}
+
+NSData *noz_sample_for_entry(id<NOZZippableEntry> entry, size_t maximumLength)
+{
+    // the entry still has to be read when it is added, so only entries that can be restarted are sampled
+    if (!maximumLength || !noz_entry_can_restart(entry)) {
+        return nil;
+    }
+
+    NSData *data = nil;
+    if ([entry respondsToSelector:@selector(contiguousData)]) {
+        data = [entry contiguousData];
+    }
+    if (data) {
+        return (data.length > maximumLength) ? [data subdataWithRange:NSMakeRange(0, maximumLength)] : data;
+    }
+
+    NSInputStream *inputStream = entry.inputStream;
+    if (!inputStream) {
+        return nil;
+    }
+    [inputStream open];
+    noz_defer(^{ [inputStream close]; });
+
+    NSMutableData *sample = [NSMutableData dataWithLength:maximumLength];
+    const NSInteger sampleLength = noz_read_input_stream_fully(inputStream, sample.mutableBytes, maximumLength);
+    if (sampleLength < 0) {
+        return nil;
+    }
+    sample.length = (NSUInteger)sampleLength;
+    return sample;
+}
@@ -30,18 +30,51 @@
 #import "NOZUtils.h"
 #import "NOZZipEntry.h"
 
+@class NOZCentralDirectoryRecord;
 @class NOZEncrytion;
+@class NOZUnzipper;
 
 /**
- Enum of possible modes to open an `NOZZipper` with.  Currently only creating a new archive is supported.
+ Enum of possible modes to open an `NOZZipper` with.
+
+ Opening an existing archive appends to it: new entries are written over the existing central directory
+ and a merged central directory is written when the zipper is closed, so the existing entries are never rewritten.
+ The archive is updated in place, so a failure after opening can leave it damaged.
  */
 typedef NS_ENUM(NSInteger, NOZZipperMode)
 {
     /** Creat a new zip archive */
     NOZZipperModeCreate,
-// TODO: add support for adding to an existing file
-//    NOZZipperModeOpenExisting,
-//    NOZZipperModeOpenExistingOrCreate,
+    /** Append to an existing zip archive, fails if there is no archive at the path */
+    NOZZipperModeOpenExisting,
+    /** Append to an existing zip archive, or create a new one if there is no archive at the path */
+    NOZZipperModeOpenExistingOrCreate,
+};
+
+/**
+ Enum of ways `NOZZipper` can handle entries whose content was already added to the archive.
+
+ Duplicates are found by fingerprinting `NOZFileZipEntry` and `NOZDataZipEntry` content (with its CRC-32 and size)
+ before it is compressed and then comparing the bytes of matching entries,
+ files that are hard links of an already added file are found without reading them.
+ Only entries added with `addEntry:progressBlock:error:` since the Zipper was opened are considered.
+ */
+typedef NS_ENUM(NSInteger, NOZZipperDeduplicationMode)
+{
+    /** Every entry is compressed and written */
+    NOZZipperDeduplicationModeNone = 0,
+    /**
+     Duplicates get a copy of the already compressed bytes, without compressing them again.
+     The copy is read back from the archive, so when zipping to an output stream, a pipe
+     or a file descriptor that wasn't opened `O_RDWR`, duplicates are compressed as usual.
+     */
+    NOZZipperDeduplicationModeCopyCompressedData,
+    /**
+     Duplicates only get a central directory record pointing at the already written data.
+     Produces the smallest archive, but the shared local file header keeps the first entry's name
+     and some unzip tools refuse archives with entries sharing data.
+     */
+    NOZZipperDeduplicationModeShareCompressedData,
 };
 
 /**
@@ -49,9 +82,8 @@ typedef NS_ENUM(NSInteger, NOZZipperMode)
  
  Uses the globally registered compression encoders.  See `NOZEncoderForCompressionMethod` and `NOZCompressionLibrary`.
  
- By default, `NOZZipper` is optimized to compress in a single pass.
- If you need `NOZZipper` to output without this optimization, define `NOZ_SINGLE_PASS_ZIP` as `0`
- in your build settings.
+ By default, `NOZZipper` is optimized to compress in a single pass, following each entry with a data descriptor.
+ Set `usesDataDescriptors` to `NO` to have the local file headers patched instead.
  
  ### Example
 
@@ -103,15 +135,86 @@ typedef NS_ENUM(NSInteger, NOZZipperMode)
  */
 @interface NOZZipper : NSObject
 
-/** The path to the zip file */
-@property (nonatomic, readonly, nonnull) NSString *zipFilePath;
+/** The path to the zip file, `nil` when zipping to memory, an output stream or a file descriptor */
+@property (nonatomic, readonly, nullable) NSString *zipFilePath;
 
-/** An optional global comment for the zip archive.  Must be set _before_ closing the Zipper. */
+/**
+ The zipped archive when zipping to memory (see `initForZippingToMemory`).
+ Set once the Zipper was closed successfully, `nil` otherwise.
+ */
+@property (nonatomic, readonly, nullable) NSData *zippedData;
+
+/**
+ An optional global comment for the zip archive.  Must be set _before_ closing the Zipper.
+ When opening an existing archive, the archive's comment is kept unless a comment was already set.
+ */
 @property (nonatomic, copy, nullable) NSString *globalComment;
 
+/**
+ Whether each entry's CRC and sizes follow its data in a data descriptor.
+ When `NO`, the zipper seeks back and writes them into the entry's local file header instead,
+ so readers walking the local file headers know each entry's size up front.
+ Must be set _before_ opening the Zipper.
+ Default is `YES`, unless `NOZ_SINGLE_PASS_ZIP` is defined as `0`.
+ */
+@property (nonatomic) BOOL usesDataDescriptors;
+
+/**
+ Whether entries that won't compress are stored instead.
+ Before an entry is compressed, its first 64KB are sampled and if they look incompressible
+ (like JPEG, MP4 or already compressed data), the entry is stored with `NOZCompressionMethodNone`.
+ `NOZFileZipEntry` and `NOZDataZipEntry` entries are also restarted as stored when compression
+ stops paying off part way through.
+ Default is `NO`.
+ */
+@property (nonatomic) BOOL detectsIncompressibleEntries;
+
+/**
+ Whether reading, compressing and writing each entry overlap.
+ When `YES`, entries' input streams are read ahead on a background thread and the archive is written
+ on another one, each through a small ring of large buffers, while the calling thread computes CRCs and compresses.
+ Helps most when the source or destination is slow storage.
+ Input streams must support being read from a background thread.
+ Must be set _before_ opening the Zipper.
+ Default is `NO`.
+ */
+@property (nonatomic) BOOL pipelinesEntries;
+
+/**
+ How entries with the same content as an earlier entry are added.
+ See `NOZZipperDeduplicationMode`.
+ Default is `NOZZipperDeduplicationModeNone`.
+ */
+@property (nonatomic) NOZZipperDeduplicationMode deduplicationMode;
+
 /** Designated initializer */
 - (nonnull instancetype)initWithZipFile:(nonnull NSString *)zipFilePath NS_DESIGNATED_INITIALIZER;
 
+/**
+ Initializer for zipping to memory, avoiding the file system altogether.
+ Meant for small archives: the whole archive is held in memory and becomes `zippedData` when the Zipper is closed.
+ Only `NOZZipperModeCreate` is supported.
+ */
+- (nonnull instancetype)initForZippingToMemory NS_DESIGNATED_INITIALIZER;
+
+/**
+ Initializer for zipping to an output stream, such as a bound pair or a socket stream.
+ The stream is opened if needed, written to synchronously, and closed when the Zipper is closed.
+ Only `NOZZipperModeCreate` is supported and since the stream can't be seeked,
+ data descriptors are always used and entries won't restart as stored (see `detectsIncompressibleEntries`).
+ */
+- (nonnull instancetype)initWithOutputStream:(nonnull NSOutputStream *)outputStream NS_DESIGNATED_INITIALIZER;
+
+/**
+ Initializer for zipping to a file descriptor, such as a pipe or an already open file.
+ The archive starts at the descriptor's current position (if it has one)
+ and the descriptor is left open when the Zipper is closed.
+ Only `NOZZipperModeCreate` is supported and when the descriptor can't be seeked,
+ the same restrictions as `initWithOutputStream:` apply.
+ `NOZZipperDeduplicationModeCopyCompressedData` reads the archive back, so it needs the descriptor opened `O_RDWR`.
+ */
+- (nonnull instancetype)initWithFileDescriptor:(int)fileDescriptor NS_DESIGNATED_INITIALIZER;
+
 /** Unavailable */
 - (nonnull instancetype)init NS_UNAVAILABLE;
 /** Unavailable */
@@ -141,4 +244,41 @@ typedef NS_ENUM(NSInteger, NOZZipperMode)
    progressBlock:(__attribute__((noescape)) NOZProgressBlock __nullable)progressBlock
            error:(out NSError * __nullable * __nullable)error;
 
+/**
+ Train a compression dictionary from samples of _entries_ and embed it in the archive.
+ The dictionary is stored as a reserved entry under `"__NOZDICTIONARIES__/"` and every entry added afterwards
+ with _compressionMethod_ is compressed with it.  Archives of many small, similar entries (like JSON files)
+ compress several times better this way.
+ The dictionary entry and the entries compressed with it are marked with an extra field,
+ `NOZUnzipper` finds the dictionary of marked entries and decompresses with it automatically, other unzip tools can't decompress those entries.
+ The encoder and decoder registered for _compressionMethod_ must support dictionaries
+ (see `trainDictionaryWithSamples:maximumSize:` in `NOZEncoder`), like the zstd coders of _ZipUtilities_ do.
+ Must be called before any entry is added (once per compression method), and not when appending to an archive with entries.
+ Records copied with `addRecord:fromUnzipper:` are not recompressed, so they must not use _compressionMethod_.
+ @param entries The entries to sample, typically the entries about to be added.  The first 128KB of each are sampled and the entries' input streams are read again when they are added.
+ @param compressionMethod The compression method of the entries the dictionary is for.
+ @param maximumSize The maximum size of the dictionary in bytes, `0` for the default of 110KB.
+ Training works best with about 100 times as many sampled bytes.
+ @param error The error will be set if an error is encountered.  Pass `NULL` if you don't care.
+ @return `YES` on success, `NO` on failure.
+ */
+- (BOOL)addDictionaryTrainedFromEntries:(nonnull NSArray<id<NOZZippableEntry>> *)entries
+                      compressionMethod:(NOZCompressionMethod)compressionMethod
+                            maximumSize:(size_t)maximumSize
+                                  error:(out NSError * __nullable * __nullable)error;
+
+/**
+ Add an entry by copying a record of another archive as is, without decompressing and recompressing it.
+ The compressed bytes, CRC and sizes of the record are copied straight into the Zipper.
+ @param record The record to copy, from the central directory of _unzipper_.
+ @param unzipper The open unzipper that read _record_.
+ @param progressBlock The optional block for observing progress (in compressed bytes).
+ @param error The error will be set if an error is encountered.  Pass `NULL` if you don't care.
+ @return `YES` on success, `NO` on failure.
+ */
+- (BOOL)addRecord:(nonnull NOZCentralDirectoryRecord *)record
+     fromUnzipper:(nonnull NOZUnzipper *)unzipper
+    progressBlock:(__attribute__((noescape)) NOZProgressBlock __nullable)progressBlock
+            error:(out NSError * __nullable * __nullable)error;
+
 @end
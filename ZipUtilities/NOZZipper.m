@@ -28,58 +28,179 @@
 #import "NOZ_Project.h"
 #import "NOZCompressionLibrary.h"
 #import "NOZError.h"
+#import "NOZUnzipper_Project.h"
 #import "NOZUtils_Project.h"
 #import "NOZZipper.h"
+#import "NOZZipper_Project.h"
 
+#include <sys/stat.h>
+
+// Only sets the default for `usesDataDescriptors`
 #ifndef NOZ_SINGLE_PASS_ZIP
 #define NOZ_SINGLE_PASS_ZIP 1
 #endif
 
-static UInt8 noz_fwrite_value(UInt64 x, const UInt8 byteCount, FILE *file);
 static UInt8 noz_store_value(UInt64 x, const UInt8 byteCount, Byte *buffer, const Byte *bufferEnd);
+static UInt16 noz_store_zip64_extra_field(const UInt64 *values, const UInt8 valueCount, Byte *buffer, const Byte *bufferEnd);
+static Byte *noz_store_local_file_descriptor(const NOZFileEntryT *entry, BOOL writeSignature, Byte *cursor, const Byte *bufferEnd);
+static Byte *noz_copy_extra_field_without_zip64(const Byte *extraField, const UInt16 extraFieldSize, UInt16 *copiedExtraFieldSize);
+static BOOL noz_copy_file_entry(NOZFileEntryT *entry, const NOZFileEntryT *sourceEntry);
+
+// Records are serialized into a stack buffer, then handed to the buffered writer in one go
+#define PRIVATE_STORE(v) \
+(cursor += noz_store_value((v), sizeof(v), cursor, bufferEnd))
+#define PRIVATE_STORE_SIZED(v, byteCount) \
+(cursor += noz_store_value((UInt64)(v), (byteCount), cursor, bufferEnd))
+
+#define NOZWriterBufferSize() (16 * NOZBufferSize())
+
+// Pipelined entries: buffers in flight between the reading, compressing and writing threads
+static const NSUInteger NOZPipelineBufferCount = 4;
+
+// Incompressible entry detection
+static const size_t NOZIncompressibleSampleSize = 64 * 1024;
+static const double NOZIncompressibleEntropyThreshold = 7.9; // bits per byte, deflate can't do better than this
+static const UInt64 NOZIncompressibleRatioCheckInterval = 1024 * 1024;
+static const double NOZIncompressibleRatioThreshold = 0.97; // compressed size over uncompressed size
+
+// Dictionary training
+static const size_t NOZDictionarySampleSize = 128 * 1024;
+static const size_t NOZDictionaryDefaultMaximumSize = 110 * 1024; // zstd's default
+static const size_t NOZDictionarySamplesPerDictionaryByte = 100; // the sampled bytes zstd recommends per dictionary byte
+
+static BOOL noz_bytes_look_incompressible(const Byte *bytes, size_t length);
+
+static BOOL noz_write_to_output_stream(void *context, const Byte *bytes, size_t length);
 
-#define PRIVATE_WRITE(v) \
-noz_fwrite_value((v), sizeof(v), _internal.file)
+// Deduplication
+static NSString *noz_inode_key_for_entry(id<NOZZippableEntry> entry, NOZCompressionMethod compressionMethod);
+static NSString *noz_content_key_for_entry(id<NOZZippableEntry> entry, NOZCompressionMethod compressionMethod);
+static BOOL noz_entries_have_same_content(id<NOZZippableEntry> entry, id<NOZZippableEntry> otherEntry);
 
 @interface NOZZipper (Private)
 
 // Top level methods
+- (BOOL)private_openOutputWithMode:(NOZZipperMode)mode error:(out NSError * __nullable * __nullable)error;
+- (void)private_finishOpening;
 - (BOOL)private_forciblyClose:(BOOL)forceClose error:(out NSError * __nullable * __nullable)error;
 
 // Entry methods
+- (BOOL)private_addEntry:(nonnull id<NOZZippableEntry>)entry
+       compressionMethod:(NOZCompressionMethod)compressionMethod
+  detectIncompressibility:(BOOL)detectIncompressibility
+              extraField:(nullable NSData *)extraField
+           progressBlock:(nullable NOZProgressBlock)progressBlock
+                   error:(out NSError * __nullable * __nullable)error;
 - (BOOL)private_openEntry:(nonnull id<NOZZippableEntry>)entry
+        compressionMethod:(NOZCompressionMethod)compressionMethod
+               extraField:(nullable NSData *)extraField
                     error:(out NSError * __nullable * __nullable)error;
-- (BOOL)private_writeEntry:(nonnull id<NOZZippableEntry>)entry
-             progressBlock:(nullable NOZProgressBlock)progressBlock
-                     error:(out NSError * __nullable * __nullable)error
-                  abortRef:(nonnull BOOL *)abort;
+- (BOOL)private_openEntryCopyingRecord:(nonnull NOZCentralDirectoryRecord *)record
+                                 error:(out NSError * __nullable * __nullable)error;
+- (BOOL)private_addEntry:(nonnull id<NOZZippableEntry>)entry
+        duplicatingEntry:(nonnull NOZFileEntryT *)duplicatedEntry
+           progressBlock:(nullable NOZProgressBlock)progressBlock
+                   error:(out NSError * __nullable * __nullable)error;
+- (void)private_discardCurrentEntry;
 - (BOOL)private_closeCurrentOpenEntryAndReturnError:(out NSError * __nullable * __nullable)error;
 
 // Helpers
-- (BOOL)private_finishEncoding;
+- (BOOL)private_readExistingCentralDirectory:(out NOZCentralDirectory * __nullable * __nonnull)centralDirectory
+                                       error:(out NSError * __nullable * __nullable)error;
+- (BOOL)private_addExistingRecordsOfCentralDirectory:(nonnull NOZCentralDirectory *)centralDirectory;
+- (nullable NOZFileEntryT *)private_appendNewEntry;
+- (nullable NSData *)private_dictionaryCompressedExtraFieldForMethod:(NOZCompressionMethod)compressionMethod;
 - (BOOL)private_flushWriteBuffer:(const Byte*)buffer length:(size_t)length;
+- (BOOL)private_writeBytes:(const Byte*)bytes length:(size_t)length;
 - (void)private_freeLinkedList;
 
 // Records
-- (BOOL)private_populateRecordsForCurrentOpenEntryWithEntry:(nonnull id<NOZZippableEntry>)entry error:(out NSError * __nullable * __nullable)error;
+- (BOOL)private_populateRecordsForCurrentOpenEntryWithEntry:(nonnull id<NOZZippableEntry>)entry
+                                          compressionMethod:(NOZCompressionMethod)compressionMethod
+                                                 extraField:(nullable NSData *)extraField
+                                                      error:(out NSError * __nullable * __nullable)error;
 - (BOOL)private_writeLocalFileHeaderForCurrentEntryAndReturnError:(out NSError * __nullable * __nullable)error;
-- (BOOL)private_writeLocalFileHeaderForEntry:(NOZFileEntryT *)entry signature:(BOOL)writeSig;
-- (BOOL)private_writeCurrentLocalFileDescriptor:(BOOL)writeSignature;
-- (BOOL)private_writeLocalFileDescriptorForEntry:(NOZFileEntryT *)entry signature:(BOOL)writeSig;
+- (BOOL)private_writeCurrentLocalFileDescriptor;
+- (BOOL)private_patchLocalFileHeaderForEntry:(NOZFileEntryT *)entry;
 - (BOOL)private_writeCentralDirectoryRecords;
 - (BOOL)private_writeCentralDirectoryRecord:(NOZFileEntryT *)entry;
+- (BOOL)private_writeZip64EndOfCentralDirectoryRecordAndLocator;
 - (BOOL)private_writeEndOfCentralDirectoryRecord;
 
 @end
 
+/**
+ Reads an input stream ahead on a background queue, into a ring of reusable blocks,
+ so that reading the next bytes overlaps with encoding the previous ones.
+ Must be stopped before being released.
+ */
+@interface NOZPipelinedStreamReader : NSObject
+- (nonnull instancetype)initWithInputStream:(nonnull NSInputStream *)inputStream
+                                  blockSize:(size_t)blockSize
+                                 blockCount:(NSUInteger)blockCount;
+//! The next block, waiting for it to be read.  Returns its length, `0` at the end of the stream or `-1` on failure.
+- (NSInteger)readBlock:(const Byte * __nullable * __nonnull)bytes;
+//! Hand the block returned by the last `readBlock:` back to be filled again
+- (void)recycleBlock;
+//! Stop reading ahead, waiting for a read in progress to finish
+- (void)stop;
+@end
+
+/**
+ Encodes the bytes of one entry, the routine shared by `NOZZipper` and `NOZEncodedEntryPayload`.
+ Settles the compression method (stored for entries that look incompressible) and the encoder
+ (with the trained dictionary for the method if there is one), then encodes small contiguous entries
+ in a single call and everything else as a stream, handing the encoded bytes to a block.
+ Codec contexts come from (and go back to) the `NOZCompressionLibrary` pools.
+ */
+@interface NOZEntryEncoder : NSObject
+@property (nonatomic, readonly, nonnull) id<NOZZippableEntry> entry;
+//! The compression method the entry is encoded with, settled by `prepareAndReturnError:`
+@property (nonatomic, readonly) NOZCompressionMethod compressionMethod;
+@property (nonatomic, readonly) UInt32 crc32;
+@property (nonatomic, readonly) UInt64 uncompressedSize;
+@property (nonatomic, readonly) UInt64 compressedSize;
+@property (nonatomic, readonly) BOOL encodedDataWasText;
+//! Whether the entry is encoded with one of the _dictionaryEncoders_, settled by `prepareAndReturnError:`
+@property (nonatomic, readonly) BOOL usesDictionary;
+- (nonnull instancetype)initWithEntry:(nonnull id<NOZZippableEntry>)entry
+                    compressionMethod:(NOZCompressionMethod)compressionMethod
+              detectIncompressibility:(BOOL)detectIncompressibility
+                   dictionaryEncoders:(nullable NSDictionary<NSNumber *, id<NOZEncoder>> *)dictionaryEncoders
+                      pipelinesStream:(BOOL)pipelinesStream;
+- (nonnull instancetype)init NS_UNAVAILABLE;
+//! Open the entry's bytes and settle the compression method and encoder
+- (BOOL)prepareAndReturnError:(out NSError * __nullable * __nullable)error;
+//! Encode the entry into _flushBlock_.  Instead of finishing, _restart_ is set when the entry should start over as stored, pass `NULL` if it can't.
+- (BOOL)encodeWithFlushBlock:(nonnull BOOL(^)(const Byte * __nonnull bytes, size_t length))flushBlock
+               progressBlock:(nullable NOZProgressBlock)progressBlock
+                       error:(out NSError * __nullable * __nullable)error
+                    abortRef:(nonnull BOOL *)abort
+                  restartRef:(nullable BOOL *)restart;
+@end
+
+@interface NOZEncodedEntryPayload ()
+- (nonnull instancetype)initWithEntry:(nonnull id<NOZZippableEntry>)entry
+                     reservationBlock:(nullable NOZEncodedEntryPayloadReservationBlock)reservationBlock
+              detectIncompressibility:(BOOL)detectIncompressibility
+                   canRestartAsStored:(BOOL)canRestartAsStored
+                   dictionaryEncoders:(nullable NSDictionary<NSNumber *, id<NOZEncoder>> *)dictionaryEncoders
+                      pipelinesStream:(BOOL)pipelinesStream NS_DESIGNATED_INITIALIZER;
+@end
+
 @implementation NOZZipper
 {
     NSString *_standardizedZipFilePath;
-    id<NOZEncoder> _currentEncoder;
-    id<NOZEncoderContext> _currentEncoderContext;
+    NSOutputStream *_outputStream;
+    int _outputFileDescriptor;
+    BOOL _zipsToMemory;
+    NSMutableDictionary<NSString *, NSValue *> *_deduplicationEntries; // inode and content keys to NOZFileEntryT pointers
+    NSMutableDictionary<NSString *, id<NOZZippableEntry>> *_deduplicationSourceEntries; // content keys to the entries they were read from
+    NSMutableDictionary<NSNumber *, id<NOZEncoder>> *_dictionaryEncoders; // compression methods to encoders with a trained dictionary
+    NSMutableDictionary<NSNumber *, NSNumber *> *_dictionaryIDs; // compression methods to the CRC-32 of their dictionary
 
     struct {
-        FILE *file;
+        NOZBufferedWriterT writer;
 
         NOZFileEntryT *firstEntry;
         NOZFileEntryT *lastEntry;
@@ -92,6 +213,8 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         Byte *comment;
 
         BOOL ownsComment:1;
+        BOOL usesDataDescriptors:1;
+        BOOL pipelinesEntries:1;
     } _internal;
 }
 
@@ -106,10 +229,57 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
     if (self = [super init]) {
         _zipFilePath = [zipFilePath copy];
         _standardizedZipFilePath = [_zipFilePath stringByStandardizingPath];
+        _outputFileDescriptor = -1;
+
+        _internal.beginBytePosition = 0;
+        _internal.writingPositionOffset = 0;
+        _internal.firstEntry = _internal.lastEntry = _internal.currentEntry = NULL;
+        _internal.writer.fd = -1;
+        _usesDataDescriptors = !!NOZ_SINGLE_PASS_ZIP;
+    }
+    return self;
+}
+
+- (instancetype)initWithOutputStream:(NSOutputStream *)outputStream
+{
+    if (self = [super init]) {
+        _outputStream = outputStream;
+        _outputFileDescriptor = -1;
+
+        _internal.beginBytePosition = 0;
+        _internal.writingPositionOffset = 0;
+        _internal.firstEntry = _internal.lastEntry = _internal.currentEntry = NULL;
+        _internal.writer.fd = -1;
+        _usesDataDescriptors = !!NOZ_SINGLE_PASS_ZIP;
+    }
+    return self;
+}
+
+- (instancetype)initForZippingToMemory
+{
+    if (self = [super init]) {
+        _zipsToMemory = YES;
+        _outputFileDescriptor = -1;
+
+        _internal.beginBytePosition = 0;
+        _internal.writingPositionOffset = 0;
+        _internal.firstEntry = _internal.lastEntry = _internal.currentEntry = NULL;
+        _internal.writer.fd = -1;
+        _usesDataDescriptors = !!NOZ_SINGLE_PASS_ZIP;
+    }
+    return self;
+}
+
+- (instancetype)initWithFileDescriptor:(int)fileDescriptor
+{
+    if (self = [super init]) {
+        _outputFileDescriptor = fileDescriptor;
 
         _internal.beginBytePosition = 0;
         _internal.writingPositionOffset = 0;
         _internal.firstEntry = _internal.lastEntry = _internal.currentEntry = NULL;
+        _internal.writer.fd = -1;
+        _usesDataDescriptors = !!NOZ_SINGLE_PASS_ZIP;
     }
     return self;
 }
@@ -122,10 +292,14 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
 
 - (BOOL)openWithMode:(NOZZipperMode)mode error:(out NSError **)error
 {
-    if (_internal.file) {
+    if (NOZBufferedWriterIsOpen(&_internal.writer)) {
         return YES;
     }
 
+    if (!_zipFilePath) {
+        return [self private_openOutputWithMode:mode error:error];
+    }
+
     __block NSError *stackError = nil;
     noz_defer(^{
         if (stackError != nil && error) {
@@ -146,19 +320,30 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         return NO;
     }
 
-    const char *fopenMode = "w+";
+    int openFlags = O_RDWR | O_CREAT | O_TRUNC;
+    NOZCentralDirectory *existingCentralDirectory = nil;
     switch (mode) {
-//        case NOZZipperModeOpenExistingOrCreate:
-//            break;
-//        case NOZZipperModeOpenExisting:
-//        {
-//            fopenMode = "r+";
-//            if (![fm fileExistsAtPath:_standardizedZipFilePath]) {
-//                stackError = NOZErrorCreate(NOZErrorCodeZipCannotOpenExistingZip, @{ @"zipFilePath" : _zipFilePath });
-//                return NO;
-//            }
-//            break;
-//        }
+        case NOZZipperModeOpenExistingOrCreate:
+        {
+            if (![fm fileExistsAtPath:_standardizedZipFilePath]) {
+                mode = NOZZipperModeCreate;
+                break;
+            }
+            mode = NOZZipperModeOpenExisting;
+            // fall through
+        }
+        case NOZZipperModeOpenExisting:
+        {
+            openFlags = O_RDWR;
+            if (![fm fileExistsAtPath:_standardizedZipFilePath]) {
+                stackError = NOZErrorCreate(NOZErrorCodeZipCannotOpenExistingZip, @{ @"zipFilePath" : _zipFilePath });
+                return NO;
+            }
+            if (![self private_readExistingCentralDirectory:&existingCentralDirectory error:&stackError]) {
+                return NO;
+            }
+            break;
+        }
         case NOZZipperModeCreate:
         default:
         {
@@ -170,32 +355,55 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         }
     }
 
-    _internal.file = fopen(_standardizedZipFilePath.UTF8String, fopenMode);
-    if (!_internal.file) {
-        // stackError = NOZErrorCreate((NOZZipperModeOpenExisting == mode) ? NOZErrorCodeZipCannotOpenExistingZip : NOZErrorCodeZipCannotCreateZip, @{ @"zipFilePath" : _zipFilePath });
-        stackError = NOZErrorCreate(NOZErrorCodeZipCannotCreateZip, @{ @"zipFilePath" : _zipFilePath });
+    const int fd = open(_standardizedZipFilePath.UTF8String, openFlags | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        stackError = NOZErrorCreate((NOZZipperModeOpenExisting == mode) ? NOZErrorCodeZipCannotOpenExistingZip : NOZErrorCodeZipCannotCreateZip, @{ @"zipFilePath" : _zipFilePath });
         return NO;
     }
     noz_defer(^{
         if (stackError != nil) {
-            fclose(_internal.file);
-            _internal.file = NULL;
+            // stop the background flusher before its fd goes away
+            NOZBufferedWriterClean(&_internal.writer);
+            close(fd);
+            _internal.writer.fd = -1;
+            [self private_freeLinkedList];
+            _internal.endOfCentralDirectoryRecord.totalRecordCount = 0;
+            _internal.endOfCentralDirectoryRecord.recordCountForDisk = 0;
             if (NOZZipperModeCreate == mode) {
                 [[NSFileManager defaultManager] removeItemAtPath:_standardizedZipFilePath error:NULL];
             }
         }
     });
 
-    if (0 != fseeko(_internal.file, 0, SEEK_END)) {
-        stackError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo: @{ @"zipFilePath" : _zipFilePath }];
+    // New entries go where the existing central directory starts, the merged central directory follows them
+    SInt64 writePosition = 0;
+    if (existingCentralDirectory) {
+        _internal.beginBytePosition = 0;
+        writePosition = lseek(fd, (off_t)existingCentralDirectory.centralDirectoryStartOffset, SEEK_SET);
+    } else {
+        _internal.beginBytePosition = writePosition = lseek(fd, 0, SEEK_END);
+    }
+    if (writePosition < 0) {
+        stackError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{ @"zipFilePath" : _zipFilePath }];
         return NO;
     }
 
-    _internal.beginBytePosition = ftello(_internal.file);
-    if (_internal.beginBytePosition < 0) {
-        stackError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{ @"zipFilePath" : _zipFilePath }];
+    if (!NOZBufferedWriterInit(&_internal.writer, fd, writePosition, NOZWriterBufferSize())) {
+        stackError = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:@{ @"zipFilePath" : _zipFilePath }];
         return NO;
     }
+
+    if (existingCentralDirectory) {
+        if (![self private_addExistingRecordsOfCentralDirectory:existingCentralDirectory]) {
+            stackError = NOZErrorCreate(NOZErrorCodeZipCannotOpenExistingZip, @{ @"zipFilePath" : _zipFilePath });
+            return NO;
+        }
+        if (!self.globalComment) {
+            self.globalComment = existingCentralDirectory.globalComment;
+        }
+    }
+
+    [self private_finishOpening];
     return YES;
 }
 
@@ -212,6 +420,199 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
 - (BOOL)addEntry:(id<NOZZippableEntry>)entry
    progressBlock:(__attribute__((noescape)) NOZProgressBlock)progressBlock
            error:(out NSError **)error
+{
+    NSString *inodeKey = nil;
+    NSString *contentKey = nil;
+    // copies are read back from the archive, which an output stream, pipe or write-only descriptor can't do
+    const NOZZipperDeduplicationMode deduplicationMode = self.deduplicationMode;
+    const BOOL canDeduplicate = (NOZZipperDeduplicationModeShareCompressedData == deduplicationMode) || (NOZZipperDeduplicationModeCopyCompressedData == deduplicationMode && _internal.writer.seekable && _internal.writer.readable);
+    if (canDeduplicate && NOZBufferedWriterIsOpen(&_internal.writer)) {
+        // hard links are caught without reading the file, everything else costs a checksum pass
+        inodeKey = noz_inode_key_for_entry(entry, entry.compressionMethod);
+        NSValue *duplicatedEntry = (inodeKey) ? _deduplicationEntries[inodeKey] : nil;
+        if (!duplicatedEntry) {
+            contentKey = noz_content_key_for_entry(entry, entry.compressionMethod);
+            duplicatedEntry = (contentKey) ? _deduplicationEntries[contentKey] : nil;
+            if (duplicatedEntry && !noz_entries_have_same_content(entry, _deduplicationSourceEntries[contentKey])) {
+                // a CRC-32 collision, the entry is added as is and the key stays with the first entry
+                duplicatedEntry = nil;
+                contentKey = nil;
+            }
+        }
+        if (duplicatedEntry) {
+            if (![self private_addEntry:entry
+                       duplicatingEntry:(NOZFileEntryT *)duplicatedEntry.pointerValue
+                          progressBlock:progressBlock
+                                  error:error]) {
+                return NO;
+            }
+            if (inodeKey) {
+                _deduplicationEntries[inodeKey] = duplicatedEntry;
+            }
+            return YES;
+        }
+    }
+
+    if (![self private_addEntry:entry
+              compressionMethod:entry.compressionMethod
+        detectIncompressibility:self.detectsIncompressibleEntries
+                     extraField:nil
+                  progressBlock:progressBlock
+                          error:error]) {
+        return NO;
+    }
+
+    if (inodeKey) {
+        _deduplicationEntries[inodeKey] = [NSValue valueWithPointer:_internal.lastEntry];
+    }
+    if (contentKey) {
+        _deduplicationEntries[contentKey] = [NSValue valueWithPointer:_internal.lastEntry];
+        _deduplicationSourceEntries[contentKey] = entry;
+    }
+    return YES;
+}
+
+- (BOOL)addDictionaryTrainedFromEntries:(NSArray<id<NOZZippableEntry>> *)entries
+                      compressionMethod:(NOZCompressionMethod)compressionMethod
+                            maximumSize:(size_t)maximumSize
+                                  error:(out NSError **)error
+{
+    __block NSError *stackError = nil;
+    noz_defer(^{
+        if (stackError && error) {
+            *error = stackError;
+        }
+    });
+
+    // entries compressed before the dictionary existed couldn't be told apart from the ones compressed with it
+    if (!NOZBufferedWriterIsOpen(&_internal.writer) || NULL != _internal.currentEntry || NOZCompressionMethodNone == compressionMethod || _dictionaryEncoders[@(compressionMethod)] || _internal.endOfCentralDirectoryRecord.totalRecordCount != _dictionaryEncoders.count) {
+        stackError = NOZErrorCreate(NOZErrorCodeZipCannotTrainDictionary, @{ @"method" : @(compressionMethod) });
+        return NO;
+    }
+
+    id<NOZEncoder> encoder = [[NOZCompressionLibrary sharedInstance] encoderForMethod:compressionMethod];
+    if (![encoder respondsToSelector:@selector(trainDictionaryWithSamples:maximumSize:)] || ![encoder respondsToSelector:@selector(encoderWithDictionaryData:)]) {
+        stackError = NOZErrorCreate(NOZErrorCodeZipDoesNotSupportCompressionMethod, @{ @"method" : @(compressionMethod) });
+        return NO;
+    }
+
+    if (!maximumSize) {
+        maximumSize = NOZDictionaryDefaultMaximumSize;
+    }
+
+    NSData *dictionaryData = nil;
+    @autoreleasepool {
+        // training memory grows with the sampled bytes, so stop once there is plenty to train with
+        const size_t maximumSamplesLength = maximumSize * NOZDictionarySamplesPerDictionaryByte;
+        size_t samplesLength = 0;
+        NSMutableArray<NSData *> *samples = [[NSMutableArray alloc] initWithCapacity:entries.count];
+        for (id<NOZZippableEntry> entry in entries) {
+            if (samplesLength >= maximumSamplesLength) {
+                break;
+            }
+            NSData *sample = noz_sample_for_entry(entry, MIN(NOZDictionarySampleSize, maximumSamplesLength - samplesLength));
+            if (sample.length > 0) {
+                [samples addObject:sample];
+                samplesLength += sample.length;
+            }
+        }
+        dictionaryData = [encoder trainDictionaryWithSamples:samples maximumSize:maximumSize];
+    }
+
+    id<NOZEncoder> dictionaryEncoder = (dictionaryData.length > 0) ? [encoder encoderWithDictionaryData:dictionaryData] : nil;
+    if (!dictionaryEncoder) {
+        stackError = NOZErrorCreate(NOZErrorCodeZipCannotTrainDictionary, @{ @"method" : @(compressionMethod) });
+        return NO;
+    }
+
+    // the extra field tells the dictionary apart from an entry that happens to have its name
+    const UInt32 dictionaryID = noz_crc32(0, dictionaryData.bytes, dictionaryData.length);
+    NOZDataZipEntry *dictionaryEntry = [[NOZDataZipEntry alloc] initWithData:dictionaryData name:noz_dictionary_entry_name(compressionMethod)];
+    dictionaryEntry.compressionMethod = NOZCompressionMethodNone;
+    if (![self private_addEntry:dictionaryEntry
+              compressionMethod:NOZCompressionMethodNone
+        detectIncompressibility:NO
+                     extraField:noz_dictionary_extra_field(NOZExtraFieldIdentifierCompressionDictionary, dictionaryID)
+                  progressBlock:NULL
+                          error:&stackError]) {
+        return NO;
+    }
+
+    _dictionaryEncoders[@(compressionMethod)] = dictionaryEncoder;
+    _dictionaryIDs[@(compressionMethod)] = @(dictionaryID);
+    return YES;
+}
+
+- (BOOL)addRecord:(NOZCentralDirectoryRecord *)record
+     fromUnzipper:(NOZUnzipper *)unzipper
+    progressBlock:(__attribute__((noescape)) NOZProgressBlock)progressBlock
+            error:(out NSError **)error
+{
+    __block NSError *stackError = nil;
+    noz_defer(^{
+        if (stackError && error) {
+            *error = stackError;
+        }
+    });
+
+    int sourceFileDescriptor = -1;
+    SInt64 sourceOffset = 0;
+    if (![unzipper locateCompressedDataOfRecord:record fileDescriptor:&sourceFileDescriptor offset:&sourceOffset error:&stackError]) {
+        return NO;
+    }
+
+    if (![self private_openEntryCopyingRecord:record error:&stackError]) {
+        return NO;
+    }
+
+    const SInt64 totalBytes = (SInt64)_internal.currentEntry->fileDescriptor.compressedSize;
+    const SInt64 chunkSize = (SInt64)NOZWriterBufferSize() * 16;
+    SInt64 bytesCopied = 0;
+    BOOL success = YES;
+    BOOL shouldAbort = NO;
+    while (success && !shouldAbort && bytesCopied < totalBytes) {
+        const SInt64 bytesToCopy = MIN(chunkSize, totalBytes - bytesCopied);
+        success = NOZBufferedWriterCopyFromFile(&_internal.writer, sourceFileDescriptor, sourceOffset + bytesCopied, bytesToCopy);
+        if (success) {
+            bytesCopied += bytesToCopy;
+            if (progressBlock) {
+                progressBlock(totalBytes, bytesCopied, bytesToCopy, &shouldAbort);
+            }
+        }
+    }
+
+    if (shouldAbort && bytesCopied < totalBytes) {
+        success = NO;
+        stackError = [NSError errorWithDomain:NSPOSIXErrorDomain code:ECANCELED userInfo:nil];
+    } else if (!success) {
+        stackError = NOZErrorCreate(NOZErrorCodeZipFailedToWriteEntry, nil);
+    }
+
+    if (![self private_closeCurrentOpenEntryAndReturnError:(success) ? (&stackError) : NULL] || !success) {
+        return NO;
+    }
+
+    return YES;
+}
+
+@end
+
+@implementation NOZZipper (Project)
+
+- (NOZEncodedEntryPayload *)encodedPayloadForEntry:(id<NOZZippableEntry>)entry
+                                  reservationBlock:(NOZEncodedEntryPayloadReservationBlock)reservationBlock
+{
+    return [[NOZEncodedEntryPayload alloc] initWithEntry:entry
+                                        reservationBlock:reservationBlock
+                                 detectIncompressibility:self.detectsIncompressibleEntries
+                                      canRestartAsStored:_internal.writer.seekable
+                                      dictionaryEncoders:[_dictionaryEncoders copy]
+                                         pipelinesStream:_internal.pipelinesEntries];
+}
+
+- (BOOL)addEntry:(id<NOZZippableEntry>)entry
+  encodedPayload:(NOZEncodedEntryPayload *)payload
+           error:(out NSError **)error
 {
     __block NSError *stackError = nil;
     noz_defer(^{
@@ -221,24 +622,35 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
     });
 
     @autoreleasepool {
-        if (![self private_openEntry:entry error:&stackError]) {
+        if (payload.encodingError) {
+            stackError = payload.encodingError;
             return NO;
         }
 
-        BOOL writeSuccess = NO;
-        BOOL shouldAbort = NO;
+        NSData *extraField = (payload.usesDictionary) ? [self private_dictionaryCompressedExtraFieldForMethod:payload.compressionMethod] : nil;
+        if (![self private_openEntry:entry compressionMethod:payload.compressionMethod extraField:extraField error:&stackError]) {
+            return NO;
+        }
 
-        if (!shouldAbort) {
-            writeSuccess = [self private_writeEntry:entry progressBlock:progressBlock error:&stackError abortRef:&shouldAbort];
+        __unsafe_unretained typeof(self) rawSelf = self;
+        const BOOL writeSuccess = [payload enumerateEncodedBytesUsingBlock:^BOOL(const Byte *bytes, size_t length) {
+            return [rawSelf private_flushWriteBuffer:bytes length:length];
+        }];
+
+        if (writeSuccess) {
+            _internal.currentEntry->fileDescriptor.crc32 = payload.crc32;
+            _internal.currentEntry->fileDescriptor.uncompressedSize = (UInt64)payload.uncompressedSize;
+            if (payload.encodedDataWasText) {
+                _internal.currentEntry->centralDirectoryRecord.internalFileAttributes |= (1 << 0) /* text */;
+            }
+        } else {
+            stackError = NOZErrorCreate(NOZErrorCodeZipFailedToWriteEntry, nil);
         }
 
         if (![self private_closeCurrentOpenEntryAndReturnError:(writeSuccess) ? (&stackError) : NULL] || !writeSuccess) {
-            if (!writeSuccess && shouldAbort && !stackError) {
-                stackError = [NSError errorWithDomain:NSPOSIXErrorDomain code:ECANCELED userInfo:nil];
-            }
             return NO;
         }
-        
+
         return YES;
     }
 }
@@ -247,9 +659,75 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
 
 @implementation NOZZipper (Private)
 
+- (BOOL)private_openOutputWithMode:(NOZZipperMode)mode error:(out NSError **)error
+{
+    // there's no existing archive to append to
+    if (NOZZipperModeOpenExisting == mode) {
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeZipCannotOpenExistingZip, nil);
+        }
+        return NO;
+    }
+
+    BOOL success;
+    _internal.beginBytePosition = 0;
+    if (_zipsToMemory) {
+        _zippedData = nil;
+        success = NOZBufferedWriterInitInMemory(&_internal.writer, NOZWriterBufferSize());
+    } else if (_outputStream) {
+        if (NSStreamStatusNotOpen == _outputStream.streamStatus) {
+            [_outputStream open];
+        }
+        if (NSStreamStatusError == _outputStream.streamStatus || NSStreamStatusClosed == _outputStream.streamStatus) {
+            if (error) {
+                *error = NOZErrorCreate(NOZErrorCodeZipCannotCreateZip, (_outputStream.streamError) ? @{ NSUnderlyingErrorKey : _outputStream.streamError } : nil);
+            }
+            return NO;
+        }
+        success = NOZBufferedWriterInitWithOutputFunction(&_internal.writer, noz_write_to_output_stream, (__bridge void *)_outputStream, NOZWriterBufferSize());
+    } else {
+        if (_outputFileDescriptor < 0) {
+            if (error) {
+                *error = NOZErrorCreate(NOZErrorCodeZipCannotCreateZip, nil);
+            }
+            return NO;
+        }
+        // pipes and sockets have no position, offsets are tracked from where the archive starts
+        const off_t position = lseek(_outputFileDescriptor, 0, SEEK_CUR);
+        _internal.beginBytePosition = (position > 0) ? (SInt64)position : 0;
+        success = NOZBufferedWriterInit(&_internal.writer, _outputFileDescriptor, _internal.beginBytePosition, NOZWriterBufferSize());
+    }
+
+    if (!success) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+        }
+        return NO;
+    }
+
+    [self private_finishOpening];
+    return YES;
+}
+
+- (void)private_finishOpening
+{
+    // fixed for the lifetime of the archive, every entry's local records are written the same way.
+    // local file headers that already went out to an unseekable output can't be patched
+    _internal.usesDataDescriptors = _usesDataDescriptors || !_internal.writer.seekable;
+    _internal.pipelinesEntries = _pipelinesEntries;
+    if (_internal.pipelinesEntries && !_internal.writer.inMemory) {
+        // best effort, writes just stay on the calling thread without it
+        NOZBufferedWriterEnableBackgroundFlushing(&_internal.writer, NOZPipelineBufferCount);
+    }
+    _deduplicationEntries = [[NSMutableDictionary alloc] init];
+    _deduplicationSourceEntries = [[NSMutableDictionary alloc] init];
+    _dictionaryEncoders = [[NSMutableDictionary alloc] init];
+    _dictionaryIDs = [[NSMutableDictionary alloc] init];
+}
+
 - (BOOL)private_forciblyClose:(BOOL)forceClose error:(out NSError **)error
 {
-    if (!_internal.file) {
+    if (!NOZBufferedWriterIsOpen(&_internal.writer)) {
         return YES;
     }
 
@@ -257,6 +735,10 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
     noz_defer(^{ if (stackError != nil && error) { *error = stackError; } });
 
     if (forceClose && ![self private_closeCurrentOpenEntryAndReturnError:&stackError]) {
+        _deduplicationEntries = nil;
+        _deduplicationSourceEntries = nil;
+        _dictionaryEncoders = nil;
+        _dictionaryIDs = nil;
         [self private_freeLinkedList];
         return NO;
     } else if (!forceClose && NULL != _internal.currentEntry) {
@@ -276,8 +758,17 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
     }
 
     noz_defer(^{
-        fclose(_internal.file);
-        _internal.file = NULL;
+        // joins the background flusher, it may still be writing queued buffers to the fd or stream
+        NOZBufferedWriterClean(&_internal.writer);
+        if (_zipFilePath) {
+            close(_internal.writer.fd);
+        }
+        [_outputStream close];
+        _internal.writer.fd = -1;
+        _deduplicationEntries = nil;
+        _deduplicationSourceEntries = nil;
+        _dictionaryEncoders = nil;
+        _dictionaryIDs = nil;
         [self private_freeLinkedList];
         if (_internal.ownsComment) {
             free(_internal.comment);
@@ -295,10 +786,96 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         return NO;
     }
 
+    if (!NOZBufferedWriterFlush(&_internal.writer)) {
+        stackError = NOZErrorCreate(NOZErrorCodeZipFailedToWriteZip, nil);
+        return NO;
+    }
+
+    // An archive that was appended to can end up shorter than it was (e.g. a shorter global comment)
+    if (_zipFilePath && 0 != ftruncate(_internal.writer.fd, (off_t)NOZBufferedWriterPosition(&_internal.writer))) {
+        stackError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{ @"zipFilePath" : _zipFilePath }];
+        return NO;
+    }
+
+    if (_zipsToMemory) {
+        size_t length = 0;
+        Byte *bytes = NOZBufferedWriterDetachBuffer(&_internal.writer, &length);
+        _zippedData = [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:YES];
+    }
+
     return YES;
 }
 
+- (BOOL)private_addEntry:(id<NOZZippableEntry>)entry
+       compressionMethod:(NOZCompressionMethod)compressionMethod
+  detectIncompressibility:(BOOL)detectIncompressibility
+              extraField:(NSData *)extraField
+           progressBlock:(NOZProgressBlock)progressBlock
+                   error:(out NSError **)error
+{
+    __block NSError *stackError = nil;
+    noz_defer(^{
+        if (stackError && error) {
+            *error = stackError;
+        }
+    });
+
+    @autoreleasepool {
+        NOZEntryEncoder *entryEncoder = [[NOZEntryEncoder alloc] initWithEntry:entry
+                                                             compressionMethod:compressionMethod
+                                                       detectIncompressibility:detectIncompressibility
+                                                            dictionaryEncoders:_dictionaryEncoders
+                                                               pipelinesStream:_internal.pipelinesEntries];
+        if (![entryEncoder prepareAndReturnError:&stackError]) {
+            return NO;
+        }
+
+        NSData *entryExtraField = (entryEncoder.usesDictionary) ? [self private_dictionaryCompressedExtraFieldForMethod:entryEncoder.compressionMethod] : extraField;
+        if (![self private_openEntry:entry compressionMethod:entryEncoder.compressionMethod extraField:entryExtraField error:&stackError]) {
+            return NO;
+        }
+
+        BOOL shouldAbort = NO;
+        BOOL shouldRestartAsStored = NO;
+        __unsafe_unretained typeof(self) rawSelf = self;
+        const BOOL writeSuccess = [entryEncoder encodeWithFlushBlock:^BOOL(const Byte *bytes, size_t length) {
+            return [rawSelf private_flushWriteBuffer:bytes length:length];
+        }
+                                                       progressBlock:progressBlock
+                                                               error:&stackError
+                                                            abortRef:&shouldAbort
+                                                          restartRef:(_internal.writer.seekable) ? &shouldRestartAsStored : NULL];
+
+        if (writeSuccess && shouldRestartAsStored) {
+            // compression isn't paying off, start over from a fresh input stream without it
+            [self private_discardCurrentEntry];
+            return [self private_addEntry:entry
+                        compressionMethod:NOZCompressionMethodNone
+                  detectIncompressibility:NO
+                               extraField:extraField
+                            progressBlock:progressBlock
+                                    error:&stackError];
+        }
+
+        if (writeSuccess) {
+            _internal.currentEntry->fileDescriptor.crc32 = entryEncoder.crc32;
+            _internal.currentEntry->fileDescriptor.uncompressedSize = entryEncoder.uncompressedSize;
+            if (entryEncoder.encodedDataWasText) {
+                _internal.currentEntry->centralDirectoryRecord.internalFileAttributes |= (1 << 0) /* text */;
+            }
+        }
+
+        if (![self private_closeCurrentOpenEntryAndReturnError:(writeSuccess) ? (&stackError) : NULL] || !writeSuccess) {
+            return NO;
+        }
+
+        return YES;
+    }
+}
+
 - (BOOL)private_openEntry:(id<NOZZippableEntry>)entry
+        compressionMethod:(NOZCompressionMethod)compressionMethod
+               extraField:(NSData *)extraField
                     error:(out NSError **)error
 {
     __block BOOL errorEncountered = NO;
@@ -310,7 +887,7 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         return NO;
     }
 
-    if (!_internal.file) {
+    if (!NOZBufferedWriterIsOpen(&_internal.writer)) {
         errorEncountered = YES;
         return NO;
     }
@@ -319,21 +896,20 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         return NO;
     }
 
-    NOZFileEntryT *newEntry = NOZFileEntryAllocInit();
+    if (_internal.writer.inMemory && entry.sizeInBytes > 0) {
+        // the stored size (plus records) is a safe guess, so the buffer rarely grows while encoding
+        const size_t recordsSize = 30 + 20 + nameSize + 24;
+        NOZBufferedWriterReserveCapacity(&_internal.writer, _internal.writer.bufferLength + (size_t)entry.sizeInBytes + recordsSize);
+    }
+
+    NOZFileEntryT *newEntry = [self private_appendNewEntry];
     if (!newEntry) {
         errorEncountered = YES;
         return NO;
     }
-
-    if (_internal.lastEntry) {
-        _internal.lastEntry->nextEntry = newEntry;
-        _internal.lastEntry = newEntry;
-    } else {
-        _internal.firstEntry = _internal.lastEntry = newEntry;
-    }
     _internal.currentEntry = newEntry;
 
-    if (![self private_populateRecordsForCurrentOpenEntryWithEntry:entry error:error]) {
+    if (![self private_populateRecordsForCurrentOpenEntryWithEntry:entry compressionMethod:compressionMethod extraField:extraField error:error]) {
         _internal.currentEntry = NULL;
         return NO;
     }
@@ -343,106 +919,187 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         return NO;
     }
 
-    __unsafe_unretained typeof(self) rawSelf = self;
-    _currentEncoder = [[NOZCompressionLibrary sharedInstance] encoderForMethod:_internal.currentEntry->fileHeader.compressionMethod];
-    _currentEncoderContext = [_currentEncoder createContextWithBitFlags:_internal.currentEntry->fileHeader.bitFlag
-                                                       compressionLevel:entry.compressionLevel
-                                                          flushCallback:^BOOL(id<NOZEncoder> encoder, id<NOZEncoderContext> context, const Byte* buffer, size_t length) {
-        if (rawSelf->_currentEncoder != encoder) {
-            return NO;
-        }
+    return YES;
+}
 
-        return [rawSelf private_flushWriteBuffer:buffer length:length];
-    }];
-    if (!_currentEncoder || !_currentEncoderContext) {
+- (BOOL)private_openEntryCopyingRecord:(NOZCentralDirectoryRecord *)record
+                                 error:(out NSError **)error
+{
+    if (!NOZBufferedWriterIsOpen(&_internal.writer)) {
         if (error) {
-            *error = NOZErrorCreate(NOZErrorCodeZipDoesNotSupportCompressionMethod, @{ @"method" : @(_internal.currentEntry->fileHeader.compressionMethod) });
+            *error = NOZErrorCreate(NOZErrorCodeZipCannotOpenNewEntry, nil);
         }
-        _currentEncoder = nil;
-        _internal.currentEntry = NULL;
         return NO;
     }
 
-    if (![_currentEncoder initializeEncoderContext:_currentEncoderContext]) {
-        _currentEncoderContext = nil;
-        _currentEncoder = nil;
-        _internal.currentEntry = NULL;
+    if (![self private_closeCurrentOpenEntryAndReturnError:error]) {
+        return NO;
+    }
+
+    NOZFileEntryT *newEntry = [self private_appendNewEntry];
+    if (!newEntry || !noz_copy_file_entry(newEntry, record.internalEntry)) {
         if (error) {
-            *error = [NSError errorWithDomain:NOZErrorDomain
-                                         code:NOZErrorCodeZipFailedToCompressEntry
-                                     userInfo:nil];
+            *error = NOZErrorCreate(NOZErrorCodeZipCannotOpenNewEntry, nil);
         }
         return NO;
     }
+    _internal.currentEntry = newEntry;
 
-    return YES;
+    // The CRC and sizes are already known, so they go straight into the local file header
+    const SInt64 offset = NOZBufferedWriterPosition(&_internal.writer) - _internal.beginBytePosition;
+    newEntry->usesZip64 = (newEntry->fileDescriptor.compressedSize >= NOZZip64MaxUInt32 || newEntry->fileDescriptor.uncompressedSize >= NOZZip64MaxUInt32);
+    newEntry->fileHeader.bitFlag &= ~NOZFlagBitUseDescriptor;
+    newEntry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk = (UInt64)offset;
+    if (newEntry->usesZip64 || (UInt64)offset >= NOZZip64MaxUInt32) {
+        newEntry->centralDirectoryRecord.versionMadeBy = NOZVersionForZip64;
+        newEntry->fileHeader.versionForExtraction = MAX(newEntry->fileHeader.versionForExtraction, (UInt16)NOZVersionForZip64);
+    }
+
+    if (![self private_writeLocalFileHeaderForCurrentEntryAndReturnError:error]) {
+        _internal.currentEntry = NULL;
+        return NO;
+    }
+
+    return YES;
 }
 
-- (BOOL)private_writeEntry:(id<NOZZippableEntry>)entry
-             progressBlock:(NOZProgressBlock)progressBlock
-                     error:(out NSError **)error
-                  abortRef:(BOOL *)abort
+- (BOOL)private_addEntry:(id<NOZZippableEntry>)entry
+        duplicatingEntry:(NOZFileEntryT *)duplicatedEntry
+           progressBlock:(NOZProgressBlock)progressBlock
+                   error:(out NSError **)error
 {
-    __block BOOL success = YES;
+    __block NSError *stackError = nil;
     noz_defer(^{
-        if (error) {
-            if ((*abort)) {
-                *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ECANCELED userInfo:nil];
-            } else if (!success && !*error) {
-                *error = NOZErrorCreate(NOZErrorCodeZipFailedToWriteEntry, nil);
-            }
+        if (stackError && error) {
+            *error = stackError;
         }
     });
 
-    NSInputStream *inputStream = entry.inputStream;
-    if (success && (!_internal.currentEntry || !inputStream)) {
-        success = NO;
+    const NSUInteger nameSize = [entry.name lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    if (nameSize > UINT16_MAX || nameSize == 0) {
+        stackError = NOZErrorCreate(NOZErrorCodeZipCannotOpenNewEntry, nil);
         return NO;
     }
 
-    const SInt64 totalBytes = entry.sizeInBytes;
-    if (success) {
-        [inputStream open];
-        noz_defer(^{ [inputStream close]; });
-        NSInteger bytesRead;
-        const size_t pageSize = NOZBufferSize();
-        Byte buffer[pageSize];
+    const NOZZipperDeduplicationMode mode = self.deduplicationMode;
+    const UInt16 compressionMethod = duplicatedEntry->fileHeader.compressionMethod;
+    if (![self private_closeCurrentOpenEntryAndReturnError:&stackError]) {
+        return NO;
+    }
 
-        do {
-            bytesRead = [inputStream read:buffer maxLength:pageSize];
+    NOZFileEntryT *newEntry = [self private_appendNewEntry];
+    if (!newEntry) {
+        stackError = NOZErrorCreate(NOZErrorCodeZipCannotOpenNewEntry, nil);
+        return NO;
+    }
+    _internal.currentEntry = newEntry;
 
-            if (bytesRead < 0) {
-                success = NO;
-                break;
-            }
+    // the duplicated entry's extra field says how its data was compressed (the Zip64 field is never kept in it)
+    NSData *extraField = (duplicatedEntry->extraField) ? [NSData dataWithBytes:duplicatedEntry->extraField length:duplicatedEntry->fileHeader.extraFieldSize] : nil;
+    if (![self private_populateRecordsForCurrentOpenEntryWithEntry:entry compressionMethod:compressionMethod extraField:extraField error:&stackError]) {
+        _internal.currentEntry = NULL;
+        return NO;
+    }
 
-            if (bytesRead == 0) {
-                break;
-            }
+    // The encoded data, and so the CRC, sizes and flags describing it, is the duplicated entry's
+    newEntry->fileDescriptor = duplicatedEntry->fileDescriptor;
+    newEntry->centralDirectoryRecord.internalFileAttributes = duplicatedEntry->centralDirectoryRecord.internalFileAttributes;
+    newEntry->fileHeader.bitFlag = duplicatedEntry->fileHeader.bitFlag;
+    newEntry->fileHeader.versionForExtraction = MAX(newEntry->fileHeader.versionForExtraction, duplicatedEntry->fileHeader.versionForExtraction);
+
+    const UInt64 duplicatedOffset = duplicatedEntry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk;
+    const SInt64 totalBytes = (SInt64)newEntry->fileDescriptor.compressedSize;
+
+    if (NOZZipperDeduplicationModeShareCompressedData == mode) {
+        // nothing is written, the central directory record points at the duplicated entry's local file header
+        newEntry->usesZip64 = duplicatedEntry->usesZip64;
+        newEntry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk = duplicatedOffset;
+        if (duplicatedEntry->centralDirectoryRecord.versionMadeBy == NOZVersionForZip64) {
+            newEntry->centralDirectoryRecord.versionMadeBy = NOZVersionForZip64;
+        }
+        _internal.endOfCentralDirectoryRecord.totalRecordCount++;
+        _internal.endOfCentralDirectoryRecord.recordCountForDisk++;
+        _internal.currentEntry = NULL;
+        if (progressBlock) {
+            BOOL shouldAbort = NO;
+            progressBlock(totalBytes, totalBytes, totalBytes, &shouldAbort);
+        }
+        return YES;
+    }
 
-            _internal.currentEntry->fileDescriptor.crc32 = (UInt32)crc32(_internal.currentEntry->fileDescriptor.crc32, buffer, (UInt32)bytesRead);
+    // Copy the compressed bytes that follow the duplicated entry's local file header
+    newEntry->fileHeader.bitFlag &= ~NOZFlagBitUseDescriptor;
+    newEntry->usesZip64 = (newEntry->fileDescriptor.compressedSize >= NOZZip64MaxUInt32 || newEntry->fileDescriptor.uncompressedSize >= NOZZip64MaxUInt32);
+    if (newEntry->usesZip64) {
+        newEntry->centralDirectoryRecord.versionMadeBy = NOZVersionForZip64;
+        newEntry->fileHeader.versionForExtraction = MAX(newEntry->fileHeader.versionForExtraction, (UInt16)NOZVersionForZip64);
+    }
 
-            success = [_currentEncoder encodeBytes:buffer length:(size_t)bytesRead context:_currentEncoderContext];
-            if (!success) {
-                if (error) {
-                    *error = [NSError errorWithDomain:NOZErrorDomain
-                                                 code:NOZErrorCodeZipFailedToCompressEntry
-                                             userInfo:nil];
-                }
-                break;
-            }
+    if (![self private_writeLocalFileHeaderForCurrentEntryAndReturnError:&stackError]) {
+        [self private_discardCurrentEntry];
+        return NO;
+    }
 
-            if (bytesRead != 0) {
-                _internal.currentEntry->fileDescriptor.uncompressedSize += (SInt64)bytesRead;
-                if (progressBlock) {
-                    progressBlock(totalBytes, _internal.currentEntry->fileDescriptor.uncompressedSize, bytesRead, abort);
-                }
+    const SInt64 sourceOffset = _internal.beginBytePosition
+                              + (SInt64)duplicatedOffset
+                              + 30
+                              + duplicatedEntry->fileHeader.nameSize
+                              + ((duplicatedEntry->usesZip64) ? 20 : 0)
+                              + duplicatedEntry->fileHeader.extraFieldSize;
+
+    BOOL success = YES;
+    BOOL shouldAbort = NO;
+    const SInt64 chunkSize = (SInt64)NOZWriterBufferSize() * 16;
+    SInt64 bytesCopied = 0;
+    while (success && !shouldAbort && bytesCopied < totalBytes) {
+        const SInt64 bytesToCopy = MIN(chunkSize, totalBytes - bytesCopied);
+        success = NOZBufferedWriterCopyWrittenBytes(&_internal.writer, sourceOffset + bytesCopied, bytesToCopy);
+        if (success) {
+            bytesCopied += bytesToCopy;
+            if (progressBlock) {
+                progressBlock(totalBytes, bytesCopied, bytesToCopy, &shouldAbort);
             }
+        }
+    }
 
-        } while ((size_t)bytesRead == pageSize && !(*abort));
+    if (shouldAbort && bytesCopied < totalBytes) {
+        success = NO;
+        stackError = [NSError errorWithDomain:NSPOSIXErrorDomain code:ECANCELED userInfo:nil];
+    } else if (!success) {
+        stackError = NOZErrorCreate(NOZErrorCodeZipFailedToWriteEntry, nil);
     }
 
-    return success;
+    if (![self private_closeCurrentOpenEntryAndReturnError:(success) ? (&stackError) : NULL] || !success) {
+        return NO;
+    }
+
+    return YES;
+}
+
+- (void)private_discardCurrentEntry
+{
+    NOZFileEntryT *entry = _internal.currentEntry;
+    if (!entry) {
+        return;
+    }
+
+    _internal.currentEntry = NULL;
+
+    // the current entry is always the last entry, and its bytes are the last bytes written
+    NOZBufferedWriterTruncate(&_internal.writer, _internal.beginBytePosition + (SInt64)entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk);
+
+    NOZFileEntryT *previousEntry = NULL;
+    if (_internal.firstEntry != entry) {
+        previousEntry = _internal.firstEntry;
+        while (previousEntry->nextEntry != entry) {
+            previousEntry = previousEntry->nextEntry;
+        }
+        previousEntry->nextEntry = NULL;
+    } else {
+        _internal.firstEntry = NULL;
+    }
+    _internal.lastEntry = previousEntry;
+    NOZFileEntryCleanFree(entry);
 }
 
 - (BOOL)private_closeCurrentOpenEntryAndReturnError:(out NSError **)error
@@ -452,28 +1109,97 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
     }
 
     BOOL success = YES;
-
-    if (success) {
-        success = [self private_finishEncoding];
+    BOOL outgrewRecords = NO;
+    if (success && !_internal.currentEntry->usesZip64) {
+        const NOZLocalFileDescriptorT *fileDescriptor = &_internal.currentEntry->fileDescriptor;
+        if (fileDescriptor->compressedSize >= NOZZip64MaxUInt32 || fileDescriptor->uncompressedSize >= NOZZip64MaxUInt32) {
+            // the local header already went out without Zip64 room
+            outgrewRecords = YES;
+            success = NO;
+        }
     }
 
-#if NOZ_SINGLE_PASS_ZIP
     if (success) {
-        success = [self private_writeCurrentLocalFileDescriptor:YES];
+        if (_internal.currentEntry->fileHeader.bitFlag & NOZFlagBitUseDescriptor) {
+            success = [self private_writeCurrentLocalFileDescriptor];
+        } else {
+            success = [self private_patchLocalFileHeaderForEntry:_internal.currentEntry];
+        }
     }
-#endif
 
     _internal.endOfCentralDirectoryRecord.totalRecordCount++;
     _internal.endOfCentralDirectoryRecord.recordCountForDisk++;
     _internal.currentEntry = NULL;
 
     if (!success && error) {
-        *error = NOZErrorCreate(NOZErrorCodeZipFailedToCloseCurrentEntry, nil);
+        *error = NOZErrorCreate((outgrewRecords) ? NOZErrorCodeZipDoesNotSupportZip64 : NOZErrorCodeZipFailedToCloseCurrentEntry, nil);
     }
     
     return success;
 }
 
+- (BOOL)private_readExistingCentralDirectory:(out NOZCentralDirectory **)centralDirectory
+                                       error:(out NSError **)error
+{
+    NSError *underlyingError = nil;
+    NOZUnzipper *unzipper = [[NOZUnzipper alloc] initWithZipFile:_standardizedZipFilePath];
+    if ([unzipper openAndReturnError:&underlyingError]) {
+        *centralDirectory = [unzipper readCentralDirectoryAndReturnError:&underlyingError];
+        [unzipper closeAndReturnError:NULL];
+    }
+
+    if (!*centralDirectory) {
+        if (error) {
+            NSMutableDictionary *userInfo = [NSMutableDictionary dictionaryWithObject:_zipFilePath forKey:@"zipFilePath"];
+            userInfo[NSUnderlyingErrorKey] = underlyingError;
+            *error = NOZErrorCreate(NOZErrorCodeZipCannotOpenExistingZip, userInfo);
+        }
+        return NO;
+    }
+
+    return YES;
+}
+
+- (BOOL)private_addExistingRecordsOfCentralDirectory:(NOZCentralDirectory *)centralDirectory
+{
+    const NSUInteger recordCount = centralDirectory.recordCount;
+    for (NSUInteger index = 0; index < recordCount; index++) {
+        NOZFileEntryT existingEntry;
+        [centralDirectory getInternalEntry:&existingEntry atIndex:index];
+        NOZFileEntryT *newEntry = [self private_appendNewEntry];
+        if (!newEntry || !noz_copy_file_entry(newEntry, &existingEntry)) {
+            return NO;
+        }
+
+        _internal.endOfCentralDirectoryRecord.totalRecordCount++;
+        _internal.endOfCentralDirectoryRecord.recordCountForDisk++;
+    }
+
+    return YES;
+}
+
+- (NOZFileEntryT *)private_appendNewEntry
+{
+    NOZFileEntryT *newEntry = NOZFileEntryAllocInit();
+    if (!newEntry) {
+        return NULL;
+    }
+
+    if (_internal.lastEntry) {
+        _internal.lastEntry->nextEntry = newEntry;
+        _internal.lastEntry = newEntry;
+    } else {
+        _internal.firstEntry = _internal.lastEntry = newEntry;
+    }
+    return newEntry;
+}
+
+- (NSData *)private_dictionaryCompressedExtraFieldForMethod:(NOZCompressionMethod)compressionMethod
+{
+    NSNumber *dictionaryID = _dictionaryIDs[@(compressionMethod)];
+    return (dictionaryID) ? noz_dictionary_extra_field(NOZExtraFieldIdentifierDictionaryCompressed, dictionaryID.unsignedIntValue) : nil;
+}
+
 - (void)private_freeLinkedList
 {
     NOZFileEntryCleanFree(_internal.firstEntry);
@@ -486,26 +1212,31 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         return YES;
     }
 
-    BOOL success = YES;
-
-    const size_t bytesWritten = fwrite(buffer, 1, length, _internal.file);
-    if (bytesWritten != length) {
-        success = NO;
+    if (!NOZBufferedWriterWrite(&_internal.writer, buffer, length)) {
+        return NO;
     }
 
-    _internal.currentEntry->fileDescriptor.compressedSize += (UInt32)bytesWritten;
+    _internal.currentEntry->fileDescriptor.compressedSize += (UInt64)length;
 
-    return success;
+    return YES;
 }
 
-- (BOOL)private_populateRecordsForCurrentOpenEntryWithEntry:(id<NOZZippableEntry>)entry error:(out NSError **)error
+- (BOOL)private_writeBytes:(const Byte*)bytes length:(size_t)length
+{
+    return NOZBufferedWriterWrite(&_internal.writer, bytes, length);
+}
+
+- (BOOL)private_populateRecordsForCurrentOpenEntryWithEntry:(id<NOZZippableEntry>)entry
+                                          compressionMethod:(NOZCompressionMethod)compressionMethod
+                                                 extraField:(NSData *)extraField
+                                                      error:(out NSError **)error
 {
     NSUInteger nameSize = [entry.name lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
     if (nameSize > UINT16_MAX) {
         nameSize = 0;
     }
 
-    NSUInteger extraFieldSize = 0;
+    NSUInteger extraFieldSize = extraField.length;
     if (extraFieldSize > UINT16_MAX) {
         extraFieldSize = 0;
     }
@@ -522,36 +1253,42 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         return NO;
     }
 
-    if (entry.sizeInBytes > UINT32_MAX || (ftello(_internal.file) - _internal.beginBytePosition) > (UINT32_MAX - UINT8_MAX)) {
+    const SInt64 offset = NOZBufferedWriterPosition(&_internal.writer) - _internal.beginBytePosition;
+    if (offset < 0) {
         if (error) {
-            *error = NOZErrorCreate(NOZErrorCodeZipDoesNotSupportZip64, nil);
+            *error = NOZErrorCreate(NOZErrorCodeZipCannotOpenNewEntry, nil);
         }
         return NO;
     }
 
+    // Sizes are only known up front as an estimate, so large entries get Zip64 local records.
+    // Offsets are known, so they only ever need the Zip64 field in the central directory.
+    _internal.currentEntry->usesZip64 = (entry.sizeInBytes > NOZZip64EntrySizeThreshold);
+    const BOOL requiresZip64 = _internal.currentEntry->usesZip64 || (UInt64)offset >= NOZZip64MaxUInt32;
+
     NOZCentralDirectoryFileRecordT *record = &_internal.currentEntry->centralDirectoryRecord;
 
     /* File Record info */
     {
-        record->versionMadeBy = NOZVersionForCreation;
+        record->versionMadeBy = (requiresZip64) ? NOZVersionForZip64 : NOZVersionForCreation;
 
         /* File Header info */
         {
-            record->fileHeader->versionForExtraction = NOZVersionForExtraction;
+            record->fileHeader->versionForExtraction = (requiresZip64) ? NOZVersionForZip64 : NOZVersionForExtraction;
 
             /* Bit Flag */
             {
                 record->fileHeader->bitFlag = 0;
-                id<NOZEncoder> encoder = [[NOZCompressionLibrary sharedInstance] encoderForMethod:entry.compressionMethod];
-                if (encoder) {
+                id<NOZEncoder> encoder = [[NOZCompressionLibrary sharedInstance] encoderForMethod:compressionMethod];
+                if (encoder && compressionMethod == entry.compressionMethod) {
                     record->fileHeader->bitFlag |= [encoder bitFlagsForEntry:entry];
                 }
-#if NOZ_SINGLE_PASS_ZIP
-                record->fileHeader->bitFlag |= NOZFlagBitUseDescriptor;
-#endif
+                if (_internal.usesDataDescriptors) {
+                    record->fileHeader->bitFlag |= NOZFlagBitUseDescriptor;
+                }
             }
 
-            record->fileHeader->compressionMethod = entry.compressionMethod;
+            record->fileHeader->compressionMethod = compressionMethod;
             noz_dos_date_from_NSDate(entry.timestamp ?: [NSDate date],
                                      &record->fileHeader->dosDate,
                                      &record->fileHeader->dosTime);
@@ -572,11 +1309,7 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         record->internalFileAttributes = 0;
         record->externalFileAttributes = 0;
 
-        SInt64 offset = ((SInt64)ftello(_internal.file) - _internal.beginBytePosition);
-        if (offset > UINT32_MAX) {
-            offset = UINT32_MAX;
-        }
-        record->localFileHeaderOffsetFromStartOfDisk = (UInt32)offset;
+        record->localFileHeaderOffsetFromStartOfDisk = (UInt64)offset;
     }
 
     if (nameSize > 0) {
@@ -585,7 +1318,12 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
         _internal.currentEntry->ownsName = YES;
     }
     _internal.currentEntry->extraField = NULL;
-    _internal.currentEntry->ownsName = NO;
+    _internal.currentEntry->ownsExtraField = NO;
+    if (extraFieldSize > 0) {
+        _internal.currentEntry->extraField = (const Byte*)malloc(extraFieldSize);
+        memcpy((void *)_internal.currentEntry->extraField, extraField.bytes, extraFieldSize);
+        _internal.currentEntry->ownsExtraField = YES;
+    }
     if (commentSize > 0) {
         _internal.currentEntry->comment = (const Byte*)malloc(commentSize);
         memcpy((void *)_internal.currentEntry->comment, entry.comment.UTF8String, commentSize);
@@ -595,51 +1333,51 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
     return YES;
 }
 
-- (BOOL)private_writeLocalFileHeaderForEntry:(NOZFileEntryT *)entry signature:(BOOL)writeSig
+- (BOOL)private_writeLocalFileHeaderForCurrentEntryAndReturnError:(out NSError **)error
 {
-    NOZLocalFileHeaderT* header = &entry->fileHeader;
-    const SInt64 oldPosition = ftello(_internal.file);
-
-    if (writeSig) {
-        PRIVATE_WRITE(NOZMagicNumberLocalFileHeader);
-    }
-    PRIVATE_WRITE(header->versionForExtraction);
-    PRIVATE_WRITE(header->bitFlag);
-    PRIVATE_WRITE(header->compressionMethod);
-    PRIVATE_WRITE(header->dosTime);
-    PRIVATE_WRITE(header->dosDate);
-
-    [self private_writeLocalFileDescriptorForEntry:entry signature:NO];
+    NOZFileEntryT *entry = _internal.currentEntry;
+    NOZLocalFileHeaderT *header = &entry->fileHeader;
+    const UInt16 zip64ExtraFieldSize = (entry->usesZip64) ? 20 : 0;
 
-    PRIVATE_WRITE(header->nameSize);
-    PRIVATE_WRITE(header->extraFieldSize);
+    Byte buffer[30 + 20];
+    const Byte *bufferEnd = buffer + sizeof(buffer);
+    Byte *cursor = buffer;
 
-    const SInt64 diff = ftello(_internal.file) - oldPosition;
-    const SInt64 expectedBytesWritten = 30;
-    return (diff == expectedBytesWritten);
-}
+    PRIVATE_STORE(NOZMagicNumberLocalFileHeader);
+    PRIVATE_STORE(header->versionForExtraction);
+    PRIVATE_STORE(header->bitFlag);
+    PRIVATE_STORE(header->compressionMethod);
+    PRIVATE_STORE(header->dosTime);
+    PRIVATE_STORE(header->dosDate);
+    cursor = noz_store_local_file_descriptor(entry, NO, cursor, bufferEnd);
+    PRIVATE_STORE(header->nameSize);
+    PRIVATE_STORE_SIZED(header->extraFieldSize + zip64ExtraFieldSize, 2);
 
-- (BOOL)private_writeLocalFileHeaderForCurrentEntryAndReturnError:(out NSError **)error
-{
-    BOOL success = YES;
-    NOZFileEntryT *entry = _internal.currentEntry;
+    BOOL success = ((cursor - buffer) == 30);
 
-    success = [self private_writeLocalFileHeaderForEntry:entry signature:YES];
+    if (success) {
+        success = [self private_writeBytes:buffer length:30];
+    }
 
     if (success) {
-        size_t bytesWritten = fwrite(entry->name, 1, (size_t)entry->fileHeader.nameSize, _internal.file);
-        if (bytesWritten != (size_t)entry->fileHeader.nameSize) {
-            success = NO;
-        }
+        success = [self private_writeBytes:entry->name length:(size_t)header->nameSize];
     }
 
-    if (success && entry->fileHeader.extraFieldSize > 0) {
-        const size_t bytesWritten = fwrite(entry->extraField, 1, (size_t)entry->fileHeader.extraFieldSize, _internal.file);
-        if (bytesWritten != (size_t)entry->fileHeader.extraFieldSize) {
+    if (success && entry->usesZip64) {
+        // sizes are filled in by the data descriptor (or patched in when not using descriptors)
+        const UInt64 zip64Values[] = { entry->fileDescriptor.uncompressedSize, entry->fileDescriptor.compressedSize };
+        Byte *zip64ExtraField = buffer + 30;
+        if (zip64ExtraFieldSize != noz_store_zip64_extra_field(zip64Values, 2, zip64ExtraField, bufferEnd)) {
             success = NO;
+        } else {
+            success = [self private_writeBytes:zip64ExtraField length:zip64ExtraFieldSize];
         }
     }
 
+    if (success && header->extraFieldSize > 0) {
+        success = [self private_writeBytes:entry->extraField length:(size_t)header->extraFieldSize];
+    }
+
     if (!success && error) {
         *error = NOZErrorCreate(NOZErrorCodeZipCannotOpenNewEntry, nil);
     }
@@ -647,48 +1385,43 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
     return success;
 }
 
-- (BOOL)private_finishEncoding
+- (BOOL)private_writeCurrentLocalFileDescriptor
 {
-    if (!_currentEncoder) {
+    Byte buffer[24];
+    const Byte *bufferEnd = buffer + sizeof(buffer);
+    Byte *cursor = noz_store_local_file_descriptor(_internal.currentEntry, YES, buffer, bufferEnd);
+
+    const size_t expectedByteCount = (_internal.currentEntry->usesZip64) ? 24 : 16;
+    if ((size_t)(cursor - buffer) != expectedByteCount) {
         return NO;
     }
 
-    noz_defer(^{
-        _currentEncoder = nil;
-        _currentEncoderContext = nil;
-    });
-
-    const BOOL success = [_currentEncoder finalizeEncoderContext:_currentEncoderContext];
-    if (_currentEncoderContext.encodedDataWasText) {
-        _internal.currentEntry->centralDirectoryRecord.internalFileAttributes |= (1 << 0) /* text */;
-    }
-    return success;
+    return [self private_writeBytes:buffer length:expectedByteCount];
 }
 
-- (BOOL)private_writeLocalFileDescriptorForEntry:(NOZFileEntryT *)entry signature:(BOOL)writeSignature
+- (BOOL)private_patchLocalFileHeaderForEntry:(NOZFileEntryT *)entry
 {
-    BOOL success = YES;
+    NOZLocalFileHeaderT *header = &entry->fileHeader;
+    const SInt64 localFileHeaderPosition = _internal.beginBytePosition + (SInt64)entry->centralDirectoryRecord.localFileHeaderOffsetFromStartOfDisk;
 
-    NOZLocalFileDescriptorT *fileDescriptor = &entry->fileDescriptor;
-    const SInt64 oldPosition = ftello(_internal.file);
-
-    if (writeSignature) {
-        PRIVATE_WRITE(NOZMagicNumberDataDescriptor);
+    Byte buffer[16];
+    const Byte *bufferEnd = buffer + sizeof(buffer);
+    Byte *cursor = noz_store_local_file_descriptor(entry, NO, buffer, bufferEnd);
+    if ((cursor - buffer) != 12 || !NOZBufferedWriterPatch(&_internal.writer, buffer, 12, localFileHeaderPosition + 14)) {
+        return NO;
     }
-    PRIVATE_WRITE(fileDescriptor->crc32);
-    PRIVATE_WRITE(fileDescriptor->compressedSize);
-    PRIVATE_WRITE(fileDescriptor->uncompressedSize);
 
-    if ((ftello(_internal.file) - oldPosition) != (writeSignature ? 16 : 12)) {
-        success = NO;
+    if (entry->usesZip64) {
+        // skip past the name and the Zip64 extra field's header to its sizes
+        cursor = buffer;
+        PRIVATE_STORE(entry->fileDescriptor.uncompressedSize);
+        PRIVATE_STORE(entry->fileDescriptor.compressedSize);
+        if ((cursor - buffer) != 16 || !NOZBufferedWriterPatch(&_internal.writer, buffer, 16, localFileHeaderPosition + 30 + header->nameSize + 4)) {
+            return NO;
+        }
     }
 
-    return success;
-}
-
-- (BOOL)private_writeCurrentLocalFileDescriptor:(BOOL)writeSignature
-{
-    return [self private_writeLocalFileDescriptorForEntry:_internal.currentEntry signature:writeSignature];
+    return YES;
 }
 
 - (BOOL)private_writeCentralDirectoryRecords
@@ -709,79 +1442,157 @@ noz_fwrite_value((v), sizeof(v), _internal.file)
 - (BOOL)private_writeCentralDirectoryRecord:(NOZFileEntryT *)entry
 {
     if (0 == _internal.endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset) {
-        _internal.endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset = (UInt32)(ftello(_internal.file) - _internal.beginBytePosition);
+        _internal.endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset = (UInt64)(NOZBufferedWriterPosition(&_internal.writer) - _internal.beginBytePosition);
     }
 
-    const SInt64 oldPosition = ftello(_internal.file);
-    SInt64 expectedBytesWritten = 46;
     NOZCentralDirectoryFileRecordT *record = &entry->centralDirectoryRecord;
+    NOZLocalFileHeaderT *header = record->fileHeader;
+    NOZLocalFileDescriptorT *fileDescriptor = header->fileDescriptor;
+
+    // Values that don't fit move to the Zip64 extra field, in this order
+    UInt64 zip64Values[3];
+    UInt8 zip64ValueCount = 0;
+    if (fileDescriptor->uncompressedSize >= NOZZip64MaxUInt32) {
+        zip64Values[zip64ValueCount++] = fileDescriptor->uncompressedSize;
+    }
+    if (fileDescriptor->compressedSize >= NOZZip64MaxUInt32) {
+        zip64Values[zip64ValueCount++] = fileDescriptor->compressedSize;
+    }
+    if (record->localFileHeaderOffsetFromStartOfDisk >= NOZZip64MaxUInt32) {
+        zip64Values[zip64ValueCount++] = record->localFileHeaderOffsetFromStartOfDisk;
+    }
+
+    Byte buffer[46 + 4 + sizeof(zip64Values)];
+    const Byte *bufferEnd = buffer + sizeof(buffer);
+    Byte *zip64ExtraField = buffer + 46;
+    const UInt16 zip64ExtraFieldSize = (zip64ValueCount) ? noz_store_zip64_extra_field(zip64Values, zip64ValueCount, zip64ExtraField, bufferEnd) : 0;
+    if (zip64ValueCount && !zip64ExtraFieldSize) {
+        return NO;
+    }
 
     /* File Record info */
+    Byte *cursor = buffer;
     {
-        PRIVATE_WRITE(NOZMagicNumberCentralDirectoryFileRecord);
-        PRIVATE_WRITE(record->versionMadeBy);
+        PRIVATE_STORE(NOZMagicNumberCentralDirectoryFileRecord);
+        PRIVATE_STORE(record->versionMadeBy);
+        PRIVATE_STORE(header->versionForExtraction);
+        PRIVATE_STORE(header->bitFlag);
+        PRIVATE_STORE(header->compressionMethod);
+        PRIVATE_STORE(header->dosTime);
+        PRIVATE_STORE(header->dosDate);
+        PRIVATE_STORE(fileDescriptor->crc32);
+        PRIVATE_STORE_SIZED(MIN(fileDescriptor->compressedSize, (UInt64)NOZZip64MaxUInt32), 4);
+        PRIVATE_STORE_SIZED(MIN(fileDescriptor->uncompressedSize, (UInt64)NOZZip64MaxUInt32), 4);
+        PRIVATE_STORE(header->nameSize);
+        PRIVATE_STORE_SIZED(header->extraFieldSize + zip64ExtraFieldSize, 2);
+        PRIVATE_STORE(record->commentSize);
+        PRIVATE_STORE(record->fileStartDiskNumber);
+        PRIVATE_STORE(record->internalFileAttributes);
+        PRIVATE_STORE(record->externalFileAttributes);
+        PRIVATE_STORE_SIZED(MIN(record->localFileHeaderOffsetFromStartOfDisk, (UInt64)NOZZip64MaxUInt32), 4);
+    }
+
+    if ((cursor - buffer) != 46) {
+        return NO;
+    }
 
-        [self private_writeLocalFileHeaderForEntry:entry signature:NO];
+    const SInt64 oldPosition = NOZBufferedWriterPosition(&_internal.writer);
+    BOOL success = [self private_writeBytes:buffer length:46];
 
-        PRIVATE_WRITE(record->commentSize);
-        PRIVATE_WRITE(record->fileStartDiskNumber);
-        PRIVATE_WRITE(record->internalFileAttributes);
-        PRIVATE_WRITE(record->externalFileAttributes);
-        PRIVATE_WRITE(record->localFileHeaderOffsetFromStartOfDisk);
+    if (success && entry->name) {
+        success = [self private_writeBytes:entry->name length:(size_t)header->nameSize];
     }
 
-    if (entry->name) {
-        expectedBytesWritten += record->fileHeader->nameSize;
-        fwrite(entry->name, 1, (size_t)record->fileHeader->nameSize, _internal.file);
+    if (success && zip64ExtraFieldSize) {
+        success = [self private_writeBytes:zip64ExtraField length:(size_t)zip64ExtraFieldSize];
     }
 
-    if (entry->extraField) {
-        expectedBytesWritten += record->fileHeader->extraFieldSize;
-        fwrite(entry->extraField, 1, (size_t)record->fileHeader->extraFieldSize, _internal.file);
+    if (success && entry->extraField) {
+        success = [self private_writeBytes:entry->extraField length:(size_t)header->extraFieldSize];
     }
 
-    if (entry->comment) {
-        expectedBytesWritten += record->commentSize;
-        fwrite(entry->comment, 1, (size_t)record->commentSize, _internal.file);
+    if (success && entry->comment) {
+        success = [self private_writeBytes:entry->comment length:(size_t)record->commentSize];
     }
 
-    const SInt64 bytesWritten = (ftello(_internal.file) - oldPosition);
-    _internal.endOfCentralDirectoryRecord.centralDirectorySize += bytesWritten;
-    if (bytesWritten != expectedBytesWritten) {
-        return NO;
+    _internal.endOfCentralDirectoryRecord.centralDirectorySize += (UInt64)(NOZBufferedWriterPosition(&_internal.writer) - oldPosition);
+    return success;
+}
+
+- (BOOL)private_writeZip64EndOfCentralDirectoryRecordAndLocator
+{
+    NOZEndOfCentralDirectoryRecordT *eocdRecord = &_internal.endOfCentralDirectoryRecord;
+    const UInt64 recordOffset = (UInt64)(NOZBufferedWriterPosition(&_internal.writer) - _internal.beginBytePosition);
+    const UInt64 remainingRecordSize = 44;
+    const UInt32 totalDiskCount = 1;
+
+    Byte buffer[56 + 20];
+    const Byte *bufferEnd = buffer + sizeof(buffer);
+    Byte *cursor = buffer;
+
+    /* Zip64 End of Central Directory Record */
+    {
+        PRIVATE_STORE(NOZMagicNumberZip64EndOfCentralDirectoryRecord);
+        PRIVATE_STORE(remainingRecordSize);
+        PRIVATE_STORE_SIZED(NOZVersionForZip64, 2); // made by
+        PRIVATE_STORE_SIZED(NOZVersionForZip64, 2); // needed for extraction
+        PRIVATE_STORE(eocdRecord->diskNumber);
+        PRIVATE_STORE(eocdRecord->startDiskNumber);
+        PRIVATE_STORE(eocdRecord->recordCountForDisk);
+        PRIVATE_STORE(eocdRecord->totalRecordCount);
+        PRIVATE_STORE(eocdRecord->centralDirectorySize);
+        PRIVATE_STORE(eocdRecord->archiveStartToCentralDirectoryStartOffset);
     }
 
-#if !NOZ_SINGLE_PASS_ZIP
-    if (0 == fseeko(_internal.file, _internal.beginBytePosition + record->localFileHeaderOffsetFromStartOfDisk + 14, SEEK_SET)) {
-        [self private_writeLocalFileDescriptorForEntry:entry signature:NO];
+    /* Zip64 End of Central Directory Locator */
+    {
+        PRIVATE_STORE(NOZMagicNumberZip64EndOfCentralDirectoryLocator);
+        PRIVATE_STORE(eocdRecord->startDiskNumber);
+        PRIVATE_STORE(recordOffset);
+        PRIVATE_STORE(totalDiskCount);
     }
-    fseeko(_internal.file, 0, SEEK_END);
-#endif
 
-    return YES;
+    if ((size_t)(cursor - buffer) != sizeof(buffer)) {
+        return NO;
+    }
+
+    return [self private_writeBytes:buffer length:sizeof(buffer)];
 }
 
 - (BOOL)private_writeEndOfCentralDirectoryRecord
 {
-    const SInt64 oldPosition = ftello(_internal.file);
-    SInt64 expectedBytesWritten = 22;
+    NOZEndOfCentralDirectoryRecordT *eocdRecord = &_internal.endOfCentralDirectoryRecord;
+    if (eocdRecord->totalRecordCount >= NOZZip64MaxUInt16 ||
+        eocdRecord->centralDirectorySize >= NOZZip64MaxUInt32 ||
+        eocdRecord->archiveStartToCentralDirectoryStartOffset >= NOZZip64MaxUInt32) {
+        if (![self private_writeZip64EndOfCentralDirectoryRecordAndLocator]) {
+            return NO;
+        }
+    }
 
-    PRIVATE_WRITE(NOZMagicNumberEndOfCentralDirectoryRecord);
-    PRIVATE_WRITE(_internal.endOfCentralDirectoryRecord.diskNumber);
-    PRIVATE_WRITE(_internal.endOfCentralDirectoryRecord.startDiskNumber);
-    PRIVATE_WRITE(_internal.endOfCentralDirectoryRecord.recordCountForDisk);
-    PRIVATE_WRITE(_internal.endOfCentralDirectoryRecord.totalRecordCount);
-    PRIVATE_WRITE(_internal.endOfCentralDirectoryRecord.centralDirectorySize);
-    PRIVATE_WRITE(_internal.endOfCentralDirectoryRecord.archiveStartToCentralDirectoryStartOffset);
-    PRIVATE_WRITE(_internal.endOfCentralDirectoryRecord.commentSize);
+    Byte buffer[22];
+    const Byte *bufferEnd = buffer + sizeof(buffer);
+    Byte *cursor = buffer;
+
+    // Values that don't fit are saturated, readers then use the Zip64 record
+    PRIVATE_STORE(NOZMagicNumberEndOfCentralDirectoryRecord);
+    PRIVATE_STORE_SIZED(eocdRecord->diskNumber, 2);
+    PRIVATE_STORE_SIZED(eocdRecord->startDiskNumber, 2);
+    PRIVATE_STORE_SIZED(MIN(eocdRecord->recordCountForDisk, (UInt64)NOZZip64MaxUInt16), 2);
+    PRIVATE_STORE_SIZED(MIN(eocdRecord->totalRecordCount, (UInt64)NOZZip64MaxUInt16), 2);
+    PRIVATE_STORE_SIZED(MIN(eocdRecord->centralDirectorySize, (UInt64)NOZZip64MaxUInt32), 4);
+    PRIVATE_STORE_SIZED(MIN(eocdRecord->archiveStartToCentralDirectoryStartOffset, (UInt64)NOZZip64MaxUInt32), 4);
+    PRIVATE_STORE(eocdRecord->commentSize);
+
+    if ((size_t)(cursor - buffer) != sizeof(buffer) || ![self private_writeBytes:buffer length:sizeof(buffer)]) {
+        return NO;
+    }
 
     if (_internal.comment) {
-        expectedBytesWritten += _internal.endOfCentralDirectoryRecord.commentSize;
-        fwrite(_internal.comment, 1, (size_t)_internal.endOfCentralDirectoryRecord.commentSize, _internal.file);
+        return [self private_writeBytes:_internal.comment length:(size_t)eocdRecord->commentSize];
     }
 
-    const SInt64 bytesWritten = ftello(_internal.file) - oldPosition;
-    return bytesWritten == expectedBytesWritten;
+    return YES;
 }
 
 @end
@@ -808,18 +1619,910 @@ static UInt8 noz_store_value(UInt64 x, const UInt8 byteCount, Byte *buffer, cons
     return byteCount;
 }
 
-static UInt8 noz_fwrite_value(UInt64 x, const UInt8 byteCount, FILE *file)
+static UInt16 noz_store_zip64_extra_field(const UInt64 *values, const UInt8 valueCount, Byte *buffer, const Byte *bufferEnd)
 {
-    Byte buffer[8];
+    const UInt16 dataSize = (UInt16)(valueCount * 8);
+    UInt16 bytesStored = 0;
 
-    UInt8 bytesWritten = noz_store_value(x, byteCount, buffer, buffer + 8);
-    if (bytesWritten != byteCount) {
-        return 0;
+    bytesStored += noz_store_value(NOZExtraFieldIdentifierZip64, 2, buffer + bytesStored, bufferEnd);
+    bytesStored += noz_store_value(dataSize, 2, buffer + bytesStored, bufferEnd);
+    for (UInt8 i = 0; i < valueCount; i++) {
+        bytesStored += noz_store_value(values[i], 8, buffer + bytesStored, bufferEnd);
     }
 
-    bytesWritten = (UInt8)fwrite((const char *)buffer, 1, (size_t)byteCount, file);
-#if DEBUG
-    fflush(file);
-#endif
-    return bytesWritten;
+    return (bytesStored == 4 + dataSize) ? bytesStored : 0;
+}
+
+static BOOL noz_bytes_look_incompressible(const Byte *bytes, size_t length)
+{
+    if (length < 4096) {
+        // too little to go by (and too little to matter)
+        return NO;
+    }
+
+    size_t histogram[256] = { 0 };
+    for (size_t i = 0; i < length; i++) {
+        histogram[bytes[i]]++;
+    }
+
+    // Order-0 (Shannon) entropy: already compressed or encrypted data sits right below 8 bits per byte
+    double entropy = 0;
+    for (size_t i = 0; i < 256; i++) {
+        if (histogram[i]) {
+            const double probability = (double)histogram[i] / (double)length;
+            entropy -= probability * log2(probability);
+        }
+    }
+
+    return entropy >= NOZIncompressibleEntropyThreshold;
+}
+
+static BOOL noz_write_to_output_stream(void *context, const Byte *bytes, size_t length)
+{
+    NSOutputStream *outputStream = (__bridge NSOutputStream *)context;
+    while (length > 0) {
+        const NSInteger bytesWritten = [outputStream write:bytes maxLength:length];
+        if (bytesWritten <= 0) {
+            return NO;
+        }
+        bytes += bytesWritten;
+        length -= (size_t)bytesWritten;
+    }
+    return YES;
+}
+
+static NSString *noz_inode_key_for_entry(id<NOZZippableEntry> entry, NOZCompressionMethod compressionMethod)
+{
+    if (![(NSObject *)entry isKindOfClass:[NOZFileZipEntry class]]) {
+        return nil;
+    }
+
+    struct stat fileStat;
+    const char *filePath = [(NOZFileZipEntry *)entry filePath].fileSystemRepresentation;
+    if (!filePath || 0 != stat(filePath, &fileStat)) {
+        return nil;
+    }
+
+    return [NSString stringWithFormat:@"inode:%u:%llu:%llu", (unsigned)compressionMethod, (unsigned long long)fileStat.st_dev, (unsigned long long)fileStat.st_ino];
 }
+
+static NSString *noz_content_key_for_entry(id<NOZZippableEntry> entry, NOZCompressionMethod compressionMethod)
+{
+    // the content has to be read again to compress it, so only entries that can be restarted are fingerprinted
+    if (!noz_entry_can_restart(entry)) {
+        return nil;
+    }
+
+    UInt32 crc32 = 0;
+    unsigned long long size = 0;
+    NSData *data = nil;
+    if ([entry respondsToSelector:@selector(contiguousData)]) {
+        data = [entry contiguousData];
+    }
+    if (data) {
+        size = data.length;
+        crc32 = noz_crc32(0, data.bytes, data.length);
+    } else {
+        NSInputStream *inputStream = entry.inputStream;
+        if (!inputStream) {
+            return nil;
+        }
+        [inputStream open];
+        noz_defer(^{ [inputStream close]; });
+
+        const size_t bufferSize = NOZBufferSize();
+        Byte buffer[bufferSize];
+        NSInteger bytesRead;
+        while ((bytesRead = [inputStream read:buffer maxLength:bufferSize]) > 0) {
+            crc32 = noz_crc32(crc32, buffer, (size_t)bytesRead);
+            size += (unsigned long long)bytesRead;
+        }
+        if (bytesRead < 0) {
+            return nil;
+        }
+    }
+
+    return [NSString stringWithFormat:@"content:%u:%llu:%08x", (unsigned)compressionMethod, size, (unsigned)crc32];
+}
+
+static NSInputStream *noz_open_content_stream_for_entry(id<NOZZippableEntry> entry)
+{
+    NSData *data = nil;
+    if ([entry respondsToSelector:@selector(contiguousData)]) {
+        data = [entry contiguousData];
+    }
+    NSInputStream *inputStream = (data) ? [NSInputStream inputStreamWithData:data] : entry.inputStream;
+    [inputStream open];
+    return inputStream;
+}
+
+static BOOL noz_entries_have_same_content(id<NOZZippableEntry> entry, id<NOZZippableEntry> otherEntry)
+{
+    if (!entry || !otherEntry) {
+        return NO;
+    }
+
+    NSInputStream *inputStream = noz_open_content_stream_for_entry(entry);
+    noz_defer(^{ [inputStream close]; });
+    NSInputStream *otherInputStream = noz_open_content_stream_for_entry(otherEntry);
+    noz_defer(^{ [otherInputStream close]; });
+    if (!inputStream || !otherInputStream) {
+        return NO;
+    }
+
+    const size_t bufferSize = NOZBufferSize();
+    Byte *buffer = malloc(bufferSize * 2);
+    if (!buffer) {
+        return NO;
+    }
+    noz_defer(^{ free(buffer); });
+    Byte *otherBuffer = buffer + bufferSize;
+
+    while (YES) {
+        const NSInteger bytesRead = noz_read_input_stream_fully(inputStream, buffer, bufferSize);
+        const NSInteger otherBytesRead = noz_read_input_stream_fully(otherInputStream, otherBuffer, bufferSize);
+        if (bytesRead < 0 || bytesRead != otherBytesRead || 0 != memcmp(buffer, otherBuffer, (size_t)bytesRead)) {
+            return NO;
+        }
+        if (bytesRead == 0) {
+            return YES;
+        }
+    }
+}
+
+static Byte *noz_copy_extra_field_without_zip64(const Byte *extraField, const UInt16 extraFieldSize, UInt16 *copiedExtraFieldSize)
+{
+    *copiedExtraFieldSize = 0;
+    Byte *copiedExtraField = (Byte *)malloc(extraFieldSize);
+    if (!copiedExtraField) {
+        return NULL;
+    }
+
+    // a malformed extra field has no Zip64 block to find and is carried over as is
+    const Byte *zip64Data = NULL;
+    UInt16 zip64DataSize = 0;
+    if (noz_find_extra_field_block(extraField, extraFieldSize, NOZExtraFieldIdentifierZip64, &zip64Data, &zip64DataSize)) {
+        const Byte *zip64Block = zip64Data - 4;
+        const Byte *zip64BlockEnd = zip64Data + zip64DataSize;
+        const size_t leadingSize = (size_t)(zip64Block - extraField);
+        const size_t trailingSize = (size_t)((extraField + extraFieldSize) - zip64BlockEnd);
+        memcpy(copiedExtraField, extraField, leadingSize);
+        memcpy(copiedExtraField + leadingSize, zip64BlockEnd, trailingSize);
+        *copiedExtraFieldSize = (UInt16)(leadingSize + trailingSize);
+    } else {
+        memcpy(copiedExtraField, extraField, extraFieldSize);
+        *copiedExtraFieldSize = extraFieldSize;
+    }
+
+    if (0 == *copiedExtraFieldSize) {
+        free(copiedExtraField);
+        return NULL;
+    }
+    return copiedExtraField;
+}
+
+static BOOL noz_copy_file_entry(NOZFileEntryT *entry, const NOZFileEntryT *sourceEntry)
+{
+    entry->fileDescriptor = sourceEntry->fileDescriptor;
+    entry->fileHeader = sourceEntry->fileHeader;
+    entry->fileHeader.fileDescriptor = &entry->fileDescriptor;
+    entry->centralDirectoryRecord = sourceEntry->centralDirectoryRecord;
+    entry->centralDirectoryRecord.fileHeader = &entry->fileHeader;
+
+    entry->name = (const Byte *)malloc(sourceEntry->fileHeader.nameSize);
+    if (!entry->name) {
+        return NO;
+    }
+    memcpy((void *)entry->name, sourceEntry->name, sourceEntry->fileHeader.nameSize);
+    entry->ownsName = YES;
+
+    entry->fileHeader.extraFieldSize = 0;
+    if (sourceEntry->extraField) {
+        // the Zip64 extra field is regenerated when writing the records
+        UInt16 extraFieldSize = 0;
+        entry->extraField = noz_copy_extra_field_without_zip64(sourceEntry->extraField, sourceEntry->fileHeader.extraFieldSize, &extraFieldSize);
+        entry->fileHeader.extraFieldSize = extraFieldSize;
+        entry->ownsExtraField = (entry->extraField != NULL);
+    }
+
+    entry->centralDirectoryRecord.commentSize = 0;
+    if (sourceEntry->comment) {
+        entry->comment = (const Byte *)malloc(sourceEntry->centralDirectoryRecord.commentSize);
+        if (!entry->comment) {
+            return NO;
+        }
+        memcpy((void *)entry->comment, sourceEntry->comment, sourceEntry->centralDirectoryRecord.commentSize);
+        entry->centralDirectoryRecord.commentSize = sourceEntry->centralDirectoryRecord.commentSize;
+        entry->ownsComment = YES;
+    }
+
+    return YES;
+}
+
+static Byte *noz_store_local_file_descriptor(const NOZFileEntryT *entry, BOOL writeSignature, Byte *cursor, const Byte *bufferEnd)
+{
+    const NOZLocalFileDescriptorT *fileDescriptor = &entry->fileDescriptor;
+
+    if (writeSignature) {
+        // Data descriptor following the entry's data, Zip64 entries use 64-bit sizes
+        const UInt8 sizeByteCount = (entry->usesZip64) ? 8 : 4;
+        PRIVATE_STORE(NOZMagicNumberDataDescriptor);
+        PRIVATE_STORE(fileDescriptor->crc32);
+        PRIVATE_STORE_SIZED(fileDescriptor->compressedSize, sizeByteCount);
+        PRIVATE_STORE_SIZED(fileDescriptor->uncompressedSize, sizeByteCount);
+    } else {
+        // Within the local file header, Zip64 entries keep their sizes in the extra field
+        PRIVATE_STORE(fileDescriptor->crc32);
+        PRIVATE_STORE_SIZED((entry->usesZip64) ? NOZZip64MaxUInt32 : fileDescriptor->compressedSize, 4);
+        PRIVATE_STORE_SIZED((entry->usesZip64) ? NOZZip64MaxUInt32 : fileDescriptor->uncompressedSize, 4);
+    }
+
+    return cursor;
+}
+
+@implementation NOZEntryEncoder
+{
+    NSDictionary<NSNumber *, id<NOZEncoder>> *_dictionaryEncoders;
+    NSData *_contiguousData;
+    NSInputStream *_inputStream;
+    NSData *_sampledBytes;
+    id<NOZEncoder> _encoder;
+    UInt16 _bitFlags;
+
+    struct {
+        BOOL detectsIncompressibility:1;
+        BOOL pipelinesStream:1;
+        BOOL encodesInSingleCall:1;
+        BOOL encoderComputesCRC32:1;
+    } _flags;
+}
+
+- (instancetype)initWithEntry:(id<NOZZippableEntry>)entry
+            compressionMethod:(NOZCompressionMethod)compressionMethod
+      detectIncompressibility:(BOOL)detectIncompressibility
+           dictionaryEncoders:(NSDictionary<NSNumber *, id<NOZEncoder>> *)dictionaryEncoders
+              pipelinesStream:(BOOL)pipelinesStream
+{
+    if (self = [super init]) {
+        _entry = entry;
+        _compressionMethod = compressionMethod;
+        _dictionaryEncoders = dictionaryEncoders;
+        _flags.detectsIncompressibility = !!detectIncompressibility;
+        _flags.pipelinesStream = !!pipelinesStream;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_inputStream close];
+}
+
+- (BOOL)prepareAndReturnError:(out NSError **)error
+{
+    // Entries that expose their bytes directly are compressed without copying them out of a stream
+    if ([_entry respondsToSelector:@selector(contiguousData)]) {
+        _contiguousData = [_entry contiguousData];
+    }
+    if (!_contiguousData) {
+        _inputStream = _entry.inputStream;
+        [_inputStream open];
+    }
+    if (!_contiguousData && !_inputStream) {
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeZipFailedToWriteEntry, nil);
+        }
+        return NO;
+    }
+
+    // Look at the start of the entry before committing to a compression method
+    if (_flags.detectsIncompressibility && NOZCompressionMethodNone != _compressionMethod && _contiguousData) {
+        if (noz_bytes_look_incompressible(_contiguousData.bytes, MIN(_contiguousData.length, (NSUInteger)NOZIncompressibleSampleSize))) {
+            _compressionMethod = NOZCompressionMethodNone;
+        }
+    } else if (_flags.detectsIncompressibility && NOZCompressionMethodNone != _compressionMethod) {
+        // the stream carries on after the sample, which is encoded first
+        NSMutableData *sample = [NSMutableData dataWithLength:NOZIncompressibleSampleSize];
+        const NSInteger sampleLength = noz_read_input_stream_fully(_inputStream, sample.mutableBytes, NOZIncompressibleSampleSize);
+        if (sampleLength < 0) {
+            if (error) {
+                *error = NOZErrorCreate(NOZErrorCodeZipFailedToWriteEntry, nil);
+            }
+            return NO;
+        }
+        sample.length = (NSUInteger)sampleLength;
+        _sampledBytes = sample;
+
+        if (noz_bytes_look_incompressible(sample.bytes, (size_t)sampleLength)) {
+            _compressionMethod = NOZCompressionMethodNone;
+        }
+    }
+
+    id<NOZEncoder> libraryEncoder = [[NOZCompressionLibrary sharedInstance] encoderForMethod:_compressionMethod];
+    id<NOZEncoder> dictionaryEncoder = _dictionaryEncoders[@(_compressionMethod)];
+    _usesDictionary = (dictionaryEncoder != nil);
+    _encoder = dictionaryEncoder ?: libraryEncoder;
+    if (!_encoder) {
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeZipDoesNotSupportCompressionMethod, @{ @"method" : @(_compressionMethod) });
+        }
+        return NO;
+    }
+
+    // the same flags the entry's records get
+    _bitFlags = (_compressionMethod == _entry.compressionMethod) ? [libraryEncoder bitFlagsForEntry:_entry] : 0;
+
+    // Small entries are encoded in a single call, straight from their bytes into one buffer.
+    // Stored entries already stream without copying, so they are left alone.
+    _flags.encodesInSingleCall = _contiguousData &&
+                                 _contiguousData.length <= NOZSingleCallCodingMaximumLength &&
+                                 NOZCompressionMethodNone != _compressionMethod &&
+                                 [_encoder respondsToSelector:@selector(maximumEncodedLengthForLength:)] &&
+                                 [_encoder respondsToSelector:@selector(encodeBytes:length:toBuffer:capacity:encodedLength:context:)];
+    return YES;
+}
+
+- (BOOL)encodeWithFlushBlock:(BOOL(^)(const Byte *bytes, size_t length))flushBlock
+               progressBlock:(NOZProgressBlock)progressBlock
+                       error:(out NSError **)error
+                    abortRef:(BOOL *)abort
+                  restartRef:(BOOL *)restart
+{
+    __block BOOL success = YES;
+    noz_defer(^{
+        if (!success && error && !*error) {
+            *error = (*abort) ? [NSError errorWithDomain:NSPOSIXErrorDomain code:ECANCELED userInfo:nil] : NOZErrorCreate(NOZErrorCodeZipFailedToWriteEntry, nil);
+        }
+    });
+
+    if (!_encoder) {
+        success = NO;
+        return NO;
+    }
+
+    __unsafe_unretained typeof(self) rawSelf = self;
+    NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+    const NOZCompressionLevel level = _entry.compressionLevel;
+    id<NOZEncoderContext> context = [library createContextForEncoder:_encoder
+                                                             bitFlags:_bitFlags
+                                                     compressionLevel:level
+                                                        flushCallback:^BOOL(id<NOZEncoder> encoder, id<NOZEncoderContext> callbackContext, const Byte* buffer, size_t length) {
+        rawSelf->_compressedSize += (UInt64)length;
+        return flushBlock(buffer, length);
+    }];
+    if (!context) {
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeZipDoesNotSupportCompressionMethod, @{ @"method" : @(_compressionMethod) });
+        }
+        success = NO;
+        return NO;
+    }
+
+    if (_flags.encodesInSingleCall) {
+        // compression is only checked for paying off every megabyte, which entries this small never reach
+        success = [self private_encodeInSingleCallWithContext:context flushBlock:flushBlock progressBlock:progressBlock error:error abortRef:abort];
+    } else {
+        BOOL shouldRestartAsStored = NO;
+        const BOOL canRestartAsStored = restart && _flags.detectsIncompressibility && NOZCompressionMethodNone != _compressionMethod && noz_entry_can_restart(_entry);
+        success = [self private_encodeStreamWithContext:context
+                                          progressBlock:progressBlock
+                                                  error:error
+                                               abortRef:abort
+                                             restartRef:(canRestartAsStored) ? &shouldRestartAsStored : NULL];
+        if (success && shouldRestartAsStored) {
+            // the context is dropped unfinished
+            *restart = YES;
+            return YES;
+        }
+
+        if (success && !(*abort)) {
+            success = [_encoder finalizeEncoderContext:context];
+            if (!success && error) {
+                *error = NOZErrorCreate(NOZErrorCodeZipFailedToCompressEntry, nil);
+            } else if (success && _flags.encoderComputesCRC32) {
+                _crc32 = [context uncompressedCRC32];
+            }
+        }
+    }
+
+    if (*abort) {
+        success = NO;
+        return NO;
+    }
+
+    if (success) {
+        _encodedDataWasText = context.encodedDataWasText;
+        [library recycleContext:context forEncoder:_encoder compressionLevel:level];
+    }
+
+    return success;
+}
+
+#pragma mark Private
+
+- (BOOL)private_encodeInSingleCallWithContext:(id<NOZEncoderContext>)context
+                                   flushBlock:(BOOL(^)(const Byte *bytes, size_t length))flushBlock
+                                progressBlock:(NOZProgressBlock)progressBlock
+                                        error:(out NSError **)error
+                                     abortRef:(BOOL *)abort
+{
+    const Byte *bytes = _contiguousData.bytes;
+    const size_t length = _contiguousData.length;
+    const size_t capacity = [_encoder maximumEncodedLengthForLength:length];
+    Byte *buffer = (capacity > 0) ? malloc(capacity) : NULL;
+    noz_defer(^{ free(buffer); });
+
+    size_t encodedLength = 0;
+    if (!buffer || ![_encoder encodeBytes:bytes
+                                   length:length
+                                 toBuffer:buffer
+                                 capacity:capacity
+                            encodedLength:&encodedLength
+                                  context:context]) {
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeZipFailedToCompressEntry, nil);
+        }
+        return NO;
+    }
+
+    _crc32 = noz_crc32(0, bytes, length);
+    _compressedSize += (UInt64)encodedLength;
+    if (!flushBlock(buffer, encodedLength)) {
+        return NO;
+    }
+
+    _uncompressedSize = (UInt64)length;
+    if (progressBlock) {
+        progressBlock(_entry.sizeInBytes, (SInt64)length, (SInt64)length, abort);
+    }
+
+    return YES;
+}
+
+- (BOOL)private_encodeStreamWithContext:(id<NOZEncoderContext>)context
+                          progressBlock:(NOZProgressBlock)progressBlock
+                                  error:(out NSError **)error
+                               abortRef:(BOOL *)abort
+                             restartRef:(BOOL *)restart
+{
+    _flags.encoderComputesCRC32 = !![context respondsToSelector:@selector(uncompressedCRC32)];
+    if (![_encoder initializeEncoderContext:context]) {
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeZipFailedToCompressEntry, nil);
+        }
+        return NO;
+    }
+
+    BOOL success = YES;
+    UInt64 nextRatioCheck = NOZIncompressibleRatioCheckInterval;
+    if (_contiguousData) {
+        // encode straight out of the entry's bytes, in spans as large as the writer's buffer
+        const Byte *bytes = _contiguousData.bytes;
+        const size_t length = _contiguousData.length;
+        const size_t spanSize = NOZWriterBufferSize();
+        for (size_t offset = 0; success && offset < length && !(*abort); offset += spanSize) {
+            success = [self private_encodeBytes:bytes + offset length:MIN(spanSize, length - offset) context:context progressBlock:progressBlock error:error abortRef:abort];
+            if (success && restart && [self private_shouldRestartAsStoredWithNextRatioCheck:&nextRatioCheck]) {
+                *restart = YES;
+                break;
+            }
+        }
+        return success;
+    }
+
+    if (_sampledBytes.length > 0) {
+        success = [self private_encodeBytes:_sampledBytes.bytes length:_sampledBytes.length context:context progressBlock:progressBlock error:error abortRef:abort];
+    }
+
+    if (success && !(*abort)) {
+        NSInteger bytesRead;
+        const size_t pageSize = NOZBufferSize();
+        Byte buffer[pageSize];
+
+        // pipelined, the stream is read ahead in large blocks while the previous ones are encoded
+        NOZPipelinedStreamReader *reader = nil;
+        if (_flags.pipelinesStream) {
+            reader = [[NOZPipelinedStreamReader alloc] initWithInputStream:_inputStream
+                                                                  blockSize:NOZWriterBufferSize()
+                                                                 blockCount:NOZPipelineBufferCount];
+        }
+        noz_defer(^{ [reader stop]; });
+
+        do {
+            const Byte *bytes = buffer;
+            bytesRead = (reader) ? [reader readBlock:&bytes] : [_inputStream read:buffer maxLength:pageSize];
+
+            if (bytesRead < 0) {
+                success = NO;
+                break;
+            }
+
+            if (bytesRead == 0) {
+                break;
+            }
+
+            success = [self private_encodeBytes:bytes length:(size_t)bytesRead context:context progressBlock:progressBlock error:error abortRef:abort];
+            [reader recycleBlock];
+            if (!success) {
+                break;
+            }
+
+            if (restart && [self private_shouldRestartAsStoredWithNextRatioCheck:&nextRatioCheck]) {
+                *restart = YES;
+                break;
+            }
+
+        } while ((reader || (size_t)bytesRead == pageSize) && !(*abort));
+    }
+
+    return success;
+}
+
+- (BOOL)private_encodeBytes:(const Byte *)bytes
+                     length:(size_t)length
+                    context:(id<NOZEncoderContext>)context
+              progressBlock:(NOZProgressBlock)progressBlock
+                      error:(out NSError **)error
+                   abortRef:(BOOL *)abort
+{
+    if (!_flags.encoderComputesCRC32) {
+        _crc32 = noz_crc32(_crc32, bytes, length);
+    }
+
+    if (![_encoder encodeBytes:bytes length:length context:context]) {
+        if (error) {
+            *error = NOZErrorCreate(NOZErrorCodeZipFailedToCompressEntry, nil);
+        }
+        return NO;
+    }
+
+    _uncompressedSize += (UInt64)length;
+    if (progressBlock) {
+        progressBlock(_entry.sizeInBytes, (SInt64)_uncompressedSize, (SInt64)length, abort);
+    }
+
+    return YES;
+}
+
+- (BOOL)private_shouldRestartAsStoredWithNextRatioCheck:(UInt64 *)nextRatioCheck
+{
+    if (_uncompressedSize < *nextRatioCheck) {
+        return NO;
+    }
+
+    if ((double)_compressedSize > (double)_uncompressedSize * NOZIncompressibleRatioThreshold) {
+        return YES;
+    }
+
+    *nextRatioCheck += NOZIncompressibleRatioCheckInterval;
+    return NO;
+}
+
+@end
+
+@implementation NOZEncodedEntryPayload
+{
+    NOZEncodedEntryPayloadReservationBlock _reservationBlock;
+    NSDictionary<NSNumber *, id<NOZEncoder>> *_dictionaryEncoders;
+    NSMutableData *_bufferedBytes;
+    SInt64 _reservedByteCount;
+    FILE *_spillFile;
+
+    struct {
+        BOOL detectsIncompressibility:1;
+        BOOL canRestartAsStored:1;
+        BOOL pipelinesStream:1;
+    } _flags;
+}
+
+- (instancetype)initWithEntry:(id<NOZZippableEntry>)entry
+             reservationBlock:(NOZEncodedEntryPayloadReservationBlock)reservationBlock
+      detectIncompressibility:(BOOL)detectIncompressibility
+           canRestartAsStored:(BOOL)canRestartAsStored
+           dictionaryEncoders:(NSDictionary<NSNumber *, id<NOZEncoder>> *)dictionaryEncoders
+              pipelinesStream:(BOOL)pipelinesStream
+{
+    if (self = [super init]) {
+        _entry = entry;
+        _compressionMethod = entry.compressionMethod;
+        _reservationBlock = [reservationBlock copy];
+        _dictionaryEncoders = dictionaryEncoders;
+        _bufferedBytes = [[NSMutableData alloc] init];
+        _flags.detectsIncompressibility = !!detectIncompressibility;
+        _flags.canRestartAsStored = !!canRestartAsStored;
+        _flags.pipelinesStream = !!pipelinesStream;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self discardEncodedBytes];
+}
+
+- (BOOL)encodeWithProgressBlock:(NOZProgressBlock)progressBlock
+{
+    NSError *error = nil;
+    BOOL abort = NO;
+    BOOL shouldRestartAsStored = NO;
+    BOOL success = [self private_encodeWithCompressionMethod:_entry.compressionMethod
+                                     detectIncompressibility:_flags.detectsIncompressibility
+                                               progressBlock:progressBlock
+                                                       error:&error
+                                                    abortRef:&abort
+                                                  restartRef:(_flags.canRestartAsStored) ? &shouldRestartAsStored : NULL];
+
+    if (success && shouldRestartAsStored) {
+        // compression isn't paying off, start over from a fresh input stream without it
+        [self discardEncodedBytes];
+        _bufferedBytes = [[NSMutableData alloc] init];
+        _compressedSize = 0;
+        success = [self private_encodeWithCompressionMethod:NOZCompressionMethodNone
+                                    detectIncompressibility:NO
+                                              progressBlock:progressBlock
+                                                      error:&error
+                                                   abortRef:&abort
+                                                 restartRef:NULL];
+    }
+
+    if (!success) {
+        _encodingError = error ?: NOZErrorCreate(NOZErrorCodeZipFailedToWriteEntry, nil);
+        [self discardEncodedBytes];
+    }
+
+    return success;
+}
+
+- (BOOL)enumerateEncodedBytesUsingBlock:(BOOL(^)(const Byte *bytes, size_t length))block
+{
+    if (_encodingError) {
+        return NO;
+    }
+
+    if (!_spillFile) {
+        return block(_bufferedBytes.bytes, _bufferedBytes.length);
+    }
+
+    if (0 != fseeko(_spillFile, 0, SEEK_SET)) {
+        return NO;
+    }
+
+    const size_t pageSize = NOZBufferSize();
+    Byte buffer[pageSize];
+    SInt64 bytesRemaining = _compressedSize;
+    while (bytesRemaining > 0) {
+        const size_t bytesToRead = (size_t)MIN((SInt64)pageSize, bytesRemaining);
+        if (fread(buffer, 1, bytesToRead, _spillFile) != bytesToRead) {
+            return NO;
+        }
+        if (!block(buffer, bytesToRead)) {
+            return NO;
+        }
+        bytesRemaining -= (SInt64)bytesToRead;
+    }
+
+    return YES;
+}
+
+- (void)discardEncodedBytes
+{
+    _bufferedBytes = nil;
+    if (_spillFile) {
+        fclose(_spillFile);
+        _spillFile = NULL;
+    }
+    if (_reservedByteCount && _reservationBlock) {
+        _reservationBlock(-_reservedByteCount);
+    }
+    _reservedByteCount = 0;
+}
+
+#pragma mark Private
+
+- (BOOL)private_encodeWithCompressionMethod:(NOZCompressionMethod)compressionMethod
+                    detectIncompressibility:(BOOL)detectIncompressibility
+                              progressBlock:(NOZProgressBlock)progressBlock
+                                      error:(out NSError **)error
+                                   abortRef:(BOOL *)abort
+                                 restartRef:(BOOL *)restart
+{
+    NOZEntryEncoder *entryEncoder = [[NOZEntryEncoder alloc] initWithEntry:_entry
+                                                         compressionMethod:compressionMethod
+                                                   detectIncompressibility:detectIncompressibility
+                                                        dictionaryEncoders:_dictionaryEncoders
+                                                           pipelinesStream:_flags.pipelinesStream];
+    if (![entryEncoder prepareAndReturnError:error]) {
+        return NO;
+    }
+
+    __unsafe_unretained typeof(self) rawSelf = self;
+    if (![entryEncoder encodeWithFlushBlock:^BOOL(const Byte *bytes, size_t length) {
+        return [rawSelf private_appendEncodedBytes:bytes length:length];
+    }
+                              progressBlock:progressBlock
+                                      error:error
+                                   abortRef:abort
+                                 restartRef:restart]) {
+        return NO;
+    }
+
+    if (restart && *restart) {
+        return YES;
+    }
+
+    _compressionMethod = entryEncoder.compressionMethod;
+    _usesDictionary = entryEncoder.usesDictionary;
+    _crc32 = entryEncoder.crc32;
+    _uncompressedSize = (SInt64)entryEncoder.uncompressedSize;
+    _encodedDataWasText = entryEncoder.encodedDataWasText;
+    return YES;
+}
+
+- (BOOL)private_appendEncodedBytes:(const Byte *)bytes length:(size_t)length
+{
+    if (0 == length) {
+        return YES;
+    }
+
+    if (!_spillFile) {
+        if (!_reservationBlock || _reservationBlock((SInt64)length)) {
+            if (_reservationBlock) {
+                _reservedByteCount += (SInt64)length;
+            }
+            [_bufferedBytes appendBytes:bytes length:length];
+            _compressedSize += (SInt64)length;
+            return YES;
+        }
+
+        // Over budget: move what we have to a temporary file and keep going from there
+        _spillFile = tmpfile();
+        if (!_spillFile) {
+            return NO;
+        }
+        if (_bufferedBytes.length != fwrite(_bufferedBytes.bytes, 1, _bufferedBytes.length, _spillFile)) {
+            return NO;
+        }
+        _bufferedBytes = nil;
+        if (_reservedByteCount) {
+            _reservationBlock(-_reservedByteCount);
+            _reservedByteCount = 0;
+        }
+    }
+
+    if (length != fwrite(bytes, 1, length, _spillFile)) {
+        return NO;
+    }
+    _compressedSize += (SInt64)length;
+    return YES;
+}
+
+@end
+
+@implementation NOZPipelinedStreamReader
+{
+    NSInputStream *_inputStream;
+    Byte *_blocks;
+    NSInteger *_blockLengths;
+    size_t _blockSize;
+    NSUInteger _blockCount;
+    NSUInteger _readIndex;
+    NSInteger _finalLength;
+    dispatch_semaphore_t _filledBlocks;
+    dispatch_semaphore_t _emptyBlocks;
+    dispatch_group_t _readGroup;
+    volatile BOOL _stopped;
+    BOOL _finished;
+}
+
+- (instancetype)initWithInputStream:(NSInputStream *)inputStream
+                          blockSize:(size_t)blockSize
+                         blockCount:(NSUInteger)blockCount
+{
+    if (self = [super init]) {
+        _inputStream = inputStream;
+        _blockSize = blockSize;
+        _blockCount = blockCount;
+        _blocks = (Byte *)malloc(blockSize * blockCount);
+        _blockLengths = (NSInteger *)calloc(blockCount, sizeof(NSInteger));
+        _filledBlocks = dispatch_semaphore_create(0);
+        _emptyBlocks = dispatch_semaphore_create((long)blockCount);
+        _readGroup = dispatch_group_create();
+
+        if (!_blocks || !_blockLengths) {
+            // nothing to read into, the first block reports the failure
+            _finished = YES;
+            _finalLength = -1;
+        } else {
+            dispatch_group_async(_readGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                [self private_readAhead];
+            });
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_blocks);
+    free(_blockLengths);
+}
+
+- (NSInteger)readBlock:(const Byte **)bytes
+{
+    if (_finished) {
+        *bytes = NULL;
+        return _finalLength;
+    }
+
+    dispatch_semaphore_wait(_filledBlocks, DISPATCH_TIME_FOREVER);
+    const NSInteger length = _blockLengths[_readIndex];
+    *bytes = _blocks + (_readIndex * _blockSize);
+    if (length <= 0) {
+        _finished = YES;
+        _finalLength = length;
+    }
+    return length;
+}
+
+- (void)recycleBlock
+{
+    if (_finished) {
+        return;
+    }
+
+    _readIndex = (_readIndex + 1) % _blockCount;
+    dispatch_semaphore_signal(_emptyBlocks);
+}
+
+- (void)stop
+{
+    if (_stopped) {
+        return;
+    }
+
+    _stopped = YES;
+    dispatch_semaphore_signal(_emptyBlocks);
+    dispatch_group_wait(_readGroup, DISPATCH_TIME_FOREVER);
+}
+
+#pragma mark Private
+
+- (void)private_readAhead
+{
+    NSUInteger index = 0;
+    BOOL atEnd = NO;
+    while (!atEnd) {
+        dispatch_semaphore_wait(_emptyBlocks, DISPATCH_TIME_FOREVER);
+        if (_stopped) {
+            break;
+        }
+
+        // fill whole blocks, streams often return less than asked for
+        Byte *block = _blocks + (index * _blockSize);
+        size_t length = 0;
+        NSInteger bytesRead = 0;
+        @autoreleasepool {
+            while (length < _blockSize) {
+                bytesRead = [_inputStream read:block + length maxLength:_blockSize - length];
+                if (bytesRead <= 0) {
+                    break;
+                }
+                length += (size_t)bytesRead;
+            }
+        }
+
+        if (bytesRead < 0) {
+            _blockLengths[index] = -1;
+            atEnd = YES;
+        } else {
+            // a short block is followed by an empty one to mark the end
+            _blockLengths[index] = (NSInteger)length;
+            atEnd = (0 == length);
+        }
+
+        dispatch_semaphore_signal(_filledBlocks);
+        index = (index + 1) % _blockCount;
+    }
+}
+
+@end
@@ -0,0 +1,99 @@
+//
+//  NOZZipper_Project.h
+//  ZipUtilities
+//
+//  The MIT License (MIT)
+//
+//  Copyright (c) 2016 Nolan O'Brien
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all
+//  copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//  SOFTWARE.
+//
+
+#import "NOZUtils.h"
+#import "NOZZipper.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ Block for reserving (positive _byteCountDelta_) or releasing (negative _byteCountDelta_) memory
+ for encoded bytes held by an `NOZEncodedEntryPayload`.
+ Return `NO` to refuse a reservation, which will spill the encoded bytes to a temporary file.
+ */
+typedef BOOL(^NOZEncodedEntryPayloadReservationBlock)(SInt64 byteCountDelta);
+
+/**
+ `NOZEncodedEntryPayload` holds the encoded bytes of an entry that was encoded outside of an `NOZZipper`
+ so that it can be appended to that zipper later on (and encoded on a different thread).
+ Payloads come from `encodedPayloadForEntry:reservationBlock:` and encode exactly like the zipper would.
+ Encoded bytes are kept in memory until the _reservationBlock_ refuses more memory, at which point all
+ encoded bytes are moved to a temporary file.
+ */
+@interface NOZEncodedEntryPayload : NSObject
+
+@property (nonatomic, readonly) id<NOZZippableEntry> entry;
+@property (nonatomic, readonly, nullable) NSError *encodingError;
+
+/** The compression method the entry was encoded with, stored if it looked incompressible */
+@property (nonatomic, readonly) NOZCompressionMethod compressionMethod;
+
+@property (nonatomic, readonly) UInt32 crc32;
+@property (nonatomic, readonly) SInt64 uncompressedSize;
+@property (nonatomic, readonly) SInt64 compressedSize;
+@property (nonatomic, readonly) BOOL encodedDataWasText;
+/** Whether the entry was encoded with the zipper's dictionary for `compressionMethod` */
+@property (nonatomic, readonly) BOOL usesDictionary;
+
+- (instancetype)init NS_UNAVAILABLE;
++ (instancetype)new NS_UNAVAILABLE;
+
+/** Encode the entry.  On failure, `encodingError` will be populated. */
+- (BOOL)encodeWithProgressBlock:(nullable NOZProgressBlock)progressBlock;
+
+/** Enumerate the encoded bytes in order.  Return `NO` from _block_ to stop with a failure. */
+- (BOOL)enumerateEncodedBytesUsingBlock:(BOOL(^)(const Byte *bytes, size_t length))block;
+
+/** Release the encoded bytes (and any memory reservation) */
+- (void)discardEncodedBytes;
+
+@end
+
+/**
+ Project level methods for `NOZZipper`
+ */
+@interface NOZZipper (Project)
+
+/**
+ A payload for _entry_ that encodes it with this zipper's settings (incompressible entry detection,
+ trained dictionaries, pipelining), so that adding it with `addEntry:encodedPayload:error:` writes
+ the same bytes as `addEntry:progressBlock:error:` would.
+ */
+- (NOZEncodedEntryPayload *)encodedPayloadForEntry:(id<NOZZippableEntry>)entry
+                                  reservationBlock:(nullable NOZEncodedEntryPayloadReservationBlock)reservationBlock;
+
+/**
+ Add an entry that has already been encoded.
+ The resulting archive bytes are identical to calling `addEntry:progressBlock:error:` with the same _entry_.
+ */
+- (BOOL)addEntry:(id<NOZZippableEntry>)entry
+  encodedPayload:(NOZEncodedEntryPayload *)payload
+           error:(out NSError * __nullable * __nullable)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
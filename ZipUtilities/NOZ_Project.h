@@ -84,10 +84,43 @@ NS_INLINE void noz_deferFunc(__strong noz_defer_block_t __nonnull * __nonnull bl
 FOUNDATION_EXTERN void noz_dos_date_from_NSDate(NSDate *__nullable dateObject, UInt16*__nonnull dateOut, UInt16*__nonnull timeOut);
 FOUNDATION_EXTERN NSDate * __nullable noz_NSDate_from_dos_date(UInt16 dosDate, UInt16 dosTime);
 
-#pragma mark CRC32 exposed
+#pragma mark Extra Fields
+
+//! Find the extra field block _identifier_ among the (2 byte id, 2 byte size, data) tuples of _extraField_, `NO` if it is missing or the tuples are malformed
+FOUNDATION_EXTERN BOOL noz_find_extra_field_block(const Byte * __nullable extraField, UInt16 extraFieldSize, UInt16 identifier, const Byte * __nullable * __nonnull data, UInt16 * __nonnull dataSize);
+
+#pragma mark Compression Dictionaries
+
+//! Directory of the reserved entries holding the dictionaries an archive's entries were compressed with
+FOUNDATION_EXTERN NSString * __nonnull const NOZDictionaryEntryDirectory;
+//! Name of the reserved entry holding the dictionary for the given compression _method_
+FOUNDATION_EXTERN NSString * __nonnull noz_dictionary_entry_name(UInt16 method);
+//! Extra field block _identifier_ carrying _dictionaryID_, the CRC-32 of the dictionary's bytes
+FOUNDATION_EXTERN NSData * __nonnull noz_dictionary_extra_field(UInt16 identifier, UInt32 dictionaryID);
+//! Find the dictionary ID of the extra field block _identifier_, `NO` if there is no such block
+FOUNDATION_EXTERN BOOL noz_read_dictionary_extra_field(const Byte * __nullable extraField, UInt16 extraFieldSize, UInt16 identifier, UInt32 * __nonnull dictionaryID);
+
+#pragma mark Entry Sampling
+
+@protocol NOZZippableEntry;
+
+//! Whether _entry_ provides a new input stream from the start every time it is asked, so it can be read more than once
+FOUNDATION_EXTERN BOOL noz_entry_can_restart(id<NOZZippableEntry> __nonnull entry);
+//! Read from _inputStream_ until _length_ bytes were read or the stream ended, returns the bytes read or `-1` on error
+FOUNDATION_EXTERN NSInteger noz_read_input_stream_fully(NSInputStream * __nonnull inputStream, Byte * __nonnull buffer, size_t length);
+//! Up to _maximumLength_ bytes from the start of _entry_, `nil` on error or if the entry can't be restarted
+FOUNDATION_EXTERN NSData * __nullable noz_sample_for_entry(id<NOZZippableEntry> __nonnull entry, size_t maximumLength);
+
+#pragma mark CRC32
 
 NS_ASSUME_NONNULL_BEGIN
 
+//! zlib's CRC-32, use `noz_crc32` instead
 extern unsigned long crc32(unsigned long crc, const unsigned char *buf, unsigned int len);
 
+//! CRC-32 (same as zlib's `crc32`), hardware accelerated when the CPU supports it
+FOUNDATION_EXTERN UInt32 noz_crc32(UInt32 crc, const Byte * __nullable bytes, size_t length);
+//! CRC-32 of two runs of bytes back to back, from their CRCs (same as zlib's `crc32_combine`)
+FOUNDATION_EXTERN UInt32 noz_crc32_combine(UInt32 crc1, UInt32 crc2, UInt64 length2);
+
 NS_ASSUME_NONNULL_END
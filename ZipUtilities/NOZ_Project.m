@@ -27,6 +27,7 @@
 
 #import "NOZ_Project.h"
 #import "NOZEncoder.h"
+#import "NOZUtils_Project.h"
 
 /**
  https://msdn.microsoft.com/en-us/library/windows/desktop/ms724247(v=vs.85).aspx
@@ -131,6 +132,61 @@ NSDate *noz_NSDate_from_dos_date(UInt16 dosDate, UInt16 dosTime)
     return date;
 }
 
+BOOL noz_find_extra_field_block(const Byte *extraField, UInt16 extraFieldSize, UInt16 identifier, const Byte **data, UInt16 *dataSize)
+{
+    if (!extraField) {
+        return NO;
+    }
+
+    const Byte *extraFieldEnd = extraField + extraFieldSize;
+    while ((extraField + 4) <= extraFieldEnd) {
+        const UInt16 blockIdentifier = NOZReadLittleEndianUInt16(extraField);
+        const UInt16 blockDataSize = NOZReadLittleEndianUInt16(extraField + 2);
+        const Byte *blockData = extraField + 4;
+        if ((blockData + blockDataSize) > extraFieldEnd) {
+            return NO;
+        }
+
+        if (identifier == blockIdentifier) {
+            *data = blockData;
+            *dataSize = blockDataSize;
+            return YES;
+        }
+
+        extraField = blockData + blockDataSize;
+    }
+
+    return NO;
+}
+
+NSString * const NOZDictionaryEntryDirectory = @"__NOZDICTIONARIES__";
+
+NSString *noz_dictionary_entry_name(UInt16 method)
+{
+    return [NSString stringWithFormat:@"%@/%u.dict", NOZDictionaryEntryDirectory, (unsigned)method];
+}
+
+NSData *noz_dictionary_extra_field(UInt16 identifier, UInt32 dictionaryID)
+{
+    const Byte extraField[8] = {
+        (Byte)identifier, (Byte)(identifier >> 8),
+        4, 0,
+        (Byte)dictionaryID, (Byte)(dictionaryID >> 8), (Byte)(dictionaryID >> 16), (Byte)(dictionaryID >> 24),
+    };
+    return [NSData dataWithBytes:extraField length:sizeof(extraField)];
+}
+
+BOOL noz_read_dictionary_extra_field(const Byte *extraField, UInt16 extraFieldSize, UInt16 identifier, UInt32 *dictionaryID)
+{
+    const Byte *data = NULL;
+    UInt16 dataSize = 0;
+    if (!noz_find_extra_field_block(extraField, extraFieldSize, identifier, &data, &dataSize) || dataSize < 4) {
+        return NO;
+    }
+    *dictionaryID = NOZReadLittleEndianUInt32(data);
+    return YES;
+}
+
 NSUInteger NOZCompressionLevelToEncoderSpecificLevel(id<NOZEncoder> encoder, NOZCompressionLevel level)
 {
     if (![encoder respondsToSelector:@selector(numberOfCompressionLevels)]) {
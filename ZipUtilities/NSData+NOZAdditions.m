@@ -26,6 +26,7 @@
 //
 
 #import "NOZ_Project.h"
+#import "NOZCompressionLibrary.h"
 #import "NOZDecoder.h"
 #import "NOZEncoder.h"
 #import "NOZError.h"
@@ -39,6 +40,31 @@
         return nil;
     }
 
+    if (self.length <= NOZSingleCallCodingMaximumLength &&
+        [encoder respondsToSelector:@selector(maximumEncodedLengthForLength:)] &&
+        [encoder respondsToSelector:@selector(encodeBytes:length:toBuffer:capacity:encodedLength:context:)]) {
+        NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+        id<NOZEncoderContext> context = [library createContextForEncoder:encoder
+                                                                 bitFlags:0
+                                                         compressionLevel:compressionLevel
+                                                            flushCallback:^BOOL(id<NOZEncoder> callbackEncoder, id<NOZEncoderContext> encoderContext, const Byte *bufferToFlush, size_t length) {
+                                                                return NO;
+                                                            }];
+        NSMutableData *encodedData = [NSMutableData dataWithLength:[encoder maximumEncodedLengthForLength:self.length]];
+        size_t encodedLength = 0;
+        if (!encodedData || ![encoder encodeBytes:self.bytes
+                                           length:self.length
+                                         toBuffer:encodedData.mutableBytes
+                                         capacity:encodedData.length
+                                    encodedLength:&encodedLength
+                                          context:context]) {
+            return nil;
+        }
+        [library recycleContext:context forEncoder:encoder compressionLevel:compressionLevel];
+        encodedData.length = encodedLength;
+        return encodedData;
+    }
+
     __block NSMutableData *encodedData = [NSMutableData data];
 
     @autoreleasepool {
@@ -76,6 +102,30 @@
         return nil;
     }
 
+    // The decoded size isn't known up front, so small data gets a single call into a generous buffer
+    // and anything that doesn't fit is decoded again as a stream
+    if (self.length <= NOZSingleCallCodingMaximumLength &&
+        [decoder respondsToSelector:@selector(decodeBytes:length:toBuffer:capacity:decodedLength:context:)]) {
+        NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+        id<NOZDecoderContext> context = [library createContextForDecoder:decoder
+                                                                 bitFlags:0
+                                                            flushCallback:^BOOL(id<NOZDecoder> callbackDecoder, id<NOZDecoderContext> decoderContext, const Byte *bufferToFlush, size_t length) {
+                                                                return NO;
+                                                            }];
+        NSMutableData *decodedData = [NSMutableData dataWithLength:MIN(MAX(self.length * 8, NOZBufferSize()), NOZSingleCallCodingMaximumLength)];
+        size_t decodedLength = 0;
+        if (decodedData && [decoder decodeBytes:self.bytes
+                                         length:self.length
+                                       toBuffer:decodedData.mutableBytes
+                                       capacity:decodedData.length
+                                  decodedLength:&decodedLength
+                                        context:context]) {
+            [library recycleContext:context forDecoder:decoder];
+            decodedData.length = decodedLength;
+            return decodedData;
+        }
+    }
+
      __block NSMutableData *decodedData = [NSMutableData data];
 
     @autoreleasepool {
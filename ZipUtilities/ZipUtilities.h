@@ -28,10 +28,12 @@
 #import "NOZCompress.h"
 #import "NOZCompression.h"
 #import "NOZCompressionLibrary.h"
+#import "NOZCompressionPolicy.h"
 #import "NOZDecoder.h"
 #import "NOZDecompress.h"
 #import "NOZEncoder.h"
 #import "NOZError.h"
+#import "NOZParallelDeflateEncoder.h"
 #import "NOZSyncStepOperation.h"
 #import "NOZUnzipper.h"
 #import "NOZUtils.h"
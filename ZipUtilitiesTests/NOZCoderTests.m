@@ -13,6 +13,12 @@
 @import XCTest;
 @import ZipUtilities;
 
+#include <zlib.h>
+
+// Not public, the project's CRC-32 is checked against zlib's
+FOUNDATION_EXTERN UInt32 noz_crc32(UInt32 crc, const Byte *bytes, size_t length);
+FOUNDATION_EXTERN UInt32 noz_crc32_combine(UInt32 crc1, UInt32 crc2, UInt64 length2);
+
 #define NOZCompressionMethodZStandard       (100)
 #define NOZCompressionMethodZStandard_D128  (101)
 #define NOZCompressionMethodZStandard_D256  (102)
@@ -402,6 +408,24 @@
     [library setEncoder:originalEncoder forMethod:NOZCompressionMethodDeflate];
 }
 
+- (void)testDeflate_ParallelDefault
+{
+    NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+
+    id<NOZEncoder> originalEncoder = [library encoderForMethod:NOZCompressionMethodDeflate];
+
+    // Parallel Encoder (small blocks to force many of them) / Original Decoder
+
+    [library setEncoder:[[NOZParallelDeflateEncoder alloc] initWithMaxConcurrentBlocks:4 blockSize:32 * 1024] forMethod:NOZCompressionMethodDeflate];
+
+    [self runCodingWithMethod:NOZCompressionMethodDeflate];
+    [self runCategoryCodingTest:NOZCompressionMethodDeflate];
+
+    // Reset encoder
+
+    [library setEncoder:originalEncoder forMethod:NOZCompressionMethodDeflate];
+}
+
 - (void)testLZMACoding
 {
     [self runCodingWithMethod:NOZCompressionMethodLZMA];
@@ -462,6 +486,261 @@
     [self runCategoryCodingTest:NOZCompressionMethodZStandard_DBOOK];
 }
 
+- (void)testZSTD_Multithreaded
+{
+    NSString *sourceFile = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *aesopData = [NSData dataWithContentsOfFile:sourceFile];
+    NSMutableData *largeData = [NSMutableData data];
+    while (largeData.length < 8 * 1024 * 1024) {
+        [largeData appendData:aesopData];
+    }
+
+    id<NOZEncoder> encoder = [NOZXZStandardCompressionCoder encoderWithDictionaryData:nil
+                                                                         workerCount:4
+                                                                             jobSize:1024 * 1024
+                                                                          overlapLog:6
+                                                            minimumMultithreadedSize:aesopData.length + 1];
+    id<NOZDecoder> decoder = [NOZXZStandardCompressionCoder decoder];
+
+    // the large data goes multithreaded, the small data stays below the threshold
+    for (NSData *sourceData in @[largeData, aesopData]) {
+        NSData *compressedData = [sourceData noz_dataByCompressing:encoder compressionLevel:NOZCompressionLevelDefault];
+        XCTAssertNotNil(compressedData);
+        XCTAssertLessThan(compressedData.length, sourceData.length);
+        XCTAssertEqualObjects([compressedData noz_dataByDecompressing:decoder], sourceData);
+    }
+}
+
+- (void)testZSTD_TrainedDictionaryArchive
+{
+    NSMutableArray<NOZDataZipEntry *> *entries = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 2000; i++) {
+        NSString *json = [NSString stringWithFormat:@"{\"id\":%lu,\"user\":{\"screen_name\":\"user_%lu\",\"followers_count\":%lu,\"verified\":%@},\"text\":\"Status number %lu of the timeline\",\"retweet_count\":%lu,\"lang\":\"en\"}", (unsigned long)i, (unsigned long)(i % 37), (unsigned long)(i * 7), (i % 2) ? @"true" : @"false", (unsigned long)i, (unsigned long)(i % 11)];
+        NOZDataZipEntry *entry = [[NOZDataZipEntry alloc] initWithData:[json dataUsingEncoding:NSUTF8StringEncoding] name:[NSString stringWithFormat:@"statuses/%lu.json", (unsigned long)i]];
+        entry.compressionMethod = NOZCompressionMethodZStandard;
+        [entries addObject:entry];
+    }
+
+    NSString *zipDirectory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"zstd_dictionary_test"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:zipDirectory withIntermediateDirectories:YES attributes:nil error:NULL];
+    NSString *plainZipFile = [zipDirectory stringByAppendingPathComponent:@"plain.zip"];
+    NSString *dictionaryZipFile = [zipDirectory stringByAppendingPathComponent:@"dictionary.zip"];
+
+    NSError *error = nil;
+    for (NSString *zipFile in @[plainZipFile, dictionaryZipFile]) {
+        NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFile];
+        XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+        if (zipFile == dictionaryZipFile) {
+            XCTAssertTrue([zipper addDictionaryTrainedFromEntries:entries compressionMethod:NOZCompressionMethodZStandard maximumSize:4 * 1024 error:&error], @"%@", error);
+            // only once per method
+            XCTAssertFalse([zipper addDictionaryTrainedFromEntries:entries compressionMethod:NOZCompressionMethodZStandard maximumSize:4 * 1024 error:NULL]);
+        }
+        for (NOZDataZipEntry *entry in entries) {
+            XCTAssertTrue([zipper addEntry:entry progressBlock:NULL error:&error], @"%@", error);
+        }
+        XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+    }
+
+    const unsigned long long plainSize = [[NSFileManager defaultManager] attributesOfItemAtPath:plainZipFile error:NULL].fileSize;
+    const unsigned long long dictionarySize = [[NSFileManager defaultManager] attributesOfItemAtPath:dictionaryZipFile error:NULL].fileSize;
+    XCTAssertLessThan(dictionarySize, plainSize);
+
+    NOZUnzipper *unzipper = [[NOZUnzipper alloc] initWithZipFile:dictionaryZipFile];
+    XCTAssertTrue([unzipper openAndReturnError:&error], @"%@", error);
+    XCTAssertNotNil([unzipper readCentralDirectoryAndReturnError:&error], @"%@", error);
+    XCTAssertEqual(unzipper.centralDirectory.recordCount, entries.count + 1);
+    XCTAssertTrue([unzipper readRecordAtIndex:0 error:NULL].isCompressionDictionary);
+    for (NSUInteger i = 0; i < entries.count; i++) {
+        NOZCentralDirectoryRecord *record = [unzipper readRecordAtIndex:i + 1 error:&error];
+        XCTAssertFalse(record.isCompressionDictionary);
+        XCTAssertEqualObjects(record.name, entries[i].name);
+        XCTAssertEqualObjects([unzipper readDataFromRecord:record progressBlock:NULL error:&error], entries[i].data, @"%@", error);
+    }
+    XCTAssertTrue([unzipper closeAndReturnError:&error], @"%@", error);
+
+    // an entry that is only named like a dictionary is neither skipped nor used to decompress
+    NSString *impostorZipFile = [zipDirectory stringByAppendingPathComponent:@"impostor.zip"];
+    NSData *impostorData = [@"not a dictionary" dataUsingEncoding:NSUTF8StringEncoding];
+    NOZDataZipEntry *impostorEntry = [[NOZDataZipEntry alloc] initWithData:impostorData name:[NSString stringWithFormat:@"__NOZDICTIONARIES__/%u.dict", (unsigned)NOZCompressionMethodZStandard]];
+    impostorEntry.compressionMethod = NOZCompressionMethodNone;
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:impostorZipFile];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:impostorEntry progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:entries.firstObject progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    unzipper = [[NOZUnzipper alloc] initWithZipFile:impostorZipFile];
+    XCTAssertTrue([unzipper openAndReturnError:&error], @"%@", error);
+    XCTAssertNotNil([unzipper readCentralDirectoryAndReturnError:&error], @"%@", error);
+    NOZCentralDirectoryRecord *impostorRecord = [unzipper readRecordAtIndex:0 error:&error];
+    XCTAssertFalse(impostorRecord.isCompressionDictionary);
+    XCTAssertEqualObjects([unzipper readDataFromRecord:impostorRecord progressBlock:NULL error:&error], impostorData, @"%@", error);
+    XCTAssertEqualObjects([unzipper readDataFromRecord:[unzipper readRecordAtIndex:1 error:&error] progressBlock:NULL error:&error], entries.firstObject.data, @"%@", error);
+    XCTAssertTrue([unzipper closeAndReturnError:&error], @"%@", error);
+
+    [[NSFileManager defaultManager] removeItemAtPath:zipDirectory error:NULL];
+}
+
+- (void)testSingleCallCoding
+{
+    NSString *sourceFile = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *sourceData = [NSData dataWithContentsOfFile:sourceFile];
+    NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+
+    for (NSNumber *methodNumber in @[@(NOZCompressionMethodNone), @(NOZCompressionMethodDeflate), @(NOZCompressionMethodZStandard), @(NOZCompressionMethodZStandard_DBOOK), @(NOZCompressionMethodBrotli)]) {
+        const NOZCompressionMethod method = (NOZCompressionMethod)methodNumber.unsignedIntegerValue;
+        id<NOZEncoder> encoder = [library encoderForMethod:method];
+        id<NOZDecoder> decoder = [library decoderForMethod:method];
+        XCTAssertTrue([encoder respondsToSelector:@selector(encodeBytes:length:toBuffer:capacity:encodedLength:context:)], @"Method=%u", method);
+        XCTAssertTrue([decoder respondsToSelector:@selector(decodeBytes:length:toBuffer:capacity:decodedLength:context:)], @"Method=%u", method);
+        NOZFlushCallback noFlushCallback = ^BOOL(id coder, id coderContext, const Byte *bufferToFlush, size_t length) {
+            return NO;
+        };
+
+        // single call output has to decode as a stream
+        NSMutableData *encodedData = [NSMutableData dataWithLength:[encoder maximumEncodedLengthForLength:sourceData.length]];
+        size_t encodedLength = 0;
+        id<NOZEncoderContext> encoderContext = [encoder createContextWithBitFlags:0 compressionLevel:NOZCompressionLevelDefault flushCallback:noFlushCallback];
+        XCTAssertTrue([encoder encodeBytes:sourceData.bytes length:sourceData.length toBuffer:encodedData.mutableBytes capacity:encodedData.length encodedLength:&encodedLength context:encoderContext], @"Method=%u", method);
+        encodedData.length = encodedLength;
+        if (NOZCompressionMethodDeflate == method) {
+            XCTAssertTrue(encoderContext.encodedDataWasText);
+        }
+
+        // a context that did a single call can be reused for another one
+        if ([encoder respondsToSelector:@selector(reuseContext:withBitFlags:flushCallback:)]) {
+            NSMutableData *reencodedData = [NSMutableData dataWithLength:encodedData.length + 1024];
+            size_t reencodedLength = 0;
+            XCTAssertTrue([encoder reuseContext:encoderContext withBitFlags:0 flushCallback:noFlushCallback], @"Method=%u", method);
+            XCTAssertTrue([encoder encodeBytes:sourceData.bytes length:sourceData.length toBuffer:reencodedData.mutableBytes capacity:reencodedData.length encodedLength:&reencodedLength context:encoderContext], @"Method=%u", method);
+            reencodedData.length = reencodedLength;
+            XCTAssertEqualObjects(reencodedData, encodedData, @"Method=%u", method);
+        }
+
+        __block NSMutableData *streamedData = [NSMutableData data];
+        id<NOZDecoderContext> context = [decoder createContextForDecodingWithBitFlags:0 flushCallback:^BOOL(id coder, id decoderContext, const Byte *bufferToFlush, size_t length) {
+            [streamedData appendBytes:bufferToFlush length:length];
+            return YES;
+        }];
+        XCTAssertTrue([decoder initializeDecoderContext:context]);
+        XCTAssertTrue([decoder decodeBytes:encodedData.bytes length:encodedData.length context:context]);
+        while (!context.hasFinished && [decoder decodeBytes:NULL length:0 context:context]) {
+        }
+        XCTAssertTrue([decoder finalizeDecoderContext:context]);
+        XCTAssertEqualObjects(streamedData, sourceData, @"Method=%u", method);
+
+        // and the single call decoding has to fail rather than overrun a buffer that is too small
+        NSMutableData *decodedData = [NSMutableData dataWithLength:sourceData.length];
+        size_t decodedLength = 0;
+        id<NOZDecoderContext> decoderContext = [decoder createContextForDecodingWithBitFlags:0 flushCallback:noFlushCallback];
+        XCTAssertTrue([decoder decodeBytes:encodedData.bytes length:encodedData.length toBuffer:decodedData.mutableBytes capacity:decodedData.length decodedLength:&decodedLength context:decoderContext], @"Method=%u", method);
+        XCTAssertEqual(decodedLength, sourceData.length);
+        XCTAssertEqualObjects(decodedData, sourceData, @"Method=%u", method);
+        decoderContext = [decoder createContextForDecodingWithBitFlags:0 flushCallback:noFlushCallback];
+        XCTAssertFalse([decoder decodeBytes:encodedData.bytes length:encodedData.length toBuffer:decodedData.mutableBytes capacity:decodedData.length / 2 decodedLength:&decodedLength context:decoderContext], @"Method=%u", method);
+    }
+}
+
+- (void)testCRC32
+{
+    // the accelerated paths fold 16 to 64 bytes at a time, so cover every start alignment and every tail length
+    const size_t maximumLength = 4096;
+    const size_t maximumAlignment = 64;
+    NSMutableData *data = [NSMutableData dataWithLength:maximumLength + maximumAlignment];
+    arc4random_buf(data.mutableBytes, data.length);
+    const Byte *bytes = data.bytes;
+
+    for (size_t alignment = 0; alignment < maximumAlignment; alignment++) {
+        for (size_t length = 0; length <= maximumLength; length++) {
+            const UInt32 expectedCRC = (UInt32)crc32(0, bytes + alignment, (uInt)length);
+            const UInt32 actualCRC = noz_crc32(0, bytes + alignment, length);
+            if (expectedCRC != actualCRC) {
+                XCTFail(@"CRC mismatch for length %zu at alignment %zu: 0x%08x != 0x%08x", length, alignment, actualCRC, expectedCRC);
+                return;
+            }
+        }
+    }
+
+    // continuing from a CRC has to match too
+    for (NSUInteger i = 0; i < 256; i++) {
+        const size_t alignment = arc4random_uniform((UInt32)maximumAlignment);
+        const size_t length = arc4random_uniform((UInt32)maximumLength + 1);
+        const UInt32 startCRC = arc4random();
+        XCTAssertEqual(noz_crc32(startCRC, bytes + alignment, length), (UInt32)crc32(startCRC, bytes + alignment, (uInt)length), @"length %zu at alignment %zu", length, alignment);
+    }
+
+    XCTAssertEqual(noz_crc32(0, NULL, 0), (UInt32)crc32(0, NULL, 0));
+}
+
+- (void)testCRC32Combine
+{
+    const size_t maximumLength = 256 * 1024;
+    NSMutableData *data = [NSMutableData dataWithLength:maximumLength];
+    arc4random_buf(data.mutableBytes, data.length);
+    const Byte *bytes = data.bytes;
+
+    for (NSUInteger i = 0; i < 512; i++) {
+        const size_t length = arc4random_uniform((UInt32)maximumLength + 1);
+        const size_t split = arc4random_uniform((UInt32)length + 1);
+        const UInt32 crc1 = (UInt32)crc32(0, bytes, (uInt)split);
+        const UInt32 crc2 = (UInt32)crc32(0, bytes + split, (uInt)(length - split));
+
+        const UInt32 combinedCRC = noz_crc32_combine(crc1, crc2, (UInt64)(length - split));
+        XCTAssertEqual(combinedCRC, (UInt32)crc32_combine(crc1, crc2, (z_off_t)(length - split)), @"split %zu of %zu", split, length);
+        XCTAssertEqual(combinedCRC, (UInt32)crc32(0, bytes, (uInt)length), @"split %zu of %zu", split, length);
+    }
+}
+
+- (void)testCompressionPolicy
+{
+    NSString *sourceFile = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *textData = [NSData dataWithContentsOfFile:sourceFile];
+    NSMutableData *randomData = [NSMutableData dataWithLength:64 * 1024];
+    arc4random_buf(randomData.mutableBytes, randomData.length);
+
+    NSArray<NOZCompressionPolicyCandidate *> *candidates = @[
+                                                             [[NOZCompressionPolicyCandidate alloc] initWithCompressionMethod:NOZCompressionMethodDeflate compressionLevel:NOZCompressionLevelMin],
+                                                             [[NOZCompressionPolicyCandidate alloc] initWithCompressionMethod:NOZCompressionMethodZStandard compressionLevel:ZSTD_LEVEL(19)],
+                                                             [[NOZCompressionPolicyCandidate alloc] initWithCompressionMethod:NOZCompressionMethodBrotli compressionLevel:BROTLI_LEVEL(11)],
+                                                             ];
+    NOZCompressionPolicy *policy = [[NOZCompressionPolicy alloc] initWithTarget:NOZCompressionPolicyTargetMaximumRatio candidates:candidates];
+
+    // the fastest deflate level never wins on ratio against the strongest zstd and brotli levels
+    NOZDataZipEntry *textEntry = [[NOZDataZipEntry alloc] initWithData:textData name:@"Aesop.txt"];
+    [policy applyToEntry:textEntry];
+    XCTAssertNotEqual(textEntry.compressionMethod, NOZCompressionMethodNone);
+    XCTAssertNotEqual(textEntry.compressionMethod, NOZCompressionMethodDeflate);
+    const NOZCompressionMethod textMethod = textEntry.compressionMethod;
+    const NOZCompressionLevel textLevel = textEntry.compressionLevel;
+
+    // nothing compresses random bytes, so they are stored
+    NOZDataZipEntry *randomEntry = [[NOZDataZipEntry alloc] initWithData:randomData name:@"random.bin"];
+    [policy applyToEntry:randomEntry];
+    XCTAssertEqual(randomEntry.compressionMethod, NOZCompressionMethodNone);
+
+    // decisions are cached per extension
+    NOZDataZipEntry *cachedEntry = [[NOZDataZipEntry alloc] initWithData:randomData name:@"Fables.TXT"];
+    [policy applyToEntry:cachedEntry];
+    XCTAssertEqual(cachedEntry.compressionMethod, textMethod);
+    XCTAssertEqual(cachedEntry.compressionLevel, textLevel);
+
+    // without an extension, the content class is sniffed from the sample
+    NOZDataZipEntry *extensionlessEntry = [[NOZDataZipEntry alloc] initWithData:randomData name:@"random"];
+    [policy applyToEntry:extensionlessEntry];
+    XCTAssertEqual(extensionlessEntry.compressionMethod, NOZCompressionMethodNone);
+
+    [policy resetCachedDecisions];
+    [policy applyToEntry:cachedEntry];
+    XCTAssertEqual(cachedEntry.compressionMethod, NOZCompressionMethodNone);
+
+    // the selection block works from file paths
+    NOZCompressionMethod method = NOZCompressionMethodDeflate;
+    NOZCompressionLevel level = NOZCompressionLevelDefault;
+    policy.compressionSelectionBlock(sourceFile, &method, &level);
+    XCTAssertEqual(method, textMethod);
+    XCTAssertEqual(level, textLevel);
+}
+
 - (void)testBrotli
 {
     [self runCodingWithMethod:NOZCompressionMethodBrotli];
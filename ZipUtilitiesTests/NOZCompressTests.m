@@ -38,6 +38,19 @@ static NSOperationQueue *sQueue = nil;
 - (nonnull NSMutableArray<id<NOZZippableEntry>> *)mutableEntries;
 @end
 
+@interface NOZOversizedDataZipEntry : NOZDataZipEntry
+@end
+
+@implementation NOZOversizedDataZipEntry
+
+- (SInt64)sizeInBytes
+{
+    // Claim to be big enough to need Zip64 records
+    return (SInt64)UINT32_MAX + 1;
+}
+
+@end
+
 @interface NOZCompressTests : XCTestCase <NOZCompressDelegate>
 @end
 
@@ -247,6 +260,36 @@ static NSOperationQueue *sQueue = nil;
     [self runAllCompressionMethodsWithRequest:request];
 }
 
+- (NOZCentralDirectory *)assertZipAtPath:(NSString *)zipFilePath containsDatas:(NSArray<NSData *> *)datas names:(NSArray<NSString *> *)names
+{
+    return [self assertZipAtPath:zipFilePath containsDatas:datas names:names recordBlock:NULL];
+}
+
+- (NOZCentralDirectory *)assertZipAtPath:(NSString *)zipFilePath containsDatas:(NSArray<NSData *> *)datas names:(NSArray<NSString *> *)names recordBlock:(void (^)(NOZCentralDirectoryRecord *record, NSUInteger index))recordBlock
+{
+    NSError *error = nil;
+    NOZUnzipper *unzipper = [[NOZUnzipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([unzipper openAndReturnError:&error], @"%@", error);
+    NOZCentralDirectory *centralDirectory = [unzipper readCentralDirectoryAndReturnError:&error];
+    XCTAssertNotNil(centralDirectory, @"%@", error);
+    XCTAssertEqual(centralDirectory.recordCount, datas.count);
+    for (NSUInteger i = 0; i < datas.count; i++) {
+        NOZCentralDirectoryRecord *record = [unzipper readRecordAtIndex:i error:&error];
+        XCTAssertNotNil(record, @"%@", error);
+        if (names) {
+            XCTAssertEqualObjects(record.name, names[i]);
+        }
+        // an empty record has no byte ranges, so it reads back as nil
+        NSData *unzippedData = [unzipper readDataFromRecord:record progressBlock:NULL error:&error];
+        XCTAssertEqualObjects(unzippedData ?: [NSData data], datas[i], @"%@", error);
+        if (recordBlock) {
+            recordBlock(record, i);
+        }
+    }
+    XCTAssertTrue([unzipper closeAndReturnError:&error], @"%@", error);
+    return centralDirectory;
+}
+
 - (void)testCompressSingleFile
 {
     NSString *sourceFilePath = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
@@ -299,6 +342,637 @@ static NSOperationQueue *sQueue = nil;
     [self runGambitWithRequest:request expectedOutputZipName:nil];
 }
 
+- (void)testCompressionDirectoryConcurrently
+{
+    NSString *sourceDirectoryPath = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    sourceDirectoryPath = [[sourceDirectoryPath stringByDeletingLastPathComponent] stringByAppendingPathComponent:@"maniac-mansion"];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"maniac-mansion.zip"];
+
+    NOZCompressRequest *request = [[NOZCompressRequest alloc] initWithDestinationPath:zipFilePath];
+    [request addEntriesInDirectory:sourceDirectoryPath filterBlock:^BOOL(NSString *filePath) {
+        return [filePath.lastPathComponent hasPrefix:@"."];
+    } compressionSelectionBlock:NULL];
+    [[self class] forceCompressionLevel:NOZCompressionLevelMax forAllEntriesOnRequest:request];
+
+    [self runValidCompressRequest:request withQueue:sQueue];
+    NSData *serialData = [NSData dataWithContentsOfFile:zipFilePath];
+    [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+    XCTAssertNotNil(serialData);
+
+    request.maxConcurrentEntryCompressions = 4;
+    [self runValidCompressRequest:request withQueue:sQueue];
+    NSData *concurrentData = [NSData dataWithContentsOfFile:zipFilePath];
+    [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+    XCTAssertEqualObjects(serialData, concurrentData);
+
+    // force every entry to be buffered to a temporary file
+    request.maxConcurrentCompressionMemory = 1;
+    [self runValidCompressRequest:request withQueue:sQueue];
+    concurrentData = [NSData dataWithContentsOfFile:zipFilePath];
+    [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+    XCTAssertEqualObjects(serialData, concurrentData);
+
+    [self runCompressRequest:request cancelling:NO];
+}
+
+- (void)testCompressionZip64LocalRecords
+{
+    NSData *data = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"]];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSError *error = nil;
+
+    NOZOversizedDataZipEntry *entry = [[NOZOversizedDataZipEntry alloc] initWithData:data name:@"Aesop.txt"];
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:entry progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    [self assertZipAtPath:zipFilePath containsDatas:@[ data ] names:@[ @"Aesop.txt" ] recordBlock:^(NOZCentralDirectoryRecord *record, NSUInteger index) {
+        XCTAssertEqual(record.uncompressedSize, (SInt64)data.length);
+    }];
+}
+
+- (void)testCompressionWithoutDataDescriptors
+{
+    NSData *data = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"]];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSError *error = nil;
+    unsigned long long fileSizes[2] = { 0, 0 };
+
+    for (NSUInteger i = 0; i < 2; i++) {
+        const BOOL usesDataDescriptors = (0 == i);
+        NOZDataZipEntry *entry = [[NOZDataZipEntry alloc] initWithData:data name:@"Aesop.txt"];
+        NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+        zipper.usesDataDescriptors = usesDataDescriptors;
+        XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+        XCTAssertTrue([zipper addEntry:entry progressBlock:NULL error:&error], @"%@", error);
+        XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+        fileSizes[i] = [[[NSFileManager defaultManager] attributesOfItemAtPath:zipFilePath error:NULL] fileSize];
+
+        [self assertZipAtPath:zipFilePath containsDatas:@[ data ] names:@[ @"Aesop.txt" ]];
+        [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+    }
+
+    // no 16 byte data descriptor
+    XCTAssertEqual(fileSizes[0] - 16, fileSizes[1]);
+}
+
+- (void)testCompressionAppendingToExistingArchive
+{
+    NSData *data = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"]];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSArray<NSString *> *names = @[ @"Aesop.txt", @"Aesop-2.txt", @"Aesop-3.txt" ];
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertFalse([zipper openWithMode:NOZZipperModeOpenExisting error:&error]);
+    XCTAssertEqual(error.code, NOZErrorCodeZipCannotOpenExistingZip);
+    error = nil;
+
+    for (NSUInteger i = 0; i < names.count; i++) {
+        zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+        zipper.globalComment = (0 == i) ? @"Fables" : nil;
+        XCTAssertTrue([zipper openWithMode:NOZZipperModeOpenExistingOrCreate error:&error], @"%@", error);
+        NOZDataZipEntry *entry = [[NOZDataZipEntry alloc] initWithData:data name:names[i]];
+        entry.comment = names[i];
+        XCTAssertTrue([zipper addEntry:entry progressBlock:NULL error:&error], @"%@", error);
+        XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+    }
+
+    NOZCentralDirectory *centralDirectory = [self assertZipAtPath:zipFilePath containsDatas:@[ data, data, data ] names:names recordBlock:^(NOZCentralDirectoryRecord *record, NSUInteger index) {
+        XCTAssertEqualObjects(record.comment, names[index]);
+    }];
+    XCTAssertEqualObjects(centralDirectory.globalComment, @"Fables");
+}
+
+- (void)testCompressionCopyingRecordsFromAnotherArchive
+{
+    NSData *data = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"]];
+    NSString *sourceZipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Mixed.zip"];
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:sourceZipFilePath];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    NOZDataZipEntry *entry = [[NOZDataZipEntry alloc] initWithData:data name:@"Aesop.txt"];
+    entry.comment = @"Fables";
+    XCTAssertTrue([zipper addEntry:entry progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    NOZUnzipper *sourceUnzipper = [[NOZUnzipper alloc] initWithZipFile:sourceZipFilePath];
+    XCTAssertTrue([sourceUnzipper openAndReturnError:&error], @"%@", error);
+    XCTAssertNotNil([sourceUnzipper readCentralDirectoryAndReturnError:&error], @"%@", error);
+    NOZCentralDirectoryRecord *sourceRecord = [sourceUnzipper readRecordAtIndex:0 error:&error];
+
+    zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    XCTAssertTrue([zipper addRecord:sourceRecord fromUnzipper:sourceUnzipper progressBlock:NULL error:&error], @"%@", error);
+    entry = [[NOZDataZipEntry alloc] initWithData:data name:@"Aesop-2.txt"];
+    XCTAssertTrue([zipper addEntry:entry progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+    XCTAssertTrue([sourceUnzipper closeAndReturnError:&error], @"%@", error);
+
+    [self assertZipAtPath:zipFilePath containsDatas:@[ data, data ] names:@[ @"Aesop.txt", @"Aesop-2.txt" ] recordBlock:^(NOZCentralDirectoryRecord *record, NSUInteger index) {
+        if (0 == index) {
+            XCTAssertEqualObjects(record.comment, sourceRecord.comment);
+            XCTAssertEqual(record.compressedSize, sourceRecord.compressedSize);
+            XCTAssertEqual(record.uncompressedSize, sourceRecord.uncompressedSize);
+        }
+    }];
+}
+
+- (void)testCompressionDetectingIncompressibleEntries
+{
+    NSData *textData = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"]];
+    NSMutableData *randomData = [NSMutableData dataWithLength:3 * 1024 * 1024];
+    arc4random_buf(randomData.mutableBytes, randomData.length);
+    NSMutableData *mixedData = [NSMutableData data];
+    while (mixedData.length < 64 * 1024) {
+        [mixedData appendData:textData];
+    }
+    mixedData.length = 64 * 1024;
+    [mixedData appendData:randomData];
+
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Mixed.zip"];
+    NSArray<NSData *> *datas = @[ textData, randomData, mixedData ];
+    NSArray<NSNumber *> *expectedMethods = @[ @(NOZCompressionMethodDeflate), @(NOZCompressionMethodNone), @(NOZCompressionMethodNone) ];
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    zipper.detectsIncompressibleEntries = YES;
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    for (NSUInteger i = 0; i < datas.count; i++) {
+        NOZDataZipEntry *entry = [[NOZDataZipEntry alloc] initWithData:datas[i] name:[NSString stringWithFormat:@"%tu.bin", i]];
+        XCTAssertTrue([zipper addEntry:entry progressBlock:NULL error:&error], @"%@", error);
+    }
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    [self assertZipAtPath:zipFilePath containsDatas:datas names:nil recordBlock:^(NOZCentralDirectoryRecord *record, NSUInteger index) {
+        XCTAssertEqual(record.compressionMethod, (NOZCompressionMethod)expectedMethods[index].integerValue);
+    }];
+}
+
+- (void)testCompressionDeduplicatingEntries
+{
+    NSString *textFilePath = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *textData = [NSData dataWithContentsOfFile:textFilePath];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSArray<NSString *> *names = @[ @"Aesop.txt", @"Copy of Aesop.txt", @"Data of Aesop.txt" ];
+    NSError *error = nil;
+
+    unsigned long long archiveSizes[3] = { 0 };
+    const NOZZipperDeduplicationMode modes[3] = { NOZZipperDeduplicationModeNone, NOZZipperDeduplicationModeCopyCompressedData, NOZZipperDeduplicationModeShareCompressedData };
+    for (NSUInteger modeIndex = 0; modeIndex < 3; modeIndex++) {
+        NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+        zipper.deduplicationMode = modes[modeIndex];
+        XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+        XCTAssertTrue([zipper addEntry:[[NOZFileZipEntry alloc] initWithFilePath:textFilePath name:names[0]] progressBlock:NULL error:&error], @"%@", error);
+        XCTAssertTrue([zipper addEntry:[[NOZFileZipEntry alloc] initWithFilePath:textFilePath name:names[1]] progressBlock:NULL error:&error], @"%@", error);
+        XCTAssertTrue([zipper addEntry:[[NOZDataZipEntry alloc] initWithData:textData name:names[2]] progressBlock:NULL error:&error], @"%@", error);
+        XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+        archiveSizes[modeIndex] = [[[NSFileManager defaultManager] attributesOfItemAtPath:zipFilePath error:NULL] fileSize];
+
+        [self assertZipAtPath:zipFilePath containsDatas:@[ textData, textData, textData ] names:names];
+        [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+    }
+
+    // copies skip compression but still take the space, shared data is only written once
+    XCTAssertLessThanOrEqual(archiveSizes[1], archiveSizes[0]);
+    XCTAssertLessThan(archiveSizes[2], archiveSizes[1]);
+}
+
+- (void)testCompressionToOutputStream
+{
+    NSString *textFilePath = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *textData = [NSData dataWithContentsOfFile:textFilePath];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithOutputStream:[NSOutputStream outputStreamToFileAtPath:zipFilePath append:NO]];
+    zipper.usesDataDescriptors = NO; // can't be honored without seeking
+    XCTAssertNil(zipper.zipFilePath);
+    XCTAssertFalse([zipper openWithMode:NOZZipperModeOpenExisting error:NULL]);
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:[[NOZFileZipEntry alloc] initWithFilePath:textFilePath] progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:[[NOZDataZipEntry alloc] initWithData:textData name:@"Aesop Data.txt"] progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    [self assertZipAtPath:zipFilePath containsDatas:@[ textData, textData ] names:@[ @"Aesop.txt", @"Aesop Data.txt" ]];
+}
+
+- (void)testCompressionToWriteOnlyFileDescriptor
+{
+    NSString *textFilePath = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *textData = [NSData dataWithContentsOfFile:textFilePath];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSError *error = nil;
+
+    // can't be read back, so the duplicate is compressed instead of copied
+    const int fd = open(zipFilePath.UTF8String, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    XCTAssertGreaterThanOrEqual(fd, 0);
+    NOZZipper *zipper = [[NOZZipper alloc] initWithFileDescriptor:fd];
+    zipper.deduplicationMode = NOZZipperDeduplicationModeCopyCompressedData;
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:[[NOZFileZipEntry alloc] initWithFilePath:textFilePath] progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:[[NOZDataZipEntry alloc] initWithData:textData name:@"Aesop Data.txt"] progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+    close(fd);
+
+    [self assertZipAtPath:zipFilePath containsDatas:@[ textData, textData ] names:@[ @"Aesop.txt", @"Aesop Data.txt" ]];
+    [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+}
+
+- (void)testCompressionToMemory
+{
+    NSString *textFilePath = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *textData = [NSData dataWithContentsOfFile:textFilePath];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initForZippingToMemory];
+    zipper.usesDataDescriptors = NO;
+    zipper.deduplicationMode = NOZZipperDeduplicationModeCopyCompressedData;
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:[[NOZFileZipEntry alloc] initWithFilePath:textFilePath] progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:[[NOZDataZipEntry alloc] initWithData:textData name:@"Aesop Data.txt"] progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertNil(zipper.zippedData);
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+    XCTAssertNotNil(zipper.zippedData);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:zipFilePath]);
+
+    XCTAssertTrue([zipper.zippedData writeToFile:zipFilePath options:NSDataWritingAtomic error:&error], @"%@", error);
+    [self assertZipAtPath:zipFilePath containsDatas:@[ textData, textData ] names:@[ @"Aesop.txt", @"Aesop Data.txt" ]];
+}
+
+- (void)testCompressionPipelined
+{
+    NSString *textFilePath = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *textData = [NSData dataWithContentsOfFile:textFilePath];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSError *error = nil;
+
+    for (NSNumber *usesDataDescriptors in @[@YES, @NO]) {
+        NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+        zipper.pipelinesEntries = YES;
+        zipper.usesDataDescriptors = usesDataDescriptors.boolValue;
+        XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+        XCTAssertTrue([zipper addEntry:[[NOZFileZipEntry alloc] initWithFilePath:textFilePath] progressBlock:NULL error:&error], @"%@", error);
+        XCTAssertTrue([zipper addEntry:[[NOZDataZipEntry alloc] initWithData:textData name:@"Aesop Data.txt"] progressBlock:NULL error:&error], @"%@", error);
+        XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+        [self assertZipAtPath:zipFilePath containsDatas:@[ textData, textData ] names:@[ @"Aesop.txt", @"Aesop Data.txt" ]];
+        [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+    }
+}
+
+- (void)testCompressionFromContiguousData
+{
+    NSString *textFilePath = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *textData = [NSData dataWithContentsOfFile:textFilePath];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NSString *emptyFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Empty.txt"];
+    XCTAssertTrue([[NSData data] writeToFile:emptyFilePath atomically:YES]);
+    NSError *error = nil;
+
+    NOZFileZipEntry *fileEntry = [[NOZFileZipEntry alloc] initWithFilePath:textFilePath];
+    XCTAssertEqualObjects([fileEntry contiguousData], textData);
+    NOZFileZipEntry *emptyFileEntry = [[NOZFileZipEntry alloc] initWithFilePath:emptyFilePath];
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:fileEntry progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper addEntry:emptyFileEntry progressBlock:NULL error:&error], @"%@", error);
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+    [[NSFileManager defaultManager] removeItemAtPath:emptyFilePath error:NULL];
+
+    [self assertZipAtPath:zipFilePath containsDatas:@[ textData, [NSData data] ] names:@[ @"Aesop.txt", @"Empty.txt" ]];
+}
+
+- (void)testCompressionReusingCodecContexts
+{
+    NSString *textFilePath = [[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"];
+    NSData *textData = [NSData dataWithContentsOfFile:textFilePath];
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];
+    NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+    const NSUInteger entryCount = 4;
+    NSError *error = nil;
+
+    const UInt64 encoderHitCount = library.encoderContextPoolHitCount;
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        NSString *name = [NSString stringWithFormat:@"Aesop %tu.txt", i];
+        XCTAssertTrue([zipper addEntry:[[NOZDataZipEntry alloc] initWithData:textData name:name] progressBlock:NULL error:&error], @"%@", error);
+    }
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+    XCTAssertGreaterThanOrEqual(library.encoderContextPoolHitCount - encoderHitCount, (UInt64)(entryCount - 1));
+
+    const UInt64 decoderHitCount = library.decoderContextPoolHitCount;
+    [self assertZipAtPath:zipFilePath containsDatas:@[ textData, textData, textData, textData ] names:nil];
+    XCTAssertGreaterThanOrEqual(library.decoderContextPoolHitCount - decoderHitCount, (UInt64)(entryCount - 1));
+
+    [library purgeContextPools];
+}
+
+- (void)testCompressionDroppingContextsOfReplacedCoders
+{
+    NOZCompressionLibrary *library = [NOZCompressionLibrary sharedInstance];
+    id<NOZEncoder> originalEncoder = [library encoderForMethod:NOZCompressionMethodDeflate];
+    id<NOZEncoder> encoder = [[[(NSObject *)originalEncoder class] alloc] init];
+    NOZFlushCallback noFlushCallback = ^BOOL(id coder, id coderContext, const Byte *bufferToFlush, size_t length) {
+        return NO;
+    };
+    NSData *sourceData = [@"To be, or not to be, that is the question" dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *encodedData = [NSMutableData dataWithLength:[encoder maximumEncodedLengthForLength:sourceData.length]];
+    size_t encodedLength = 0;
+
+    [library setEncoder:encoder forMethod:NOZCompressionMethodDeflate];
+    id<NOZEncoderContext> context = [library createContextForEncoder:encoder bitFlags:0 compressionLevel:NOZCompressionLevelDefault flushCallback:noFlushCallback];
+    XCTAssertTrue([encoder encodeBytes:sourceData.bytes length:sourceData.length toBuffer:encodedData.mutableBytes capacity:encodedData.length encodedLength:&encodedLength context:context]);
+    [library recycleContext:context forEncoder:encoder compressionLevel:NOZCompressionLevelDefault];
+
+    // replacing the encoder drops its pool, so its next context is a new one
+    [library setEncoder:originalEncoder forMethod:NOZCompressionMethodDeflate];
+    XCTAssertEqual([library encoderForMethod:NOZCompressionMethodDeflate], originalEncoder);
+    const UInt64 encoderMissCount = library.encoderContextPoolMissCount;
+    context = [library createContextForEncoder:encoder bitFlags:0 compressionLevel:NOZCompressionLevelDefault flushCallback:noFlushCallback];
+    XCTAssertNotNil(context);
+    XCTAssertEqual(library.encoderContextPoolMissCount - encoderMissCount, (UInt64)1);
+}
+
+- (void)testDecompressionFromMemoryMappedArchive
+{
+    NSData *textData = [NSData dataWithContentsOfFile:[[NSBundle bundleForClass:[self class]] pathForResource:@"Aesop" ofType:@"txt"]];
+    NSMutableData *largeData = [NSMutableData data];
+    while (largeData.length < 3 * 1024 * 1024) {
+        [largeData appendData:textData];
+    }
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Mapped.zip"];
+    NSArray<NSData *> *datas = @[ textData, textData, largeData, largeData ];
+    NSArray<NSNumber *> *methods = @[ @(NOZCompressionMethodNone), @(NOZCompressionMethodDeflate), @(NOZCompressionMethodNone), @(NOZCompressionMethodDeflate) ];
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    for (NSUInteger i = 0; i < datas.count; i++) {
+        NOZDataZipEntry *entry = [[NOZDataZipEntry alloc] initWithData:datas[i] name:[NSString stringWithFormat:@"%tu.txt", i]];
+        entry.compressionMethod = (NOZCompressionMethod)methods[i].integerValue;
+        XCTAssertTrue([zipper addEntry:entry progressBlock:NULL error:&error], @"%@", error);
+    }
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    NOZUnzipper *unzipper = [[NOZUnzipper alloc] initWithZipFile:zipFilePath];
+    unzipper.memoryMapsArchive = YES;
+    XCTAssertTrue([unzipper openAndReturnError:&error], @"%@", error);
+    XCTAssertNotNil([unzipper readCentralDirectoryAndReturnError:&error], @"%@", error);
+    XCTAssertEqual(unzipper.centralDirectory.recordCount, datas.count);
+    for (NSUInteger i = 0; i < datas.count; i++) {
+        NOZCentralDirectoryRecord *record = [unzipper readRecordAtIndex:i error:&error];
+        XCTAssertEqual(record.compressionMethod, (NOZCompressionMethod)methods[i].integerValue);
+
+        // ranges arrive in order, whether they point into the mapping or at decoded bytes
+        __block NSUInteger nextLocation = 0;
+        NSMutableData *unzippedData = [NSMutableData data];
+        XCTAssertTrue([unzipper enumerateByteRangesOfRecord:record
+                                              progressBlock:NULL
+                                                 usingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+                                                     XCTAssertEqual(byteRange.location, nextLocation);
+                                                     nextLocation = NSMaxRange(byteRange);
+                                                     [unzippedData appendBytes:bytes length:byteRange.length];
+                                                 }
+                                                      error:&error], @"%@", error);
+        XCTAssertEqualObjects(unzippedData, datas[i]);
+    }
+    XCTAssertTrue([unzipper closeAndReturnError:&error], @"%@", error);
+    [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+}
+
+- (void)testDecompressionCentralDirectoryWithManyRecords
+{
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"ManyRecords.zip"];
+    const NSUInteger recordCount = 5000;
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    zipper.globalComment = @"Many records";
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    for (NSUInteger i = 0; i < recordCount; i++) {
+        NSData *data = [[NSString stringWithFormat:@"Record #%tu", i] dataUsingEncoding:NSUTF8StringEncoding];
+        NOZDataZipEntry *entry = [[NOZDataZipEntry alloc] initWithData:data name:[NSString stringWithFormat:@"records/%tu.txt", i]];
+        entry.comment = (i % 2) ? [NSString stringWithFormat:@"Comment #%tu", i] : nil;
+        XCTAssertTrue([zipper addEntry:entry progressBlock:NULL error:&error], @"%@", error);
+    }
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    // the central directory is parsed from one read, or straight from the mapping
+    for (NSNumber *memoryMapsArchive in @[ @NO, @YES ]) {
+        NOZUnzipper *unzipper = [[NOZUnzipper alloc] initWithZipFile:zipFilePath];
+        unzipper.memoryMapsArchive = memoryMapsArchive.boolValue;
+        XCTAssertTrue([unzipper openAndReturnError:&error], @"%@", error);
+        NOZCentralDirectory *centralDirectory = [unzipper readCentralDirectoryAndReturnError:&error];
+        XCTAssertNotNil(centralDirectory, @"%@", error);
+        XCTAssertEqual(centralDirectory.recordCount, recordCount);
+        XCTAssertEqualObjects(centralDirectory.globalComment, @"Many records");
+        for (NSUInteger i = 0; i < recordCount; i += 499) {
+            NOZCentralDirectoryRecord *record = [unzipper readRecordAtIndex:i error:&error];
+            XCTAssertEqualObjects(record.name, ([NSString stringWithFormat:@"records/%tu.txt", i]));
+            XCTAssertEqualObjects(record.comment, ((i % 2) ? [NSString stringWithFormat:@"Comment #%tu", i] : nil));
+            NSData *data = [unzipper readDataFromRecord:record progressBlock:NULL error:&error];
+            XCTAssertEqualObjects([[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding], ([NSString stringWithFormat:@"Record #%tu", i]), @"%@", error);
+        }
+        XCTAssertEqual([unzipper indexForRecordWithName:@"records/4999.txt"], recordCount - 1);
+        XCTAssertEqual([unzipper indexForRecordWithName:@"records/5000.txt"], (NSUInteger)NSNotFound);
+
+        // records are created on demand and stay valid after the unzipper is closed
+        NOZCentralDirectoryRecord *lastRecord = [unzipper readRecordAtIndex:recordCount - 1 error:&error];
+        XCTAssertEqual([lastRecord copy], lastRecord);
+        NOZCentralDirectoryRecord *refetchedRecord = [unzipper readRecordAtIndex:recordCount - 1 error:&error];
+        XCTAssertEqualObjects(refetchedRecord, lastRecord);
+        XCTAssertEqual(refetchedRecord.hash, lastRecord.hash);
+        XCTAssertTrue([[NSSet setWithObject:lastRecord] containsObject:refetchedRecord]);
+        XCTAssertNotEqualObjects([unzipper readRecordAtIndex:0 error:&error], lastRecord);
+        XCTAssertTrue([unzipper closeAndReturnError:&error], @"%@", error);
+        XCTAssertEqualObjects(lastRecord.name, @"records/4999.txt");
+        XCTAssertEqualObjects(lastRecord.comment, @"Comment #4999");
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+}
+
+- (void)testDecompressionLookingUpRecordsByName
+{
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Lookup.zip"];
+    NSArray<NSString *> *names = @[ @"a.txt", @"dir/a.txt", @"dir/b.txt", @"dir/sub/c.txt", @"Ünïcödé.txt", @"a.txt" ];
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    for (NSString *name in names) {
+        NSData *data = [name dataUsingEncoding:NSUTF8StringEncoding];
+        XCTAssertTrue([zipper addEntry:[[NOZDataZipEntry alloc] initWithData:data name:name] progressBlock:NULL error:&error], @"%@", error);
+    }
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    for (NSNumber *indexesEagerly in @[ @NO, @YES ]) {
+        NOZUnzipper *unzipper = [[NOZUnzipper alloc] initWithZipFile:zipFilePath];
+        unzipper.indexesRecordNamesEagerly = indexesEagerly.boolValue;
+        XCTAssertTrue([unzipper openAndReturnError:&error], @"%@", error);
+        XCTAssertNotNil([unzipper readCentralDirectoryAndReturnError:&error], @"%@", error);
+
+        // duplicate names find the first record
+        XCTAssertEqual([unzipper indexForRecordWithName:@"a.txt"], (NSUInteger)0);
+        XCTAssertEqual([unzipper indexForRecordWithName:@"dir/sub/c.txt"], (NSUInteger)3);
+        XCTAssertEqual([unzipper indexForRecordWithName:@"Ünïcödé.txt"], (NSUInteger)4);
+        XCTAssertEqual([unzipper indexForRecordWithName:@"dir"], (NSUInteger)NSNotFound);
+        XCTAssertEqual([unzipper indexForRecordWithName:@""], (NSUInteger)NSNotFound);
+
+        XCTAssertEqual([unzipper indexForRecordWithUTF8Name:"dir/b.txt"], (NSUInteger)2);
+        XCTAssertEqual([unzipper indexForRecordWithUTF8Name:"dir/c.txt"], (NSUInteger)NSNotFound);
+        const char *span = "dir/a.txt/and/more";
+        XCTAssertEqual([unzipper indexForRecordWithNameBytes:span length:9], (NSUInteger)1);
+        XCTAssertEqual([unzipper indexForRecordWithNameBytes:span length:8], (NSUInteger)NSNotFound);
+
+        XCTAssertTrue([unzipper closeAndReturnError:&error], @"%@", error);
+        XCTAssertEqual([unzipper indexForRecordWithUTF8Name:"a.txt"], (NSUInteger)NSNotFound);
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+}
+
+- (void)testDecompressionQueryingRecordsByNamePrefix
+{
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Tree.zip"];
+    NSArray<NSString *> *names = @[ @"a.txt", @"a.txt.bak", @"b/x.png", @"b/y.txt", @"b/c/z.txt", @"b/c/d/w.txt", @"e/f/g.txt", @"h.txt" ];
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    for (NSString *name in names) {
+        NSData *data = [name dataUsingEncoding:NSUTF8StringEncoding];
+        XCTAssertTrue([zipper addEntry:[[NOZDataZipEntry alloc] initWithData:data name:name] progressBlock:NULL error:&error], @"%@", error);
+    }
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    for (NSNumber *indexesEagerly in @[ @NO, @YES ]) {
+        NOZUnzipper *unzipper = [[NOZUnzipper alloc] initWithZipFile:zipFilePath];
+        unzipper.indexesRecordNamesEagerly = indexesEagerly.boolValue;
+        XCTAssertTrue([unzipper openAndReturnError:&error], @"%@", error);
+        XCTAssertNotNil([unzipper readCentralDirectoryAndReturnError:&error], @"%@", error);
+
+        NSArray<NSNumber *> *(^indexesWithPrefix)(NSString *) = ^(NSString *prefix) {
+            NSMutableArray<NSNumber *> *indexes = [NSMutableArray array];
+            [unzipper enumerateRecordsWithNamePrefix:prefix usingBlock:^(NOZCentralDirectoryRecord *record, NSUInteger index, BOOL *stop) {
+                XCTAssertTrue([record.name hasPrefix:prefix]);
+                [indexes addObject:@(index)];
+            }];
+            return indexes;
+        };
+        NSArray<NSNumber *> *(^indexesMatchingGlob)(NSString *) = ^(NSString *pattern) {
+            NSMutableArray<NSNumber *> *indexes = [NSMutableArray array];
+            [unzipper enumerateRecordsMatchingGlob:pattern usingBlock:^(NOZCentralDirectoryRecord *record, NSUInteger index, BOOL *stop) {
+                [indexes addObject:@(index)];
+            }];
+            return indexes;
+        };
+
+        XCTAssertEqualObjects(indexesWithPrefix(@"b/c/"), (@[ @5, @4 ]));
+        XCTAssertEqualObjects(indexesWithPrefix(@"a.txt"), (@[ @0, @1 ]));
+        XCTAssertEqualObjects(indexesWithPrefix(@""), (@[ @0, @1, @5, @4, @2, @3, @6, @7 ]));
+        XCTAssertEqualObjects(indexesWithPrefix(@"zz"), (@[]));
+
+        __block NSUInteger visitCount = 0;
+        [unzipper enumerateRecordsWithNamePrefix:@"" usingBlock:^(NOZCentralDirectoryRecord *record, NSUInteger index, BOOL *stop) {
+            *stop = (++visitCount == 2);
+        }];
+        XCTAssertEqual(visitCount, (NSUInteger)2);
+
+        XCTAssertEqualObjects([unzipper namesOfItemsInDirectory:@""], (@[ @"a.txt", @"a.txt.bak", @"b/", @"e/", @"h.txt" ]));
+        XCTAssertEqualObjects([unzipper namesOfItemsInDirectory:@"b"], (@[ @"b/c/", @"b/x.png", @"b/y.txt" ]));
+        XCTAssertEqualObjects([unzipper namesOfItemsInDirectory:@"b/c/"], (@[ @"b/c/d/", @"b/c/z.txt" ]));
+        XCTAssertEqualObjects([unzipper namesOfItemsInDirectory:@"e"], (@[ @"e/f/" ]));
+        XCTAssertEqualObjects([unzipper namesOfItemsInDirectory:@"x"], (@[]));
+
+        XCTAssertEqualObjects(indexesMatchingGlob(@"*.txt"), (@[ @0, @7 ]));
+        XCTAssertEqualObjects(indexesMatchingGlob(@"**.txt"), (@[ @0, @5, @4, @3, @6, @7 ]));
+        XCTAssertEqualObjects(indexesMatchingGlob(@"b/**/*.txt"), (@[ @5, @4, @3 ]));
+        XCTAssertEqualObjects(indexesMatchingGlob(@"b/?.png"), (@[ @2 ]));
+        XCTAssertEqualObjects(indexesMatchingGlob(@"[ah].txt*"), (@[ @0, @1, @7 ]));
+        XCTAssertEqualObjects(indexesMatchingGlob(@"[!ah].txt"), (@[]));
+
+        XCTAssertTrue([unzipper closeAndReturnError:&error], @"%@", error);
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+}
+
+- (void)testCompressionZip64EndOfCentralDirectory
+{
+    NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Zip64EOCD.zip"];
+    const NSUInteger entryCount = 70000; // more than the 16-bit EOCD record count can hold
+    NSError *error = nil;
+
+    NOZZipper *zipper = [[NOZZipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([zipper openWithMode:NOZZipperModeCreate error:&error], @"%@", error);
+    for (NSUInteger i = 0; i < entryCount; i++) {
+        NSData *data = [[NSString stringWithFormat:@"%tu", i] dataUsingEncoding:NSUTF8StringEncoding];
+        NOZDataZipEntry *entry = [[NOZDataZipEntry alloc] initWithData:data name:[NSString stringWithFormat:@"%tu.txt", i]];
+        entry.compressionMethod = NOZCompressionMethodNone;
+        if (![zipper addEntry:entry progressBlock:NULL error:&error]) {
+            XCTFail(@"%@", error);
+            break;
+        }
+    }
+    XCTAssertTrue([zipper closeAndReturnError:&error], @"%@", error);
+
+    // Validate the trailing records: Zip64 EOCD record, Zip64 EOCD locator, then the saturated EOCD record
+    NSData *zipData = [NSData dataWithContentsOfFile:zipFilePath];
+    XCTAssertGreaterThan(zipData.length, (NSUInteger)(56 + 20 + 22));
+    if (zipData.length > (56 + 20 + 22)) {
+        const Byte *bytes = zipData.bytes;
+        const Byte *eocd = bytes + zipData.length - 22;
+        const Byte *locator = eocd - 20;
+        UInt32 signature;
+        UInt16 count16;
+        UInt64 value64;
+
+        memcpy(&signature, eocd, sizeof(signature));
+        XCTAssertEqual(CFSwapInt32LittleToHost(signature), (UInt32)0x06054b50);
+        memcpy(&count16, eocd + 8, sizeof(count16));
+        XCTAssertEqual(CFSwapInt16LittleToHost(count16), (UInt16)0xFFFF);
+        memcpy(&count16, eocd + 10, sizeof(count16));
+        XCTAssertEqual(CFSwapInt16LittleToHost(count16), (UInt16)0xFFFF);
+
+        memcpy(&signature, locator, sizeof(signature));
+        XCTAssertEqual(CFSwapInt32LittleToHost(signature), (UInt32)0x07064b50);
+        memcpy(&value64, locator + 8, sizeof(value64));
+        const UInt64 zip64RecordOffset = CFSwapInt64LittleToHost(value64);
+        XCTAssertEqual(zip64RecordOffset, (UInt64)(locator - bytes - 56));
+
+        if (zip64RecordOffset + 56 <= zipData.length) {
+            const Byte *zip64Record = bytes + zip64RecordOffset;
+            memcpy(&signature, zip64Record, sizeof(signature));
+            XCTAssertEqual(CFSwapInt32LittleToHost(signature), (UInt32)0x06064b50);
+            memcpy(&value64, zip64Record + 24, sizeof(value64));
+            XCTAssertEqual(CFSwapInt64LittleToHost(value64), (UInt64)entryCount);
+            memcpy(&value64, zip64Record + 32, sizeof(value64));
+            XCTAssertEqual(CFSwapInt64LittleToHost(value64), (UInt64)entryCount);
+        }
+    }
+
+    NOZUnzipper *unzipper = [[NOZUnzipper alloc] initWithZipFile:zipFilePath];
+    XCTAssertTrue([unzipper openAndReturnError:&error], @"%@", error);
+    NOZCentralDirectory *centralDirectory = [unzipper readCentralDirectoryAndReturnError:&error];
+    XCTAssertNotNil(centralDirectory, @"%@", error);
+    XCTAssertEqual(centralDirectory.recordCount, entryCount);
+    for (NSUInteger i = 0; i < entryCount; i += (entryCount - 1)) {
+        NOZCentralDirectoryRecord *record = [unzipper readRecordAtIndex:i error:&error];
+        XCTAssertNotNil(record, @"%@", error);
+        XCTAssertEqualObjects(record.name, ([NSString stringWithFormat:@"%tu.txt", i]));
+        NSData *unzippedData = [unzipper readDataFromRecord:record progressBlock:NULL error:&error];
+        XCTAssertEqualObjects(unzippedData, [[NSString stringWithFormat:@"%tu", i] dataUsingEncoding:NSUTF8StringEncoding], @"%@", error);
+    }
+    XCTAssertTrue([unzipper closeAndReturnError:&error], @"%@", error);
+
+    [[NSFileManager defaultManager] removeItemAtPath:zipFilePath error:NULL];
+}
+
 - (void)testCompressionInvalid
 {
     NSString *zipFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Aesop.zip"];